@@ -0,0 +1,502 @@
+/*
+File: asset-cache.cpp
+Description: Implements the content addressed cache CScratch shares costume pixels and textures through
+*/
+
+#include "scratch-render.hpp"
+#include "scratch-util.hpp"
+#include "scratch-config.hpp"
+#include <algorithm>
+#include <cstring>
+
+using namespace scratch;
+
+namespace
+{
+    // halves an image with a 2x2 box filter, weighting colors by alpha so transparent pixels don't darken the edges
+    // odd sizes round up, the last column or row is averaged with itself
+    Image downsample(Image source)
+    {
+        Image result = GenImageColor((source.width + 1) / 2, (source.height + 1) / 2, COLOR_BLANK);
+        const Color* p_source = (const Color*)source.data;
+        Color* p_result = (Color*)result.data;
+
+        for (int y = 0; y < result.height; ++y)
+        {
+            int rows[2] = {y * 2, std::min(y * 2 + 1, source.height - 1)};
+            for (int x = 0; x < result.width; ++x)
+            {
+                int columns[2] = {x * 2, std::min(x * 2 + 1, source.width - 1)};
+                unsigned int sums[4] = {};
+                for (int row : rows)
+                {
+                    for (int column : columns)
+                    {
+                        const Color& pixel = p_source[row * source.width + column];
+                        sums[0] += pixel.r * pixel.a;
+                        sums[1] += pixel.g * pixel.a;
+                        sums[2] += pixel.b * pixel.a;
+                        sums[3] += pixel.a;
+                    }
+                }
+                if (sums[3] > 0)
+                {
+                    p_result[y * result.width + x] = Color{(unsigned char)((sums[0] + sums[3] / 2) / sums[3]), (unsigned char)((sums[1] + sums[3] / 2) / sums[3]),
+                        (unsigned char)((sums[2] + sums[3] / 2) / sums[3]), (unsigned char)((sums[3] + 2) / 4)};
+                }
+            }
+        }
+        return result;
+    }
+}
+
+// costume asset
+costume_asset::costume_asset(Image image)
+{
+    m_hash = 0;
+    m_image = image;
+    m_mask_words_per_row = 0;
+    m_texture = {};
+    m_source_rect = {0.0f, 0.0f, 0.0f, 0.0f};
+    m_owns_texture = false;
+    m_references = 0;
+    m_last_drawn_frame = 0;
+    if (m_image.data != nullptr)
+    {
+        ImageFormat(&m_image, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+        m_source_rect = {0.0f, 0.0f, (float)m_image.width, (float)m_image.height};
+        build_mask();
+    }
+}
+
+costume_asset::~costume_asset()
+{
+    unload_texture();
+    if (m_image.data != nullptr)
+    {
+        UnloadImage(m_image);
+    }
+}
+
+// images go into the atlas when there is one and they fit, otherwise they get a texture of their own
+bool costume_asset::upload(costume_atlas* p_atlas)
+{
+    if (m_texture.id != 0)
+    {
+        return true;
+    }
+    if (m_image.data == nullptr || !IsWindowReady()) // headless costumes are never uploaded, there is no GPU context to upload to
+    {
+        return false;
+    }
+    if (p_atlas != nullptr && p_atlas->pack(m_image, m_texture, m_source_rect))
+    {
+        m_owns_texture = false;
+        return true;
+    }
+    m_texture = LoadTextureFromImage(m_image);
+    m_source_rect = {0.0f, 0.0f, (float)m_image.width, (float)m_image.height};
+    m_owns_texture = true;
+    return m_texture.id != 0;
+}
+
+// levels are only ever drawn small, so they nearly always fit in the atlas
+bool costume_asset::upload_level(unsigned int level, costume_atlas* p_atlas)
+{
+    costume_level* p_level = nullptr;
+    Image image = {};
+
+    if (level == 0)
+    {
+        return upload(p_atlas);
+    }
+    if (level > get_level_count() || !IsWindowReady())
+    {
+        return false;
+    }
+    if (m_levels.size() < level)
+    {
+        m_levels.resize(level, costume_level{});
+    }
+    p_level = &m_levels[level - 1];
+    if (p_level->texture.id != 0)
+    {
+        return true;
+    }
+
+    image = downsample(m_image);
+    for (unsigned int i = 1; i < level; ++i)
+    {
+        Image smaller = downsample(image);
+        UnloadImage(image);
+        image = smaller;
+    }
+    if (p_atlas != nullptr && p_atlas->pack(image, p_level->texture, p_level->source_rect))
+    {
+        p_level->owns_texture = false;
+    }
+    else
+    {
+        p_level->texture = LoadTextureFromImage(image);
+        p_level->source_rect = {0.0f, 0.0f, (float)image.width, (float)image.height};
+        p_level->owns_texture = true;
+    }
+    UnloadImage(image);
+    return p_level->texture.id != 0;
+}
+
+unsigned int costume_asset::get_level_count()
+{
+    unsigned int count = 0;
+    int longest_side = std::max(m_image.width, m_image.height);
+
+    if (m_image.data == nullptr)
+    {
+        return 0;
+    }
+    while (count < COSTUME_MAX_LEVELS && (longest_side + 1) / 2 >= COSTUME_LEVEL_MIN_SIZE)
+    {
+        longest_side = (longest_side + 1) / 2;
+        ++count;
+    }
+    return count;
+}
+
+void costume_asset::unload_texture()
+{
+    for (costume_level& level : m_levels)
+    {
+        if (level.owns_texture && level.texture.id != 0)
+        {
+            UnloadTexture(level.texture);
+            level = costume_level{};
+        }
+    }
+    if (!m_owns_texture || m_texture.id == 0)
+    {
+        return;
+    }
+    UnloadTexture(m_texture);
+    m_texture = {};
+    m_owns_texture = false;
+}
+
+size_t costume_asset::get_texture_bytes()
+{
+    size_t bytes = 0;
+
+    for (costume_level& level : m_levels)
+    {
+        if (level.owns_texture && level.texture.id != 0)
+        {
+            bytes += (size_t)level.texture.width * level.texture.height * 4;
+        }
+    }
+    if (m_owns_texture && m_texture.id != 0)
+    {
+        bytes += (size_t)m_texture.width * m_texture.height * 4;
+    }
+    return bytes;
+}
+
+// packs the alpha channel into one bit per pixel so collision checks can test 64 pixels per instruction
+// bits past the image width stay 0, queries rely on that to read whole words without masking the row end
+void costume_asset::build_mask()
+{
+    const Color* p_pixels = (const Color*)m_image.data;
+
+    if (m_image.width <= 0 || m_image.height <= 0)
+    {
+        return;
+    }
+    m_mask_words_per_row = (m_image.width + 63) / 64;
+    m_mask.assign((size_t)m_mask_words_per_row * m_image.height, 0);
+    for (int y = 0; y < m_image.height; ++y)
+    {
+        unsigned long long* p_row = m_mask.data() + (size_t)y * m_mask_words_per_row;
+        for (int x = 0; x < m_image.width; ++x)
+        {
+            if (p_pixels[y * m_image.width + x].a != 0)
+            {
+                p_row[x >> 6] |= 1ULL << (x & 63);
+            }
+        }
+    }
+}
+
+// asset cache
+asset_cache::asset_cache(costume_atlas* p_atlas)
+{
+    mp_atlas = p_atlas;
+    m_frame = 0;
+    m_budget_bytes = ASSET_DEFAULT_TEXTURE_BUDGET;
+    m_upload_budget_bytes = ASSET_DEFAULT_UPLOAD_BUDGET;
+    m_frame_upload_bytes = 0;
+    m_resident_bytes = 0;
+    m_hits = 0;
+    m_misses = 0;
+    m_uploads = 0;
+    m_level_uploads = 0;
+    m_evictions = 0;
+    m_deferred_uploads = 0;
+}
+
+asset_cache::~asset_cache()
+{
+    for (std::pair<const unsigned long long, costume_asset*>& entry : m_assets)
+    {
+        delete entry.second;
+    }
+    for (costume_asset* p_asset : m_collided)
+    {
+        delete p_asset;
+    }
+}
+
+// the hash covers the size and every pixel, a matching hash is still checked byte for byte before pixels are shared
+// an image that collides with a different cached image just gets an uncached asset of its own
+costume_asset* asset_cache::acquire(Image image)
+{
+    costume_asset* p_asset = nullptr;
+    unsigned long long hash = 0;
+    size_t size = 0;
+    int dimensions[2] = {};
+    std::unordered_map<unsigned long long, costume_asset*>::iterator found;
+
+    if (image.data != nullptr)
+    {
+        ImageFormat(&image, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+        size = (size_t)image.width * image.height * 4;
+        dimensions[0] = image.width;
+        dimensions[1] = image.height;
+        hash = scratch_util::fnv1a_64(dimensions, sizeof(dimensions)) ^ scratch_util::fnv1a_64(image.data, size);
+        hash = hash == 0 ? 1 : hash; // 0 marks uncached assets
+        found = m_assets.find(hash);
+        if (found != m_assets.end())
+        {
+            p_asset = found->second;
+            if (p_asset->m_image.width == image.width && p_asset->m_image.height == image.height && memcmp(p_asset->m_image.data, image.data, size) == 0)
+            {
+                ++m_hits;
+                ++p_asset->m_references;
+                UnloadImage(image);
+                return p_asset;
+            }
+            // hash collision, this one stays out of the table. its texture still counts against the budget, so it is kept in
+            // m_collided where evict and get_stats see it too
+            ++m_misses;
+            p_asset = new costume_asset(image);
+            p_asset->m_references = 1;
+            m_collided.push_back(p_asset);
+            return p_asset;
+        }
+    }
+
+    ++m_misses;
+    p_asset = new costume_asset(image);
+    p_asset->m_references = 1;
+    if (image.data != nullptr)
+    {
+        p_asset->m_hash = hash;
+        m_assets[hash] = p_asset;
+    }
+    return p_asset;
+}
+
+// assets are freed as soon as no costume uses them anymore
+void asset_cache::release(costume_asset* p_asset)
+{
+    if (p_asset == nullptr || --p_asset->m_references > 0)
+    {
+        return;
+    }
+    m_resident_bytes -= p_asset->get_texture_bytes();
+    if (p_asset->m_hash != 0)
+    {
+        m_assets.erase(p_asset->m_hash);
+    }
+    else
+    {
+        m_collided.erase(std::remove(m_collided.begin(), m_collided.end(), p_asset), m_collided.end());
+    }
+    delete p_asset;
+}
+
+// making room before uploading, textures drawn this frame are never evicted so a frame can go over budget if it really needs to
+// once a frame has uploaded its share of pixels the rest get an empty texture back and are skipped until a later frame has room
+Texture2D asset_cache::get_texture(costume_asset* p_asset, bool forced)
+{
+    size_t bytes = 0;
+    size_t image_bytes = (size_t)p_asset->m_image.width * p_asset->m_image.height * 4;
+
+    p_asset->m_last_drawn_frame = m_frame;
+    if (p_asset->m_texture.id != 0)
+    {
+        return p_asset->m_texture;
+    }
+    if (!reserve_upload(image_bytes, forced))
+    {
+        return Texture2D{};
+    }
+    if (mp_atlas == nullptr || p_asset->m_image.width > ATLAS_MAX_ENTRY_SIZE || p_asset->m_image.height > ATLAS_MAX_ENTRY_SIZE) // atlas entries don't count against the budget
+    {
+        evict(image_bytes);
+    }
+    bytes = p_asset->get_texture_bytes();
+    if (p_asset->upload(mp_atlas))
+    {
+        ++m_uploads;
+        m_frame_upload_bytes += image_bytes;
+        m_resident_bytes += p_asset->get_texture_bytes() - bytes;
+    }
+    return p_asset->m_texture;
+}
+
+// levels live and die with the rest of the asset's textures, so a costume nobody draws anymore loses all of them at once
+// while its level is waiting for upload budget the closest finer level already on the GPU is drawn instead
+Texture2D asset_cache::get_texture(costume_asset* p_asset, unsigned int level, Rectangle& source_rect, bool forced)
+{
+    costume_level* p_level = nullptr;
+    size_t bytes = 0;
+    int level_width = p_asset->m_image.width;
+    int level_height = p_asset->m_image.height;
+
+    level = std::min(level, p_asset->get_level_count());
+    if (level == 0)
+    {
+        source_rect = p_asset->m_source_rect;
+        return get_texture(p_asset, forced);
+    }
+    p_asset->m_last_drawn_frame = m_frame;
+    if (p_asset->m_levels.size() >= level && p_asset->m_levels[level - 1].texture.id != 0)
+    {
+        p_level = &p_asset->m_levels[level - 1];
+        source_rect = p_level->source_rect;
+        return p_level->texture;
+    }
+
+    for (unsigned int i = 0; i < level; ++i)
+    {
+        level_width = (level_width + 1) / 2;
+        level_height = (level_height + 1) / 2;
+    }
+    if (!reserve_upload((size_t)level_width * level_height * 4, forced))
+    {
+        for (unsigned int finer = std::min(level - 1, (unsigned int)p_asset->m_levels.size()); finer > 0; --finer)
+        {
+            if (p_asset->m_levels[finer - 1].texture.id != 0)
+            {
+                source_rect = p_asset->m_levels[finer - 1].source_rect;
+                return p_asset->m_levels[finer - 1].texture;
+            }
+        }
+        source_rect = p_asset->m_source_rect;
+        return p_asset->m_texture;
+    }
+    if (mp_atlas == nullptr || level_width > ATLAS_MAX_ENTRY_SIZE || level_height > ATLAS_MAX_ENTRY_SIZE)
+    {
+        evict((size_t)level_width * level_height * 4);
+    }
+    bytes = p_asset->get_texture_bytes();
+    if (!p_asset->upload_level(level, mp_atlas))
+    {
+        source_rect = p_asset->m_source_rect;
+        return Texture2D{};
+    }
+    ++m_uploads;
+    ++m_level_uploads;
+    m_frame_upload_bytes += (size_t)level_width * level_height * 4;
+    m_resident_bytes += p_asset->get_texture_bytes() - bytes;
+    p_level = &p_asset->m_levels[level - 1];
+    source_rect = p_level->source_rect;
+    return p_level->texture;
+}
+
+void asset_cache::begin_frame()
+{
+    ++m_frame;
+    m_frame_upload_bytes = 0;
+}
+
+void asset_cache::set_texture_budget(size_t budget_bytes)
+{
+    m_budget_bytes = budget_bytes;
+    evict(0);
+}
+
+// 0 uploads everything the moment it is first drawn
+void asset_cache::set_upload_budget(size_t bytes_per_frame)
+{
+    m_upload_budget_bytes = bytes_per_frame;
+}
+
+asset_cache_stats asset_cache::get_stats()
+{
+    asset_cache_stats stats = {};
+
+    stats.assets = m_assets.size() + m_collided.size();
+    stats.hits = m_hits;
+    stats.misses = m_misses;
+    stats.uploads = m_uploads;
+    stats.level_uploads = m_level_uploads;
+    stats.evictions = m_evictions;
+    stats.deferred_uploads = m_deferred_uploads;
+    stats.resident_bytes = m_resident_bytes;
+    stats.budget_bytes = m_budget_bytes;
+    for (std::pair<const unsigned long long, costume_asset*>& entry : m_assets)
+    {
+        stats.resident_textures += entry.second->get_texture_bytes() > 0 ? 1 : 0;
+    }
+    for (costume_asset* p_asset : m_collided)
+    {
+        stats.resident_textures += p_asset->get_texture_bytes() > 0 ? 1 : 0;
+    }
+    return stats;
+}
+
+// unloads the least recently drawn textures of their own until needed_bytes more fit in the budget
+// evicted assets keep their pixels, they are simply uploaded again the next time they are drawn
+void asset_cache::evict(size_t needed_bytes)
+{
+    costume_asset* p_oldest = nullptr;
+
+    while (m_resident_bytes + needed_bytes > m_budget_bytes && m_resident_bytes > 0)
+    {
+        p_oldest = nullptr;
+        for (std::pair<const unsigned long long, costume_asset*>& entry : m_assets)
+        {
+            pick_oldest(entry.second, p_oldest);
+        }
+        for (costume_asset* p_asset : m_collided)
+        {
+            pick_oldest(p_asset, p_oldest);
+        }
+        if (p_oldest == nullptr) // everything resident was drawn this frame
+        {
+            return;
+        }
+        m_resident_bytes -= p_oldest->get_texture_bytes();
+        p_oldest->unload_texture();
+        ++m_evictions;
+    }
+}
+
+// textures drawn this frame are never candidates
+void asset_cache::pick_oldest(costume_asset* p_asset, costume_asset*& p_oldest)
+{
+    if (p_asset->get_texture_bytes() > 0 && p_asset->m_last_drawn_frame < m_frame && (p_oldest == nullptr || p_asset->m_last_drawn_frame < p_oldest->m_last_drawn_frame))
+    {
+        p_oldest = p_asset;
+    }
+}
+
+// the first upload of a frame always goes through so huge images can't starve
+bool asset_cache::reserve_upload(size_t image_bytes, bool forced)
+{
+    if (!forced && m_upload_budget_bytes > 0 && m_frame_upload_bytes > 0 && m_frame_upload_bytes + image_bytes > m_upload_budget_bytes)
+    {
+        ++m_deferred_uploads;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,87 @@
+/*
+File: costume-atlas.cpp
+Description: Implements the texture atlas that CScratch packs costume images into
+*/
+
+#include "scratch-render.hpp"
+#include "scratch-config.hpp"
+#include <algorithm>
+
+using namespace scratch;
+
+costume_atlas::costume_atlas()
+{
+}
+
+costume_atlas::~costume_atlas()
+{
+    for (atlas_page& page : m_pages)
+    {
+        UnloadTexture(page.texture);
+    }
+}
+
+// copies image into an atlas page, returning the page texture and the rectangle the image was placed at
+// pages are filled shelf by shelf (left to right, then a new shelf below the tallest image of the previous one)
+// returns false if the image cannot go into the atlas (too big, no GPU to upload to) and the caller should give it a texture of its own
+bool costume_atlas::pack(Image image, Texture2D& page_texture, Rectangle& source_rect)
+{
+    atlas_page* p_page = nullptr;
+    int padded_width = image.width + ATLAS_PADDING * 2;
+    int padded_height = image.height + ATLAS_PADDING * 2;
+
+    if (image.data == nullptr || image.format != PIXELFORMAT_UNCOMPRESSED_R8G8B8A8 || !IsWindowReady())
+    {
+        return false;
+    }
+    if (image.width > ATLAS_MAX_ENTRY_SIZE || image.height > ATLAS_MAX_ENTRY_SIZE)
+    {
+        return false;
+    }
+
+    // only the newest page is ever written to, older pages are considered full
+    if (!m_pages.empty())
+    {
+        p_page = &m_pages.back();
+        if (p_page->shelf_x + padded_width > ATLAS_PAGE_SIZE) // start a new shelf
+        {
+            p_page->shelf_x = 0;
+            p_page->shelf_y += p_page->shelf_height;
+            p_page->shelf_height = 0;
+        }
+        if (p_page->shelf_y + padded_height > ATLAS_PAGE_SIZE) // page is full
+        {
+            p_page = nullptr;
+        }
+    }
+    if (p_page == nullptr)
+    {
+        Image blank_page = GenImageColor(ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE, COLOR_BLANK);
+        atlas_page page = {};
+
+        page.texture = LoadTextureFromImage(blank_page);
+        UnloadImage(blank_page);
+        if (page.texture.id == 0)
+        {
+            return false;
+        }
+        m_pages.push_back(page);
+        p_page = &m_pages.back();
+    }
+
+    source_rect.x = (float)(p_page->shelf_x + ATLAS_PADDING);
+    source_rect.y = (float)(p_page->shelf_y + ATLAS_PADDING);
+    source_rect.width = (float)image.width;
+    source_rect.height = (float)image.height;
+    UpdateTextureRec(p_page->texture, source_rect, image.data);
+
+    p_page->shelf_x += padded_width;
+    p_page->shelf_height = std::max(p_page->shelf_height, padded_height);
+    page_texture = p_page->texture;
+    return true;
+}
+
+unsigned int costume_atlas::get_page_count()
+{
+    return m_pages.size();
+}
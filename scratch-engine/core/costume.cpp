@@ -4,6 +4,8 @@ Description: Implements the code for CScratch costumes
 */
 
 #include "scratch-render.hpp"
+#include <algorithm>
+#include <cmath>
 
 using namespace scratch;
 
@@ -12,15 +14,56 @@ costume::costume(std::wstring costume_name, Texture2D texture, double rotation_c
 {
     m_costume_name = costume_name;
     m_texture = texture;
+    mp_asset = nullptr;
+    mp_cache = nullptr;
     m_rotation_center_x = rotation_center_x;
     m_rotation_center_y = rotation_center_y;
     m_width = std::max(width, 1.0);
     m_height = std::max(height, 1.0);
 }
 
+// initializes a costume from CPU side pixels. image BECOMES OWNED BY THE COSTUME OBJECT just like the texture in the constructor above
+// the pixels are kept around so that the software rasterizer can draw the costume, a texture is only uploaded once the costume is first drawn
+// if p_cache is given, costumes showing identical images share one copy of the pixels and one texture. the cache must outlive the costume
+costume::costume(std::wstring costume_name, Image image, double rotation_center_x, double rotation_center_y, double width, double height, asset_cache* p_cache)
+{
+    m_costume_name = costume_name;
+    m_texture = {};
+    mp_cache = p_cache;
+    m_rotation_center_x = rotation_center_x;
+    m_rotation_center_y = rotation_center_y;
+    m_width = std::max(width, 1.0);
+    m_height = std::max(height, 1.0);
+
+    if (mp_cache != nullptr)
+    {
+        mp_asset = mp_cache->acquire(image);
+    }
+    else
+    {
+        mp_asset = new costume_asset(image);
+        mp_asset->m_references = 1;
+    }
+}
+
 costume::~costume()
 {
-    UnloadTexture(m_texture);
+    if (mp_asset == nullptr)
+    {
+        if (m_texture.id != 0)
+        {
+            UnloadTexture(m_texture);
+        }
+        return;
+    }
+    if (mp_cache != nullptr)
+    {
+        mp_cache->release(mp_asset);
+    }
+    else
+    {
+        delete mp_asset;
+    }
 }
 
 std::wstring costume::get_costume_name()
@@ -29,9 +72,78 @@ std::wstring costume::get_costume_name()
 }
 
 // please do not write to the pointer, only read from it
-Texture2D costume::get_texture()
+Texture2D costume::get_texture(bool forced)
+{
+    if (mp_asset == nullptr)
+    {
+        return m_texture;
+    }
+    if (mp_cache != nullptr)
+    {
+        return mp_cache->get_texture(mp_asset, forced);
+    }
+    if (mp_asset->m_texture.id == 0)
+    {
+        mp_asset->upload(nullptr);
+    }
+    return mp_asset->m_texture;
+}
+
+// drawing a big costume small with the full image aliases badly and wastes bandwidth, so every halving of the texels that land on one
+// pixel drops a level. scale is render plane pixels per costume pixel, the sprite's size times how much the stage texture is stretched
+Texture2D costume::get_texture(double scale, Rectangle& source_rect, bool forced)
+{
+    unsigned int level = 0;
+    double texels_per_pixel = 0.0;
+
+    source_rect = get_source_rect();
+    if (mp_asset == nullptr || scale <= 0.0 || m_width <= 0.0 || m_height <= 0.0)
+    {
+        return get_texture(forced);
+    }
+    texels_per_pixel = std::max(source_rect.width / m_width, source_rect.height / m_height) / scale;
+    if (texels_per_pixel >= 2.0)
+    {
+        level = std::min((unsigned int)std::log2(texels_per_pixel), mp_asset->get_level_count());
+    }
+    if (level == 0)
+    {
+        return get_texture(forced);
+    }
+    if (mp_cache != nullptr)
+    {
+        return mp_cache->get_texture(mp_asset, level, source_rect, forced);
+    }
+    if (!mp_asset->upload_level(level, nullptr))
+    {
+        return get_texture(forced);
+    }
+    source_rect = mp_asset->m_levels[level - 1].source_rect;
+    return mp_asset->m_levels[level - 1].texture;
+}
+
+// area of get_texture() holding this costume, in texels. images saved at a higher resolution than the costume (bitmapResolution 2 in
+// projects) cover more texels than the costume is wide, the whole image is stretched over the costume rectangle
+Rectangle costume::get_source_rect()
+{
+    Rectangle source_rect = {0.0f, 0.0f, (float)m_width, (float)m_height};
+
+    if (mp_asset == nullptr)
+    {
+        return source_rect;
+    }
+    return mp_asset->m_source_rect;
+}
+
+bool costume::has_image()
+{
+    return mp_asset != nullptr && mp_asset->m_image.data != nullptr;
+}
+
+// same deal as get_texture, the pixel data is owned by the costume (or the cache it came from)
+Image costume::get_image()
 {
-    return m_texture;
+    return mp_asset != nullptr ? mp_asset->m_image : Image{};
 }
 
 double costume::get_rotation_center_x()
@@ -52,4 +164,24 @@ double costume::get_width()
 double costume::get_height()
 {
     return m_height;
-}
\ No newline at end of file
+}
+
+bool costume::has_mask()
+{
+    return mp_asset != nullptr && !mp_asset->m_mask.empty();
+}
+
+const unsigned long long* costume::get_mask_row(int y)
+{
+    return mp_asset->m_mask.data() + (size_t)y * mp_asset->m_mask_words_per_row;
+}
+
+int costume::get_mask_width()
+{
+    return has_mask() ? mp_asset->m_image.width : 0;
+}
+
+int costume::get_mask_height()
+{
+    return has_mask() ? mp_asset->m_image.height : 0;
+}
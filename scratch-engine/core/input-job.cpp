@@ -10,36 +10,62 @@ Description: Implements the code for handling input into CScratch
 using namespace scratch;
 using namespace scratch_util;
 
-input_job::input_job(input_state* p_key_pressed)
+input_job::input_job(input_source* p_source, input_tracker* p_input)
 {
-    mp_key_pressed = p_key_pressed;
+    mp_source = p_source;
+    mp_input = p_input;
+    m_run_count = 0;
 }
+
+input_job::~input_job()
+{
+    delete mp_source;
+}
+
+// the tracker only sees what changed, so a frame without input costs nothing no matter how many keys there are
 job_status input_job::run()
 {
-    if (mp_key_pressed == nullptr)
+    if (mp_source == nullptr || mp_input == nullptr)
     {
         return job_status::error;
     }
-    if (WindowShouldClose())
+    if (mp_source->should_close())
     {
         return job_status::signal_engine_terminate;
     }
 
-    // marking keys as no longer being freshly pressed so that the event scheduler doesn't create duplicate threads for the keys
-    for (int i = 0; i < SCRATCHK_MAX_KEYCODE; ++i)
+    ++m_run_count;
+    m_events.clear();
+    mp_source->collect(m_events);
+    for (const input_event& event : m_events)
     {
-        if (IsKeyPressedRepeat(i))
-        {
-            mp_key_pressed[i] = input_state::fresh_pressed;
-        }
-        else if (IsKeyPressed(i))
-        {
-            mp_key_pressed[i] = input_state::pressed;
-        }
-        else
-        {
-            mp_key_pressed[i] = input_state::unpressed;
-        }
+        mp_input->apply(event);
     }
     return job_status::ok;
-}
\ No newline at end of file
+}
+
+// the old source is deleted, the new one becomes property of the job
+void input_job::set_source(input_source* p_source)
+{
+    if (p_source == nullptr || p_source == mp_source)
+    {
+        return;
+    }
+    delete mp_source;
+    mp_source = p_source;
+}
+
+const std::vector<input_event>& input_job::get_events()
+{
+    return m_events;
+}
+
+unsigned long long input_job::get_run_count()
+{
+    return m_run_count;
+}
+
+const char* input_job::get_name()
+{
+    return "input_job";
+}
@@ -0,0 +1,92 @@
+/*
+File: input-source.cpp
+Description: Implements the sources of keyboard and mouse events CScratch can be fed from
+*/
+
+#include "scratch-input.hpp"
+#include <algorithm>
+#include <cmath>
+
+using namespace scratch;
+
+window_input_source::window_input_source()
+{
+    m_mouse_x = 0.0;
+    m_mouse_y = 0.0;
+}
+
+// new presses come off raylib's key queue, only the keys already held are checked for repeats and releases
+// the mouse is mapped back through the letterbox render_job draws the stage with, then clamped and rounded to whole stage units like Scratch does
+void window_input_source::collect(std::vector<input_event>& events)
+{
+    Vector2 mouse = GetMousePosition();
+    double screen_width = (double)GetScreenWidth();
+    double screen_height = (double)GetScreenHeight();
+    double scale = std::min(screen_width / STAGE_SIZE_X_FLOAT, screen_height / STAGE_SIZE_Y_FLOAT);
+    double mouse_x = 0.0;
+    double mouse_y = 0.0;
+    int keycode = 0;
+
+    for (unsigned int i = 0; i < m_held_keys.size();)
+    {
+        keycode = m_held_keys[i];
+        if (!IsKeyDown(keycode))
+        {
+            events.push_back(input_event{input_event_type::key_up, keycode, 0.0, 0.0});
+            m_held_keys[i] = m_held_keys.back();
+            m_held_keys.pop_back();
+            continue;
+        }
+        if (IsKeyPressedRepeat(keycode))
+        {
+            events.push_back(input_event{input_event_type::key_down, keycode, 0.0, 0.0});
+        }
+        ++i;
+    }
+    for (keycode = GetKeyPressed(); keycode != 0; keycode = GetKeyPressed())
+    {
+        if (std::find(m_held_keys.begin(), m_held_keys.end(), keycode) == m_held_keys.end())
+        {
+            m_held_keys.push_back(keycode);
+        }
+        events.push_back(input_event{input_event_type::key_down, keycode, 0.0, 0.0});
+    }
+
+    if (scale > 0.0)
+    {
+        mouse_x = (mouse.x - (screen_width - STAGE_SIZE_X_FLOAT * scale) / 2.0) / scale + STAGE_MIN_X_FLOAT;
+        mouse_y = STAGE_MAX_Y_FLOAT - (mouse.y - (screen_height - STAGE_SIZE_Y_FLOAT * scale) / 2.0) / scale;
+        mouse_x = floor(std::min(std::max(mouse_x, STAGE_MIN_X_FLOAT), STAGE_MAX_X_FLOAT) + 0.5);
+        mouse_y = floor(std::min(std::max(mouse_y, STAGE_MIN_Y_FLOAT), STAGE_MAX_Y_FLOAT) + 0.5);
+    }
+    if (mouse_x != m_mouse_x || mouse_y != m_mouse_y)
+    {
+        m_mouse_x = mouse_x;
+        m_mouse_y = mouse_y;
+        events.push_back(input_event{input_event_type::mouse_move, 0, mouse_x, mouse_y});
+    }
+    if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT))
+    {
+        events.push_back(input_event{input_event_type::mouse_down, 0, mouse_x, mouse_y});
+    }
+    if (IsMouseButtonReleased(MOUSE_BUTTON_LEFT))
+    {
+        events.push_back(input_event{input_event_type::mouse_up, 0, mouse_x, mouse_y});
+    }
+}
+
+bool window_input_source::should_close()
+{
+    return WindowShouldClose();
+}
+
+void queued_input_source::push(const input_event& event)
+{
+    m_queue.push_back(event);
+}
+
+void queued_input_source::collect(std::vector<input_event>& events)
+{
+    events.insert(events.end(), m_queue.begin(), m_queue.end());
+    m_queue.clear();
+}
@@ -0,0 +1,283 @@
+/*
+File: input-trace.cpp
+Description: Implements the compact binary format CScratch records input sessions in
+*/
+
+#include "scratch-input.hpp"
+#include "scratch-util.hpp"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+using namespace scratch;
+
+// file layout: INPUT_TRACE_MAGIC, one version byte, the seed as 8 little endian bytes, then the frames until the end of the file
+// numbers are LEB128 varints, signed ones zigzag encoded first. a frame is its tick count followed by the scheduler passes of each
+// tick, then its event count followed by the events: a type byte, then the keycode for key events or the change in mouse position
+// for mouse events. the window reports whole stage units like Scratch, so moves between whole positions are stored as that change
+// and an idle frame takes 3 bytes. any other position (from a queued source, say) sets INPUT_TRACE_EXACT_POSITION on the type byte
+// and follows as the bits of two little endian doubles, so every session replays exactly
+namespace
+{
+    bool is_whole(double value) // and small enough that the change from another whole position fits a long long
+    {
+        return value == floor(value) && fabs(value) < 4503599627370496.0; // 2^52
+    }
+
+    unsigned long long zigzag(long long value)
+    {
+        return ((unsigned long long)value << 1) ^ (unsigned long long)(value >> 63);
+    }
+
+    long long unzigzag(unsigned long long value)
+    {
+        return (long long)(value >> 1) ^ -(long long)(value & 1);
+    }
+}
+
+input_trace::input_trace()
+{
+    clear(1);
+}
+
+void input_trace::clear(unsigned long long seed)
+{
+    m_data.clear();
+    m_seed = seed;
+    m_frame_count = 0;
+    m_write_mouse_x = m_write_mouse_y = 0.0;
+    rewind();
+}
+
+void input_trace::add_frame(const std::vector<input_event>& events, const std::vector<unsigned int>& tick_passes)
+{
+    unsigned long long bits = 0;
+
+    write_varint(tick_passes.size());
+    for (unsigned int passes : tick_passes)
+    {
+        write_varint(passes);
+    }
+    write_varint(events.size());
+    for (const input_event& event : events)
+    {
+        m_data.push_back((unsigned char)event.type);
+        if (event.type == input_event_type::key_down || event.type == input_event_type::key_up)
+        {
+            write_varint(zigzag(event.key));
+            continue;
+        }
+        if (is_whole(event.x) && is_whole(event.y) && is_whole(m_write_mouse_x) && is_whole(m_write_mouse_y))
+        {
+            write_varint(zigzag((long long)event.x - (long long)m_write_mouse_x));
+            write_varint(zigzag((long long)event.y - (long long)m_write_mouse_y));
+        }
+        else
+        {
+            m_data.back() |= INPUT_TRACE_EXACT_POSITION;
+            for (double position : {event.x, event.y})
+            {
+                memcpy(&bits, &position, sizeof(bits));
+                for (int i = 0; i < 8; ++i)
+                {
+                    m_data.push_back((unsigned char)(bits >> (i * 8)));
+                }
+            }
+        }
+        m_write_mouse_x = event.x;
+        m_write_mouse_y = event.y;
+    }
+    ++m_frame_count;
+}
+
+bool input_trace::save(const char* p_path)
+{
+    FILE* p_file = fopen(p_path, "wb");
+    unsigned char p_header[sizeof(INPUT_TRACE_MAGIC) - 1 + 1 + 8] = {};
+
+    if (p_file == nullptr)
+    {
+        return false;
+    }
+    memcpy(p_header, INPUT_TRACE_MAGIC, sizeof(INPUT_TRACE_MAGIC) - 1);
+    p_header[sizeof(INPUT_TRACE_MAGIC) - 1] = INPUT_TRACE_VERSION;
+    for (int i = 0; i < 8; ++i)
+    {
+        p_header[sizeof(INPUT_TRACE_MAGIC) + i] = (unsigned char)(m_seed >> (i * 8));
+    }
+    fwrite(p_header, 1, sizeof(p_header), p_file);
+    fwrite(m_data.data(), 1, m_data.size(), p_file);
+    return fclose(p_file) == 0;
+}
+
+// the frames are counted up front so a cut off file is caught here rather than halfway through a replay
+bool input_trace::load(const char* p_path)
+{
+    scratch_util::mapped_file file;
+    const unsigned char* p_data = nullptr;
+    size_t header_size = sizeof(INPUT_TRACE_MAGIC) - 1 + 1 + 8;
+    unsigned long long seed = 0;
+    std::vector<input_event> events;
+    std::vector<unsigned int> tick_passes;
+
+    if (!file.open(p_path) || file.get_size() < header_size)
+    {
+        return false;
+    }
+    p_data = file.get_data();
+    if (memcmp(p_data, INPUT_TRACE_MAGIC, sizeof(INPUT_TRACE_MAGIC) - 1) != 0 || p_data[sizeof(INPUT_TRACE_MAGIC) - 1] != INPUT_TRACE_VERSION)
+    {
+        return false;
+    }
+    for (int i = 0; i < 8; ++i)
+    {
+        seed |= (unsigned long long)p_data[sizeof(INPUT_TRACE_MAGIC) + i] << (i * 8);
+    }
+
+    clear(seed);
+    m_data.assign(p_data + header_size, p_data + file.get_size());
+    while (m_read_offset < m_data.size())
+    {
+        if (!next_frame(events, tick_passes))
+        {
+            clear(1);
+            return false;
+        }
+        ++m_frame_count;
+    }
+    rewind();
+    return true;
+}
+
+void input_trace::rewind()
+{
+    m_read_offset = 0;
+    m_read_mouse_x = m_read_mouse_y = 0.0;
+}
+
+bool input_trace::next_frame(std::vector<input_event>& events, std::vector<unsigned int>& tick_passes)
+{
+    unsigned long long count = 0;
+    unsigned long long value = 0;
+    unsigned long long bits = 0;
+    unsigned char type = 0;
+    input_event event = {};
+
+    events.clear();
+    tick_passes.clear();
+    if (m_read_offset >= m_data.size() || !read_varint(count) || count > m_data.size() - m_read_offset)
+    {
+        return false;
+    }
+    for (unsigned long long i = 0; i < count; ++i)
+    {
+        if (!read_varint(value))
+        {
+            return false;
+        }
+        tick_passes.push_back((unsigned int)value);
+    }
+    if (!read_varint(count) || count > m_data.size() - m_read_offset)
+    {
+        return false;
+    }
+    for (unsigned long long i = 0; i < count; ++i)
+    {
+        if (m_read_offset >= m_data.size())
+        {
+            return false;
+        }
+        type = m_data[m_read_offset++];
+        event = input_event{static_cast<input_event_type>(type & ~INPUT_TRACE_EXACT_POSITION), 0, 0.0, 0.0};
+        if (event.type > input_event_type::mouse_up)
+        {
+            return false;
+        }
+        if (event.type == input_event_type::key_down || event.type == input_event_type::key_up)
+        {
+            if ((type & INPUT_TRACE_EXACT_POSITION) != 0 || !read_varint(value))
+            {
+                return false;
+            }
+            event.key = (int)unzigzag(value);
+        }
+        else if ((type & INPUT_TRACE_EXACT_POSITION) != 0)
+        {
+            if (m_data.size() - m_read_offset < 16)
+            {
+                return false;
+            }
+            for (double* p_position : {&m_read_mouse_x, &m_read_mouse_y})
+            {
+                bits = 0;
+                for (int i = 0; i < 8; ++i)
+                {
+                    bits |= (unsigned long long)m_data[m_read_offset++] << (i * 8);
+                }
+                memcpy(p_position, &bits, sizeof(bits));
+            }
+            event.x = m_read_mouse_x;
+            event.y = m_read_mouse_y;
+        }
+        else
+        {
+            if (!read_varint(value))
+            {
+                return false;
+            }
+            m_read_mouse_x += (double)unzigzag(value);
+            if (!read_varint(value))
+            {
+                return false;
+            }
+            m_read_mouse_y += (double)unzigzag(value);
+            event.x = m_read_mouse_x;
+            event.y = m_read_mouse_y;
+        }
+        events.push_back(event);
+    }
+    return true;
+}
+
+unsigned long long input_trace::get_seed()
+{
+    return m_seed;
+}
+
+unsigned long long input_trace::get_frame_count()
+{
+    return m_frame_count;
+}
+
+size_t input_trace::get_size()
+{
+    return m_data.size();
+}
+
+void input_trace::write_varint(unsigned long long value)
+{
+    while (value >= 0x80)
+    {
+        m_data.push_back((unsigned char)(value | 0x80));
+        value >>= 7;
+    }
+    m_data.push_back((unsigned char)value);
+}
+
+bool input_trace::read_varint(unsigned long long& value)
+{
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        if (m_read_offset >= m_data.size())
+        {
+            return false;
+        }
+        value |= (unsigned long long)(m_data[m_read_offset] & 0x7f) << shift;
+        if ((m_data[m_read_offset++] & 0x80) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,100 @@
+/*
+File: input-tracker.cpp
+Description: Implements the keyboard and mouse state scripts read and the queue hat scripts are started from
+*/
+
+#include "scratch-input.hpp"
+#include <cstring>
+
+using namespace scratch;
+
+input_tracker::input_tracker()
+{
+    memset(mp_keys_down, 0, sizeof(mp_keys_down));
+    m_keys_down_count = 0;
+    m_mouse_x = 0.0;
+    m_mouse_y = 0.0;
+    m_mouse_down = false;
+}
+
+// presses are only queued once they made it into the state, so a key the tracker can't hold never starts a hat either
+void input_tracker::apply(const input_event& event)
+{
+    unsigned long long bit = 0;
+    unsigned long long* p_word = nullptr;
+
+    switch (event.type)
+    {
+        case input_event_type::key_down:
+        case input_event_type::key_up:
+            if (event.key < 0 || event.key >= SCRATCHK_MAX_KEYCODE)
+            {
+                return;
+            }
+            bit = 1ull << (event.key % 64);
+            p_word = &mp_keys_down[event.key / 64];
+            if (event.type == input_event_type::key_up)
+            {
+                m_keys_down_count -= (*p_word & bit) != 0;
+                *p_word &= ~bit;
+                return;
+            }
+            m_keys_down_count += (*p_word & bit) == 0;
+            *p_word |= bit;
+            m_pending.push_back(event);
+            return;
+        case input_event_type::mouse_down:
+            m_mouse_down = true;
+            m_mouse_x = event.x;
+            m_mouse_y = event.y;
+            m_pending.push_back(event);
+            return;
+        case input_event_type::mouse_up:
+            m_mouse_down = false;
+            m_mouse_x = event.x;
+            m_mouse_y = event.y;
+            return;
+        default: // input_event_type::mouse_move
+            m_mouse_x = event.x;
+            m_mouse_y = event.y;
+            return;
+    }
+}
+
+bool input_tracker::is_key_down(int keycode)
+{
+    if (keycode < 0)
+    {
+        return m_keys_down_count > 0;
+    }
+    if (keycode >= SCRATCHK_MAX_KEYCODE)
+    {
+        return false;
+    }
+    return (mp_keys_down[keycode / 64] >> (keycode % 64)) & 1;
+}
+
+double input_tracker::get_mouse_x()
+{
+    return m_mouse_x;
+}
+
+double input_tracker::get_mouse_y()
+{
+    return m_mouse_y;
+}
+
+bool input_tracker::is_mouse_down()
+{
+    return m_mouse_down;
+}
+
+const std::vector<input_event>& input_tracker::get_pending()
+{
+    return m_pending;
+}
+
+void input_tracker::clear_pending()
+{
+    m_pending.clear();
+}
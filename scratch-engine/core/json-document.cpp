@@ -0,0 +1,593 @@
+/*
+File: json-document.cpp
+Description: Implements the flat, in place JSON parser CScratch reads project.json with
+*/
+
+#include "scratch-loader.hpp"
+#include "scratch-util.hpp"
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+using namespace scratch;
+
+namespace
+{
+    int hex_digit(char c)
+    {
+        if (c >= '0' && c <= '9')
+        {
+            return c - '0';
+        }
+        if (c >= 'a' && c <= 'f')
+        {
+            return c - 'a' + 10;
+        }
+        if (c >= 'A' && c <= 'F')
+        {
+            return c - 'A' + 10;
+        }
+        return -1;
+    }
+
+    unsigned int read_hex4(const char* p_text)
+    {
+        return (hex_digit(p_text[0]) << 12) | (hex_digit(p_text[1]) << 8) | (hex_digit(p_text[2]) << 4) | hex_digit(p_text[3]);
+    }
+
+    // reads one code point of string contents, escape sequences included. the parser already checked that the escapes are well formed
+    // bad UTF-8 comes back as U+FFFD one byte at a time
+    unsigned int next_code_point(const char*& p_text, const char* p_end, bool escaped)
+    {
+        unsigned char lead = (unsigned char)*p_text++;
+        unsigned int code_point = 0;
+        unsigned int low = 0;
+        int continuation = 0;
+
+        if (escaped && lead == '\\')
+        {
+            switch (*p_text++)
+            {
+                case 'b': return '\b';
+                case 'f': return '\f';
+                case 'n': return '\n';
+                case 'r': return '\r';
+                case 't': return '\t';
+                case 'u':
+                    code_point = read_hex4(p_text);
+                    p_text += 4;
+                    if (code_point >= 0xD800 && code_point < 0xDC00 && p_end - p_text >= 6 && p_text[0] == '\\' && p_text[1] == 'u') // surrogate pair
+                    {
+                        low = read_hex4(p_text + 2);
+                        if (low >= 0xDC00 && low < 0xE000)
+                        {
+                            p_text += 6;
+                            return 0x10000 + ((code_point - 0xD800) << 10) + (low - 0xDC00);
+                        }
+                    }
+                    return code_point;
+                default:
+                    return (unsigned char)p_text[-1]; // \" \\ and \/
+            }
+        }
+
+        if (lead < 0x80)
+        {
+            return lead;
+        }
+        if ((lead & 0xE0) == 0xC0)
+        {
+            code_point = lead & 0x1F;
+            continuation = 1;
+        }
+        else if ((lead & 0xF0) == 0xE0)
+        {
+            code_point = lead & 0x0F;
+            continuation = 2;
+        }
+        else if ((lead & 0xF8) == 0xF0)
+        {
+            code_point = lead & 0x07;
+            continuation = 3;
+        }
+        else
+        {
+            return 0xFFFD;
+        }
+        if (p_end - p_text < continuation)
+        {
+            return 0xFFFD;
+        }
+        for (int i = 0; i < continuation; ++i)
+        {
+            if (((unsigned char)p_text[i] & 0xC0) != 0x80)
+            {
+                return 0xFFFD;
+            }
+            code_point = (code_point << 6) | ((unsigned char)p_text[i] & 0x3F);
+        }
+        p_text += continuation;
+        return code_point;
+    }
+
+    void append_utf8(std::string& text, unsigned int code_point)
+    {
+        if (code_point < 0x80)
+        {
+            text += (char)code_point;
+        }
+        else if (code_point < 0x800)
+        {
+            text += (char)(0xC0 | (code_point >> 6));
+            text += (char)(0x80 | (code_point & 0x3F));
+        }
+        else if (code_point < 0x10000)
+        {
+            text += (char)(0xE0 | (code_point >> 12));
+            text += (char)(0x80 | ((code_point >> 6) & 0x3F));
+            text += (char)(0x80 | (code_point & 0x3F));
+        }
+        else
+        {
+            text += (char)(0xF0 | (code_point >> 18));
+            text += (char)(0x80 | ((code_point >> 12) & 0x3F));
+            text += (char)(0x80 | ((code_point >> 6) & 0x3F));
+            text += (char)(0x80 | (code_point & 0x3F));
+        }
+    }
+
+    // wchar_t is UTF-16 on windows and UTF-32 everywhere else
+    void append_wide(std::wstring& text, unsigned int code_point)
+    {
+        if (sizeof(wchar_t) == 2 && code_point >= 0x10000)
+        {
+            code_point -= 0x10000;
+            text += (wchar_t)(0xD800 + (code_point >> 10));
+            text += (wchar_t)(0xDC00 + (code_point & 0x3FF));
+            return;
+        }
+        text += (wchar_t)code_point;
+    }
+}
+
+json_document::json_document()
+{
+    mp_text = nullptr;
+    m_length = 0;
+    m_position = 0;
+}
+
+bool json_document::parse(const char* p_text, size_t length)
+{
+    mp_text = p_text;
+    m_length = length;
+    m_position = 0;
+    m_values.clear();
+    if (p_text == nullptr || length > 0xFFFFFFFFu) // offsets are stored in 32 bits
+    {
+        return false;
+    }
+    m_values.reserve(length / 16 + 1); // roughly one entry per 16 bytes of project.json, so the array is rarely grown more than once
+    if (!parse_value(0))
+    {
+        m_values.clear();
+        return false;
+    }
+    skip_whitespace();
+    if (m_position != m_length)
+    {
+        m_values.clear();
+        return false;
+    }
+    return true;
+}
+
+unsigned int json_document::get_count()
+{
+    return m_values.size();
+}
+
+const json_value& json_document::get(unsigned int index)
+{
+    return m_values[index];
+}
+
+int json_document::find(unsigned int object, const char* p_key)
+{
+    if (object >= m_values.size() || m_values[object].type != json_type::object)
+    {
+        return -1;
+    }
+    for (unsigned int key = object + 1; key < m_values[object].end; key = m_values[key + 1].end)
+    {
+        if (equals(key, p_key))
+        {
+            return key + 1;
+        }
+    }
+    return -1;
+}
+
+bool json_document::equals(unsigned int index, const char* p_text)
+{
+    const json_value& value = m_values[index];
+
+    if (value.type != json_type::string)
+    {
+        return false;
+    }
+    if (value.escaped)
+    {
+        return get_string(index) == p_text;
+    }
+    return strlen(p_text) == value.length && memcmp(mp_text + value.offset, p_text, value.length) == 0;
+}
+
+bool json_document::equals(unsigned int index, unsigned int other)
+{
+    const json_value& value = m_values[index];
+    const json_value& other_value = m_values[other];
+
+    if (value.type != json_type::string || other_value.type != json_type::string)
+    {
+        return false;
+    }
+    if (value.escaped || other_value.escaped)
+    {
+        return get_string(index) == get_string(other);
+    }
+    return value.length == other_value.length && memcmp(mp_text + value.offset, mp_text + other_value.offset, value.length) == 0;
+}
+
+std::string json_document::get_string(unsigned int index)
+{
+    const json_value& value = m_values[index];
+    const char* p_text = mp_text + value.offset;
+    const char* p_end = p_text + value.length;
+    std::string text;
+
+    switch (value.type)
+    {
+        case json_type::boolean:
+            return value.truth ? "true" : "false";
+        case json_type::number:
+            return std::string(p_text, value.length);
+        case json_type::string:
+            break;
+        default:
+            return std::string();
+    }
+    if (!value.escaped)
+    {
+        return std::string(p_text, value.length);
+    }
+    text.reserve(value.length);
+    while (p_text < p_end)
+    {
+        append_utf8(text, next_code_point(p_text, p_end, true));
+    }
+    return text;
+}
+
+std::wstring json_document::get_wstring(unsigned int index)
+{
+    const json_value& value = m_values[index];
+    const char* p_text = mp_text + value.offset;
+    const char* p_end = p_text + value.length;
+    std::wstring text;
+
+    switch (value.type)
+    {
+        case json_type::boolean:
+            return value.truth ? L"true" : L"false";
+        case json_type::number:
+        case json_type::string:
+            break;
+        default:
+            return std::wstring();
+    }
+    text.reserve(value.length);
+    while (p_text < p_end)
+    {
+        append_wide(text, next_code_point(p_text, p_end, value.escaped));
+    }
+    return text;
+}
+
+double json_document::get_number(unsigned int index, double fallback)
+{
+    const json_value& value = m_values[index];
+    char p_buffer[64] = {};
+    double number = 0.0;
+
+    switch (value.type)
+    {
+        case json_type::number:
+            if (value.length >= sizeof(p_buffer)) // absurdly long numbers, the source text isn't terminated so it can't go to strtod directly
+            {
+                return strtod(get_string(index).c_str(), nullptr);
+            }
+            memcpy(p_buffer, mp_text + value.offset, value.length);
+            return strtod(p_buffer, nullptr);
+        case json_type::string:
+            number = string_to_number(get_wstring(index));
+            return std::isnan(number) ? fallback : number;
+        case json_type::boolean:
+            return value.truth ? 1.0 : 0.0;
+        default:
+            return fallback;
+    }
+}
+
+bool json_document::get_boolean(unsigned int index)
+{
+    const json_value& value = m_values[index];
+
+    if (value.type == json_type::boolean)
+    {
+        return value.truth;
+    }
+    return equals(index, "true");
+}
+
+scratch_state json_document::get_state(unsigned int index)
+{
+    switch (m_values[index].type)
+    {
+        case json_type::number:
+            return scratch_state(get_number(index));
+        case json_type::boolean:
+            return scratch_state(m_values[index].truth);
+        case json_type::string:
+            return scratch_state(get_wstring(index));
+        default:
+            return scratch_state(L"");
+    }
+}
+
+unsigned long long json_document::hash(unsigned int index)
+{
+    const json_value& value = m_values[index];
+    std::string text;
+
+    if (value.type == json_type::string && !value.escaped)
+    {
+        return scratch_util::fnv1a_64(mp_text + value.offset, value.length);
+    }
+    text = get_string(index);
+    return scratch_util::fnv1a_64(text.data(), text.size());
+}
+
+// containers are pushed before their children and get their end index once the children are in
+bool json_document::parse_value(unsigned int depth)
+{
+    unsigned int container = 0;
+    unsigned int count = 0;
+    char close = 0;
+    bool is_object = false;
+
+    if (depth > JSON_MAX_DEPTH)
+    {
+        return false;
+    }
+    skip_whitespace();
+    if (m_position >= m_length)
+    {
+        return false;
+    }
+    switch (mp_text[m_position])
+    {
+        case '"':
+            return parse_string();
+        case 't':
+            return parse_literal("true", json_type::boolean, true);
+        case 'f':
+            return parse_literal("false", json_type::boolean, false);
+        case 'n':
+            return parse_literal("null", json_type::null_value, false);
+        case '{':
+            is_object = true;
+            close = '}';
+            break;
+        case '[':
+            close = ']';
+            break;
+        default:
+            return parse_number();
+    }
+
+    container = m_values.size();
+    push(is_object ? json_type::object : json_type::array, m_position, 0);
+    ++m_position;
+    skip_whitespace();
+    if (m_position < m_length && mp_text[m_position] == close)
+    {
+        ++m_position;
+        m_values[container].end = m_values.size();
+        return true;
+    }
+    while (true)
+    {
+        if (is_object)
+        {
+            skip_whitespace();
+            if (m_position >= m_length || mp_text[m_position] != '"' || !parse_string())
+            {
+                return false;
+            }
+            skip_whitespace();
+            if (m_position >= m_length || mp_text[m_position] != ':')
+            {
+                return false;
+            }
+            ++m_position;
+            ++count;
+        }
+        if (!parse_value(depth + 1))
+        {
+            return false;
+        }
+        ++count;
+        skip_whitespace();
+        if (m_position >= m_length)
+        {
+            return false;
+        }
+        if (mp_text[m_position] == ',')
+        {
+            ++m_position;
+            continue;
+        }
+        if (mp_text[m_position] != close)
+        {
+            return false;
+        }
+        ++m_position;
+        break;
+    }
+    m_values[container].length = count;
+    m_values[container].end = m_values.size();
+    return true;
+}
+
+// only finds where the string ends and whether it needs decoding, the contents are left in the source
+bool json_document::parse_string()
+{
+    size_t start = ++m_position;
+    bool escaped = false;
+
+    while (m_position < m_length)
+    {
+        unsigned char c = (unsigned char)mp_text[m_position];
+
+        if (c == '"')
+        {
+            push(json_type::string, start, m_position - start);
+            m_values.back().escaped = escaped;
+            ++m_position;
+            return true;
+        }
+        if (c < 0x20)
+        {
+            return false;
+        }
+        if (c == '\\')
+        {
+            escaped = true;
+            if (m_position + 1 >= m_length)
+            {
+                return false;
+            }
+            c = (unsigned char)mp_text[m_position + 1];
+            if (c == 'u')
+            {
+                if (m_position + 6 > m_length)
+                {
+                    return false;
+                }
+                for (int i = 2; i < 6; ++i)
+                {
+                    if (hex_digit(mp_text[m_position + i]) < 0)
+                    {
+                        return false;
+                    }
+                }
+                m_position += 6;
+                continue;
+            }
+            if (strchr("\"\\/bfnrt", c) == nullptr || c == 0)
+            {
+                return false;
+            }
+            m_position += 2;
+            continue;
+        }
+        ++m_position;
+    }
+    return false;
+}
+
+bool json_document::parse_literal(const char* p_word, json_type type, bool truth)
+{
+    size_t length = strlen(p_word);
+
+    if (m_length - m_position < length || memcmp(mp_text + m_position, p_word, length) != 0)
+    {
+        return false;
+    }
+    push(type, m_position, length);
+    m_values.back().truth = truth;
+    m_position += length;
+    return true;
+}
+
+// follows the JSON number grammar, the value itself is only converted when someone asks for it
+bool json_document::parse_number()
+{
+    size_t start = m_position;
+    size_t digits_start = 0;
+
+    if (m_position < m_length && mp_text[m_position] == '-')
+    {
+        ++m_position;
+    }
+    digits_start = m_position;
+    while (m_position < m_length && mp_text[m_position] >= '0' && mp_text[m_position] <= '9')
+    {
+        ++m_position;
+    }
+    if (m_position == digits_start)
+    {
+        return false;
+    }
+    if (m_position < m_length && mp_text[m_position] == '.')
+    {
+        digits_start = ++m_position;
+        while (m_position < m_length && mp_text[m_position] >= '0' && mp_text[m_position] <= '9')
+        {
+            ++m_position;
+        }
+        if (m_position == digits_start)
+        {
+            return false;
+        }
+    }
+    if (m_position < m_length && (mp_text[m_position] == 'e' || mp_text[m_position] == 'E'))
+    {
+        ++m_position;
+        if (m_position < m_length && (mp_text[m_position] == '+' || mp_text[m_position] == '-'))
+        {
+            ++m_position;
+        }
+        digits_start = m_position;
+        while (m_position < m_length && mp_text[m_position] >= '0' && mp_text[m_position] <= '9')
+        {
+            ++m_position;
+        }
+        if (m_position == digits_start)
+        {
+            return false;
+        }
+    }
+    push(json_type::number, start, m_position - start);
+    return true;
+}
+
+void json_document::skip_whitespace()
+{
+    while (m_position < m_length && (mp_text[m_position] == ' ' || mp_text[m_position] == '\t' || mp_text[m_position] == '\n' || mp_text[m_position] == '\r'))
+    {
+        ++m_position;
+    }
+}
+
+void json_document::push(json_type type, size_t offset, size_t length)
+{
+    json_value value = {};
+
+    value.type = type;
+    value.offset = (unsigned int)offset;
+    value.length = (unsigned int)length;
+    value.end = m_values.size() + 1; // scalars end right after themselves
+    m_values.push_back(value);
+}
@@ -0,0 +1,238 @@
+/*
+File: layer-list.cpp
+Description: Implements the implicit treap CScratch keeps its sprites' layer order in
+*/
+
+#include "scratch-render.hpp"
+#include <algorithm>
+
+using namespace scratch;
+
+layer_list::layer_list()
+{
+    m_nodes.push_back(layer_node{nullptr, 0, 0, 0, 0, 0});
+    m_root = 0;
+    m_random = 0x9e3779b9;
+    m_draw_order_valid = true;
+}
+
+layer_list::~layer_list()
+{
+    for (unsigned int i = 1; i < m_nodes.size(); ++i)
+    {
+        if (m_nodes[i].p_sprite != nullptr)
+        {
+            m_nodes[i].p_sprite->mp_layers = nullptr;
+            m_nodes[i].p_sprite->m_layer_node = 0;
+        }
+    }
+}
+
+void layer_list::insert(sprite* p_sprite, unsigned int index)
+{
+    unsigned int node = 0;
+
+    if (p_sprite == nullptr || p_sprite->mp_layers != nullptr)
+    {
+        return;
+    }
+    node = new_node(p_sprite);
+    p_sprite->mp_layers = this;
+    p_sprite->m_layer_node = node;
+    attach(node, index);
+}
+
+void layer_list::remove(sprite* p_sprite)
+{
+    unsigned int node = 0;
+
+    if (p_sprite == nullptr || p_sprite->mp_layers != this)
+    {
+        return;
+    }
+    node = detach(get_index(p_sprite));
+    m_nodes[node].p_sprite = nullptr;
+    m_free_nodes.push_back(node);
+    p_sprite->mp_layers = nullptr;
+    p_sprite->m_layer_node = 0;
+}
+
+// the node itself is moved so the sprite keeps it
+void layer_list::move(sprite* p_sprite, unsigned int index)
+{
+    if (p_sprite == nullptr || p_sprite->mp_layers != this)
+    {
+        return;
+    }
+    attach(detach(get_index(p_sprite)), index);
+}
+
+// counting the nodes left of the sprite's node on the way up to the root
+unsigned int layer_list::get_index(sprite* p_sprite)
+{
+    unsigned int node = 0;
+    unsigned int index = 0;
+
+    if (p_sprite == nullptr || p_sprite->mp_layers != this)
+    {
+        return 0;
+    }
+    node = p_sprite->m_layer_node;
+    index = m_nodes[m_nodes[node].left].size;
+    for (unsigned int parent = m_nodes[node].parent; parent != 0; node = parent, parent = m_nodes[parent].parent)
+    {
+        if (m_nodes[parent].right == node)
+        {
+            index += m_nodes[m_nodes[parent].left].size + 1;
+        }
+    }
+    return index;
+}
+
+sprite* layer_list::get_sprite(unsigned int index)
+{
+    unsigned int node = m_root;
+
+    while (node != 0)
+    {
+        unsigned int left_size = m_nodes[m_nodes[node].left].size;
+
+        if (index < left_size)
+        {
+            node = m_nodes[node].left;
+        }
+        else if (index == left_size)
+        {
+            return m_nodes[node].p_sprite;
+        }
+        else
+        {
+            index -= left_size + 1;
+            node = m_nodes[node].right;
+        }
+    }
+    return nullptr;
+}
+
+unsigned int layer_list::get_count()
+{
+    return m_nodes[m_root].size;
+}
+
+// an in order walk with an explicit stack, only after the order changed since the last call
+const std::vector<sprite*>& layer_list::get_draw_order()
+{
+    std::vector<unsigned int> stack;
+    unsigned int node = m_root;
+
+    if (m_draw_order_valid)
+    {
+        return m_draw_order;
+    }
+    m_draw_order.clear();
+    while (node != 0 || !stack.empty())
+    {
+        for (; node != 0; node = m_nodes[node].left)
+        {
+            stack.push_back(node);
+        }
+        node = stack.back();
+        stack.pop_back();
+        m_draw_order.push_back(m_nodes[node].p_sprite);
+        node = m_nodes[node].right;
+    }
+    m_draw_order_valid = true;
+    return m_draw_order;
+}
+
+unsigned int layer_list::new_node(sprite* p_sprite)
+{
+    unsigned int node = 0;
+
+    m_random ^= m_random << 13;
+    m_random ^= m_random >> 17;
+    m_random ^= m_random << 5;
+    if (!m_free_nodes.empty())
+    {
+        node = m_free_nodes.back();
+        m_free_nodes.pop_back();
+    }
+    else
+    {
+        node = m_nodes.size();
+        m_nodes.push_back(layer_node{});
+    }
+    m_nodes[node] = layer_node{p_sprite, 0, 0, 0, 1, m_random};
+    return node;
+}
+
+void layer_list::update(unsigned int node)
+{
+    layer_node& current = m_nodes[node];
+
+    current.size = m_nodes[current.left].size + m_nodes[current.right].size + 1;
+    m_nodes[current.left].parent = node;
+    m_nodes[current.right].parent = node;
+}
+
+void layer_list::split(unsigned int node, unsigned int count, unsigned int& left, unsigned int& right)
+{
+    if (node == 0)
+    {
+        left = right = 0;
+        return;
+    }
+    if (m_nodes[m_nodes[node].left].size < count)
+    {
+        split(m_nodes[node].right, count - m_nodes[m_nodes[node].left].size - 1, m_nodes[node].right, right);
+        left = node;
+    }
+    else
+    {
+        split(m_nodes[node].left, count, left, m_nodes[node].left);
+        right = node;
+    }
+    update(node);
+}
+
+unsigned int layer_list::merge(unsigned int left, unsigned int right)
+{
+    if (left == 0 || right == 0)
+    {
+        return left != 0 ? left : right;
+    }
+    if (m_nodes[left].priority > m_nodes[right].priority)
+    {
+        m_nodes[left].right = merge(m_nodes[left].right, right);
+        update(left);
+        return left;
+    }
+    m_nodes[right].left = merge(left, m_nodes[right].left);
+    update(right);
+    return right;
+}
+
+unsigned int layer_list::detach(unsigned int index)
+{
+    unsigned int below = 0;
+    unsigned int node = 0;
+    unsigned int above = 0;
+
+    split(m_root, index, below, above);
+    split(above, 1, node, above);
+    m_root = merge(below, above);
+    m_nodes[m_root].parent = 0;
+    m_draw_order_valid = false;
+    return node;
+}
+
+void layer_list::attach(unsigned int node, unsigned int index)
+{
+    unsigned int below = 0;
+    unsigned int above = 0;
+
+    split(m_root, std::min(index, get_count()), below, above);
+    m_root = merge(merge(below, node), above);
+    m_nodes[m_root].parent = 0;
+    m_draw_order_valid = false;
+}
@@ -0,0 +1,153 @@
+/*
+File: mapped-file.cpp
+Description: Implements the read only memory mapped file views CScratch loads projects through
+*/
+
+#include "scratch-util.hpp"
+#include <cstdio>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h> // kept out of every header, it clashes with raylib's names
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace scratch_util;
+
+mapped_file::mapped_file()
+{
+    mp_data = nullptr;
+    m_size = 0;
+    m_mapped = false;
+    mp_mapping = nullptr;
+}
+
+mapped_file::~mapped_file()
+{
+    close();
+}
+
+bool mapped_file::open(const char* p_path)
+{
+    FILE* p_file = nullptr;
+    unsigned char* p_buffer = nullptr;
+    long length = 0;
+
+    close();
+#ifdef _WIN32
+    {
+        HANDLE file = CreateFileA(p_path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        LARGE_INTEGER file_size = {};
+        HANDLE mapping = nullptr;
+
+        if (file != INVALID_HANDLE_VALUE)
+        {
+            if (GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0)
+            {
+                mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            }
+            CloseHandle(file); // the mapping keeps the file open
+            if (mapping != nullptr)
+            {
+                mp_data = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+                if (mp_data != nullptr)
+                {
+                    m_size = (size_t)file_size.QuadPart;
+                    m_mapped = true;
+                    mp_mapping = mapping;
+                    return true;
+                }
+                CloseHandle(mapping);
+            }
+        }
+    }
+#else
+    {
+        int file = ::open(p_path, O_RDONLY);
+        struct stat file_stat = {};
+        void* p_view = MAP_FAILED;
+
+        if (file >= 0)
+        {
+            if (fstat(file, &file_stat) == 0 && file_stat.st_size > 0)
+            {
+                p_view = mmap(nullptr, (size_t)file_stat.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+            }
+            ::close(file); // the mapping keeps its own reference to the file
+            if (p_view != MAP_FAILED)
+            {
+                mp_data = (const unsigned char*)p_view;
+                m_size = (size_t)file_stat.st_size;
+                m_mapped = true;
+                return true;
+            }
+        }
+    }
+#endif
+
+    // mapping failed (or the file is empty), reading it the slow way
+    p_file = fopen(p_path, "rb");
+    if (p_file == nullptr)
+    {
+        return false;
+    }
+    if (fseek(p_file, 0, SEEK_END) != 0 || (length = ftell(p_file)) < 0 || fseek(p_file, 0, SEEK_SET) != 0)
+    {
+        fclose(p_file);
+        return false;
+    }
+    p_buffer = new unsigned char[length > 0 ? length : 1];
+    if (length > 0 && fread(p_buffer, 1, (size_t)length, p_file) != (size_t)length)
+    {
+        delete[] p_buffer;
+        fclose(p_file);
+        return false;
+    }
+    fclose(p_file);
+    mp_data = p_buffer;
+    m_size = (size_t)length;
+    return true;
+}
+
+void mapped_file::close()
+{
+    if (mp_data == nullptr)
+    {
+        return;
+    }
+    if (!m_mapped)
+    {
+        delete[] mp_data;
+    }
+#ifdef _WIN32
+    else
+    {
+        UnmapViewOfFile(mp_data);
+        CloseHandle((HANDLE)mp_mapping);
+    }
+#else
+    else
+    {
+        munmap((void*)mp_data, m_size);
+    }
+#endif
+    mp_data = nullptr;
+    m_size = 0;
+    m_mapped = false;
+    mp_mapping = nullptr;
+}
+
+const unsigned char* mapped_file::get_data()
+{
+    return mp_data;
+}
+
+size_t mapped_file::get_size()
+{
+    return m_size;
+}
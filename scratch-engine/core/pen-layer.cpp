@@ -0,0 +1,118 @@
+/*
+File: pen-layer.cpp
+Description: Implements the queue pen blocks draw into until the renderer flushes it onto the pen layer
+*/
+
+#include "scratch-render.hpp"
+#include "scratch-util.hpp"
+#include <algorithm>
+#include <cmath>
+
+using namespace scratch;
+
+// hue wraps around, the other parameters are clamped to 0 to 100 by the blocks before they get here
+Color scratch::resolve_pen_color(const pen_state& pen)
+{
+    double hue = pen.color / 100.0 - floor(pen.color / 100.0);
+    double value = pen.brightness / 100.0;
+    double chroma = value * pen.saturation / 100.0;
+    double red = std::min(std::max(fabs(hue * 6.0 - 3.0) - 1.0, 0.0), 1.0) * chroma + value - chroma;
+    double green = std::min(std::max(2.0 - fabs(hue * 6.0 - 2.0), 0.0), 1.0) * chroma + value - chroma;
+    double blue = std::min(std::max(2.0 - fabs(hue * 6.0 - 4.0), 0.0), 1.0) * chroma + value - chroma;
+
+    return Color{(unsigned char)scratch_util::round(red * 255.0), (unsigned char)scratch_util::round(green * 255.0),
+        (unsigned char)scratch_util::round(blue * 255.0), (unsigned char)scratch_util::round((1.0 - pen.transparency / 100.0) * 255.0)};
+}
+
+pen_layer::pen_layer()
+{
+    m_clear_pending = false;
+    m_damage = empty_box();
+    m_ink = empty_box();
+}
+
+void pen_layer::draw_line(double x0, double y0, double x1, double y1, const pen_state& pen)
+{
+    pen_line line = {};
+    stage_box bounds = {};
+
+    if (pen.rgba.a == 0)
+    {
+        return;
+    }
+    line.x0 = (float)scratch_util::stage_to_screen_x_coordinate(x0);
+    line.y0 = (float)scratch_util::stage_to_screen_y_coordinate(y0);
+    line.x1 = (float)scratch_util::stage_to_screen_x_coordinate(x1);
+    line.y1 = (float)scratch_util::stage_to_screen_y_coordinate(y1);
+    line.size = (float)pen.size;
+    line.color = pen.rgba;
+    m_lines.push_back(line);
+    bounds.min_x = std::min(line.x0, line.x1) - line.size / 2.0;
+    bounds.min_y = std::min(line.y0, line.y1) - line.size / 2.0;
+    bounds.max_x = std::max(line.x0, line.x1) + line.size / 2.0;
+    bounds.max_y = std::max(line.y0, line.y1) + line.size / 2.0;
+    grow_box(m_damage, bounds);
+    grow_box(m_ink, bounds);
+}
+
+// the sprite may have moved or been deleted by the time the queue is drawn, so everything needed to draw it is copied now
+void pen_layer::stamp(sprite* p_sprite)
+{
+    pen_stamp stamp = {};
+    stage_box bounds = {};
+
+    if (p_sprite == nullptr || !p_sprite->get_transform(stamp.transform))
+    {
+        return;
+    }
+    stamp.p_costume = p_sprite->get_current_costume();
+    stamp.has_effects = p_sprite->get_effects(stamp.effects);
+    stamp.line_index = m_lines.size();
+    m_stamps.push_back(stamp);
+    bounds = stage_box{stamp.transform.min_x, stamp.transform.min_y, stamp.transform.max_x, stamp.transform.max_y};
+    grow_box(m_damage, bounds);
+    grow_box(m_ink, bounds);
+}
+
+void pen_layer::clear()
+{
+    m_lines.clear();
+    m_stamps.clear();
+    m_clear_pending = true;
+    grow_box(m_damage, m_ink);
+    m_ink = empty_box();
+}
+
+bool pen_layer::has_pending()
+{
+    return m_clear_pending || !m_lines.empty() || !m_stamps.empty();
+}
+
+bool pen_layer::is_clear_pending()
+{
+    return m_clear_pending;
+}
+
+const std::vector<pen_line>& pen_layer::get_lines()
+{
+    return m_lines;
+}
+
+const std::vector<pen_stamp>& pen_layer::get_stamps()
+{
+    return m_stamps;
+}
+
+const stage_box& pen_layer::get_damage()
+{
+    return m_damage;
+}
+
+// the vectors keep their capacity so a project drawing every frame stops allocating after the first few
+void pen_layer::finish_frame()
+{
+    m_lines.clear();
+    m_stamps.clear();
+    m_clear_pending = false;
+    m_damage = empty_box();
+}
@@ -0,0 +1,48 @@
+/*
+File: record-job.cpp
+Description: Implements the job that records a session's input so it can be replayed
+*/
+
+#include "scratch-jobs.hpp"
+
+using namespace scratch;
+
+record_job::record_job(input_job* p_input_job, unsigned long long seed)
+{
+    mp_input_job = p_input_job;
+    m_recorded_runs = p_input_job->get_run_count();
+    m_trace.clear(seed);
+}
+
+input_trace& record_job::get_trace()
+{
+    return m_trace;
+}
+
+std::vector<unsigned int>* record_job::get_pass_log()
+{
+    return &m_pass_log;
+}
+
+// runs at the end of every frame and after run_ticks, the input is only taken if input_job ran since the last frame was recorded
+job_status record_job::run()
+{
+    std::vector<input_event> no_events;
+
+    if (mp_input_job->get_run_count() != m_recorded_runs)
+    {
+        m_recorded_runs = mp_input_job->get_run_count();
+        m_trace.add_frame(mp_input_job->get_events(), m_pass_log);
+    }
+    else
+    {
+        m_trace.add_frame(no_events, m_pass_log);
+    }
+    m_pass_log.clear();
+    return job_status::ok;
+}
+
+const char* record_job::get_name()
+{
+    return "record_job";
+}
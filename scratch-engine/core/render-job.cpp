@@ -6,120 +6,547 @@ Description: Implements the code for handling rendering sprites and pen in CScra
 #include "scratch-jobs.hpp"
 #include "scratch-util.hpp"
 #include "scratch-config.hpp"
+#include "scratch-trace.hpp"
+#include <rlgl.h>
+#include <cmath>
+#include <cstring>
+#include <string>
 
 using namespace scratch;
 using namespace scratch_util;
 
+namespace
+{
+    // the GPU side of sprite-effects.cpp, keep the two in step. raylib's default vertex shader feeds it
+    // slots hold (color, fisheye, whirl, mosaic), (pixelate blocks across, pixelate blocks down, brightness, unused) and the costume's
+    // texture coordinates (left, top, right, bottom) so effects work in costume space even when the costume sits in an atlas page
+    const char* const EFFECT_SHADER_SOURCE = R"(
+in vec2 fragTexCoord;
+in vec4 fragColor;
+uniform sampler2D texture0;
+uniform vec4 colDiffuse;
+uniform vec4 effect_slots[EFFECT_BATCH_SLOTS * 3];
+out vec4 finalColor;
+
+const float center = 0.5;
+const float min_value = 0.11 / 2.0;
+const float min_saturation = 0.09;
+
+void main()
+{
+    int slot = int(fragColor.r * 255.0 + 0.5) * 3;
+    vec4 shape = effect_slots[slot];
+    vec4 tone = effect_slots[slot + 1];
+    vec4 source = effect_slots[slot + 2];
+    vec2 uv = fragTexCoord;
+    vec4 color;
+
+    if (slot == 0)
+    {
+        finalColor = texture(texture0, uv) * colDiffuse * vec4(1.0, 1.0, 1.0, fragColor.a);
+        return;
+    }
+    uv = (uv - source.xy) / (source.zw - source.xy);
+    if (shape.w != 1.0)
+    {
+        uv = fract(uv * shape.w);
+    }
+    if (tone.x > 0.0)
+    {
+        uv = (floor(uv * tone.xy) + center) / tone.xy;
+    }
+    if (shape.z != 0.0)
+    {
+        vec2 offset = uv - center;
+        float falloff = max(1.0 - length(offset) / center, 0.0);
+        float angle = shape.z * falloff * falloff;
+        uv = mat2(cos(angle), -sin(angle), sin(angle), cos(angle)) * offset + center;
+    }
+    if (shape.y != 1.0)
+    {
+        vec2 direction = (uv - center) / center;
+        float len = length(direction);
+        float radius = pow(min(len, 1.0), shape.y) * max(1.0, len);
+        uv = center + direction * (len > 0.0 ? radius / len * center : 0.0);
+    }
+    if (any(lessThan(uv, vec2(0.0))) || any(greaterThanEqual(uv, vec2(1.0))))
+    {
+        discard;
+    }
+    color = texture(texture0, mix(source.xy, source.zw, uv));
+    if (shape.x != 0.0)
+    {
+        float value = max(color.r, max(color.g, color.b));
+        float chroma = value - min(color.r, min(color.g, color.b));
+        float hue = chroma == 0.0 ? 0.0 : value == color.r ? (color.g - color.b) / chroma : value == color.g ? (color.b - color.r) / chroma + 2.0 : (color.r - color.g) / chroma + 4.0;
+        float saturation = value > 0.0 ? chroma / value : 0.0;
+        bool dark = value < min_value;
+        bool gray = !dark && saturation < min_saturation;
+
+        hue = dark || gray ? 0.0 : hue / 6.0;
+        saturation = dark ? 1.0 : gray ? min_saturation : saturation;
+        value = dark ? min_value : value;
+        hue = fract(hue + shape.x);
+        chroma = value * saturation;
+        color.rgb = clamp(vec3(abs(hue * 6.0 - 3.0) - 1.0, 2.0 - abs(hue * 6.0 - 2.0), 2.0 - abs(hue * 6.0 - 4.0)), 0.0, 1.0) * chroma + value - chroma;
+    }
+    color.rgb = clamp(color.rgb + tone.z, 0.0, 1.0);
+    finalColor = color * colDiffuse * vec4(1.0, 1.0, 1.0, fragColor.a);
+}
+)";
+}
+
 // render job
-render_job::render_job(sprite** pp_sprite_list)
+render_job::render_job(layer_list* p_layers, pen_layer* p_pen_layer, stage_damage* p_damage, render_stats* p_stats)
 {
-    mpp_sprite_list = pp_sprite_list;
+    Image cap = GenImageColor(PEN_CAP_TEXTURE_SIZE, PEN_CAP_TEXTURE_SIZE, COLOR_BLANK);
+    Color* p_cap_pixels = (Color*)cap.data;
+    double cap_radius = PEN_CAP_TEXTURE_SIZE / 2.0;
+
+    mp_layers = p_layers;
+    mp_pen_layer = p_pen_layer;
+    mp_damage = p_damage;
+    mp_stats = p_stats;
+    m_batch_texture_id = 0;
     m_stage_texture = LoadRenderTexture(STAGE_SIZE_X, STAGE_SIZE_Y);
+    m_area = Rectangle{0.0f, 0.0f, (float)STAGE_SIZE_X, (float)STAGE_SIZE_Y};
+    m_pen_texture = LoadRenderTexture(STAGE_SIZE_X, STAGE_SIZE_Y);
+    m_pen_used = false;
+    BeginTextureMode(m_pen_texture);
+    ClearBackground(COLOR_BLANK);
+    EndTextureMode();
+
+    // line ends are drawn as quads showing this disc, line bodies sample its middle so every pen quad uses the same texture
+    for (int y = 0; y < PEN_CAP_TEXTURE_SIZE; ++y)
+    {
+        for (int x = 0; x < PEN_CAP_TEXTURE_SIZE; ++x)
+        {
+            double offset_x = x + 0.5 - cap_radius;
+            double offset_y = y + 0.5 - cap_radius;
+
+            if (offset_x * offset_x + offset_y * offset_y <= cap_radius * cap_radius)
+            {
+                p_cap_pixels[y * PEN_CAP_TEXTURE_SIZE + x] = COLOR_WHITE;
+            }
+        }
+    }
+    m_pen_cap_texture = LoadTextureFromImage(cap);
+    SetTextureFilter(m_pen_cap_texture, TEXTURE_FILTER_BILINEAR);
+    UnloadImage(cap);
+
+    m_effect_shader = LoadShaderFromMemory(nullptr, (std::string("#version 330\n#define EFFECT_BATCH_SLOTS ") + std::to_string(EFFECT_BATCH_SLOTS) + EFFECT_SHADER_SOURCE).c_str());
+    m_effect_slots_location = m_effect_shader.id != 0 ? GetShaderLocation(m_effect_shader, "effect_slots") : -1;
+    if (m_effect_slots_location < 0) // raylib hands back its default shader when compiling fails, UnloadShader leaves that one alone
+    {
+        UnloadShader(m_effect_shader);
+        m_effect_shader = {};
+    }
+    memset(mp_effect_slots, 0, sizeof(mp_effect_slots));
+    m_effect_slot_count = 1;
 }
 render_job::~render_job()
 {
+    if (m_effect_shader.id != 0)
+    {
+        UnloadShader(m_effect_shader);
+    }
+    UnloadTexture(m_pen_cap_texture);
+    UnloadRenderTexture(m_pen_texture);
     UnloadRenderTexture(m_stage_texture);
 }
+const char* render_job::get_name()
+{
+    return "render_job";
+}
+
+// the stage texture is only drawn again where something changed, a project sitting idle just presents the last frame again
 job_status render_job::run()
 {
-    if (mpp_sprite_list == nullptr)
+    bool redraw = true;
+    bool partial = false;
+
+    if (mp_layers == nullptr)
     {
         return job_status::error;
     }
     
+    if (mp_stats != nullptr)
+    {
+        *mp_stats = {};
+    }
+    redraw = mp_damage == nullptr || mp_damage->collect(mp_layers->get_draw_order(), mp_pen_layer, m_area); // before the flush, which empties the pen's damage
+    
+    if (mp_pen_layer != nullptr && mp_pen_layer->has_pending())
+    {
+        flush_pen();
+    }
+    if (!redraw)
+    {
+        present_stage();
+        return job_status::ok;
+    }
+
+    partial = m_area.width < STAGE_SIZE_X || m_area.height < STAGE_SIZE_Y;
+    if (mp_stats != nullptr)
+    {
+        mp_stats->redrawn_pixels = (unsigned int)(m_area.width * m_area.height);
+    }
     BeginTextureMode(m_stage_texture);
+    if (partial) // the clear respects the scissor rectangle too
+    {
+        BeginScissorMode((int)m_area.x, (int)m_area.y, (int)m_area.width, (int)m_area.height);
+    }
     ClearBackground(COLOR_WHITE);
+    if (m_pen_used) // render textures come out upside down, hence the negative height
+    {
+        BeginBlendMode(BLEND_ALPHA_PREMULTIPLY);
+        DrawTextureRec(m_pen_texture.texture, Rectangle{0.0f, 0.0f, (float)m_pen_texture.texture.width, -(float)m_pen_texture.texture.height}, Vector2{0.0f, 0.0f}, COLOR_WHITE);
+        EndBlendMode();
+        if (mp_stats != nullptr)
+        {
+            ++mp_stats->draw_calls;
+            ++mp_stats->texture_switches;
+        }
+    }
+    if (m_effect_shader.id != 0)
+    {
+        BeginShaderMode(m_effect_shader);
+    }
+    m_effect_slot_count = 1;
     
-    // render all sprites
-    for (sprite* p_sprite = *mpp_sprite_list; p_sprite != nullptr; p_sprite = p_sprite->mp_above)
+    // render all sprites, bottom to top so layer order is kept. consecutive sprites on the same texture (atlas page) end up in one batch
+    m_batch_texture_id = 0;
+    for (sprite* p_sprite : mp_layers->get_draw_order())
     {
-        if (p_sprite->m_hidden)
+        if (p_sprite->is_hidden())
         {
             continue;
         }
         draw_sprite(p_sprite);
     }
+    if (m_batch_texture_id != 0) // closing the last batch
+    {
+        rlEnd();
+        rlSetTexture(0);
+        m_batch_texture_id = 0;
+    }
+    if (m_effect_shader.id != 0)
+    {
+        EndShaderMode();
+    }
+    if (partial)
+    {
+        EndScissorMode();
+    }
 
     EndTextureMode();
     present_stage();
     return job_status::ok;
 }
 
+// appends the sprite's quad to the current batch, see draw_costume
 void render_job::draw_sprite(sprite* p_sprite)
 {
-    costume* p_costume = nullptr;
+    sprite_transform transform = {};
+    sprite_effects effects = {};
+    bool has_effects = false;
+    unsigned int effect_slot = 0;
+    SCRATCH_TRACE_SCOPE("render_job::draw_sprite");
+
+    if (p_sprite == nullptr || !p_sprite->get_transform(transform))
+    {
+        return;
+    }
+    if (transform.max_x < m_area.x || transform.min_x > m_area.x + m_area.width || transform.max_y < m_area.y || transform.min_y > m_area.y + m_area.height)
+    {
+        return;
+    }
+    has_effects = p_sprite->get_effects(effects);
+    if (!draw_costume(p_sprite->get_current_costume(), transform, has_effects, effects, effect_slot, false))
+    {
+        if (mp_damage != nullptr) // its texture didn't make this frame's upload budget, it gets another go next frame
+        {
+            mp_damage->add(stage_box{transform.min_x, transform.min_y, transform.max_x, transform.max_y});
+        }
+        return;
+    }
+    if (mp_stats != nullptr)
+    {
+        ++mp_stats->sprites_drawn;
+        mp_stats->effect_sprites += effect_slot != 0 ? 1 : 0;
+    }
+}
+
+// appends a costume's quad to the current batch, laid out exactly like DrawTexturePro would with the transform's rectangle, origin and rotation
+// a new batch (and so a new draw call) is only started when the texture differs from the previous quad's. forced draws upload the texture
+// even when the frame's upload budget is used up
+bool render_job::draw_costume(costume* p_costume, const sprite_transform& transform, bool has_effects, const sprite_effects& effects, unsigned int& effect_slot, bool forced)
+{
     Texture2D texture = {};
-    Vector2 rotate_center = {};
+    Vector2 top_left = {};
+    Vector2 top_right = {};
+    Vector2 bottom_left = {};
+    Vector2 bottom_right = {};
     Rectangle rect_source = {};
-    Rectangle rect_destination = {};
     Color draw_color = COLOR_WHITE;
-    double sprite_direction = 0;
-    double costume_width = 0;
-    double costume_height = 0;
-    double costume_rotation_center_x = 0;
-    double costume_rotation_center_y = 0;
-    double sprite_scale = 0;
-    double sprite_x = 0;
-    double sprite_y = 0;
-    double stage_sprite_x = 0;
-    double stage_sprite_y = 0;
-
-    if (p_sprite == nullptr)
+    double sprite_scale = 0.0;
+    float left_u = 0.0f;
+    float right_u = 0.0f;
+    float top_v = 0.0f;
+    float bottom_v = 0.0f;
+
+    effect_slot = 0;
+    if (p_costume == nullptr || p_costume->get_width() <= 0.0)
     {
-        return;
+        return false;
     }
 
-    p_costume = p_sprite->get_current_costume();
-    if (p_costume == nullptr)
+    // sprites land in the stage texture rather than the window, so resizing the window doesn't change which level is needed
+    sprite_scale = transform.width / p_costume->get_width();
+    texture = p_costume->get_texture(sprite_scale * m_stage_texture.texture.width / STAGE_SIZE_X_FLOAT, rect_source, forced);
+    if (texture.id == 0)
     {
-        return;
+        return false;
+    }
+
+    left_u = rect_source.x / texture.width;
+    right_u = (rect_source.x + rect_source.width) / texture.width;
+    top_v = rect_source.y / texture.height;
+    bottom_v = (rect_source.y + rect_source.height) / texture.height;
+    if (has_effects) // slots take the texture coordinates before mirroring, effects work on the costume as drawn
+    {
+        draw_color.a = (unsigned char)(effects.ghost * 255.0f + 0.5f);
+        if ((effects.coordinates || effects.colors) && m_effect_shader.id != 0)
+        {
+            effect_slot = add_effect_slot(effects, left_u, top_v, right_u, bottom_v);
+        }
+    }
+    if (m_effect_shader.id != 0)
+    {
+        draw_color.r = (unsigned char)effect_slot;
+    }
+    if (transform.flip_x)
+    {
+        std::swap(left_u, right_u);
     }
 
-    texture = p_costume->get_texture();
-    sprite_scale = p_sprite->get_size() / 100.0;
-    sprite_x = p_sprite->get_x();
-    sprite_y = p_sprite->get_y();
-    sprite_direction = p_sprite->get_direction();
-    costume_width = p_costume->get_width() * sprite_scale;
-    costume_height = p_costume->get_height() * sprite_scale;
-    stage_sprite_x = stage_to_screen_x_coordinate(sprite_x);
-    stage_sprite_y = stage_to_screen_y_coordinate(sprite_y);
-    costume_rotation_center_x = p_costume->get_rotation_center_x() * sprite_scale;
-    costume_rotation_center_y = p_costume->get_rotation_center_y() * sprite_scale;
-
-    rect_destination.width = costume_width;
-    rect_destination.height = costume_height;
-    rect_destination.x = stage_sprite_x;
-    rect_destination.y = stage_sprite_y;
-    rect_source.width = p_costume->get_width();
-    rect_source.height = p_costume->get_height();
-    rect_source.x = 0.0;
-    rect_source.y = 0.0;
-    // rotate_center.x = costume_rotation_center_x;
-    // rotate_center.y = costume_rotation_center_y;
-    rotate_center.x = costume_rotation_center_x;
-    rotate_center.y = costume_height - costume_rotation_center_y;
-
-    printf("Transformed position: (%f, %f)\n", stage_sprite_x, stage_sprite_y);
-    // printf("Rendering rectangle at (%f, %f, %f, %f)\n", rect_destination.x, rect_destination.y, rect_destination.width, rect_destination.height);
-    switch (p_sprite->get_rotation_mode())
-    {
-        case rotation_mode::all_around:
-            DrawTexturePro(texture, rect_source, rect_destination, rotate_center, sprite_direction - 90.0, draw_color);
-            break;
-        case rotation_mode::left_right:
-            if (sprite_direction < 0.0)
+    // rotating the destination rectangle's corners around the rotation center
+    top_left = get_corner(transform, 0.0, 0.0);
+    top_right = get_corner(transform, transform.width, 0.0);
+    bottom_left = get_corner(transform, 0.0, transform.height);
+    bottom_right = get_corner(transform, transform.width, transform.height);
+
+    if (texture.id != m_batch_texture_id)
+    {
+        if (m_batch_texture_id != 0)
+        {
+            rlEnd();
+            if (mp_stats != nullptr)
+            {
+                ++mp_stats->texture_switches;
+            }
+        }
+        rlSetTexture(texture.id);
+        rlBegin(RL_QUADS);
+        m_batch_texture_id = texture.id;
+        if (mp_stats != nullptr)
+        {
+            ++mp_stats->draw_calls;
+        }
+    }
+    rlColor4ub(draw_color.r, draw_color.g, draw_color.b, draw_color.a);
+    rlNormal3f(0.0f, 0.0f, 1.0f);
+    rlTexCoord2f(left_u, top_v);
+    rlVertex2f(top_left.x, top_left.y);
+    rlTexCoord2f(left_u, bottom_v);
+    rlVertex2f(bottom_left.x, bottom_left.y);
+    rlTexCoord2f(right_u, bottom_v);
+    rlVertex2f(bottom_right.x, bottom_right.y);
+    rlTexCoord2f(right_u, top_v);
+    rlVertex2f(top_right.x, top_right.y);
+    return true;
+}
+
+// a point of the unrotated costume rectangle (0 to width, 0 to height) on the render plane
+Vector2 render_job::get_corner(const sprite_transform& transform, double x, double y)
+{
+    double offset_x = x - transform.origin_x;
+    double offset_y = y - transform.origin_y;
+
+    return Vector2{(float)(transform.x + offset_x * transform.cos_rotation - offset_y * transform.sin_rotation), (float)(transform.y + offset_x * transform.sin_rotation + offset_y * transform.cos_rotation)};
+}
+
+// sprites with the same effects on the same costume one after the other (clones mostly) reuse the last slot, running out of slots ends the batch
+// the whole used part of the array is uploaded each time, the quads already queued only read slots that didn't change
+unsigned int render_job::add_effect_slot(const sprite_effects& effects, float left_u, float top_v, float right_u, float bottom_v)
+{
+    float slot[12] = {effects.color, effects.fisheye, effects.whirl, effects.mosaic, 0.0f, 0.0f, effects.brightness, 0.0f, left_u, top_v, right_u, bottom_v};
+
+    if (effects.pixelate > 0.0f)
+    {
+        slot[4] = effects.costume_width / effects.pixelate;
+        slot[5] = effects.costume_height / effects.pixelate;
+    }
+    if (m_effect_slot_count > 1 && memcmp(slot, mp_effect_slots + (m_effect_slot_count - 1) * 12, sizeof(slot)) == 0)
+    {
+        return m_effect_slot_count - 1;
+    }
+    if (m_effect_slot_count == EFFECT_BATCH_SLOTS)
+    {
+        flush_batch();
+    }
+    memcpy(mp_effect_slots + m_effect_slot_count * 12, slot, sizeof(slot));
+    ++m_effect_slot_count;
+    SetShaderValueV(m_effect_shader, m_effect_slots_location, mp_effect_slots, SHADER_UNIFORM_VEC4, m_effect_slot_count * 3);
+    return m_effect_slot_count - 1;
+}
+
+// draws the queued pen lines and stamps into the pen texture. it holds premultiplied colors so translucent lines over empty pixels
+// don't darken, the separate blend factors write non-premultiplied colors into it that way and it is composited with BLEND_ALPHA_PREMULTIPLY
+// lines between two stamps go out as one batch on the cap texture, stamps go through the effect shader like sprites do. a stamp is drawn
+// once and the queue is gone after this frame, so its texture is uploaded whatever the upload budget says
+void render_job::flush_pen()
+{
+    const std::vector<pen_line>& lines = mp_pen_layer->get_lines();
+    const std::vector<pen_stamp>& stamps = mp_pen_layer->get_stamps();
+    size_t line = 0;
+    unsigned int effect_slot = 0;
+    bool stamping = false;
+    SCRATCH_TRACE_SCOPE("render_job::flush_pen");
+
+    BeginTextureMode(m_pen_texture);
+    if (mp_pen_layer->is_clear_pending())
+    {
+        ClearBackground(COLOR_BLANK);
+        m_pen_used = false;
+    }
+    rlSetBlendFactorsSeparate(RL_SRC_ALPHA, RL_ONE_MINUS_SRC_ALPHA, RL_ONE, RL_ONE_MINUS_SRC_ALPHA, RL_FUNC_ADD, RL_FUNC_ADD);
+    BeginBlendMode(BLEND_CUSTOM_SEPARATE);
+    for (const pen_stamp& stamp : stamps)
+    {
+        if (line < stamp.line_index)
+        {
+            if (stamping)
+            {
+                end_stamps();
+                stamping = false;
+            }
+            draw_pen_lines(lines, line, stamp.line_index);
+            line = stamp.line_index;
+        }
+        if (!stamping)
+        {
+            if (m_effect_shader.id != 0)
             {
-                rect_source.width *= -1.0;
+                BeginShaderMode(m_effect_shader);
             }
-            DrawTexturePro(texture, rect_source, rect_destination, rotate_center, 0.0, draw_color);
-            break;
-        default: // default to rotation_mode::none
-            DrawTexturePro(texture, rect_source, rect_destination, rotate_center, 0.0, draw_color);
-            break;
+            m_effect_slot_count = 1;
+            m_batch_texture_id = 0;
+            stamping = true;
+        }
+        draw_costume(stamp.p_costume, stamp.transform, stamp.has_effects, stamp.effects, effect_slot, true);
+    }
+    if (stamping)
+    {
+        end_stamps();
+    }
+    draw_pen_lines(lines, line, lines.size());
+    EndBlendMode();
+    EndTextureMode();
+
+    m_pen_used = m_pen_used || !lines.empty() || !stamps.empty();
+    if (mp_stats != nullptr)
+    {
+        mp_stats->pen_lines = lines.size();
+        mp_stats->pen_stamps = stamps.size();
+    }
+    mp_pen_layer->finish_frame();
+}
+
+void render_job::end_stamps()
+{
+    if (m_batch_texture_id != 0)
+    {
+        rlEnd();
+        rlSetTexture(0);
+        m_batch_texture_id = 0;
+    }
+    if (m_effect_shader.id != 0)
+    {
+        EndShaderMode();
     }
 }
 
+// each line is a quad for its body and one for each round end. the quads all use the cap texture so the whole run is a single batch,
+// rlgl only splits it when its vertex buffer fills up
+void render_job::draw_pen_lines(const std::vector<pen_line>& lines, size_t first, size_t last)
+{
+    if (first >= last)
+    {
+        return;
+    }
+    rlSetTexture(m_pen_cap_texture.id);
+    rlBegin(RL_QUADS);
+    if (mp_stats != nullptr)
+    {
+        ++mp_stats->draw_calls;
+    }
+    for (size_t i = first; i < last; ++i)
+    {
+        const pen_line& line = lines[i];
+        float radius = std::max(line.size, 1.0f) / 2.0f;
+        float delta_x = line.x1 - line.x0;
+        float delta_y = line.y1 - line.y0;
+        float length = sqrt(delta_x * delta_x + delta_y * delta_y);
+
+        if (rlCheckRenderBatchLimit(12) && mp_stats != nullptr)
+        {
+            ++mp_stats->draw_calls;
+        }
+        rlColor4ub(line.color.r, line.color.g, line.color.b, line.color.a);
+        rlNormal3f(0.0f, 0.0f, 1.0f);
+        if (length > 0.0f)
+        {
+            float normal_x = -delta_y / length * radius;
+            float normal_y = delta_x / length * radius;
+
+            rlTexCoord2f(0.5f, 0.5f);
+            rlVertex2f(line.x0 - normal_x, line.y0 - normal_y);
+            rlVertex2f(line.x0 + normal_x, line.y0 + normal_y);
+            rlVertex2f(line.x1 + normal_x, line.y1 + normal_y);
+            rlVertex2f(line.x1 - normal_x, line.y1 - normal_y);
+            draw_pen_cap(line.x1, line.y1, radius);
+        }
+        draw_pen_cap(line.x0, line.y0, radius);
+    }
+    rlEnd();
+    rlSetTexture(0);
+}
+
+void render_job::draw_pen_cap(float x, float y, float radius)
+{
+    rlTexCoord2f(0.0f, 0.0f);
+    rlVertex2f(x - radius, y - radius);
+    rlTexCoord2f(0.0f, 1.0f);
+    rlVertex2f(x - radius, y + radius);
+    rlTexCoord2f(1.0f, 1.0f);
+    rlVertex2f(x + radius, y + radius);
+    rlTexCoord2f(1.0f, 0.0f);
+    rlVertex2f(x + radius, y - radius);
+}
+
+// draws everything queued so far so the effect slots can be handed out again
+void render_job::flush_batch()
+{
+    if (m_batch_texture_id != 0)
+    {
+        rlEnd();
+        m_batch_texture_id = 0;
+    }
+    rlDrawRenderBatchActive();
+    m_effect_slot_count = 1;
+}
+
 // draws the final stage texture onto the screen in letterbox format
 void render_job::present_stage()
 {
@@ -131,6 +558,7 @@ void render_job::present_stage()
     Rectangle rect_source = {};
     Rectangle rect_destination = {};
     Vector2 rotation_center = {0.0, 0.0};
+    SCRATCH_TRACE_SCOPE("render_job::present_stage");
 
     scale = std::min(screen_width / stage_width, screen_height / stage_height);
     rect_destination.x = (screen_width - stage_width * scale) / 2.0;
@@ -142,6 +570,11 @@ void render_job::present_stage()
 
     BeginDrawing();
     ClearBackground(COLOR_BLACK);
+    if (mp_stats != nullptr) // the stage texture itself
+    {
+        ++mp_stats->draw_calls;
+        ++mp_stats->texture_switches;
+    }
     DrawTexturePro(m_stage_texture.texture, rect_source, rect_destination, rotation_center, 0.0, COLOR_WHITE);
     EndDrawing();
 }
\ No newline at end of file
@@ -0,0 +1,47 @@
+/*
+File: replay-input-job.cpp
+Description: Implements the job that feeds a recorded session's input back into CScratch
+*/
+
+#include "scratch-jobs.hpp"
+
+using namespace scratch;
+
+replay_input_job::replay_input_job(input_tracker* p_input)
+{
+    mp_input = p_input;
+}
+
+input_trace& replay_input_job::get_trace()
+{
+    return m_trace;
+}
+
+// a window can still be closed in the middle of a replay, headless replays just run until the trace is used up
+job_status replay_input_job::run()
+{
+    if (IsWindowReady() && WindowShouldClose())
+    {
+        return job_status::signal_engine_terminate;
+    }
+    if (!m_trace.next_frame(m_events, m_tick_passes))
+    {
+        m_tick_passes.clear();
+        return job_status::signal_engine_terminate;
+    }
+    for (const input_event& event : m_events)
+    {
+        mp_input->apply(event);
+    }
+    return job_status::ok;
+}
+
+const std::vector<unsigned int>& replay_input_job::get_tick_passes()
+{
+    return m_tick_passes;
+}
+
+const char* replay_input_job::get_name()
+{
+    return "replay_input_job";
+}
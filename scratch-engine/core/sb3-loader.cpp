@@ -0,0 +1,799 @@
+/*
+File: sb3-loader.cpp
+Description: Implements the loader that turns Scratch 3 project files into CScratch sprites, costumes and compiled scripts
+*/
+
+#include "scratch-loader.hpp"
+#include "scratch-engine.hpp"
+#include "scratch-util.hpp"
+#include "scratch-trace.hpp"
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+using namespace scratch;
+
+namespace
+{
+    const int SB3_MAX_PLACEHOLDER_SIZE = 2048; // sizes read from damaged headers are clamped to this
+
+    double seconds_since(std::chrono::steady_clock::time_point start_time)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    }
+
+    unsigned int read_u32_big_endian(const unsigned char* p_data)
+    {
+        return ((unsigned int)p_data[0] << 24) | (p_data[1] << 16) | (p_data[2] << 8) | p_data[3];
+    }
+
+    // reads a numeric attribute out of an svg tag, "480" and "480px" both give 480
+    double read_svg_attribute(const std::string& tag, const char* p_name)
+    {
+        std::string pattern = std::string(" ") + p_name + "=";
+        size_t position = tag.find(pattern);
+
+        if (position == std::string::npos || position + pattern.size() >= tag.size())
+        {
+            return 0.0;
+        }
+        position += pattern.size() + 1; // skipping the opening quote
+        return atof(tag.c_str() + position);
+    }
+
+    // placeholders keep the size of the image they stand in for so layouts and collisions stay roughly right
+    void read_image_size(const std::string& file_type, const unsigned char* p_data, size_t size, int& width, int& height)
+    {
+        static const unsigned char p_png_signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+        std::string tag;
+        size_t tag_start = 0;
+        size_t tag_end = 0;
+        const char* p_view_box = nullptr;
+        double view_box[4] = {};
+
+        width = 0;
+        height = 0;
+        if (p_data == nullptr)
+        {
+            return;
+        }
+        if (file_type == ".png" && size >= 24 && memcmp(p_data, p_png_signature, sizeof(p_png_signature)) == 0) // IHDR is always the first chunk
+        {
+            width = (int)std::min(read_u32_big_endian(p_data + 16), (unsigned int)SB3_MAX_PLACEHOLDER_SIZE);
+            height = (int)std::min(read_u32_big_endian(p_data + 20), (unsigned int)SB3_MAX_PLACEHOLDER_SIZE);
+            return;
+        }
+        if (file_type != ".svg")
+        {
+            return;
+        }
+
+        tag.assign((const char*)p_data, std::min(size, (size_t)4096)); // the root element is always near the top
+        tag_start = tag.find("<svg");
+        tag_end = tag_start == std::string::npos ? std::string::npos : tag.find('>', tag_start);
+        if (tag_end == std::string::npos)
+        {
+            return;
+        }
+        tag = tag.substr(tag_start, tag_end - tag_start);
+        std::replace(tag.begin(), tag.end(), '\n', ' ');
+        std::replace(tag.begin(), tag.end(), '\t', ' ');
+        width = (int)std::min(read_svg_attribute(tag, "width"), (double)SB3_MAX_PLACEHOLDER_SIZE);
+        height = (int)std::min(read_svg_attribute(tag, "height"), (double)SB3_MAX_PLACEHOLDER_SIZE);
+        if ((width <= 0 || height <= 0) && (tag_start = tag.find(" viewBox=")) != std::string::npos && tag_start + 10 < tag.size())
+        {
+            p_view_box = tag.c_str() + tag_start + 10;
+            for (int i = 0; i < 4; ++i)
+            {
+                char* p_next = nullptr;
+                view_box[i] = strtod(p_view_box, &p_next);
+                p_view_box = p_next;
+                while (*p_view_box == ',' || *p_view_box == ' ')
+                {
+                    ++p_view_box;
+                }
+            }
+            width = (int)std::min(view_box[2], (double)SB3_MAX_PLACEHOLDER_SIZE);
+            height = (int)std::min(view_box[3], (double)SB3_MAX_PLACEHOLDER_SIZE);
+        }
+    }
+
+    // "#ff8000", anything else is black like in Scratch
+    scratch_state parse_color(const std::string& text)
+    {
+        unsigned long value = 0;
+
+        if (text.size() == 7 && text[0] == '#')
+        {
+            value = strtoul(text.c_str() + 1, nullptr, 16);
+        }
+        return scratch_state::make_color((unsigned char)(value >> 16), (unsigned char)(value >> 8), (unsigned char)value);
+    }
+}
+
+sb3_loader::sb3_loader(scratch_engine* p_engine)
+{
+    mp_engine = p_engine;
+    mp_stage = nullptr;
+    m_stats = {};
+    m_depth = 0;
+    m_too_deep = false;
+}
+
+// nothing is added to the engine unless the archive and project.json check out and no script nests deeper than SB3_MAX_BLOCK_DEPTH,
+// after that the load always completes (blocks, costumes and properties that can't be read are skipped or replaced by placeholders instead)
+load_status sb3_loader::load(const char* p_path, unsigned int decode_threads)
+{
+    SCRATCH_TRACE_SCOPE("sb3_loader::load");
+    std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point decode_start_time;
+    scratch_util::mapped_file file;
+    scratch_util::thread_pool* p_pool = nullptr;
+    std::vector<unsigned char> project_buffer;
+    const unsigned char* p_project = nullptr;
+    size_t project_size = 0;
+    std::vector<target_record> records;
+    std::vector<image_job> jobs;
+    std::unordered_map<std::string, unsigned int> job_lookup;
+    std::vector<target_record*> sprite_records;
+    int project_entry = -1;
+    int targets = -1;
+    int stage_record = -1;
+
+    m_stats = {};
+    mp_stage = nullptr;
+    if (mp_engine == nullptr || p_path == nullptr || !file.open(p_path))
+    {
+        return load_status::file_error;
+    }
+    if (!m_archive.open(file.get_data(), file.get_size()))
+    {
+        return load_status::archive_error;
+    }
+    project_entry = find_project_entry();
+    if (project_entry < 0 || !m_archive.read(project_entry, project_buffer, p_project, project_size))
+    {
+        return load_status::archive_error;
+    }
+    if (!m_document.parse((const char*)p_project, project_size))
+    {
+        return load_status::json_error;
+    }
+
+    targets = m_document.find(0, "targets");
+    if (targets < 0 || m_document.get(targets).type != json_type::array)
+    {
+        return load_status::project_error;
+    }
+    for (unsigned int target = targets + 1; target < m_document.get(targets).end; target = m_document.get(target).end)
+    {
+        target_record record = {};
+        int is_stage = m_document.find(target, "isStage");
+
+        if (m_document.get(target).type != json_type::object)
+        {
+            return load_status::project_error;
+        }
+        record.value = target;
+        if (is_stage >= 0 && m_document.get_boolean(is_stage))
+        {
+            if (stage_record >= 0) // there can only be one stage
+            {
+                return load_status::project_error;
+            }
+            stage_record = records.size();
+        }
+        records.push_back(record);
+    }
+    if (stage_record < 0)
+    {
+        return load_status::project_error;
+    }
+    m_stats.parse_seconds = seconds_since(start_time);
+
+    // costume files are found first so they can be decoding while the scripts compile. the stage's backdrops are not loaded, nothing draws them yet
+    for (unsigned int i = 0; i < records.size(); ++i)
+    {
+        if ((int)i != stage_record)
+        {
+            collect_costumes(records[i], jobs, job_lookup);
+        }
+    }
+    m_stats.images = jobs.size();
+    decode_start_time = std::chrono::steady_clock::now();
+    if (decode_threads != 1 && jobs.size() > 1)
+    {
+        p_pool = new scratch_util::thread_pool(std::min(decode_threads == 0 ? std::max(1u, std::thread::hardware_concurrency()) : decode_threads, (unsigned int)jobs.size()));
+        for (image_job& job : jobs) // jobs doesn't change size from here on so the references stay good
+        {
+            p_pool->submit([this, &job] { decode_image(job); });
+        }
+        m_stats.decode_threads = p_pool->get_thread_count();
+    }
+
+    m_converted.assign(m_document.get_count(), 0);
+    m_depth = 0;
+    m_too_deep = false;
+    build_target(records[stage_record]); // sprites need the stage for their global variables
+    mp_stage = records[stage_record].p_target;
+    for (unsigned int i = 0; i < records.size(); ++i)
+    {
+        if ((int)i != stage_record)
+        {
+            build_target(records[i]);
+            sprite_records.push_back(&records[i]);
+        }
+    }
+
+    if (p_pool != nullptr)
+    {
+        p_pool->wait();
+        delete p_pool;
+        m_stats.decode_seconds = seconds_since(decode_start_time);
+    }
+    else
+    {
+        decode_start_time = std::chrono::steady_clock::now();
+        for (image_job& job : jobs)
+        {
+            decode_image(job);
+        }
+        m_stats.decode_threads = 1;
+        m_stats.decode_seconds = seconds_since(decode_start_time);
+    }
+    for (image_job& job : jobs)
+    {
+        m_stats.placeholder_images += job.placeholder ? 1 : 0;
+    }
+    m_converted.clear();
+    m_converted.shrink_to_fit();
+
+    // the targets were only built, nothing in the engine knows about them yet
+    if (m_too_deep)
+    {
+        for (target_record& record : records)
+        {
+            delete record.p_target;
+            delete record.p_sprite;
+        }
+        for (image_job& job : jobs)
+        {
+            if (job.image.data != nullptr)
+            {
+                UnloadImage(job.image);
+            }
+        }
+        m_document = json_document();
+        m_archive = zip_archive();
+        m_block_lookup.clear();
+        m_block_lookup.shrink_to_fit();
+        mp_stage = nullptr;
+        return load_status::project_error;
+    }
+    mp_engine->get_scheduler()->add_target(records[stage_record].p_target);
+    for (target_record* p_record : sprite_records)
+    {
+        mp_engine->get_scheduler()->add_target(p_record->p_target);
+    }
+
+    // sprites go on top of each other in layer order, bottom first
+    std::stable_sort(sprite_records.begin(), sprite_records.end(), [](const target_record* p_a, const target_record* p_b) { return p_a->layer_order < p_b->layer_order; });
+    for (target_record* p_record : sprite_records)
+    {
+        apply_sprite_state(*p_record, jobs);
+        mp_engine->add_sprite(p_record->p_sprite, nullptr);
+    }
+    for (image_job& job : jobs)
+    {
+        if (!job.used && job.image.data != nullptr)
+        {
+            UnloadImage(job.image);
+        }
+    }
+
+    // the document points into the mapping, which goes away with this call
+    m_document = json_document();
+    m_archive = zip_archive();
+    m_block_lookup.clear();
+    m_block_lookup.shrink_to_fit();
+    m_stats.targets = records.size();
+    m_stats.total_seconds = seconds_since(start_time);
+    return load_status::ok;
+}
+
+vm_target* sb3_loader::get_stage()
+{
+    return mp_stage;
+}
+
+sb3_load_stats sb3_loader::get_stats()
+{
+    return m_stats;
+}
+
+int sb3_loader::find_project_entry()
+{
+    int entry = m_archive.find("project.json");
+    const std::string suffix = "/project.json";
+
+    m_prefix.clear();
+    if (entry >= 0)
+    {
+        return entry;
+    }
+    for (unsigned int i = 0; i < m_archive.get_entry_count(); ++i)
+    {
+        const std::string& name = m_archive.get_entry(i).name;
+        if (name.size() > suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0)
+        {
+            m_prefix = name.substr(0, name.size() - suffix.size() + 1);
+            return i;
+        }
+    }
+    return -1;
+}
+
+// costumes name their file either by md5ext or by assetId plus dataFormat, files used by several costumes are decoded once
+void sb3_loader::collect_costumes(target_record& record, std::vector<image_job>& jobs, std::unordered_map<std::string, unsigned int>& job_lookup)
+{
+    int costumes = m_document.find(record.value, "costumes");
+
+    if (costumes < 0 || m_document.get(costumes).type != json_type::array)
+    {
+        return;
+    }
+    for (unsigned int costume = costumes + 1; costume < m_document.get(costumes).end; costume = m_document.get(costume).end)
+    {
+        costume_record result = {};
+        int name = m_document.find(costume, "name");
+        int md5ext = m_document.find(costume, "md5ext");
+        int asset_id = m_document.find(costume, "assetId");
+        int data_format = m_document.find(costume, "dataFormat");
+        int resolution = m_document.find(costume, "bitmapResolution");
+        int center_x = m_document.find(costume, "rotationCenterX");
+        int center_y = m_document.find(costume, "rotationCenterY");
+        std::string file_name;
+        std::string file_type;
+        std::unordered_map<std::string, unsigned int>::iterator found;
+        int entry = -1;
+
+        if (m_document.get(costume).type != json_type::object)
+        {
+            continue;
+        }
+        result.name = name >= 0 ? m_document.get_wstring(name) : std::wstring();
+        result.resolution = resolution >= 0 ? m_document.get_number(resolution, 1.0) : 1.0;
+        result.resolution = result.resolution > 0.0 ? result.resolution : 1.0;
+        result.rotation_center_x = center_x >= 0 ? m_document.get_number(center_x) : 0.0;
+        result.rotation_center_y = center_y >= 0 ? m_document.get_number(center_y) : 0.0;
+        result.job = -1;
+
+        if (md5ext >= 0)
+        {
+            file_name = m_document.get_string(md5ext);
+        }
+        else if (asset_id >= 0 && data_format >= 0)
+        {
+            file_name = m_document.get_string(asset_id) + "." + m_document.get_string(data_format);
+        }
+        if (file_name.find('.') != std::string::npos)
+        {
+            file_type = file_name.substr(file_name.rfind('.'));
+            std::transform(file_type.begin(), file_type.end(), file_type.begin(), [](unsigned char c) { return (char)tolower(c); });
+        }
+
+        found = job_lookup.find(file_name);
+        if (found != job_lookup.end())
+        {
+            result.job = found->second;
+        }
+        else if (!file_name.empty() && (entry = m_archive.find(m_prefix + file_name)) >= 0)
+        {
+            image_job job = {};
+            job.entry = entry;
+            job.file_type = file_type;
+            result.job = jobs.size();
+            job_lookup[file_name] = jobs.size();
+            jobs.push_back(job);
+        }
+        record.costumes.push_back(result);
+    }
+}
+
+// runs on the decode threads. only reads the archive, which is safe to share, and writes nothing but its own job
+void sb3_loader::decode_image(image_job& job)
+{
+    SCRATCH_TRACE_SCOPE("sb3_loader::decode_image");
+    std::vector<unsigned char> buffer;
+    const unsigned char* p_data = nullptr;
+    size_t size = 0;
+    int width = 0;
+    int height = 0;
+
+    job.image = {};
+    job.placeholder = false;
+    if (m_archive.read(job.entry, buffer, p_data, size) && size <= INT_MAX)
+    {
+        job.image = LoadImageFromMemory(job.file_type.c_str(), p_data, (int)size); // SVGs only decode when raylib was built with SVG support
+    }
+    if (job.image.data != nullptr)
+    {
+        ImageFormat(&job.image, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8); // done here rather than in the asset cache, on the main thread
+        return;
+    }
+
+    read_image_size(job.file_type, p_data, size, width, height);
+    job.image = GenImageColor(std::max(width, 2), std::max(height, 2), SB3_PLACEHOLDER_COLOR);
+    job.placeholder = true;
+}
+
+// makes the target (and for sprites the sprite, whose costumes are added once the images are decoded) and compiles its scripts,
+// the target goes to the scheduler once every target has been built
+void sb3_loader::build_target(target_record& record)
+{
+    int name = m_document.find(record.value, "name");
+    int layer_order = m_document.find(record.value, "layerOrder");
+    int blocks = m_document.find(record.value, "blocks");
+
+    if (mp_stage == nullptr)
+    {
+        record.p_sprite = nullptr;
+        record.p_target = new vm_target(nullptr, nullptr);
+    }
+    else
+    {
+        record.p_sprite = new sprite(name >= 0 ? m_document.get_wstring(name) : std::wstring(L"Sprite"));
+        record.p_target = new vm_target(record.p_sprite, mp_stage);
+    }
+    record.layer_order = layer_order >= 0 ? m_document.get_number(layer_order) : 0.0;
+    declare_data(record);
+    if (blocks >= 0 && m_document.get(blocks).type == json_type::object)
+    {
+        compile_scripts(record, blocks);
+    }
+}
+
+// variables are {id: [name, value]} and lists {id: [name, [items]]}, the stage's are the global ones
+void sb3_loader::declare_data(target_record& record)
+{
+    int variables = m_document.find(record.value, "variables");
+    int lists = m_document.find(record.value, "lists");
+
+    if (variables >= 0 && m_document.get(variables).type == json_type::object)
+    {
+        for (unsigned int key = variables + 1; key < m_document.get(variables).end; key = m_document.get(key + 1).end)
+        {
+            unsigned int variable = key + 1;
+            if (m_document.get(variable).type == json_type::array && m_document.get(variable).length >= 2)
+            {
+                record.p_target->declare_variable(m_document.get_wstring(variable + 1), m_document.get_state(m_document.get(variable + 1).end));
+            }
+        }
+    }
+    if (lists >= 0 && m_document.get(lists).type == json_type::object)
+    {
+        for (unsigned int key = lists + 1; key < m_document.get(lists).end; key = m_document.get(key + 1).end)
+        {
+            unsigned int list = key + 1;
+            unsigned int items = 0;
+            scratch_list* p_list = nullptr;
+
+            if (m_document.get(list).type != json_type::array || m_document.get(list).length < 2)
+            {
+                continue;
+            }
+            p_list = &record.p_target->m_lists[record.p_target->declare_list(m_document.get_wstring(list + 1))];
+            items = m_document.get(list + 1).end;
+            if (m_document.get(items).type != json_type::array)
+            {
+                continue;
+            }
+            p_list->clear();
+            for (unsigned int item = items + 1; item < m_document.get(items).end && p_list->size() < LIST_ITEM_LIMIT; item = m_document.get(item).end)
+            {
+                p_list->push_back(m_document.get_state(item));
+            }
+        }
+    }
+}
+
+// blocks reference each other by id, so the ids are indexed before any script is converted
+void sb3_loader::compile_scripts(target_record& record, unsigned int blocks)
+{
+    SCRATCH_TRACE_SCOPE("sb3_loader::compile_scripts");
+    vm_compiler compiler(record.p_target);
+
+    m_block_lookup.clear();
+    for (unsigned int key = blocks + 1; key < m_document.get(blocks).end; key = m_document.get(key + 1).end)
+    {
+        if (m_document.get(key + 1).type == json_type::object) // loose variable and list reporters are stored as arrays, they never run
+        {
+            m_block_lookup.emplace_back(m_document.hash(key), key);
+        }
+    }
+    std::sort(m_block_lookup.begin(), m_block_lookup.end());
+
+    for (unsigned int key = blocks + 1; key < m_document.get(blocks).end; key = m_document.get(key + 1).end)
+    {
+        unsigned int block = key + 1;
+        int top_level = m_document.find(block, "topLevel");
+        int shadow = m_document.find(block, "shadow");
+        script_node* p_script = nullptr;
+
+        if (top_level < 0 || !m_document.get_boolean(top_level) || (shadow >= 0 && m_document.get_boolean(shadow)))
+        {
+            continue;
+        }
+        p_script = convert_stack(key);
+        if (p_script != nullptr && compiler.add_script(p_script))
+        {
+            ++m_stats.scripts;
+        }
+        delete p_script; // the compiler keeps nothing but the bytecode
+    }
+    compiler.finish();
+}
+
+// copies the image into each costume and sets the sprite up like the project left it, costumes have to be in before the position
+// since the stage fencing depends on the costume's bounds
+void sb3_loader::apply_sprite_state(target_record& record, std::vector<image_job>& jobs)
+{
+    sprite* p_sprite = record.p_sprite;
+    int rotation_style = m_document.find(record.value, "rotationStyle");
+    int current_costume = m_document.find(record.value, "currentCostume");
+    int size = m_document.find(record.value, "size");
+    int direction = m_document.find(record.value, "direction");
+    int x = m_document.find(record.value, "x");
+    int y = m_document.find(record.value, "y");
+    int visible = m_document.find(record.value, "visible");
+    double costume_index = current_costume >= 0 ? m_document.get_number(current_costume) : 0.0;
+
+    for (costume_record& costume_info : record.costumes)
+    {
+        Image image = {};
+
+        if (costume_info.job >= 0)
+        {
+            image_job& job = jobs[costume_info.job];
+            image = job.used ? ImageCopy(job.image) : job.image; // copies of the same pixels collapse into one asset in the cache
+            job.used = true;
+        }
+        else
+        {
+            image = GenImageColor(2, 2, SB3_PLACEHOLDER_COLOR);
+            ++m_stats.placeholder_images;
+        }
+        // bitmaps may be stored at twice the costume's size, the costume keeps Scratch's size and the renderers sample the whole image
+        p_sprite->add_costume(new costume(costume_info.name, image, costume_info.rotation_center_x / costume_info.resolution, costume_info.rotation_center_y / costume_info.resolution,
+            image.width / costume_info.resolution, image.height / costume_info.resolution, mp_engine->get_asset_cache()));
+        ++m_stats.costumes;
+    }
+
+    if (rotation_style >= 0)
+    {
+        if (m_document.equals(rotation_style, "left-right"))
+        {
+            p_sprite->set_rotation_mode(rotation_mode::left_right);
+        }
+        else if (m_document.equals(rotation_style, "don't rotate"))
+        {
+            p_sprite->set_rotation_mode(rotation_mode::none);
+        }
+        else
+        {
+            p_sprite->set_rotation_mode(rotation_mode::all_around);
+        }
+    }
+    if (p_sprite->get_costume_count() > 0)
+    {
+        // the index is range checked as a double, casting a huge or NaN one is undefined
+        costume_index = std::isfinite(costume_index) ? std::min(std::max(costume_index, 0.0), p_sprite->get_costume_count() - 1.0) : 0.0;
+        p_sprite->set_costume_number((unsigned int)costume_index + 1);
+    }
+    p_sprite->set_size(size >= 0 ? m_document.get_number(size, SPRITE_DEFAULT_SIZE) : SPRITE_DEFAULT_SIZE);
+    p_sprite->set_direction(direction >= 0 ? m_document.get_number(direction, 90.0) : 90.0);
+    p_sprite->set_x(x >= 0 ? m_document.get_number(x) : 0.0);
+    p_sprite->set_y(y >= 0 ? m_document.get_number(y) : 0.0);
+    p_sprite->set_hidden(visible >= 0 && !m_document.get_boolean(visible));
+}
+
+// entry of the block object with the id held by the string entry id, -1 if there is none
+int sb3_loader::find_block(unsigned int id)
+{
+    std::pair<unsigned long long, unsigned int> key(m_document.hash(id), 0);
+    std::vector<std::pair<unsigned long long, unsigned int>>::iterator it = std::lower_bound(m_block_lookup.begin(), m_block_lookup.end(), key);
+
+    for (; it != m_block_lookup.end() && it->first == key.first; ++it)
+    {
+        if (m_document.equals(it->second, id))
+        {
+            return it->second + 1;
+        }
+    }
+    return -1;
+}
+
+// follows the next links iteratively, long scripts would otherwise recurse once per block
+script_node* sb3_loader::convert_stack(unsigned int id)
+{
+    script_node* p_first = nullptr;
+    script_node* p_last = nullptr;
+    int block = find_block(id);
+    int next = -1;
+
+    if (m_too_deep || m_depth >= SB3_MAX_BLOCK_DEPTH) // each nested stack is another few frames on the native stack
+    {
+        m_too_deep = true;
+        return nullptr;
+    }
+    ++m_depth;
+    while (block >= 0 && !m_converted[block])
+    {
+        script_node* p_node = nullptr;
+
+        m_converted[block] = 1;
+        p_node = convert_block(block);
+        if (p_first == nullptr)
+        {
+            p_first = p_node;
+        }
+        else
+        {
+            p_last->mp_next = p_node;
+        }
+        p_last = p_node;
+        next = m_document.find(block, "next");
+        block = next >= 0 && m_document.get(next).type == json_type::string ? find_block(next) : -1;
+    }
+    --m_depth;
+    return p_first;
+}
+
+script_node* sb3_loader::convert_block(unsigned int block)
+{
+    int opcode = m_document.find(block, "opcode");
+    int fields = m_document.find(block, "fields");
+    int inputs = m_document.find(block, "inputs");
+    int mutation = m_document.find(block, "mutation");
+    script_node* p_node = new script_node(opcode >= 0 ? m_document.get_string(opcode) : std::string());
+
+    // fields are {"NAME": [value, id]}
+    if (fields >= 0 && m_document.get(fields).type == json_type::object)
+    {
+        for (unsigned int key = fields + 1; key < m_document.get(fields).end; key = m_document.get(key + 1).end)
+        {
+            unsigned int field = key + 1;
+            if (m_document.get(field).type == json_type::array && m_document.get(field).length >= 1)
+            {
+                p_node->add_field(m_document.get_string(key), m_document.get_wstring(field + 1));
+            }
+        }
+    }
+    if (inputs >= 0 && m_document.get(inputs).type == json_type::object)
+    {
+        for (unsigned int key = inputs + 1; key < m_document.get(inputs).end; key = m_document.get(key + 1).end)
+        {
+            script_node* p_input = convert_input(key + 1);
+            if (p_input != nullptr)
+            {
+                p_node->add_input(m_document.get_string(key), p_input);
+            }
+        }
+    }
+    if (mutation >= 0 && m_document.get(mutation).type == json_type::object)
+    {
+        convert_mutation(mutation, p_node->m_mutation);
+    }
+    return p_node;
+}
+
+// inputs are [1, shadow], [2, block] or [3, block, shadow]. the block wins, the shadow underneath it is used when the slot is empty
+script_node* sb3_loader::convert_input(unsigned int input)
+{
+    unsigned int value = 0;
+    script_node* p_node = nullptr;
+
+    if (m_document.get(input).type != json_type::array || m_document.get(input).length < 2)
+    {
+        return nullptr;
+    }
+    value = m_document.get(input + 1).end;
+    p_node = convert_input_value(value);
+    if (p_node == nullptr && m_document.get(input).length >= 3)
+    {
+        p_node = convert_input_value(m_document.get(value).end);
+    }
+    return p_node;
+}
+
+script_node* sb3_loader::convert_input_value(unsigned int value)
+{
+    switch (m_document.get(value).type)
+    {
+        case json_type::string:
+            return convert_stack(value);
+        case json_type::array:
+            return convert_primitive(value);
+        default:
+            return nullptr;
+    }
+}
+
+// shadows are usually stored inline as [type, value, ...]: 4-8 numbers, 9 colors, 10 text, 11 broadcasts, 12 variables and 13 lists
+script_node* sb3_loader::convert_primitive(unsigned int primitive)
+{
+    unsigned int value = 0;
+    double type = 0.0;
+    script_node* p_node = nullptr;
+
+    if (m_document.get(primitive).length < 2)
+    {
+        return nullptr;
+    }
+    value = m_document.get(primitive + 1).end;
+    type = m_document.get_number(primitive + 1);
+    if (!(type >= 4.0 && type < 14.0)) // also false for NaN, only known types are cast
+    {
+        return nullptr;
+    }
+    switch ((int)type)
+    {
+        case 4:
+        case 5:
+        case 6:
+        case 7:
+        case 8:
+        case 10:
+            return script_node::make_literal(m_document.get_state(value)); // numbers stay text, "1" and "1.0" mean different things to pick random
+        case 9:
+            return script_node::make_literal(parse_color(m_document.get_string(value)));
+        case 11:
+            return script_node::make_literal(scratch_state(m_document.get_wstring(value)));
+        case 12:
+            p_node = new script_node("data_variable");
+            p_node->add_field("VARIABLE", m_document.get_wstring(value));
+            return p_node;
+        case 13:
+            p_node = new script_node("data_listcontents");
+            p_node->add_field("LIST", m_document.get_wstring(value));
+            return p_node;
+        default:
+            return nullptr;
+    }
+}
+
+// argument ids and names are JSON arrays stored as strings inside the mutation
+void sb3_loader::convert_mutation(unsigned int mutation, script_mutation& result)
+{
+    int proccode = m_document.find(mutation, "proccode");
+    int warp = m_document.find(mutation, "warp");
+    int argument_ids = m_document.find(mutation, "argumentids");
+    int argument_names = m_document.find(mutation, "argumentnames");
+
+    result.proccode = proccode >= 0 ? m_document.get_wstring(proccode) : std::wstring();
+    result.warp = warp >= 0 && m_document.get_boolean(warp);
+    for (int i = 0; i < 2; ++i)
+    {
+        int source = i == 0 ? argument_ids : argument_names;
+        std::vector<std::wstring>& destination = i == 0 ? result.argument_ids : result.argument_names;
+        std::string text;
+        json_document list;
+
+        if (source < 0)
+        {
+            continue;
+        }
+        text = m_document.get_string(source);
+        if (!list.parse(text.data(), text.size()) || list.get(0).type != json_type::array)
+        {
+            continue;
+        }
+        for (unsigned int item = 1; item < list.get(0).end; item = list.get(item).end)
+        {
+            destination.push_back(list.get_wstring(item));
+        }
+    }
+}
@@ -0,0 +1,510 @@
+/*
+File: scheduler-job.cpp
+Description: Implements the job that runs Scratch scripts as cooperative threads
+*/
+
+#include "scratch-jobs.hpp"
+#include "scratch-util.hpp"
+#include "scratch-config.hpp"
+#include "scratch-trace.hpp"
+#include <algorithm>
+
+using namespace scratch;
+
+scheduler_job::scheduler_job(input_tracker* p_input, layer_list* p_layers, sprite_grid* p_sprite_grid, pen_layer* p_pen_layer)
+{
+    m_tick_time = 1.0 / SIMULATION_DEFAULT_TICK_RATE;
+    m_time_base = 0.0;
+    m_ticks_since_base = 0;
+    m_turbo = false;
+    m_last_wait_group = 0;
+    m_last_generation = 0;
+    mp_clone_pool = new sprite_pool();
+    m_clone_count = 0;
+    m_clone_limit = SPRITE_DEFAULT_CLONE_LIMIT;
+    mp_pass_log = nullptr;
+    m_pass_limit = 0;
+    m_context = {};
+    m_context.p_input = p_input;
+    m_context.p_layers = p_layers;
+    m_context.p_sprite_grid = p_sprite_grid;
+    m_context.p_pen_layer = p_pen_layer;
+    m_context.p_broadcasts = &m_broadcasts;
+    m_context.random_state = (unsigned long long)std::chrono::steady_clock::now().time_since_epoch().count() | 1; // xorshift must never be seeded with 0
+}
+
+// clones live in the layer list too, they are taken out of it here so the engine only ever frees the sprites it was given
+scheduler_job::~scheduler_job()
+{
+    for (scheduled_thread& thread : m_threads)
+    {
+        delete thread.p_thread;
+    }
+    m_threads.clear();
+    for (vm_thread* p_thread : m_free_threads)
+    {
+        delete p_thread;
+    }
+    delete_all_clones();
+    for (vm_target* p_target : m_targets)
+    {
+        delete p_target;
+    }
+    for (vm_target* p_target : m_free_clone_targets)
+    {
+        delete p_target;
+    }
+    delete mp_clone_pool;
+}
+
+// one tick of Scratch's sequencer: every thread is stepped once per pass and passes repeat until no thread is
+// left running, something visible changed (ignored in turbo mode) or SCHEDULER_WORK_FRACTION of the tick is gone
+// the clock scripts see is simulation time, it moves by exactly one tick per run so waits don't depend on how fast ticks are run
+// threads parked in a wait block don't count as running since the clock only moves between ticks
+job_status scheduler_job::run()
+{
+    std::chrono::steady_clock::time_point frame_start = std::chrono::steady_clock::now();
+    std::chrono::duration<double> work_time(SCHEDULER_WORK_FRACTION * m_tick_time);
+    unsigned int running_threads = 0;
+    unsigned int passes = 0;
+    size_t kept_threads = 0;
+    job_status status = job_status::ok;
+
+    m_context.current_time = m_time_base + m_ticks_since_base * m_tick_time;
+    ++m_ticks_since_base;
+
+    do
+    {
+        ++passes;
+        running_threads = 0;
+        m_context.redraw_requested = false;
+        for (unsigned int i = 0; i < m_threads.size(); ++i) // threads started during the pass get stepped in the same pass
+        {
+            if (m_threads[i].p_thread == nullptr)
+            {
+                continue;
+            }
+            if (m_threads[i].waiting_for != 0)
+            {
+                if (is_group_running(m_threads[i].waiting_for))
+                {
+                    continue;
+                }
+                m_threads[i].waiting_for = 0;
+            }
+
+            status = step_thread(i);
+            if (status == job_status::signal_vm_halt)
+            {
+                stop_all();
+                break;
+            }
+            if (m_threads[i].p_thread != nullptr && m_threads[i].waiting_for == 0 && !m_threads[i].p_thread->is_waiting())
+            {
+                ++running_threads;
+            }
+        }
+
+        // dropping stopped threads while keeping the order the rest run in
+        kept_threads = 0;
+        for (scheduled_thread& thread : m_threads)
+        {
+            if (thread.p_thread != nullptr)
+            {
+                m_threads[kept_threads++] = thread;
+            }
+        }
+        m_threads.resize(kept_threads);
+    } while (status != job_status::signal_vm_halt && (m_pass_limit != 0 ? passes < m_pass_limit
+        : running_threads > 0 && (m_turbo || !m_context.redraw_requested) && std::chrono::steady_clock::now() - frame_start < work_time));
+
+    if (mp_pass_log != nullptr)
+    {
+        mp_pass_log->push_back(passes);
+    }
+    return job_status::ok;
+}
+
+const char* scheduler_job::get_name()
+{
+    return "scheduler_job";
+}
+
+void scheduler_job::add_target(vm_target* p_target)
+{
+    if (p_target != nullptr)
+    {
+        m_targets.push_back(p_target);
+    }
+}
+
+vm_target* scheduler_job::find_target(sprite* p_sprite)
+{
+    for (vm_target* p_target : m_targets)
+    {
+        if (p_target->mp_sprite == p_sprite)
+        {
+            return p_target;
+        }
+    }
+    return nullptr;
+}
+
+const std::vector<vm_target*>& scheduler_job::get_targets()
+{
+    return m_targets;
+}
+
+// starts every script under a matching hat (broadcast names match case insensitively), returns how many were started
+// like Scratch, scripts that are already running are restarted from the top except for key press scripts which are left alone
+unsigned int scheduler_job::start_hats(vm_hat hat, const std::wstring& parameter, vm_target* p_only_target)
+{
+    bool restart = hat != vm_hat::key_pressed && hat != vm_hat::clone_start;
+    unsigned int started = 0;
+    unsigned int wait_group = 0;
+
+    if (hat == vm_hat::broadcast_received) // every broadcast gets its own group so broadcast and wait knows what to wait on
+    {
+        wait_group = ++m_last_wait_group;
+    }
+    for (vm_target* p_target : m_targets)
+    {
+        if (p_only_target != nullptr && p_target != p_only_target)
+        {
+            continue;
+        }
+        for (const vm_script_entry& script : p_target->mp_program->m_scripts)
+        {
+            if (script.hat != hat)
+            {
+                continue;
+            }
+            if ((hat == vm_hat::broadcast_received || hat == vm_hat::key_pressed) && !string_equals_ignore_case(script.hat_parameter, parameter))
+            {
+                continue;
+            }
+            if (start_script(p_target, script.entry, restart, wait_group))
+            {
+                ++started;
+            }
+        }
+    }
+    return started;
+}
+
+// the green flag stops everything, resets the timer and then starts the flag scripts
+void scheduler_job::green_flag()
+{
+    stop_all();
+    m_context.timer_start = m_time_base + m_ticks_since_base * m_tick_time; // the time the next tick will see
+    start_hats(vm_hat::green_flag, L"");
+}
+
+// like the stop sign in Scratch this also deletes every clone
+void scheduler_job::stop_all()
+{
+    for (unsigned int i = 0; i < m_threads.size(); ++i)
+    {
+        stop_thread(i);
+    }
+    m_threads.clear();
+    m_broadcasts.clear();
+    delete_all_clones();
+}
+
+void scheduler_job::set_tick_rate(double ticks_per_second)
+{
+    if (ticks_per_second > 0.0)
+    {
+        m_time_base += m_ticks_since_base * m_tick_time;
+        m_ticks_since_base = 0;
+        m_tick_time = 1.0 / ticks_per_second;
+    }
+}
+
+void scheduler_job::set_turbo(bool turbo)
+{
+    m_turbo = turbo;
+}
+
+void scheduler_job::set_clone_limit(unsigned int clone_limit)
+{
+    m_clone_limit = clone_limit;
+}
+
+// pick random is the only randomness scripts can see, so a fixed seed makes a replayed session come out the same
+void scheduler_job::set_random_seed(unsigned long long seed)
+{
+    m_context.random_state = seed | 1; // xorshift must never be seeded with 0
+}
+
+void scheduler_job::set_pass_log(std::vector<unsigned int>* p_pass_log)
+{
+    mp_pass_log = p_pass_log;
+}
+
+// the time budget is the one thing in a tick that depends on how fast the machine is, replays take the recorded pass counts instead
+void scheduler_job::set_pass_limit(unsigned int passes)
+{
+    m_pass_limit = passes;
+}
+
+unsigned int scheduler_job::get_clone_count()
+{
+    return m_clone_count;
+}
+
+unsigned int scheduler_job::get_thread_count()
+{
+    unsigned int count = 0;
+
+    for (scheduled_thread& thread : m_threads)
+    {
+        count += thread.p_thread != nullptr ? 1 : 0;
+    }
+    return count;
+}
+
+// returns false when the script is already running and restart is false
+bool scheduler_job::start_script(vm_target* p_target, unsigned int entry, bool restart, unsigned int wait_group)
+{
+    scheduled_thread thread = {};
+
+    for (unsigned int i = 0; i < m_threads.size(); ++i)
+    {
+        if (m_threads[i].p_thread == nullptr || m_threads[i].p_thread->get_target() != p_target || m_threads[i].p_thread->get_entry() != entry)
+        {
+            continue;
+        }
+        if (!restart)
+        {
+            return false;
+        }
+        stop_thread(i); // restarting in place so the thread keeps its spot in the execution order
+        m_threads[i].p_thread = new_thread(p_target, entry);
+        m_threads[i].wait_group = wait_group;
+        m_threads[i].generation = ++m_last_generation;
+        return true;
+    }
+
+    thread.p_thread = new_thread(p_target, entry);
+    thread.wait_group = wait_group;
+    thread.generation = ++m_last_generation;
+    m_threads.push_back(thread);
+    return true;
+}
+
+// runs one thread until it yields, then starts whatever it broadcast
+job_status scheduler_job::step_thread(unsigned int index)
+{
+    SCRATCH_TRACE_SCOPE("scheduler_job::step_thread");
+    vm_thread* p_thread = m_threads[index].p_thread;
+    vm_target* p_target = p_thread->get_target();
+    job_status status = job_status::ok;
+    unsigned int wait_group = 0;
+    unsigned int generation = m_threads[index].generation;
+
+    m_context.warp_deadline = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(SCHEDULER_WARP_TIME_LIMIT));
+    status = p_thread->step(m_context);
+    while (status == job_status::signal_scheduler_terminate_others || status == job_status::signal_create_clone) // handled right away, then the thread carries on
+    {
+        if (status == job_status::signal_create_clone)
+        {
+            create_clone(p_target, m_context.clone_option);
+        }
+        for (unsigned int i = 0; i < m_threads.size() && status == job_status::signal_scheduler_terminate_others; ++i) // stop other scripts in sprite
+        {
+            if (i != index && m_threads[i].p_thread != nullptr && m_threads[i].p_thread->get_target() == p_target)
+            {
+                stop_thread(i);
+            }
+        }
+        status = p_thread->step(m_context);
+    }
+    if (status == job_status::signal_vm_halt)
+    {
+        return status;
+    }
+
+    // starting receivers can grow m_threads so only indices are held on to from here on
+    for (unsigned int i = 0; i < m_broadcasts.size(); ++i)
+    {
+        vm_broadcast broadcast = m_broadcasts[i];
+        unsigned int started = start_hats(vm_hat::broadcast_received, broadcast.name);
+        wait_group = m_last_wait_group;
+        if (broadcast.wait && started > 0 && m_threads[index].generation == generation) // the sender may have restarted itself
+        {
+            m_threads[index].waiting_for = wait_group;
+        }
+    }
+    m_broadcasts.clear();
+
+    if (status == job_status::signal_delete_clone) // after the broadcasts since those were sent before the clone went away
+    {
+        delete_clone(p_target);
+        return status;
+    }
+    if ((status == job_status::signal_job_terminate || status == job_status::error) && m_threads[index].generation == generation)
+    {
+        stop_thread(index);
+    }
+    return status;
+}
+
+vm_thread* scheduler_job::new_thread(vm_target* p_target, unsigned int entry)
+{
+    vm_thread* p_thread = nullptr;
+
+    if (m_free_threads.empty())
+    {
+        return new vm_thread(p_target, entry);
+    }
+    p_thread = m_free_threads.back();
+    m_free_threads.pop_back();
+    p_thread->reset(p_target, entry);
+    return p_thread;
+}
+
+void scheduler_job::stop_thread(unsigned int index)
+{
+    if (m_threads[index].p_thread != nullptr)
+    {
+        m_free_threads.push_back(m_threads[index].p_thread);
+    }
+    m_threads[index].p_thread = nullptr;
+    m_threads[index].wait_group = 0;
+    m_threads[index].waiting_for = 0;
+}
+
+bool scheduler_job::is_group_running(unsigned int wait_group)
+{
+    for (scheduled_thread& thread : m_threads)
+    {
+        if (thread.p_thread != nullptr && thread.wait_group == wait_group)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// "when key pressed" scripts fire once for every key down event the engine takes off its input queue (key repeats included)
+void scheduler_job::start_key_hats(int keycode)
+{
+    for (vm_target* p_target : m_targets)
+    {
+        for (const vm_script_entry& script : p_target->mp_program->m_scripts)
+        {
+            if (script.hat != vm_hat::key_pressed)
+            {
+                continue;
+            }
+            if (scratch_util::key_name_to_keycode(script.hat_parameter) == keycode || script.hat_parameter == L"any")
+            {
+                start_script(p_target, script.entry, false, 0);
+            }
+        }
+    }
+}
+
+// "_myself_" clones whatever is running the block (clones included), any other name clones that sprite's original
+// the clone goes right below its parent and its "when I start as a clone" scripts run later in the same pass
+// returns false when there was nothing to clone or the clone limit has been reached
+bool scheduler_job::create_clone(vm_target* p_parent, const scratch_state& option)
+{
+    vm_target* p_source = nullptr;
+    vm_target* p_clone = nullptr;
+    sprite* p_sprite = nullptr;
+
+    if (m_clone_limit != 0 && m_clone_count >= m_clone_limit)
+    {
+        return false;
+    }
+    if (option.string_equals(L"_myself_"))
+    {
+        p_source = p_parent;
+    }
+    else
+    {
+        for (vm_target* p_target : m_targets)
+        {
+            if (p_target->mp_sprite != nullptr && !p_target->is_clone() && option.string_equals(p_target->mp_sprite->get_name().c_str()))
+            {
+                p_source = p_target;
+                break;
+            }
+        }
+    }
+    if (p_source == nullptr || p_source->mp_sprite == nullptr) // the stage can't be cloned
+    {
+        return false;
+    }
+
+    p_sprite = mp_clone_pool->acquire(p_source->mp_sprite);
+    p_sprite->insert_below(p_source->mp_sprite);
+    if (m_free_clone_targets.empty())
+    {
+        p_clone = new vm_target(nullptr, nullptr);
+    }
+    else
+    {
+        p_clone = m_free_clone_targets.back();
+        m_free_clone_targets.pop_back();
+    }
+    p_clone->make_clone_of(p_source, p_sprite);
+    m_targets.push_back(p_clone);
+    ++m_clone_count;
+    if (!p_sprite->is_hidden())
+    {
+        m_context.redraw_requested = true;
+    }
+    start_hats(vm_hat::clone_start, L"", p_clone);
+    return true;
+}
+
+// stops every script the clone is running and hands its sprite and target back for reuse
+void scheduler_job::delete_clone(vm_target* p_clone)
+{
+    std::vector<vm_target*>::iterator found = std::find(m_targets.begin(), m_targets.end(), p_clone);
+
+    if (found == m_targets.end() || !p_clone->is_clone())
+    {
+        return;
+    }
+    for (unsigned int i = 0; i < m_threads.size(); ++i)
+    {
+        if (m_threads[i].p_thread != nullptr && m_threads[i].p_thread->get_target() == p_clone)
+        {
+            stop_thread(i);
+        }
+    }
+    m_targets.erase(found); // keeping the order the remaining targets start their scripts in
+    if (!p_clone->mp_sprite->is_hidden())
+    {
+        m_context.redraw_requested = true;
+    }
+    mp_clone_pool->release(p_clone->mp_sprite);
+    p_clone->mp_sprite = nullptr;
+    m_free_clone_targets.push_back(p_clone);
+    --m_clone_count;
+}
+
+// the threads of deleted clones have to be stopped already, this only frees the clones themselves
+void scheduler_job::delete_all_clones()
+{
+    size_t kept_targets = 0;
+
+    for (vm_target* p_target : m_targets)
+    {
+        if (!p_target->is_clone())
+        {
+            m_targets[kept_targets++] = p_target;
+            continue;
+        }
+        mp_clone_pool->release(p_target->mp_sprite);
+        p_target->mp_sprite = nullptr;
+        m_free_clone_targets.push_back(p_target);
+    }
+    m_targets.resize(kept_targets);
+    m_clone_count = 0;
+}
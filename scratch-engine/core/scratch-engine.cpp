@@ -4,7 +4,9 @@ Description: Main include file for use of the CScratch engine for external progr
 */
 
 #include "scratch-engine.hpp"
-#include <iostream>
+#include "scratch-trace.hpp"
+#include <algorithm>
+#include <chrono>
 #include <cstring>
 
 using namespace scratch;
@@ -12,23 +14,51 @@ using namespace scratch;
 // creates a scratch engine instance that uses a renderer
 // please note that the renderer becomes the property of scratch engine after it is initialized with the renderer please do not ever touch the renderer again in external code
 // renderer will be destroyed when the object is destroyed
-scratch_engine::scratch_engine(const char* window_title)
+// in headless mode no window is opened and the stage is drawn into an in-memory framebuffer as fast as the CPU allows (no frame rate cap)
+scratch_engine::scratch_engine(const char* window_title, engine_mode mode)
 {
-    memset(mp_key_pressed, 0, sizeof(mp_key_pressed));
-    SetConfigFlags(FLAG_WINDOW_RESIZABLE);
-    SetTraceLogLevel(LOG_FATAL);
-    InitWindow(1280, 720, window_title);
-    SetTargetFPS(TARGET_FRAMERATE);
-
-    m_mouse_data.x = 0.0;
-    m_mouse_data.y = 0.0;
-    m_mouse_data.mouse_down = false;
-
-    m_sprite_list.p_bottom_sprite = nullptr;
-    m_sprite_list.p_top_sprite = nullptr;
+    m_mode = mode;
+    m_tick_rate = SIMULATION_DEFAULT_TICK_RATE;
+    m_turbo = false;
+    m_tick_accumulator = 0.0;
+    m_last_frame_time = std::chrono::steady_clock::now();
+    m_tick_count = 0;
+    mp_stage_framebuffer = nullptr;
+    mp_costume_atlas = nullptr;
+    mp_asset_cache = nullptr;
+    mp_sprite_grid = new sprite_grid();
+    mp_transforms = new transform_store(mp_sprite_grid);
+    mp_sprite_grid->set_transform_store(mp_transforms);
+    mp_layers = new layer_list();
+    mp_pen_layer = new pen_layer();
+    mp_stage_damage = new stage_damage();
+    m_render_stats = {};
+    mp_record_job = nullptr;
+    mp_replay_job = nullptr;
+    if (m_mode == engine_mode::windowed)
+    {
+        SetConfigFlags(FLAG_WINDOW_RESIZABLE);
+        SetTraceLogLevel(LOG_FATAL);
+        InitWindow(WINDOW_DEFAULT_WIDTH, WINDOW_DEFAULT_HEIGHT, window_title);
+        SetTargetFPS(TARGET_FRAMERATE); // only paces presentation, logic ticks run at m_tick_rate regardless
+    }
 
-    mp_core_jobs[static_cast<int>(core_jobs::input)] = new input_job(mp_key_pressed);
-    mp_core_jobs[static_cast<int>(core_jobs::render)] = new render_job(&m_sprite_list.p_bottom_sprite);
+    if (m_mode == engine_mode::headless)
+    {
+        mp_stage_framebuffer = new Color[STAGE_PIXEL_COUNT];
+        mp_core_jobs[static_cast<int>(core_jobs::input)] = new input_job(new input_source(), &m_input); // no window to poll, see set_input_source
+        mp_core_jobs[static_cast<int>(core_jobs::scheduler)] = new scheduler_job(&m_input, mp_layers, mp_sprite_grid, mp_pen_layer);
+        mp_core_jobs[static_cast<int>(core_jobs::render)] = new software_render_job(mp_layers, mp_pen_layer, mp_stage_damage, mp_stage_framebuffer, &m_render_stats);
+    }
+    else
+    {
+        mp_costume_atlas = new costume_atlas();
+        mp_core_jobs[static_cast<int>(core_jobs::input)] = new input_job(new window_input_source(), &m_input);
+        mp_core_jobs[static_cast<int>(core_jobs::scheduler)] = new scheduler_job(&m_input, mp_layers, mp_sprite_grid, mp_pen_layer);
+        mp_core_jobs[static_cast<int>(core_jobs::render)] = new render_job(mp_layers, mp_pen_layer, mp_stage_damage, &m_render_stats);
+    }
+    mp_core_jobs[static_cast<int>(core_jobs::record)] = new engine_job(); // replaced by start_recording
+    mp_asset_cache = new asset_cache(mp_costume_atlas);
     for (engine_job* p_job : mp_core_jobs)
     {
         if (p_job == nullptr)
@@ -44,23 +74,41 @@ scratch_engine::scratch_engine(const char* window_title)
 // frees all data associated with the scratch engine
 scratch_engine::~scratch_engine()
 {
-    sprite* p_sprite = m_sprite_list.p_bottom_sprite;
-    sprite* p_sprite_above = nullptr;
-    CloseWindow();
+    std::vector<sprite*> sprites;
 
-    // freeing all data associated with the engine
+    // freeing all data associated with the engine, the scheduler's targets go before the sprites they point at
+    // and the scheduler takes its clones out of the layers, so the layers are only walked afterwards
     for (engine_job* p_job : mp_core_jobs)
     {
         delete p_job;
     }
-    while (p_sprite != nullptr)
+    sprites = mp_layers->get_draw_order();
+    for (sprite* p_sprite : sprites)
     {
-        p_sprite_above = p_sprite->mp_above;
+        mp_layers->remove(p_sprite);
         delete p_sprite;
     }
+    delete mp_layers;
+    mp_layers = nullptr;
+    delete[] mp_stage_framebuffer;
+    mp_stage_framebuffer = nullptr;
+    delete mp_asset_cache; // after the sprites since their costumes hold on to cached assets
+    mp_asset_cache = nullptr;
+    delete mp_costume_atlas; // after the cache since its assets may live in the atlas
+    mp_costume_atlas = nullptr;
+    delete mp_transforms; // same as the grid
+    mp_transforms = nullptr;
+    delete mp_sprite_grid; // sprites unlink themselves when deleted so the grid has to outlive them
+    mp_sprite_grid = nullptr;
+    delete mp_pen_layer;
+    mp_pen_layer = nullptr;
+    delete mp_stage_damage; // clones report to it as they are deleted, so it goes after the sprites too
+    mp_stage_damage = nullptr;
 
-    m_sprite_list.p_bottom_sprite = nullptr;
-    m_sprite_list.p_top_sprite = nullptr;
+    if (m_mode == engine_mode::windowed) // window goes last since the jobs and costumes still need the GPU context to unload their textures
+    {
+        CloseWindow();
+    }
 }
 
 engine_status scratch_engine::get_status()
@@ -68,104 +116,371 @@ engine_status scratch_engine::get_status()
     return m_status;
 }
 
+engine_mode scratch_engine::get_mode()
+{
+    return m_mode;
+}
+
+// returns the last frame drawn by the software rasterizer (STAGE_SIZE_X * STAGE_SIZE_Y pixels, top row first)
+// only available in headless mode, returns nullptr otherwise
+const Color* scratch_engine::get_stage_framebuffer()
+{
+    return mp_stage_framebuffer;
+}
+
+// counters from the last rendered frame
+render_stats scratch_engine::get_render_stats()
+{
+    return m_render_stats;
+}
+
+// every added sprite in layer order, bottom first
+layer_list* scratch_engine::get_layers()
+{
+    return mp_layers;
+}
+
+// broad phase grid every added sprite is kept in, get_stats() reports how well the cell size fits the project
+sprite_grid* scratch_engine::get_sprite_grid()
+{
+    return mp_sprite_grid;
+}
+
+// atlas the asset cache packs costumes into when they are first drawn, nullptr in headless mode
+costume_atlas* scratch_engine::get_costume_atlas()
+{
+    return mp_costume_atlas;
+}
+
+// pass this when creating costumes for the engine so identical images are only stored and uploaded once
+asset_cache* scratch_engine::get_asset_cache()
+{
+    return mp_asset_cache;
+}
+
+// pen lines and stamps waiting to be drawn, scripts fill it through the pen blocks
+pen_layer* scratch_engine::get_pen_layer()
+{
+    return mp_pen_layer;
+}
+
+// what the renderer has to redraw next frame, get_stats() reports how many frames were skipped or only partly redrawn
+stage_damage* scratch_engine::get_stage_damage()
+{
+    return mp_stage_damage;
+}
+
+// the job that runs scripts, add targets to it and start them with green_flag()
+scheduler_job* scratch_engine::get_scheduler()
+{
+    return static_cast<scheduler_job*>(mp_core_jobs[static_cast<int>(core_jobs::scheduler)]);
+}
+
+// runs one presented frame: polls input, runs as many logic ticks as are due and draws the stage once
+// windowed, ticks follow the real clock at the tick rate (capped at SIMULATION_MAX_CATCHUP_TICKS per frame)
+// headless runs exactly one tick per frame so runs are reproducible, and turbo mode runs ticks for a whole frame's worth of time
 engine_status scratch_engine::next_tick()
 {
+    SCRATCH_TRACE_SCOPE("scratch_engine::next_tick");
+    std::chrono::steady_clock::time_point frame_start = std::chrono::steady_clock::now();
+    std::chrono::duration<double> frame_time(1.0 / TARGET_FRAMERATE);
+    double tick_time = 1.0 / m_tick_rate;
+    unsigned int due_ticks = 0;
+
     if (m_status != engine_status::ok)
     {
         return m_status;
     }
-    for (engine_job* p_job : mp_core_jobs)
+    if (!run_job(core_jobs::input))
+    {
+        return m_status;
+    }
+    dispatch_input();
+
+    if (mp_replay_job != nullptr) // the trace says how many ticks this frame ran and how far each got, the clock has no say
     {
-        switch (p_job->run())
+        for (unsigned int passes : mp_replay_job->get_tick_passes())
         {
-            case job_status::signal_engine_terminate:
-                m_status = engine_status::exited;
+            get_scheduler()->set_pass_limit(passes);
+            if (!run_job(core_jobs::scheduler))
+            {
                 return m_status;
-            default:
-                break;
+            }
+            ++m_tick_count;
         }
     }
-    m_status = engine_status::ok;
-    return engine_status::ok;
+    else if (m_turbo)
+    {
+        do
+        {
+            if (!run_job(core_jobs::scheduler))
+            {
+                return m_status;
+            }
+            ++m_tick_count;
+        } while (std::chrono::steady_clock::now() - frame_start < frame_time);
+        m_tick_accumulator = 0.0;
+    }
+    else if (m_mode == engine_mode::headless)
+    {
+        if (!run_job(core_jobs::scheduler))
+        {
+            return m_status;
+        }
+        ++m_tick_count;
+    }
+    else
+    {
+        m_tick_accumulator += std::chrono::duration<double>(frame_start - m_last_frame_time).count();
+        due_ticks = std::min((unsigned int)(m_tick_accumulator / tick_time), (unsigned int)SIMULATION_MAX_CATCHUP_TICKS);
+        m_tick_accumulator = std::min(m_tick_accumulator - due_ticks * tick_time, tick_time); // whatever could not be caught up is dropped
+        for (unsigned int i = 0; i < due_ticks; ++i)
+        {
+            if (!run_job(core_jobs::scheduler))
+            {
+                return m_status;
+            }
+            ++m_tick_count;
+        }
+    }
+    m_last_frame_time = frame_start;
+    if (!run_job(core_jobs::record))
+    {
+        return m_status;
+    }
+
+    mp_asset_cache->begin_frame();
+    mp_transforms->update(); // whatever moved since the last frame gets laid out in one go before the renderer reads it
+    if (!run_job(core_jobs::render))
+    {
+        return m_status;
+    }
+    return m_status;
 }
 
-// inserts sprite into sprite list below sprite p_above
-// if p_above is not provided (ie p_above == nullptr), p_sprite is inserted at the top of the sprite list
-void scratch_engine::add_sprite(sprite* p_sprite, sprite* p_above)
+// runs tick_count logic ticks back to back without polling input or drawing anything, for batch runs where only the final state matters
+// call next_tick afterwards to see the result
+engine_status scratch_engine::run_ticks(unsigned long long tick_count)
 {
-    if (p_sprite == nullptr)
+    SCRATCH_TRACE_SCOPE("scratch_engine::run_ticks");
+
+    for (unsigned long long i = 0; i < tick_count && m_status == engine_status::ok; ++i)
+    {
+        if (!run_job(core_jobs::scheduler))
+        {
+            break;
+        }
+        ++m_tick_count;
+    }
+    run_job(core_jobs::record);
+    m_last_frame_time = std::chrono::steady_clock::now(); // the time spent here should not be caught up on by the next frame
+    m_tick_accumulator = 0.0;
+    return m_status;
+}
+
+void scratch_engine::set_tick_rate(double ticks_per_second)
+{
+    if (ticks_per_second <= 0.0)
     {
         return;
     }
-    if (p_above == nullptr) // insert sprite at the top of the sprite list
+    m_tick_rate = ticks_per_second;
+    get_scheduler()->set_tick_rate(ticks_per_second);
+}
+
+// turbo mode runs logic ticks for the whole frame instead of at the tick rate, and scripts keep running after visible changes
+void scratch_engine::set_turbo(bool turbo)
+{
+    m_turbo = turbo;
+    get_scheduler()->set_turbo(turbo);
+}
+
+bool scratch_engine::is_turbo()
+{
+    return m_turbo;
+}
+
+// logic ticks run since the engine was created
+unsigned long long scratch_engine::get_tick_count()
+{
+    return m_tick_count;
+}
+
+bool scratch_engine::run_job(core_jobs job)
+{
+    engine_job* p_job = mp_core_jobs[static_cast<int>(job)];
+    job_status status = job_status::ok;
+
+    {
+        SCRATCH_TRACE_SCOPE(p_job->get_name());
+        status = p_job->run();
+    }
+    switch (status)
+    {
+        case job_status::signal_engine_terminate:
+            m_status = engine_status::exited;
+            return false;
+        default:
+            return true;
+    }
+}
+
+// topmost visible sprite with an opaque pixel under the given stage point, nullptr if the point is on the bare stage
+// the grid narrows things down to the sprites sharing the point's cell, the layers are only asked when several of them are hit
+sprite* scratch_engine::pick_sprite(double x, double y)
+{
+    sprite* p_top_hit = nullptr;
+    unsigned int top_layer = 0;
+
+    for (sprite* p_sprite : mp_sprite_grid->query_point(x, y))
     {
-        if (m_sprite_list.p_bottom_sprite == nullptr) // bottom sprite being null implies sprite list is empty implying top sprite is also null so no need to check
+        if (!p_sprite->touches_point(x, y))
         {
-            m_sprite_list.p_bottom_sprite = p_sprite;
-            m_sprite_list.p_top_sprite = p_sprite;
+            continue;
         }
-        else
+        if (p_top_hit == nullptr)
         {
-            m_sprite_list.p_top_sprite->mp_above = p_sprite;
-            p_sprite->mp_below = m_sprite_list.p_top_sprite;
-            m_sprite_list.p_top_sprite = p_sprite;
+            p_top_hit = p_sprite;
+            continue;
         }
-    }
-    else // insert sprite below p_above
-    {
-        if(m_sprite_list.p_bottom_sprite == p_above)
+        if (top_layer == 0)
+        {
+            top_layer = p_top_hit->get_layer();
+        }
+        if (p_sprite->get_layer() > top_layer)
         {
-            m_sprite_list.p_bottom_sprite = p_sprite;
+            p_top_hit = p_sprite;
+            top_layer = p_sprite->get_layer();
         }
-        p_sprite->mp_above = p_above;
-        p_above->mp_below = p_sprite;
     }
+    return p_top_hit;
+}
+
+// starts the "when this sprite clicked" scripts of whatever is under the given stage point, the stage's own if no sprite is there
+void scratch_engine::click(double x, double y)
+{
+    scheduler_job* p_scheduler = get_scheduler();
+    vm_target* p_target = p_scheduler->find_target(pick_sprite(x, y));
+
+    if (p_target == nullptr) // sprites without scripts swallow the click like they do in Scratch
+    {
+        return;
+    }
+    p_scheduler->start_hats(vm_hat::sprite_clicked, L"", p_target);
+}
+
+// keys held down, the mouse, and the presses and clicks that still have to start their hat scripts
+input_tracker* scratch_engine::get_input()
+{
+    return &m_input;
+}
+
+void scratch_engine::set_input_source(input_source* p_source)
+{
+    if (mp_replay_job != nullptr) // the input job has been swapped out for the replay
+    {
+        delete p_source;
+        return;
+    }
+    static_cast<input_job*>(mp_core_jobs[static_cast<int>(core_jobs::input)])->set_source(p_source);
+}
+
+// from here on every frame's input and ticks are kept along with a fresh seed for pick random, save_recording writes them out
+// start it right after loading the project so a replay starts from the same state, starting again throws away what was recorded
+bool scratch_engine::start_recording()
+{
+    unsigned long long seed = (unsigned long long)std::chrono::steady_clock::now().time_since_epoch().count() | 1;
 
-    p_sprite->mpp_bottom_layer_addy = &m_sprite_list.p_bottom_sprite;
-    p_sprite->mpp_top_layer_addy = &m_sprite_list.p_top_sprite;
+    if (mp_replay_job != nullptr)
+    {
+        return false;
+    }
+    m_input = input_tracker();
+    get_scheduler()->set_random_seed(seed);
+    mp_record_job = new record_job(static_cast<input_job*>(mp_core_jobs[static_cast<int>(core_jobs::input)]), seed);
+    get_scheduler()->set_pass_log(mp_record_job->get_pass_log());
+    delete mp_core_jobs[static_cast<int>(core_jobs::record)];
+    mp_core_jobs[static_cast<int>(core_jobs::record)] = mp_record_job;
+    return true;
 }
 
-int main()
+bool scratch_engine::save_recording(const char* p_path)
 {
-    scratch_engine* engine = new scratch_engine("CScratch");
-    sprite* test_sprite = new sprite(L"Sprite1");
-    costume* p_costume = nullptr;
-    Texture2D costume_texture = {};
-    double direction = 90.0;
-    
-    if (engine == nullptr || test_sprite == nullptr)
+    if (mp_record_job == nullptr)
     {
-        std::cout << "failed to initialize engine award" << std::endl;
-        return 1;
+        return false;
     }
-    
-    costume_texture = LoadTexture("../assets/breadboard.png");
-    std::cout << "loaded assets award" << std::endl;
-    p_costume = new costume(L"Costume1", costume_texture, costume_texture.width / 2.0, costume_texture.height / 2.0, costume_texture.width, costume_texture.height);
-    if (p_costume == nullptr)
+    return mp_record_job->get_trace().save(p_path);
+}
+
+// replaces the input job with the trace at p_path, load the same project first. next_tick then runs exactly the recorded ticks
+// with the recorded input whatever the clock says, and the engine exits when the trace runs out. headless this runs at full speed
+bool scratch_engine::start_replay(const char* p_path)
+{
+    replay_input_job* p_job = nullptr;
+
+    if (mp_record_job != nullptr || mp_replay_job != nullptr)
     {
-        std::cout << "failed to initialize costume award" << std::endl;
-        return 1;
+        return false;
     }
+    p_job = new replay_input_job(&m_input);
+    if (!p_job->get_trace().load(p_path))
+    {
+        delete p_job;
+        return false;
+    }
+    m_input = input_tracker();
+    get_scheduler()->set_random_seed(p_job->get_trace().get_seed());
+    delete mp_core_jobs[static_cast<int>(core_jobs::input)];
+    mp_core_jobs[static_cast<int>(core_jobs::input)] = p_job;
+    mp_replay_job = p_job;
+    return true;
+}
+
+bool scratch_engine::is_replaying()
+{
+    return mp_replay_job != nullptr;
+}
 
-    test_sprite->add_costume(p_costume);
-    test_sprite->set_costume_number(1);
-    test_sprite->set_rotation_mode(rotation_mode::all_around);
-    test_sprite->set_size(10.0);
-    test_sprite->set_direction(90.0);
-    test_sprite->set_x(0.0);
-    test_sprite->set_y(0.0);
-    engine->add_sprite(test_sprite, nullptr);
-    std::cout << "initialized engine award" << std::endl;
+// starts the hat scripts of every key press and click since the last frame, in the order they happened
+// the scripts get their first step on the next logic tick, so they wait their turn if this frame has none
+void scratch_engine::dispatch_input()
+{
+    scheduler_job* p_scheduler = get_scheduler();
 
-    while (engine->next_tick() == engine_status::ok)
+    for (const input_event& event : m_input.get_pending())
     {
-        direction += 10.0;
-        test_sprite->set_direction(direction);
-        std::cout << "renderered frame award" << std::endl;
+        if (event.type == input_event_type::key_down)
+        {
+            p_scheduler->start_key_hats(event.key);
+        }
+        else if (event.type == input_event_type::mouse_down)
+        {
+            click(event.x, event.y);
+        }
     }
+    m_input.clear_pending();
+}
 
-    delete engine;
+// inserts sprite into the layers below sprite p_above
+// if p_above is not provided (ie p_above == nullptr), p_sprite is inserted on top of all the other sprites
+void scratch_engine::add_sprite(sprite* p_sprite, sprite* p_above)
+{
+    if (p_sprite == nullptr)
+    {
+        return;
+    }
+    if (p_above == nullptr || p_above->mp_layers != mp_layers)
+    {
+        mp_layers->insert(p_sprite, mp_layers->get_count());
+    }
+    else
+    {
+        mp_layers->insert(p_sprite, mp_layers->get_index(p_above));
+    }
 
-    return 0;
-}
\ No newline at end of file
+    p_sprite->mp_grid = mp_sprite_grid;
+    p_sprite->mp_transforms = mp_transforms;
+    p_sprite->mp_damage = mp_stage_damage;
+    p_sprite->update_bounds();
+}
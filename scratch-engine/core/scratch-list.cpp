@@ -0,0 +1,310 @@
+/*
+File: scratch-list.cpp
+Description: Implements scratch_list, the chunked storage behind Scratch lists
+*/
+
+#include "scratch-vm.hpp"
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+
+using namespace scratch;
+
+namespace
+{
+    // the same chunk operations for both representations
+    template <typename T>
+    void split(std::vector<std::vector<T>>& chunks, size_t chunk)
+    {
+        std::vector<T>& full = chunks[chunk];
+        size_t half = full.size() / 2;
+        std::vector<T> second(std::make_move_iterator(full.begin() + half), std::make_move_iterator(full.end()));
+
+        full.erase(full.begin() + half, full.end());
+        chunks.insert(chunks.begin() + chunk + 1, std::move(second));
+    }
+
+    template <typename T>
+    void append_chunk(std::vector<std::vector<T>>& chunks, size_t from, size_t to) // moves every item of chunk from onto the end of chunk to
+    {
+        chunks[to].insert(chunks[to].end(), std::make_move_iterator(chunks[from].begin()), std::make_move_iterator(chunks[from].end()));
+        chunks[from].clear();
+    }
+}
+
+scratch_list::scratch_list()
+{
+    m_size = 0;
+    m_numeric = true;
+    m_last_chunk = 0;
+}
+
+size_t scratch_list::size() const
+{
+    return m_size;
+}
+
+bool scratch_list::empty() const
+{
+    return m_size == 0;
+}
+
+bool scratch_list::is_numeric() const
+{
+    return m_numeric;
+}
+
+scratch_state scratch_list::get(size_t index) const
+{
+    size_t chunk = 0;
+    size_t offset = 0;
+
+    locate(index, chunk, offset);
+    return m_numeric ? scratch_state(m_number_chunks[chunk][offset]) : m_value_chunks[chunk][offset];
+}
+
+void scratch_list::set(size_t index, const scratch_state& item)
+{
+    size_t chunk = 0;
+    size_t offset = 0;
+
+    if (m_numeric && !item.is_number())
+    {
+        make_generic();
+    }
+    locate(index, chunk, offset);
+    if (m_numeric)
+    {
+        m_number_chunks[chunk][offset] = item.get_number();
+    }
+    else
+    {
+        m_value_chunks[chunk][offset] = item;
+    }
+}
+
+void scratch_list::push_back(const scratch_state& item)
+{
+    insert(m_size, item);
+}
+
+void scratch_list::insert(size_t index, const scratch_state& item)
+{
+    size_t chunk = 0;
+    size_t offset = 0;
+    size_t chunk_size = 0;
+
+    if (m_numeric && !item.is_number())
+    {
+        make_generic();
+    }
+    if (m_chunk_starts.empty() || (index == m_size && m_size - m_chunk_starts.back() >= LIST_CHUNK_SIZE)) // appending to a full chunk starts a new one
+    {
+        if (m_numeric)
+        {
+            m_number_chunks.emplace_back();
+        }
+        else
+        {
+            m_value_chunks.emplace_back();
+        }
+        m_chunk_starts.push_back(m_size);
+    }
+
+    if (index == m_size)
+    {
+        chunk = m_chunk_starts.size() - 1;
+        offset = m_size - m_chunk_starts[chunk];
+    }
+    else
+    {
+        locate(index, chunk, offset);
+    }
+    if (m_numeric)
+    {
+        m_number_chunks[chunk].insert(m_number_chunks[chunk].begin() + offset, item.get_number());
+        chunk_size = m_number_chunks[chunk].size();
+    }
+    else
+    {
+        m_value_chunks[chunk].insert(m_value_chunks[chunk].begin() + offset, item);
+        chunk_size = m_value_chunks[chunk].size();
+    }
+    for (size_t i = chunk + 1; i < m_chunk_starts.size(); ++i)
+    {
+        ++m_chunk_starts[i];
+    }
+    ++m_size;
+
+    if (chunk_size > LIST_CHUNK_SIZE)
+    {
+        split_chunk(chunk);
+    }
+}
+
+void scratch_list::erase(size_t index)
+{
+    size_t chunk = 0;
+    size_t offset = 0;
+    size_t chunk_size = 0;
+    size_t next_size = 0;
+
+    locate(index, chunk, offset);
+    if (m_numeric)
+    {
+        m_number_chunks[chunk].erase(m_number_chunks[chunk].begin() + offset);
+    }
+    else
+    {
+        m_value_chunks[chunk].erase(m_value_chunks[chunk].begin() + offset);
+    }
+    for (size_t i = chunk + 1; i < m_chunk_starts.size(); ++i)
+    {
+        --m_chunk_starts[i];
+    }
+    --m_size;
+    if (m_size == 0)
+    {
+        clear(); // an empty list goes back to holding numbers
+        return;
+    }
+
+    // chunks that have shrunk a lot are folded into the next one so deleting doesn't leave lots of tiny chunks behind
+    chunk_size = get_chunk_size(chunk);
+    next_size = chunk + 1 < m_chunk_starts.size() ? get_chunk_size(chunk + 1) : LIST_CHUNK_SIZE;
+    if (chunk_size == 0)
+    {
+        remove_chunk(chunk);
+    }
+    else if (chunk_size < LIST_CHUNK_SIZE / 4 && chunk_size + next_size <= LIST_CHUNK_SIZE)
+    {
+        if (m_numeric)
+        {
+            append_chunk(m_number_chunks, chunk + 1, chunk);
+        }
+        else
+        {
+            append_chunk(m_value_chunks, chunk + 1, chunk);
+        }
+        remove_chunk(chunk + 1);
+    }
+}
+
+void scratch_list::clear()
+{
+    m_number_chunks.clear();
+    m_value_chunks.clear();
+    m_chunk_starts.clear();
+    m_size = 0;
+    m_numeric = true;
+    m_last_chunk = 0;
+}
+
+int scratch_list::find(const scratch_state& item) const
+{
+    int position = 0;
+    double value = 0.0;
+
+    if (m_numeric && item.is_number() && !std::isnan(item.get_number())) // two numbers that aren't NaN are equal exactly when == says so
+    {
+        value = item.get_number();
+        for (const std::vector<double>& chunk : m_number_chunks)
+        {
+            for (double number : chunk)
+            {
+                ++position;
+                if (number == value)
+                {
+                    return position;
+                }
+            }
+        }
+        return 0;
+    }
+
+    if (m_numeric)
+    {
+        for (const std::vector<double>& chunk : m_number_chunks)
+        {
+            for (double number : chunk)
+            {
+                ++position;
+                if (scratch_state(number).equals(item))
+                {
+                    return position;
+                }
+            }
+        }
+        return 0;
+    }
+    for (const std::vector<scratch_state>& chunk : m_value_chunks)
+    {
+        for (const scratch_state& value_item : chunk)
+        {
+            ++position;
+            if (value_item.equals(item))
+            {
+                return position;
+            }
+        }
+    }
+    return 0;
+}
+
+void scratch_list::locate(size_t index, size_t& chunk, size_t& offset) const
+{
+    size_t count = m_chunk_starts.size();
+
+    if (m_last_chunk >= count || index < m_chunk_starts[m_last_chunk] || index - m_chunk_starts[m_last_chunk] >= get_chunk_size(m_last_chunk))
+    {
+        m_last_chunk = std::upper_bound(m_chunk_starts.begin(), m_chunk_starts.end(), index) - m_chunk_starts.begin() - 1;
+    }
+    chunk = m_last_chunk;
+    offset = index - m_chunk_starts[chunk];
+}
+
+size_t scratch_list::get_chunk_size(size_t chunk) const
+{
+    return (chunk + 1 < m_chunk_starts.size() ? m_chunk_starts[chunk + 1] : m_size) - m_chunk_starts[chunk];
+}
+
+void scratch_list::make_generic()
+{
+    m_value_chunks.clear();
+    m_value_chunks.reserve(m_number_chunks.size());
+    for (const std::vector<double>& numbers : m_number_chunks)
+    {
+        m_value_chunks.emplace_back(numbers.begin(), numbers.end()); // scratch_state(double) for every item
+    }
+    m_number_chunks.clear();
+    m_numeric = false;
+}
+
+void scratch_list::split_chunk(size_t chunk)
+{
+    size_t half = get_chunk_size(chunk) / 2;
+
+    if (m_numeric)
+    {
+        split(m_number_chunks, chunk);
+    }
+    else
+    {
+        split(m_value_chunks, chunk);
+    }
+    m_chunk_starts.insert(m_chunk_starts.begin() + chunk + 1, m_chunk_starts[chunk] + half);
+}
+
+void scratch_list::remove_chunk(size_t chunk) // the chunk must be empty, its items deleted or moved into the chunk before it
+{
+    if (m_numeric)
+    {
+        m_number_chunks.erase(m_number_chunks.begin() + chunk);
+    }
+    else
+    {
+        m_value_chunks.erase(m_value_chunks.begin() + chunk);
+    }
+    m_chunk_starts.erase(m_chunk_starts.begin() + chunk);
+    m_last_chunk = 0;
+}
@@ -0,0 +1,648 @@
+/*
+File: scratch-state.cpp
+Description: Implements Scratch's value casting and comparison rules for scratch_state
+*/
+
+#include "scratch-vm.hpp"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cwctype>
+#include <mutex>
+#include <unordered_map>
+
+using namespace scratch;
+
+namespace
+{
+    struct intern_shard
+    {
+        std::mutex mutex;
+        std::unordered_multimap<unsigned long long, scratch_string*> strings; // by hash
+    };
+
+    // never freed, values in static storage can still be releasing strings while the program exits
+    intern_shard& get_intern_shard(unsigned long long hash)
+    {
+        static intern_shard* p_shards = new intern_shard[STRING_INTERN_SHARD_COUNT];
+
+        return p_shards[hash & (STRING_INTERN_SHARD_COUNT - 1)];
+    }
+
+    // returns the existing scratch_string for the text with a reference taken for the caller, or a new one
+    scratch_string* intern_string(const wchar_t* p_text, size_t length)
+    {
+        unsigned long long hash = 14695981039346656037ULL; // FNV-1a over the code units, once as they are and once lower cased
+        unsigned long long folded_hash = hash;
+        intern_shard* p_shard = nullptr;
+        scratch_string* p_string = nullptr;
+
+        for (size_t i = 0; i < length; ++i)
+        {
+            hash = (hash ^ (unsigned long long)p_text[i]) * 1099511628211ULL;
+            folded_hash = (folded_hash ^ (unsigned long long)towlower(p_text[i])) * 1099511628211ULL;
+        }
+        p_shard = &get_intern_shard(hash);
+
+        std::lock_guard<std::mutex> lock(p_shard->mutex);
+        auto matches = p_shard->strings.equal_range(hash);
+        for (auto entry = matches.first; entry != matches.second && p_string == nullptr;)
+        {
+            scratch_string* p_candidate = entry->second;
+            unsigned int references = p_candidate->references.load(std::memory_order_relaxed);
+
+            if (p_candidate->text.size() != length || p_candidate->text.compare(0, length, p_text, length) != 0)
+            {
+                ++entry;
+                continue;
+            }
+            while (references != 0 && !p_candidate->references.compare_exchange_weak(references, references + 1, std::memory_order_relaxed))
+            {
+            }
+            if (references == 0) // its last holder is about to delete it, a new copy takes its place
+            {
+                entry = p_shard->strings.erase(entry);
+                continue;
+            }
+            p_string = p_candidate;
+        }
+        if (p_string == nullptr)
+        {
+            p_string = new scratch_string;
+            p_string->references.store(1, std::memory_order_relaxed);
+            p_string->text.assign(p_text, length);
+            p_string->hash = hash;
+            p_string->folded_hash = folded_hash;
+            p_string->number_bits.store(STRING_NUMBER_UNPARSED, std::memory_order_relaxed);
+            p_shard->strings.emplace(hash, p_string);
+        }
+        return p_string;
+    }
+}
+
+scratch_state::scratch_state(const std::wstring& value)
+{
+    m_bits = 0;
+    m_inline = 0;
+    assign_string(value.data(), value.size());
+}
+
+scratch_state::scratch_state(const wchar_t* p_value)
+{
+    m_bits = 0;
+    m_inline = 0;
+    assign_string(p_value, wcslen(p_value));
+}
+
+scratch_state scratch_state::make_color(unsigned char r, unsigned char g, unsigned char b)
+{
+    scratch_state value;
+
+    value.m_bits = BOX_COLOR | ((unsigned long long)r << 16) | ((unsigned long long)g << 8) | b;
+    return value;
+}
+
+// the only path that allocates. inline strings are packed 16 bits per code unit: units 0-3 in m_inline,
+// the length in payload bits 0-7 and units 4-5 in payload bits 8-23 and 24-39
+void scratch_state::assign_string(const wchar_t* p_text, size_t length)
+{
+    scratch_string* p_string = nullptr;
+    bool fits_inline = length <= INLINE_LENGTH;
+
+    for (size_t i = 0; fits_inline && i < length; ++i)
+    {
+        fits_inline = (unsigned long)p_text[i] <= 0xFFFF; // characters outside the BMP only exist as wide wchar_t on some platforms
+    }
+
+    if (fits_inline)
+    {
+        m_bits = BOX_SHORT_STRING | length;
+        m_inline = 0;
+        for (size_t i = 0; i < length; ++i)
+        {
+            unsigned long long unit = (unsigned long long)p_text[i] & 0xFFFF;
+            if (i < 4)
+            {
+                m_inline |= unit << (i * 16);
+            }
+            else
+            {
+                m_bits |= unit << (8 + (i - 4) * 16);
+            }
+        }
+        return;
+    }
+
+    p_string = intern_string(p_text, length);
+    m_bits = BOX_LONG_STRING | (static_cast<unsigned long long>(reinterpret_cast<uintptr_t>(p_string)) & BOX_PAYLOAD_MASK); // user space pointers fit in 48 bits
+    m_inline = 0;
+}
+
+// a string is only found in the intern table while it has references, so nothing can pick it up again once the count hits 0
+void scratch_state::release()
+{
+    scratch_string* p_string = get_long_string();
+
+    if (p_string->references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        intern_shard& shard = get_intern_shard(p_string->hash);
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            auto matches = shard.strings.equal_range(p_string->hash);
+            for (auto entry = matches.first; entry != matches.second; ++entry)
+            {
+                if (entry->second == p_string) // a newer copy may have replaced it already
+                {
+                    shard.strings.erase(entry);
+                    break;
+                }
+            }
+        }
+        delete p_string;
+    }
+    m_bits = 0;
+}
+
+size_t scratch_state::get_short_string(wchar_t* p_buffer) const
+{
+    size_t length = m_bits & 0xFF;
+
+    for (size_t i = 0; i < length; ++i)
+    {
+        if (i < 4)
+        {
+            p_buffer[i] = (wchar_t)((m_inline >> (i * 16)) & 0xFFFF);
+        }
+        else
+        {
+            p_buffer[i] = (wchar_t)((m_bits >> (8 + (i - 4) * 16)) & 0xFFFF);
+        }
+    }
+    return length;
+}
+
+state_type scratch_state::get_type() const
+{
+    if (is_number())
+    {
+        return state_type::number;
+    }
+    switch (m_bits & BOX_TAG_MASK)
+    {
+        case BOX_BOOLEAN:
+            return state_type::boolean;
+        case BOX_COLOR:
+            return state_type::color;
+        default:
+            return state_type::string;
+    }
+}
+
+// compares in place, never building a temporary state since that would allocate for texts too long to inline
+bool scratch_state::string_equals(const wchar_t* p_text) const
+{
+    wchar_t buffer[INLINE_LENGTH] = {};
+    size_t length = 0;
+
+    if ((m_bits & BOX_TAG_MASK) == BOX_LONG_STRING)
+    {
+        return get_long_string()->text == p_text;
+    }
+    if ((m_bits & BOX_TAG_MASK) != BOX_SHORT_STRING)
+    {
+        return false;
+    }
+    length = get_short_string(buffer);
+    return wcsncmp(buffer, p_text, length) == 0 && p_text[length] == L'\0'; // the prefix matching means p_text is at least length long
+}
+
+double scratch_state::to_number() const
+{
+    double value = 0.0;
+
+    if (is_number())
+    {
+        value = get_number();
+        return std::isnan(value) ? 0.0 : value;
+    }
+    switch (m_bits & BOX_TAG_MASK)
+    {
+        case BOX_BOOLEAN:
+            return (double)(m_bits & 1);
+        case BOX_COLOR:
+            return (double)(m_bits & 0xFFFFFF);
+        case BOX_LONG_STRING:
+            value = get_long_number();
+            break;
+        default:
+            value = string_to_number(to_string());
+            break;
+    }
+    return std::isnan(value) ? 0.0 : value;
+}
+
+bool scratch_state::to_boolean() const
+{
+    double value = 0.0;
+
+    if (is_number())
+    {
+        value = get_number();
+        return value != 0.0 && !std::isnan(value);
+    }
+    switch (m_bits & BOX_TAG_MASK)
+    {
+        case BOX_BOOLEAN:
+            return (m_bits & 1) != 0;
+        case BOX_COLOR:
+            return true;
+        case BOX_SHORT_STRING:
+            return !(m_bits == BOX_SHORT_STRING || string_equals(L"0") || string_equals_ignore_case(to_string(), L"false"));
+        default:
+            return !string_equals_ignore_case(get_long_string()->text, L"false"); // long strings are never empty or "0"
+    }
+}
+
+std::wstring scratch_state::to_string() const
+{
+    wchar_t buffer[INLINE_LENGTH] = {};
+    wchar_t hex_color[8] = {};
+    size_t length = 0;
+
+    if (is_number())
+    {
+        return number_to_string(get_number());
+    }
+    switch (m_bits & BOX_TAG_MASK)
+    {
+        case BOX_BOOLEAN:
+            return (m_bits & 1) != 0 ? L"true" : L"false";
+        case BOX_COLOR:
+            swprintf(hex_color, 8, L"#%02x%02x%02x", (unsigned int)((m_bits >> 16) & 0xFF), (unsigned int)((m_bits >> 8) & 0xFF), (unsigned int)(m_bits & 0xFF));
+            return hex_color;
+        case BOX_LONG_STRING:
+            return get_long_string()->text;
+        default:
+            length = get_short_string(buffer);
+            return std::wstring(buffer, length);
+    }
+}
+
+bool scratch_state::is_whitespace() const
+{
+    wchar_t buffer[INLINE_LENGTH] = {};
+    size_t length = 0;
+
+    if ((m_bits & BOX_TAG_MASK) == BOX_LONG_STRING)
+    {
+        for (wchar_t character : get_long_string()->text)
+        {
+            if (!iswspace(character))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+    if ((m_bits & BOX_TAG_MASK) != BOX_SHORT_STRING)
+    {
+        return false;
+    }
+    length = get_short_string(buffer);
+    for (size_t i = 0; i < length; ++i)
+    {
+        if (!iswspace(buffer[i]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// returns a negative number, zero or a positive number like strcmp
+int scratch_state::compare(const scratch_state& other) const
+{
+    double left = 0.0;
+    double right = 0.0;
+    std::wstring left_text;
+    std::wstring right_text;
+
+    if (is_number() && other.is_number()) // the common case, no casting needed
+    {
+        left = get_number();
+        right = other.get_number();
+        if (!std::isnan(left) && !std::isnan(right))
+        {
+            return left < right ? -1 : (left > right ? 1 : 0); // equal infinities compare as 0 here too
+        }
+    }
+    if (m_bits == other.m_bits && m_inline == other.m_inline && !is_number()) // same boxed value, including the same long string
+    {
+        return 0;
+    }
+
+    left = get_compare_number();
+    right = other.get_compare_number();
+    if (std::isnan(left) || std::isnan(right)) // not both numbers, comparing as case insensitive text
+    {
+        left_text = to_string();
+        right_text = other.to_string();
+        for (wchar_t& character : left_text)
+        {
+            character = towlower(character);
+        }
+        for (wchar_t& character : right_text)
+        {
+            character = towlower(character);
+        }
+        return left_text.compare(right_text);
+    }
+    if (std::isinf(left) && std::isinf(right) && left == right)
+    {
+        return 0;
+    }
+    return left < right ? -1 : (left > right ? 1 : 0);
+}
+
+// interning makes most long string comparisons a pointer or hash check, compare only runs when the texts could still match
+bool scratch_state::equals(const scratch_state& other) const
+{
+    scratch_string* p_left = nullptr;
+    scratch_string* p_right = nullptr;
+    double left = 0.0;
+    double right = 0.0;
+
+    if ((m_bits & BOX_TAG_MASK) == BOX_LONG_STRING && (other.m_bits & BOX_TAG_MASK) == BOX_LONG_STRING)
+    {
+        p_left = get_long_string();
+        p_right = other.get_long_string();
+        if (p_left == p_right)
+        {
+            return true;
+        }
+        left = get_long_number();
+        right = other.get_long_number();
+        if (!std::isnan(left) && !std::isnan(right))
+        {
+            return left == right;
+        }
+        if (p_left->folded_hash != p_right->folded_hash) // compared as text, and lower casing them gives different texts
+        {
+            return false;
+        }
+    }
+    return compare(other) == 0;
+}
+
+double scratch_state::get_long_number() const
+{
+    scratch_string* p_string = get_long_string();
+    unsigned long long bits = p_string->number_bits.load(std::memory_order_relaxed);
+    double value = 0.0;
+
+    if (bits == STRING_NUMBER_UNPARSED) // every thread that gets here parses the same text to the same bits, so racing is harmless
+    {
+        value = is_whitespace() ? NAN : string_to_number(p_string->text); // whitespace only strings would otherwise parse as 0
+        value = std::isnan(value) ? NAN : value;
+        memcpy(&bits, &value, sizeof(bits));
+        p_string->number_bits.store(bits, std::memory_order_relaxed);
+    }
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+double scratch_state::get_compare_number() const
+{
+    double value = 0.0;
+
+    if (is_number())
+    {
+        return get_number();
+    }
+    switch (m_bits & BOX_TAG_MASK)
+    {
+        case BOX_LONG_STRING:
+            return get_long_number();
+        case BOX_SHORT_STRING:
+            value = string_to_number(to_string());
+            return value == 0.0 && is_whitespace() ? NAN : value;
+        default:
+            return to_number();
+    }
+}
+
+// parses text the way JavaScript's Number() does: surrounding whitespace is ignored, the empty string is 0,
+// decimal, hex (0x), octal (0o), binary (0b) and Infinity are accepted and anything else is NaN
+double scratch::string_to_number(const std::wstring& text)
+{
+    size_t start = 0;
+    size_t end = text.size();
+    size_t digits = 0;
+    size_t position = 0;
+    bool negative = false;
+    bool seen_digit = false;
+    int base = 0;
+    double value = 0.0;
+    std::wstring trimmed;
+
+    while (start < end && iswspace(text[start]))
+    {
+        ++start;
+    }
+    while (end > start && iswspace(text[end - 1]))
+    {
+        --end;
+    }
+    if (start == end)
+    {
+        return 0.0;
+    }
+    trimmed = text.substr(start, end - start);
+
+    // prefixed integers, these do not take a sign
+    if (trimmed.size() > 2 && trimmed[0] == L'0')
+    {
+        switch (trimmed[1])
+        {
+            case L'x': case L'X': base = 16; break;
+            case L'o': case L'O': base = 8; break;
+            case L'b': case L'B': base = 2; break;
+            default: break;
+        }
+    }
+    if (base != 0)
+    {
+        for (position = 2; position < trimmed.size(); ++position)
+        {
+            wchar_t character = towlower(trimmed[position]);
+            int digit = -1;
+            if (character >= L'0' && character <= L'9')
+            {
+                digit = character - L'0';
+            }
+            else if (character >= L'a' && character <= L'f')
+            {
+                digit = character - L'a' + 10;
+            }
+            if (digit < 0 || digit >= base)
+            {
+                return NAN;
+            }
+            value = value * base + digit;
+        }
+        return value;
+    }
+
+    position = 0;
+    if (trimmed[0] == L'+' || trimmed[0] == L'-')
+    {
+        negative = trimmed[0] == L'-';
+        position = 1;
+    }
+    if (trimmed.compare(position, std::wstring::npos, L"Infinity") == 0)
+    {
+        return negative ? -INFINITY : INFINITY;
+    }
+
+    // validating the decimal literal grammar before handing it to wcstod (which also accepts things like "nan" and hex floats)
+    digits = position;
+    while (digits < trimmed.size() && iswdigit(trimmed[digits]))
+    {
+        ++digits;
+        seen_digit = true;
+    }
+    if (digits < trimmed.size() && trimmed[digits] == L'.')
+    {
+        ++digits;
+        while (digits < trimmed.size() && iswdigit(trimmed[digits]))
+        {
+            ++digits;
+            seen_digit = true;
+        }
+    }
+    if (!seen_digit)
+    {
+        return NAN;
+    }
+    if (digits < trimmed.size() && (trimmed[digits] == L'e' || trimmed[digits] == L'E'))
+    {
+        ++digits;
+        if (digits < trimmed.size() && (trimmed[digits] == L'+' || trimmed[digits] == L'-'))
+        {
+            ++digits;
+        }
+        if (digits >= trimmed.size() || !iswdigit(trimmed[digits]))
+        {
+            return NAN;
+        }
+        while (digits < trimmed.size() && iswdigit(trimmed[digits]))
+        {
+            ++digits;
+        }
+    }
+    if (digits != trimmed.size())
+    {
+        return NAN;
+    }
+    return wcstod(trimmed.c_str(), nullptr);
+}
+
+// shortest text that reads back as the same double, laid out with JavaScript's rules for when to use exponents
+std::wstring scratch::number_to_string(double value)
+{
+    char buffer[40] = {};
+    char digits[20] = {};
+    int digit_count = 0;
+    int exponent = 0;
+    int decimal_point = 0;
+    std::wstring result;
+
+    if (std::isnan(value))
+    {
+        return L"NaN";
+    }
+    if (std::isinf(value))
+    {
+        return value > 0 ? L"Infinity" : L"-Infinity";
+    }
+    if (value == 0.0)
+    {
+        return L"0";
+    }
+    if (value < 0.0)
+    {
+        result = L"-";
+        value = -value;
+    }
+
+    // finding the fewest significant digits that round trip
+    for (int precision = 1; precision <= 17; ++precision)
+    {
+        snprintf(buffer, sizeof(buffer), "%.*e", precision - 1, value);
+        if (strtod(buffer, nullptr) == value)
+        {
+            break;
+        }
+    }
+    for (char* p_char = buffer; *p_char != '\0' && *p_char != 'e'; ++p_char)
+    {
+        if (*p_char >= '0' && *p_char <= '9')
+        {
+            digits[digit_count++] = *p_char;
+        }
+    }
+    while (digit_count > 1 && digits[digit_count - 1] == '0')
+    {
+        --digit_count;
+    }
+    exponent = atoi(strchr(buffer, 'e') + 1);
+    decimal_point = exponent + 1; // number of digits before the decimal point
+
+    if (decimal_point >= digit_count && decimal_point <= 21) // integer
+    {
+        result.append(digits, digits + digit_count);
+        result.append(decimal_point - digit_count, L'0');
+    }
+    else if (decimal_point > 0 && decimal_point <= 21)
+    {
+        result.append(digits, digits + decimal_point);
+        result += L'.';
+        result.append(digits + decimal_point, digits + digit_count);
+    }
+    else if (decimal_point > -6 && decimal_point <= 0)
+    {
+        result += L"0.";
+        result.append(-decimal_point, L'0');
+        result.append(digits, digits + digit_count);
+    }
+    else
+    {
+        result += (wchar_t)digits[0];
+        if (digit_count > 1)
+        {
+            result += L'.';
+            result.append(digits + 1, digits + digit_count);
+        }
+        result += L'e';
+        result += exponent < 0 ? L'-' : L'+';
+        result += std::to_wstring(std::abs(exponent));
+    }
+    return result;
+}
+
+bool scratch::string_equals_ignore_case(const std::wstring& a, const std::wstring& b)
+{
+    if (a.size() != b.size())
+    {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); ++i)
+    {
+        if (towlower(a[i]) != towlower(b[i]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,131 @@
+/*
+File: scratch-trace.cpp
+Description: Implements the per thread trace buffers and the Chrome trace event exporter
+*/
+
+#include "scratch-trace.hpp"
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+using namespace scratch;
+
+#ifdef CSCRATCH_TRACING
+
+// every buffer ever handed out, kept alive after their threads exit so the trace can still be exported
+// the mutex is only taken the first time a thread traces something and when exporting, never while recording
+static std::mutex g_trace_registry_mutex;
+static std::vector<trace_buffer*> g_trace_registry;
+static const std::chrono::steady_clock::time_point g_trace_epoch = std::chrono::steady_clock::now();
+
+trace_buffer::trace_buffer(unsigned int thread_id)
+{
+    m_thread_id = thread_id;
+    m_head.store(0, std::memory_order_relaxed);
+}
+
+void trace_buffer::record(const char* p_name, unsigned long long start_ns, unsigned long long duration_ns)
+{
+    unsigned long long head = m_head.load(std::memory_order_relaxed);
+    trace_event& event = mp_events[head & (TRACE_BUFFER_EVENT_COUNT - 1)];
+
+    event.p_name = p_name;
+    event.start_ns = start_ns;
+    event.duration_ns = duration_ns;
+    m_head.store(head + 1, std::memory_order_release); // publishing the event to the exporter
+}
+
+unsigned int trace_buffer::get_thread_id()
+{
+    return m_thread_id;
+}
+
+unsigned long long trace_buffer::get_event_count()
+{
+    return m_head.load(std::memory_order_acquire);
+}
+
+trace_event trace_buffer::get_event(unsigned long long index)
+{
+    return mp_events[index & (TRACE_BUFFER_EVENT_COUNT - 1)];
+}
+
+trace_scope::trace_scope(const char* p_name)
+{
+    mp_name = p_name;
+    m_start_ns = trace_now_ns();
+}
+
+trace_scope::~trace_scope()
+{
+    unsigned long long end_ns = trace_now_ns();
+    trace_get_thread_buffer()->record(mp_name, m_start_ns, end_ns - m_start_ns);
+}
+
+unsigned long long scratch::trace_now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - g_trace_epoch).count();
+}
+
+trace_buffer* scratch::trace_get_thread_buffer()
+{
+    static thread_local trace_buffer* p_buffer = nullptr;
+
+    if (p_buffer == nullptr)
+    {
+        std::lock_guard<std::mutex> lock(g_trace_registry_mutex);
+        p_buffer = new trace_buffer(g_trace_registry.size() + 1);
+        g_trace_registry.push_back(p_buffer);
+    }
+    return p_buffer;
+}
+
+// writes every event still held in the ring buffers to p_path in Chrome's trace event format (load it in chrome://tracing or Perfetto)
+// meant to be called once the traced threads are idle, events written during the export may be torn
+bool scratch::trace_export_chrome_json(const char* p_path)
+{
+    std::lock_guard<std::mutex> lock(g_trace_registry_mutex);
+    FILE* p_file = fopen(p_path, "w");
+    bool first_event = true;
+
+    if (p_file == nullptr)
+    {
+        return false;
+    }
+
+    fprintf(p_file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    for (trace_buffer* p_buffer : g_trace_registry)
+    {
+        unsigned long long event_count = p_buffer->get_event_count();
+        unsigned long long first_index = event_count > TRACE_BUFFER_EVENT_COUNT ? event_count - TRACE_BUFFER_EVENT_COUNT : 0;
+
+        for (unsigned long long i = first_index; i < event_count; ++i)
+        {
+            trace_event event = p_buffer->get_event(i);
+            fprintf(p_file, "%s\n{\"name\":\"", first_event ? "" : ",");
+            for (const char* p_char = event.p_name; *p_char != '\0'; ++p_char) // names are code identifiers but escaping anyway to never emit broken JSON
+            {
+                if (*p_char == '"' || *p_char == '\\')
+                {
+                    fputc('\\', p_file);
+                }
+                fputc(*p_char, p_file);
+            }
+            fprintf(p_file, "\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}", p_buffer->get_thread_id(), event.start_ns / 1000.0, event.duration_ns / 1000.0);
+            first_event = false;
+        }
+    }
+    fprintf(p_file, "\n]}\n");
+    return fclose(p_file) == 0;
+}
+
+#else
+
+// tracing compiled out, there is nothing to export
+bool scratch::trace_export_chrome_json(const char* /*p_path*/)
+{
+    return false;
+}
+
+#endif
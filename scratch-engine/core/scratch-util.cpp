@@ -5,12 +5,77 @@ Description: Implements all CScratch utility functions
 
 #include "scratch-util.hpp"
 #include "scratch-config.hpp"
+#include <algorithm>
 
 int scratch_util::round(double value)
 {
     return (int)(value + 0.5);
 }
 
+// 64 bit FNV-1a hash, cheap enough to checksum whole frames
+unsigned long long scratch_util::fnv1a_64(const void* p_data, size_t size)
+{
+    const unsigned char* p_bytes = (const unsigned char*)p_data;
+    unsigned long long hash = 14695981039346656037ULL;
+
+    if (p_bytes == nullptr)
+    {
+        return hash;
+    }
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= p_bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// maps a Scratch key name ("space", "up arrow", "a", "7") to its raylib keycode
+// returns -1 for "any" and for names that have no key
+int scratch_util::key_name_to_keycode(const std::wstring& name)
+{
+    wchar_t character = 0;
+
+    if (name == L"space")
+    {
+        return 32; // KEY_SPACE
+    }
+    if (name == L"right arrow")
+    {
+        return 262; // KEY_RIGHT
+    }
+    if (name == L"left arrow")
+    {
+        return 263; // KEY_LEFT
+    }
+    if (name == L"down arrow")
+    {
+        return 264; // KEY_DOWN
+    }
+    if (name == L"up arrow")
+    {
+        return 265; // KEY_UP
+    }
+    if (name == L"enter")
+    {
+        return 257; // KEY_ENTER
+    }
+    if (name.size() != 1)
+    {
+        return -1;
+    }
+    character = name[0];
+    if (character >= L'a' && character <= L'z') // raylib uses the upper case ASCII codes for letters
+    {
+        return character - L'a' + L'A';
+    }
+    if ((character >= L'A' && character <= L'Z') || (character >= L'0' && character <= L'9') || (character >= 32 && character < 127))
+    {
+        return character;
+    }
+    return -1;
+}
+
 // transforms a stage y coordinate into it's corresponding location on the screen render plane
 double scratch_util::stage_to_screen_x_coordinate(double scratch_y)
 {
@@ -21,4 +86,28 @@ double scratch_util::stage_to_screen_x_coordinate(double scratch_y)
 double scratch_util::stage_to_screen_y_coordinate(double scratch_x)
 {
     return scratch_x + STAGE_SIZE_Y / 2.0;
-}
\ No newline at end of file
+}
+
+// narrows [t_min, t_max] down to the values of t for which 0 <= start + step * t < limit
+void scratch_util::clip_span(double start, double step, double limit, double& t_min, double& t_max)
+{
+    double t_enter = 0.0;
+    double t_exit = 0.0;
+
+    if (step == 0.0)
+    {
+        if (start < 0.0 || start >= limit)
+        {
+            t_max = t_min - 1.0; // empty span
+        }
+        return;
+    }
+    t_enter = -start / step;
+    t_exit = (limit - start) / step;
+    if (t_enter > t_exit)
+    {
+        std::swap(t_enter, t_exit);
+    }
+    t_min = std::max(t_min, t_enter);
+    t_max = std::min(t_max, t_exit);
+}
@@ -0,0 +1,75 @@
+/*
+File: script-node.cpp
+Description: Implements the block tree that scripts are described with before being compiled
+*/
+
+#include "scratch-vm.hpp"
+
+using namespace scratch;
+
+script_node::script_node(std::string opcode)
+{
+    m_opcode = opcode;
+    m_mutation.warp = false;
+    mp_next = nullptr;
+}
+
+script_node::~script_node() // frees every block hanging off of this one
+{
+    script_node* p_next = mp_next;
+    script_node* p_after = nullptr;
+
+    for (std::pair<std::string, script_node*>& input : m_inputs)
+    {
+        delete input.second;
+    }
+    while (p_next != nullptr) // walking the stack instead of recursing so long scripts cannot overflow the call stack
+    {
+        p_after = p_next->mp_next;
+        p_next->mp_next = nullptr;
+        delete p_next;
+        p_next = p_after;
+    }
+}
+
+script_node* script_node::make_literal(scratch_state value)
+{
+    script_node* p_node = new script_node("literal");
+    p_node->m_literal = value;
+    return p_node;
+}
+
+// the node takes ownership of p_node
+void script_node::add_input(std::string name, script_node* p_node)
+{
+    m_inputs.push_back(std::make_pair(name, p_node));
+}
+
+void script_node::add_field(std::string name, std::wstring value)
+{
+    m_fields.push_back(std::make_pair(name, value));
+}
+
+script_node* script_node::get_input(const std::string& name)
+{
+    for (std::pair<std::string, script_node*>& input : m_inputs)
+    {
+        if (input.first == name)
+        {
+            return input.second;
+        }
+    }
+    return nullptr;
+}
+
+const std::wstring* script_node::get_field(const std::string& name)
+{
+    for (std::pair<std::string, std::wstring>& field : m_fields)
+    {
+        if (field.first == name)
+        {
+            return &field.second;
+        }
+    }
+    return nullptr;
+}
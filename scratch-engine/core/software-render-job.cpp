@@ -0,0 +1,435 @@
+/*
+File: software-render-job.cpp
+Description: Implements the CPU rasterizer CScratch uses to draw the stage when running headless
+*/
+
+#include "scratch-jobs.hpp"
+#include "scratch-util.hpp"
+#include "scratch-config.hpp"
+#include "scratch-trace.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using namespace scratch;
+using namespace scratch_util;
+
+// blends a source pixel over a destination pixel using the same equation as raylib's BLEND_ALPHA mode
+static inline void blend_pixel(Color* p_destination, Color source)
+{
+    unsigned int alpha = source.a;
+    unsigned int inverse_alpha = 255 - alpha;
+
+    if (alpha == 255)
+    {
+        *p_destination = source;
+        return;
+    }
+    if (alpha == 0)
+    {
+        return;
+    }
+    p_destination->r = (unsigned char)((source.r * alpha + p_destination->r * inverse_alpha + 127) / 255);
+    p_destination->g = (unsigned char)((source.g * alpha + p_destination->g * inverse_alpha + 127) / 255);
+    p_destination->b = (unsigned char)((source.b * alpha + p_destination->b * inverse_alpha + 127) / 255);
+    p_destination->a = (unsigned char)((source.a * alpha + p_destination->a * inverse_alpha + 127) / 255);
+}
+
+// the pen layer keeps premultiplied colors so lines drawn over empty pixels don't pick up their black, this is the equivalent of
+// drawing non-premultiplied colors into it with BLEND_CUSTOM_SEPARATE (src alpha, one minus src alpha for color, one, one minus src alpha for alpha)
+static inline void blend_pen_pixel(Color* p_destination, Color source)
+{
+    unsigned int alpha = source.a;
+    unsigned int inverse_alpha = 255 - alpha;
+
+    if (alpha == 0)
+    {
+        return;
+    }
+    p_destination->r = (unsigned char)((source.r * alpha + p_destination->r * inverse_alpha + 127) / 255);
+    p_destination->g = (unsigned char)((source.g * alpha + p_destination->g * inverse_alpha + 127) / 255);
+    p_destination->b = (unsigned char)((source.b * alpha + p_destination->b * inverse_alpha + 127) / 255);
+    p_destination->a = (unsigned char)(alpha + (p_destination->a * inverse_alpha + 127) / 255);
+}
+
+static inline void blend_pixel(Color* p_destination, Color source, bool pen_target)
+{
+    if (pen_target)
+    {
+        blend_pen_pixel(p_destination, source);
+    }
+    else
+    {
+        blend_pixel(p_destination, source);
+    }
+}
+
+// software render job
+software_render_job::software_render_job(layer_list* p_layers, pen_layer* p_pen_layer, stage_damage* p_damage, Color* p_framebuffer, render_stats* p_stats)
+{
+    mp_layers = p_layers;
+    mp_pen_layer = p_pen_layer;
+    mp_damage = p_damage;
+    mp_framebuffer = p_framebuffer;
+    m_clip_min_x = 0;
+    m_clip_min_y = 0;
+    m_clip_max_x = STAGE_SIZE_X - 1;
+    m_clip_max_y = STAGE_SIZE_Y - 1;
+    mp_pen_framebuffer = nullptr;
+    mp_stats = p_stats;
+}
+software_render_job::~software_render_job()
+{
+    delete[] mp_pen_framebuffer;
+}
+const char* software_render_job::get_name()
+{
+    return "software_render_job";
+}
+
+// the framebuffer is only drawn again where something changed, a project sitting idle leaves it as it is
+job_status software_render_job::run()
+{
+    Color clear_color = COLOR_WHITE;
+    Rectangle area = {0.0f, 0.0f, (float)STAGE_SIZE_X, (float)STAGE_SIZE_Y};
+    bool redraw = true;
+
+    if (mp_layers == nullptr || mp_framebuffer == nullptr)
+    {
+        return job_status::error;
+    }
+    if (mp_stats != nullptr) // there are no draw calls or textures to count on the CPU
+    {
+        *mp_stats = {};
+    }
+    redraw = mp_damage == nullptr || mp_damage->collect(mp_layers->get_draw_order(), mp_pen_layer, area); // before the flush, which empties the pen's damage
+
+    // the pen layer sits between the backdrop and the sprites, projects that never use the pen never pay for it
+    if (mp_pen_layer != nullptr && mp_pen_layer->has_pending())
+    {
+        flush_pen();
+    }
+    if (!redraw)
+    {
+        return job_status::ok;
+    }
+    m_clip_min_x = (int)area.x;
+    m_clip_min_y = (int)area.y;
+    m_clip_max_x = (int)(area.x + area.width) - 1;
+    m_clip_max_y = (int)(area.y + area.height) - 1;
+    if (mp_stats != nullptr)
+    {
+        mp_stats->redrawn_pixels = (unsigned int)(area.width * area.height);
+    }
+
+    for (int row = m_clip_min_y; row <= m_clip_max_y; ++row)
+    {
+        int offset = (STAGE_SIZE_Y - 1 - row) * STAGE_SIZE_X; // render plane rows are stored bottom up, see draw_costume
+
+        for (int i = offset + m_clip_min_x; i <= offset + m_clip_max_x; ++i)
+        {
+            mp_framebuffer[i] = clear_color;
+        }
+        if (mp_pen_framebuffer == nullptr)
+        {
+            continue;
+        }
+        for (int i = offset + m_clip_min_x; i <= offset + m_clip_max_x; ++i)
+        {
+            Color pen = mp_pen_framebuffer[i];
+            unsigned int inverse_alpha = 255 - pen.a;
+
+            if (pen.a == 0)
+            {
+                continue;
+            }
+            mp_framebuffer[i].r = (unsigned char)(pen.r + (mp_framebuffer[i].r * inverse_alpha + 127) / 255);
+            mp_framebuffer[i].g = (unsigned char)(pen.g + (mp_framebuffer[i].g * inverse_alpha + 127) / 255);
+            mp_framebuffer[i].b = (unsigned char)(pen.b + (mp_framebuffer[i].b * inverse_alpha + 127) / 255);
+            mp_framebuffer[i].a = (unsigned char)(pen.a + (mp_framebuffer[i].a * inverse_alpha + 127) / 255);
+        }
+    }
+
+    // render all sprites
+    for (sprite* p_sprite : mp_layers->get_draw_order())
+    {
+        if (p_sprite->is_hidden())
+        {
+            continue;
+        }
+        draw_sprite(p_sprite);
+    }
+    return job_status::ok;
+}
+
+// draws a sprite the same way render_job::draw_sprite lays out its quad (same destination rectangle, origin and rotation)
+// every covered stage pixel is mapped back into the costume image and point sampled, which is what raylib does with the default texture filter
+void software_render_job::draw_sprite(sprite* p_sprite)
+{
+    costume* p_costume = nullptr;
+    sprite_transform transform = {};
+    sprite_effects effects = {};
+    bool has_effects = false;
+    SCRATCH_TRACE_SCOPE("software_render_job::draw_sprite");
+
+    if (p_sprite == nullptr)
+    {
+        return;
+    }
+
+    p_costume = p_sprite->get_current_costume();
+    if (p_costume == nullptr || !p_costume->has_image() || !p_sprite->get_transform(transform))
+    {
+        return;
+    }
+    if (transform.max_x < m_clip_min_x || transform.min_x > m_clip_max_x + 1 || transform.max_y < m_clip_min_y || transform.min_y > m_clip_max_y + 1)
+    {
+        return;
+    }
+    has_effects = p_sprite->get_effects(effects);
+    draw_costume(mp_framebuffer, false, p_costume, transform, has_effects, effects);
+    if (mp_stats != nullptr)
+    {
+        ++mp_stats->sprites_drawn;
+        mp_stats->effect_sprites += has_effects && (effects.coordinates || effects.colors) ? 1 : 0;
+    }
+}
+
+// the part of draw_sprite that doesn't need the sprite itself, shared with stamps which only have a snapshot of it
+void software_render_job::draw_costume(Color* p_target, bool pen_target, costume* p_costume, const sprite_transform& transform, bool has_effects, const sprite_effects& effects)
+{
+    Image image = {};
+    const Color* p_pixels = nullptr;
+    double source_width = 0.0;
+    int row_start = 0;
+    int row_end = 0;
+    int column_start = 0;
+    int column_end = 0;
+    int clip_min_x = pen_target ? 0 : m_clip_min_x; // the pen layer keeps everything, it is never redrawn
+    int clip_max_x = pen_target ? STAGE_SIZE_X - 1 : m_clip_max_x;
+    unsigned int ghost_alpha = 255;
+    bool span_effects = has_effects && (effects.coordinates || effects.colors);
+
+    if (p_costume == nullptr || !p_costume->has_image())
+    {
+        return;
+    }
+    image = p_costume->get_image();
+    p_pixels = (const Color*)image.data;
+    source_width = image.width;
+    if (has_effects)
+    {
+        ghost_alpha = (unsigned int)(effects.ghost * 255.0f + 0.5f); // ghost alone doesn't need the float path
+    }
+
+    column_start = std::max(0, (int)floor(transform.min_x));
+    column_end = std::min(STAGE_SIZE_X - 1, (int)ceil(transform.max_x));
+    row_start = std::max(pen_target ? 0 : m_clip_min_y, (int)floor(transform.min_y));
+    row_end = std::min(pen_target ? STAGE_SIZE_Y - 1 : m_clip_max_y, (int)ceil(transform.max_y));
+
+    for (int row = row_start; row <= row_end; ++row)
+    {
+        // the render texture is drawn upside down when presented, so row 0 of the render plane is the bottom row of the framebuffer
+        Color* p_row = p_target + (STAGE_SIZE_Y - 1 - row) * STAGE_SIZE_X;
+        double relative_x = column_start + 0.5 - transform.x;
+        double relative_y = row + 0.5 - transform.y;
+        double local_x = relative_x * transform.cos_rotation + relative_y * transform.sin_rotation + transform.origin_x; // undoing the rotation
+        double local_y = -relative_x * transform.sin_rotation + relative_y * transform.cos_rotation + transform.origin_y;
+        double t_min = 0.0;
+        double t_max = column_end - column_start;
+        int first = 0;
+        int last = 0;
+
+        // only visiting the pixels of this row that land inside the destination rectangle
+        clip_span(local_x, transform.cos_rotation, transform.width, t_min, t_max);
+        clip_span(local_y, -transform.sin_rotation, transform.height, t_min, t_max);
+        t_min = std::max(t_min, (double)(clip_min_x - column_start)); // clipping t rather than moving column_start keeps the samples bit for bit the same as a full redraw
+        t_max = std::min(t_max, (double)(clip_max_x - column_start));
+        if (t_min > t_max)
+        {
+            continue;
+        }
+        first = (int)ceil(t_min);
+        last = (int)floor(t_max);
+        if (span_effects)
+        {
+            unsigned int count = 0;
+
+            for (int t = first; t <= last; ++t)
+            {
+                double sample_x = local_x + t * transform.cos_rotation;
+                double sample_y = local_y - t * transform.sin_rotation;
+
+                mp_span_u[count] = (float)(sample_x / transform.width);
+                mp_span_v[count] = (float)(sample_y / transform.height);
+                if (transform.flip_x) // effects work on the costume the way it was drawn, mirroring happens afterwards
+                {
+                    mp_span_u[count] = 1.0f - mp_span_u[count];
+                }
+                ++count;
+            }
+            draw_span(p_row + column_start + first, pen_target, image, effects, count);
+            continue;
+        }
+        for (int t = first; t <= last; ++t)
+        {
+            double sample_x = local_x + t * transform.cos_rotation;
+            double sample_y = local_y - t * transform.sin_rotation;
+            int texel_x = 0;
+            int texel_y = 0;
+
+            if (sample_x < 0.0 || sample_x >= transform.width || sample_y < 0.0 || sample_y >= transform.height) // clip_span endpoints can round onto the edge
+            {
+                continue;
+            }
+            texel_x = (int)(sample_x * transform.u_scale);
+            texel_y = (int)(sample_y * transform.v_scale);
+            if (transform.flip_x)
+            {
+                texel_x = (int)source_width - 1 - texel_x;
+            }
+            if (texel_x < 0 || texel_x >= image.width || texel_y < 0 || texel_y >= image.height)
+            {
+                continue;
+            }
+            if (ghost_alpha == 255)
+            {
+                blend_pixel(p_row + column_start + t, p_pixels[texel_y * image.width + texel_x], pen_target);
+            }
+            else
+            {
+                Color pixel = p_pixels[texel_y * image.width + texel_x];
+
+                pixel.a = (unsigned char)((pixel.a * ghost_alpha + 127) / 255);
+                blend_pixel(p_row + column_start + t, pixel, pen_target);
+            }
+        }
+    }
+}
+
+// the coordinate effects can send samples outside the costume, those pixels are left alone just like transparent ones
+void software_render_job::draw_span(Color* p_destination, bool pen_target, const Image& image, const sprite_effects& effects, unsigned int count)
+{
+    const Color* p_pixels = (const Color*)image.data;
+
+    if (effects.coordinates)
+    {
+        apply_effect_coordinates(effects, mp_span_u, mp_span_v, count);
+    }
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        int texel_x = (int)std::floor(mp_span_u[i] * image.width);
+        int texel_y = (int)std::floor(mp_span_v[i] * image.height);
+        Color pixel = {};
+
+        if (texel_x >= 0 && texel_x < image.width && texel_y >= 0 && texel_y < image.height)
+        {
+            pixel = p_pixels[texel_y * image.width + texel_x];
+        }
+        mp_span_red[i] = pixel.r / 255.0f;
+        mp_span_green[i] = pixel.g / 255.0f;
+        mp_span_blue[i] = pixel.b / 255.0f;
+        mp_span_alpha[i] = pixel.a / 255.0f;
+    }
+    apply_effect_colors(effects, mp_span_red, mp_span_green, mp_span_blue, mp_span_alpha, count);
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        Color pixel = {(unsigned char)(mp_span_red[i] * 255.0f + 0.5f), (unsigned char)(mp_span_green[i] * 255.0f + 0.5f),
+            (unsigned char)(mp_span_blue[i] * 255.0f + 0.5f), (unsigned char)(mp_span_alpha[i] * 255.0f + 0.5f)};
+
+        blend_pixel(p_destination + i, pixel, pen_target);
+    }
+}
+
+// lines and stamps go in the order they were issued, the stamps remember how many lines came before them
+void software_render_job::flush_pen()
+{
+    const std::vector<pen_line>& lines = mp_pen_layer->get_lines();
+    const std::vector<pen_stamp>& stamps = mp_pen_layer->get_stamps();
+    size_t line = 0;
+    SCRATCH_TRACE_SCOPE("software_render_job::flush_pen");
+
+    if (mp_pen_layer->is_clear_pending() && mp_pen_framebuffer != nullptr)
+    {
+        memset(mp_pen_framebuffer, 0, sizeof(Color) * STAGE_PIXEL_COUNT);
+    }
+    if (mp_pen_framebuffer == nullptr && (!lines.empty() || !stamps.empty()))
+    {
+        mp_pen_framebuffer = new Color[STAGE_PIXEL_COUNT]();
+    }
+    for (const pen_stamp& stamp : stamps)
+    {
+        for (; line < stamp.line_index; ++line)
+        {
+            draw_pen_line(lines[line]);
+        }
+        draw_costume(mp_pen_framebuffer, true, stamp.p_costume, stamp.transform, stamp.has_effects, stamp.effects);
+    }
+    for (; line < lines.size(); ++line)
+    {
+        draw_pen_line(lines[line]);
+    }
+    if (mp_stats != nullptr)
+    {
+        mp_stats->pen_lines = lines.size();
+        mp_stats->pen_stamps = stamps.size();
+    }
+    mp_pen_layer->finish_frame();
+}
+
+// lines have round caps, so a pixel is covered when its center is within half the pen size of the segment
+// the covered part of each row is the union of what the two end discs and the rectangle between them cover, one span since the shape is convex
+void software_render_job::draw_pen_line(const pen_line& line)
+{
+    double radius = std::max(line.size, 1.0f) / 2.0;
+    double delta_x = line.x1 - line.x0;
+    double delta_y = line.y1 - line.y0;
+    double length = sqrt(delta_x * delta_x + delta_y * delta_y);
+    int row_start = std::max(0, (int)floor(std::min(line.y0, line.y1) - radius));
+    int row_end = std::min(STAGE_SIZE_Y - 1, (int)ceil(std::max(line.y0, line.y1) + radius));
+
+    for (int row = row_start; row <= row_end; ++row)
+    {
+        Color* p_row = mp_pen_framebuffer + (STAGE_SIZE_Y - 1 - row) * STAGE_SIZE_X;
+        double center_y = row + 0.5;
+        double span_start = INFINITY;
+        double span_end = -INFINITY;
+        int first = 0;
+        int last = 0;
+
+        for (int end = 0; end < 2; ++end)
+        {
+            double offset_y = center_y - (end == 0 ? line.y0 : line.y1);
+            double half_width = radius * radius - offset_y * offset_y;
+
+            if (half_width >= 0.0)
+            {
+                half_width = sqrt(half_width);
+                span_start = std::min(span_start, (end == 0 ? line.x0 : line.x1) - half_width);
+                span_end = std::max(span_end, (end == 0 ? line.x0 : line.x1) + half_width);
+            }
+        }
+        if (length > 0.0)
+        {
+            // along and across the segment for x = line.x0 + t, with across shifted so the rectangle is 0 to 2 * radius
+            double along = (center_y - line.y0) * delta_y / length;
+            double across = (center_y - line.y0) * delta_x / length + radius;
+            double t_min = -INFINITY;
+            double t_max = INFINITY;
+
+            clip_span(along, delta_x / length, length, t_min, t_max);
+            clip_span(across, -delta_y / length, 2.0 * radius, t_min, t_max);
+            if (t_min <= t_max)
+            {
+                span_start = std::min(span_start, line.x0 + t_min);
+                span_end = std::max(span_end, line.x0 + t_max);
+            }
+        }
+        first = std::max(0, (int)ceil(span_start - 0.5));
+        last = std::min(STAGE_SIZE_X - 1, (int)floor(span_end - 0.5));
+        for (int column = first; column <= last; ++column)
+        {
+            blend_pen_pixel(p_row + column, line.color);
+        }
+    }
+}
@@ -0,0 +1,258 @@
+/*
+File: sprite-collision.cpp
+Description: Implements the pixel perfect touching queries for CScratch sprites using the per costume alpha masks
+*/
+
+#include "scratch-render.hpp"
+#include "scratch-util.hpp"
+#include "scratch-config.hpp"
+#include "scratch-trace.hpp"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace scratch;
+using namespace scratch_util;
+
+namespace
+{
+    const int STAGE_ROW_WORDS = (STAGE_SIZE_X + 63) / 64;
+
+    // reads 64 mask bits starting at bit offset, bits before the row start or past its end read as 0
+    unsigned long long read_mask_bits(const unsigned long long* p_row, int word_count, int offset)
+    {
+        int word = offset >> 6; // arithmetic shift keeps negative offsets rounding down
+        int shift = offset & 63;
+        unsigned long long low = (word >= 0 && word < word_count) ? p_row[word] : 0;
+        unsigned long long high = (word + 1 >= 0 && word + 1 < word_count) ? p_row[word + 1] : 0;
+
+        if (shift == 0)
+        {
+            return low;
+        }
+        return (low >> shift) | (high << (64 - shift));
+    }
+
+    // sets bit i of p_words when render plane pixel (column_start + i, row) is covered by an opaque pixel of the costume
+    // pixels are sampled at their centers exactly like software_render_job::draw_sprite so collisions match what is drawn
+    void fill_coverage_row(const sprite_transform& transform, costume* p_costume, int row, int column_start, int column_count, unsigned long long* p_words)
+    {
+        int word_count = (column_count + 63) / 64;
+        int mask_width = p_costume->get_mask_width();
+        int mask_height = p_costume->get_mask_height();
+        double relative_x = column_start + 0.5 - transform.x;
+        double relative_y = row + 0.5 - transform.y;
+        double local_x = relative_x * transform.cos_rotation + relative_y * transform.sin_rotation + transform.origin_x;
+        double local_y = -relative_x * transform.sin_rotation + relative_y * transform.cos_rotation + transform.origin_y;
+        double t_min = 0.0;
+        double t_max = column_count - 1;
+        const unsigned long long* p_mask_row = nullptr;
+        int texel_y = 0;
+        int offset = 0;
+
+        std::fill(p_words, p_words + word_count, 0ULL);
+
+        // unrotated, unscaled and unflipped sprites map screen columns straight onto mask columns so whole words can be copied
+        if (transform.cos_rotation == 1.0 && transform.sin_rotation == 0.0 && transform.u_scale == 1.0 && transform.v_scale == 1.0 && !transform.flip_x
+            && mask_width == transform.width && mask_height == transform.height)
+        {
+            if (local_y < 0.0 || local_y >= transform.height)
+            {
+                return;
+            }
+            texel_y = (int)local_y;
+            p_mask_row = p_costume->get_mask_row(texel_y);
+            offset = (int)floor(local_x); // column column_start + i lands on texel offset + i
+            for (int word = 0; word < word_count; ++word)
+            {
+                p_words[word] = read_mask_bits(p_mask_row, (mask_width + 63) / 64, offset + word * 64);
+            }
+            if (column_count & 63) // the last word can pick up columns past the end of the span
+            {
+                p_words[word_count - 1] &= (1ULL << (column_count & 63)) - 1;
+            }
+            return;
+        }
+
+        clip_span(local_x, transform.cos_rotation, transform.width, t_min, t_max);
+        clip_span(local_y, -transform.sin_rotation, transform.height, t_min, t_max);
+        if (t_min > t_max)
+        {
+            return;
+        }
+        for (int t = (int)ceil(t_min); t <= (int)floor(t_max); ++t)
+        {
+            double sample_x = local_x + t * transform.cos_rotation;
+            double sample_y = local_y - t * transform.sin_rotation;
+            int texel_x = 0;
+
+            if (sample_x < 0.0 || sample_x >= transform.width || sample_y < 0.0 || sample_y >= transform.height)
+            {
+                continue;
+            }
+            texel_x = (int)(sample_x * transform.u_scale);
+            texel_y = (int)(sample_y * transform.v_scale);
+            if (transform.flip_x)
+            {
+                texel_x = mask_width - 1 - texel_x;
+            }
+            if (texel_x < 0 || texel_x >= mask_width || texel_y < 0 || texel_y >= mask_height)
+            {
+                continue;
+            }
+            if ((p_costume->get_mask_row(texel_y)[texel_x >> 6] >> (texel_x & 63)) & 1)
+            {
+                p_words[t >> 6] |= 1ULL << (t & 63);
+            }
+        }
+    }
+
+    bool any_bits(const unsigned long long* p_words, int word_count)
+    {
+        for (int i = 0; i < word_count; ++i)
+        {
+            if (p_words[i] != 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+}
+
+// true when the opaque pixel under the given stage point belongs to this sprite, hidden sprites touch nothing
+bool sprite::touches_point(double x, double y)
+{
+    costume* p_costume = get_current_costume();
+    sprite_transform transform = {};
+    unsigned long long word = 0;
+    int column = (int)floor(stage_to_screen_x_coordinate(x));
+    int row = (int)floor(stage_to_screen_y_coordinate(y));
+
+    if (m_hidden || p_costume == nullptr || !p_costume->has_mask() || !get_transform(transform))
+    {
+        return false;
+    }
+    if (column < transform.min_x - 1.0 || column > transform.max_x || row < transform.min_y - 1.0 || row > transform.max_y)
+    {
+        return false;
+    }
+    fill_coverage_row(transform, p_costume, row, column, 1, &word);
+    return word != 0;
+}
+
+// only the on stage part of the bounding box overlap is tested, and rows are compared 64 pixels at a time
+bool sprite::touches_sprite(sprite* p_other)
+{
+    SCRATCH_TRACE_SCOPE("sprite::touches_sprite");
+    costume* p_costume = get_current_costume();
+    costume* p_other_costume = nullptr;
+    sprite_transform transform = {};
+    sprite_transform other_transform = {};
+    unsigned long long p_words[STAGE_ROW_WORDS];
+    unsigned long long p_other_words[STAGE_ROW_WORDS];
+    int column_start = 0;
+    int column_end = 0;
+    int row_start = 0;
+    int row_end = 0;
+    int column_count = 0;
+    int word_count = 0;
+
+    if (p_other == nullptr || p_other == this || m_hidden || p_other->m_hidden)
+    {
+        return false;
+    }
+    p_other_costume = p_other->get_current_costume();
+    if (p_costume == nullptr || p_other_costume == nullptr || !p_costume->has_mask() || !p_other_costume->has_mask())
+    {
+        return false;
+    }
+    if (!get_transform(transform) || !p_other->get_transform(other_transform))
+    {
+        return false;
+    }
+
+    column_start = std::max(0, (int)floor(std::max(transform.min_x, other_transform.min_x)));
+    column_end = std::min(STAGE_SIZE_X - 1, (int)ceil(std::min(transform.max_x, other_transform.max_x)));
+    row_start = std::max(0, (int)floor(std::max(transform.min_y, other_transform.min_y)));
+    row_end = std::min(STAGE_SIZE_Y - 1, (int)ceil(std::min(transform.max_y, other_transform.max_y)));
+    if (column_start > column_end || row_start > row_end)
+    {
+        return false;
+    }
+
+    column_count = column_end - column_start + 1;
+    word_count = (column_count + 63) / 64;
+    for (int row = row_start; row <= row_end; ++row)
+    {
+        fill_coverage_row(transform, p_costume, row, column_start, column_count, p_words);
+        if (!any_bits(p_words, word_count))
+        {
+            continue;
+        }
+        fill_coverage_row(other_transform, p_other_costume, row, column_start, column_count, p_other_words);
+        for (int word = 0; word < word_count; ++word)
+        {
+            if (p_words[word] & p_other_words[word])
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// true when any opaque pixel of the sprite lies off the stage
+bool sprite::touches_edge()
+{
+    costume* p_costume = get_current_costume();
+    sprite_transform transform = {};
+    std::vector<unsigned long long> words;
+    int column_start = 0;
+    int column_end = 0;
+    int row_start = 0;
+    int row_end = 0;
+
+    if (m_hidden || p_costume == nullptr || !p_costume->has_mask() || !get_transform(transform))
+    {
+        return false;
+    }
+    column_start = (int)floor(transform.min_x);
+    column_end = (int)ceil(transform.max_x);
+    row_start = (int)floor(transform.min_y);
+    row_end = (int)ceil(transform.max_y);
+    if (column_start >= 0 && column_end < STAGE_SIZE_X && row_start >= 0 && row_end < STAGE_SIZE_Y) // the whole box is on stage
+    {
+        return false;
+    }
+
+    words.resize((column_end - column_start + 64) / 64);
+    for (int row = row_start; row <= row_end; ++row)
+    {
+        int span_start = column_start;
+        int span_end = column_end;
+
+        if (row >= 0 && row < STAGE_SIZE_Y) // on stage rows only need the parts hanging off the sides
+        {
+            if (column_start < 0)
+            {
+                fill_coverage_row(transform, p_costume, row, column_start, -column_start, words.data());
+                if (any_bits(words.data(), (-column_start + 63) / 64))
+                {
+                    return true;
+                }
+            }
+            span_start = std::max(column_start, STAGE_SIZE_X);
+        }
+        if (span_start > span_end)
+        {
+            continue;
+        }
+        fill_coverage_row(transform, p_costume, row, span_start, span_end - span_start + 1, words.data());
+        if (any_bits(words.data(), (span_end - span_start + 64) / 64))
+        {
+            return true;
+        }
+    }
+    return false;
+}
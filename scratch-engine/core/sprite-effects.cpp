@@ -0,0 +1,121 @@
+/*
+File: sprite-effects.cpp
+Description: Implements the CPU version of the graphical effects, the same math as the effect shader in render-job.cpp
+*/
+
+#include "scratch-render.hpp"
+#include <algorithm>
+#include <cmath>
+
+using namespace scratch;
+
+namespace
+{
+    const float EFFECT_CENTER = 0.5f;
+    const float EFFECT_MIN_VALUE = 0.11f / 2.0f; // Scratch gives near black and near gray pixels a bit of color so the hue shift is visible on them
+    const float EFFECT_MIN_SATURATION = 0.09f;
+
+    float clamp_unit(float value)
+    {
+        return std::min(std::max(value, 0.0f), 1.0f);
+    }
+}
+
+// each effect is its own pass over the span and they run in the order Scratch's shader applies them: mosaic, pixelate, whirl, fisheye
+void scratch::apply_effect_coordinates(const sprite_effects& effects, float* p_u, float* p_v, unsigned int count)
+{
+    if (effects.mosaic != 1.0f)
+    {
+        for (unsigned int i = 0; i < count; ++i)
+        {
+            p_u[i] = p_u[i] * effects.mosaic - std::floor(p_u[i] * effects.mosaic);
+            p_v[i] = p_v[i] * effects.mosaic - std::floor(p_v[i] * effects.mosaic);
+        }
+    }
+    if (effects.pixelate > 0.0f && effects.costume_width > 0.0f && effects.costume_height > 0.0f)
+    {
+        float blocks_u = effects.costume_width / effects.pixelate;
+        float blocks_v = effects.costume_height / effects.pixelate;
+
+        for (unsigned int i = 0; i < count; ++i)
+        {
+            p_u[i] = (std::floor(p_u[i] * blocks_u) + EFFECT_CENTER) / blocks_u;
+            p_v[i] = (std::floor(p_v[i] * blocks_v) + EFFECT_CENTER) / blocks_v;
+        }
+    }
+    if (effects.whirl != 0.0f)
+    {
+        for (unsigned int i = 0; i < count; ++i)
+        {
+            float offset_u = p_u[i] - EFFECT_CENTER;
+            float offset_v = p_v[i] - EFFECT_CENTER;
+            float falloff = std::max(1.0f - std::sqrt(offset_u * offset_u + offset_v * offset_v) / EFFECT_CENTER, 0.0f);
+            float angle = effects.whirl * falloff * falloff;
+            float cos_angle = std::cos(angle);
+            float sin_angle = std::sin(angle);
+
+            p_u[i] = cos_angle * offset_u + sin_angle * offset_v + EFFECT_CENTER;
+            p_v[i] = -sin_angle * offset_u + cos_angle * offset_v + EFFECT_CENTER;
+        }
+    }
+    if (effects.fisheye != 1.0f)
+    {
+        for (unsigned int i = 0; i < count; ++i)
+        {
+            float direction_u = (p_u[i] - EFFECT_CENTER) / EFFECT_CENTER;
+            float direction_v = (p_v[i] - EFFECT_CENTER) / EFFECT_CENTER;
+            float length = std::sqrt(direction_u * direction_u + direction_v * direction_v);
+            float radius = std::pow(std::min(length, 1.0f), effects.fisheye) * std::max(1.0f, length);
+            float scale = length > 0.0f ? radius / length * EFFECT_CENTER : 0.0f;
+
+            p_u[i] = EFFECT_CENTER + direction_u * scale;
+            p_v[i] = EFFECT_CENTER + direction_v * scale;
+        }
+    }
+}
+
+// hue shifting goes through HSV with selects instead of branches, then brightness and ghost are plain adds and multiplies
+void scratch::apply_effect_colors(const sprite_effects& effects, float* p_red, float* p_green, float* p_blue, float* p_alpha, unsigned int count)
+{
+    if (effects.color != 0.0f)
+    {
+        for (unsigned int i = 0; i < count; ++i)
+        {
+            float red = p_red[i];
+            float green = p_green[i];
+            float blue = p_blue[i];
+            float value = std::max(red, std::max(green, blue));
+            float chroma = value - std::min(red, std::min(green, blue));
+            float hue = chroma == 0.0f ? 0.0f : value == red ? (green - blue) / chroma : value == green ? (blue - red) / chroma + 2.0f : (red - green) / chroma + 4.0f;
+            float saturation = value > 0.0f ? chroma / value : 0.0f;
+            bool dark = value < EFFECT_MIN_VALUE;
+            bool gray = !dark && saturation < EFFECT_MIN_SATURATION;
+
+            hue = dark || gray ? 0.0f : hue / 6.0f;
+            saturation = dark ? 1.0f : gray ? EFFECT_MIN_SATURATION : saturation;
+            value = dark ? EFFECT_MIN_VALUE : value;
+            hue += effects.color;
+            hue -= std::floor(hue);
+            chroma = value * saturation;
+            p_red[i] = clamp_unit(std::fabs(hue * 6.0f - 3.0f) - 1.0f) * chroma + value - chroma;
+            p_green[i] = clamp_unit(2.0f - std::fabs(hue * 6.0f - 2.0f)) * chroma + value - chroma;
+            p_blue[i] = clamp_unit(2.0f - std::fabs(hue * 6.0f - 4.0f)) * chroma + value - chroma;
+        }
+    }
+    if (effects.brightness != 0.0f)
+    {
+        for (unsigned int i = 0; i < count; ++i)
+        {
+            p_red[i] = clamp_unit(p_red[i] + effects.brightness);
+            p_green[i] = clamp_unit(p_green[i] + effects.brightness);
+            p_blue[i] = clamp_unit(p_blue[i] + effects.brightness);
+        }
+    }
+    if (effects.ghost != 1.0f)
+    {
+        for (unsigned int i = 0; i < count; ++i)
+        {
+            p_alpha[i] *= effects.ghost;
+        }
+    }
+}
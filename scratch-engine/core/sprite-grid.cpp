@@ -0,0 +1,251 @@
+/*
+File: sprite-grid.cpp
+Description: Implements the uniform grid CScratch uses as a broad phase for touching and picking queries
+*/
+
+#include "scratch-render.hpp"
+#include "scratch-util.hpp"
+#include "scratch-config.hpp"
+#include <algorithm>
+#include <cmath>
+
+using namespace scratch;
+
+sprite_grid::sprite_grid(double cell_size)
+{
+    mp_transforms = nullptr;
+    m_cell_size = 0.0;
+    m_columns = 0;
+    m_rows = 0;
+    m_query_stamp = 0;
+    m_updates = 0;
+    m_relinks = 0;
+    m_queries = 0;
+    m_candidates = 0;
+    set_cell_size(cell_size);
+}
+
+// sprites only move between cells when their bounds cross a cell border so most moves just compare four numbers
+void sprite_grid::update(sprite* p_sprite)
+{
+    sprite_transform transform = {};
+    int first_column = 0;
+    int first_row = 0;
+    int last_column = 0;
+    int last_row = 0;
+
+    ++m_updates;
+    if (!p_sprite->get_transform(transform))
+    {
+        unlink(p_sprite);
+        return;
+    }
+    first_column = column_of(transform.min_x);
+    first_row = row_of(transform.min_y);
+    last_column = column_of(transform.max_x);
+    last_row = row_of(transform.max_y);
+    if (p_sprite->m_in_grid && p_sprite->mp_grid_cells[0] == first_column && p_sprite->mp_grid_cells[1] == first_row
+        && p_sprite->mp_grid_cells[2] == last_column && p_sprite->mp_grid_cells[3] == last_row)
+    {
+        return;
+    }
+
+    ++m_relinks;
+    unlink(p_sprite);
+    p_sprite->mp_grid_cells[0] = first_column;
+    p_sprite->mp_grid_cells[1] = first_row;
+    p_sprite->mp_grid_cells[2] = last_column;
+    p_sprite->mp_grid_cells[3] = last_row;
+    link(p_sprite);
+}
+
+void sprite_grid::remove(sprite* p_sprite)
+{
+    unlink(p_sprite);
+}
+
+void sprite_grid::set_cell_size(double cell_size)
+{
+    std::vector<sprite*> sprites;
+
+    for (std::vector<sprite*>& cell : m_cells) // each sprite is collected from its first cell only
+    {
+        for (sprite* p_sprite : cell)
+        {
+            if (&cell == &m_cells[(size_t)p_sprite->mp_grid_cells[1] * m_columns + p_sprite->mp_grid_cells[0]])
+            {
+                sprites.push_back(p_sprite);
+            }
+        }
+    }
+    for (sprite* p_sprite : sprites)
+    {
+        p_sprite->m_in_grid = false;
+    }
+
+    m_cell_size = cell_size > 0.0 ? cell_size : SPRITE_GRID_DEFAULT_CELL_SIZE;
+    m_columns = std::max(1, (int)ceil(STAGE_SIZE_X / m_cell_size));
+    m_rows = std::max(1, (int)ceil(STAGE_SIZE_Y / m_cell_size));
+    m_cells.assign((size_t)m_columns * m_rows, std::vector<sprite*>());
+    for (sprite* p_sprite : sprites)
+    {
+        update(p_sprite);
+    }
+}
+
+void sprite_grid::set_transform_store(transform_store* p_transforms)
+{
+    mp_transforms = p_transforms;
+}
+
+// pixels are sampled at their centers so the point's pixel is the only one that can be hit
+const std::vector<sprite*>& sprite_grid::query_point(double x, double y)
+{
+    double column = floor(scratch_util::stage_to_screen_x_coordinate(x));
+    double row = floor(scratch_util::stage_to_screen_y_coordinate(y));
+
+    return query_box(column, row, column, row);
+}
+
+const std::vector<sprite*>& sprite_grid::query_box(double min_x, double min_y, double max_x, double max_y)
+{
+    int first_column = column_of(min_x);
+    int first_row = row_of(min_y);
+    int last_column = column_of(max_x);
+    int last_row = row_of(max_y);
+
+    if (mp_transforms != nullptr)
+    {
+        mp_transforms->update();
+    }
+    m_results.clear();
+    ++m_queries;
+    if (++m_query_stamp == 0) // wrapped around, stale stamps could now match so they all get cleared
+    {
+        for (std::vector<sprite*>& cell : m_cells)
+        {
+            for (sprite* p_sprite : cell)
+            {
+                p_sprite->m_grid_query_stamp = 0;
+            }
+        }
+        m_query_stamp = 1;
+    }
+
+    for (int row = first_row; row <= last_row; ++row)
+    {
+        for (int column = first_column; column <= last_column; ++column)
+        {
+            for (sprite* p_sprite : m_cells[(size_t)row * m_columns + column])
+            {
+                if (p_sprite->m_grid_query_stamp != m_query_stamp)
+                {
+                    p_sprite->m_grid_query_stamp = m_query_stamp;
+                    m_results.push_back(p_sprite);
+                }
+            }
+        }
+    }
+    m_candidates += m_results.size();
+    return m_results;
+}
+
+// visits the square around the circle, callers measure the actual distance
+const std::vector<sprite*>& sprite_grid::query_radius(double x, double y, double radius)
+{
+    double center_x = scratch_util::stage_to_screen_x_coordinate(x);
+    double center_y = scratch_util::stage_to_screen_y_coordinate(y);
+
+    radius = std::max(0.0, radius);
+    return query_box(center_x - radius, center_y - radius, center_x + radius, center_y + radius);
+}
+
+sprite_grid_stats sprite_grid::get_stats()
+{
+    sprite_grid_stats stats = {};
+
+    if (mp_transforms != nullptr)
+    {
+        mp_transforms->update();
+    }
+    stats.columns = m_columns;
+    stats.rows = m_rows;
+    stats.cell_size = m_cell_size;
+    stats.updates = m_updates;
+    stats.relinks = m_relinks;
+    stats.queries = m_queries;
+    stats.candidates = m_candidates;
+    for (std::vector<sprite*>& cell : m_cells)
+    {
+        stats.cell_entries += cell.size();
+        stats.occupied_cells += cell.empty() ? 0 : 1;
+        stats.max_cell_occupancy = std::max(stats.max_cell_occupancy, (unsigned int)cell.size());
+        for (sprite* p_sprite : cell) // counting each sprite in its first cell only
+        {
+            if (&cell == &m_cells[(size_t)p_sprite->mp_grid_cells[1] * m_columns + p_sprite->mp_grid_cells[0]])
+            {
+                ++stats.sprite_count;
+            }
+        }
+    }
+    if (stats.occupied_cells > 0)
+    {
+        stats.mean_cell_occupancy = (double)stats.cell_entries / stats.occupied_cells;
+    }
+    return stats;
+}
+
+// anything off the stage lands in the border cells, they are still searched by queries reaching past the stage
+int sprite_grid::column_of(double x)
+{
+    if (!(x >= 0.0)) // also catches nan
+    {
+        return 0;
+    }
+    return std::min(m_columns - 1, (int)std::min(x / m_cell_size, (double)m_columns));
+}
+
+int sprite_grid::row_of(double y)
+{
+    if (!(y >= 0.0))
+    {
+        return 0;
+    }
+    return std::min(m_rows - 1, (int)std::min(y / m_cell_size, (double)m_rows));
+}
+
+void sprite_grid::link(sprite* p_sprite)
+{
+    for (int row = p_sprite->mp_grid_cells[1]; row <= p_sprite->mp_grid_cells[3]; ++row)
+    {
+        for (int column = p_sprite->mp_grid_cells[0]; column <= p_sprite->mp_grid_cells[2]; ++column)
+        {
+            m_cells[(size_t)row * m_columns + column].push_back(p_sprite);
+        }
+    }
+    p_sprite->m_in_grid = true;
+}
+
+// cells are unordered so removal swaps the last entry into the hole
+void sprite_grid::unlink(sprite* p_sprite)
+{
+    if (!p_sprite->m_in_grid)
+    {
+        return;
+    }
+    for (int row = p_sprite->mp_grid_cells[1]; row <= p_sprite->mp_grid_cells[3]; ++row)
+    {
+        for (int column = p_sprite->mp_grid_cells[0]; column <= p_sprite->mp_grid_cells[2]; ++column)
+        {
+            std::vector<sprite*>& cell = m_cells[(size_t)row * m_columns + column];
+            std::vector<sprite*>::iterator it = std::find(cell.begin(), cell.end(), p_sprite);
+
+            if (it != cell.end())
+            {
+                *it = cell.back();
+                cell.pop_back();
+            }
+        }
+    }
+    p_sprite->m_in_grid = false;
+}
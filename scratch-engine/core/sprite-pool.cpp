@@ -0,0 +1,71 @@
+/*
+File: sprite-pool.cpp
+Description: Implements the slab allocator CScratch creates clone sprites from
+*/
+
+#include "scratch-render.hpp"
+#include "scratch-config.hpp"
+#include <new>
+
+using namespace scratch;
+
+sprite_pool::sprite_pool()
+{
+    mp_free = nullptr;
+    m_live_count = 0;
+}
+
+sprite_pool::~sprite_pool()
+{
+    for (slot* p_slab : m_slabs)
+    {
+        delete[] p_slab;
+    }
+}
+
+// a new slab is only allocated once every slot handed out so far is in use
+sprite* sprite_pool::acquire(sprite* p_parent)
+{
+    slot* p_slot = nullptr;
+    slot* p_slab = nullptr;
+
+    if (mp_free == nullptr)
+    {
+        p_slab = new slot[SPRITE_POOL_SLAB_SIZE];
+        for (int i = SPRITE_POOL_SLAB_SIZE - 1; i >= 0; --i)
+        {
+            p_slab[i].p_next_free = mp_free;
+            mp_free = &p_slab[i];
+        }
+        m_slabs.push_back(p_slab);
+    }
+    p_slot = mp_free;
+    mp_free = p_slot->p_next_free;
+    ++m_live_count;
+    return new (p_slot->p_storage) sprite(p_parent);
+}
+
+void sprite_pool::release(sprite* p_clone)
+{
+    slot* p_slot = reinterpret_cast<slot*>(p_clone);
+
+    if (p_clone == nullptr)
+    {
+        return;
+    }
+    p_clone->remove_from_layers();
+    p_clone->~sprite();
+    p_slot->p_next_free = mp_free;
+    mp_free = p_slot;
+    --m_live_count;
+}
+
+unsigned int sprite_pool::get_live_count()
+{
+    return m_live_count;
+}
+
+unsigned int sprite_pool::get_capacity()
+{
+    return m_slabs.size() * SPRITE_POOL_SLAB_SIZE;
+}
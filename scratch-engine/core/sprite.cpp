@@ -4,17 +4,19 @@ Description: Implements the code for CScratch sprite data tracking
 */
 
 #include "scratch-render.hpp"
+#include "scratch-util.hpp"
+#include <algorithm>
 #include <cmath>
 
 using namespace scratch;
 
 sprite::sprite(std::wstring name)
 {
-    m_name = name;
-    mpp_bottom_layer_addy = nullptr;
-    mpp_top_layer_addy = nullptr;
-    mp_above = nullptr;
-    mp_below = nullptr;
+    mp_costume_set = new costume_set();
+    mp_costume_set->name = name;
+    mp_costume_set->references = 1;
+    mp_layers = nullptr;
+    m_layer_node = 0;
     m_is_clone = false;
 
     m_costume_number = 0;
@@ -24,27 +26,87 @@ sprite::sprite(std::wstring name)
     m_x = 0.0;
     m_y = 0.0;
     m_rotation_mode = rotation_mode::all_around;
+    mp_transforms = nullptr;
+    m_in_transforms = false;
+    m_transform_slot = 0;
+    mp_grid = nullptr;
+    m_in_grid = false;
+    mp_grid_cells[0] = mp_grid_cells[1] = mp_grid_cells[2] = mp_grid_cells[3] = 0;
+    m_grid_query_stamp = 0;
+    mp_damage = nullptr;
+    m_damage_pending = false;
+    m_drawn = false;
+    m_drawn_bounds = empty_box();
     clear_effects();
+    m_pen.down = false;
+    m_pen.size = PEN_DEFAULT_SIZE;
+    m_pen.color = PEN_DEFAULT_COLOR;
+    m_pen.saturation = 100.0;
+    m_pen.brightness = 100.0;
+    m_pen.transparency = 0.0;
+    m_pen.rgba = resolve_pen_color(m_pen);
 }
 
-sprite::~sprite() // freeing all costumes that the sprite uses
+// clones start out as a copy of everything visible about their parent and share its costumes instead of copying them
+// only sprite_pool creates clones, they are not in the layers or the grid until insert_below is called
+sprite::sprite(sprite* p_parent)
 {
-    for (costume* p_costume: m_costumes)
+    mp_costume_set = p_parent->mp_costume_set;
+    ++mp_costume_set->references;
+    mp_layers = nullptr;
+    m_layer_node = 0;
+    m_is_clone = true;
+
+    m_costume_number = p_parent->m_costume_number;
+    m_size = p_parent->m_size;
+    m_hidden = p_parent->m_hidden;
+    m_direction = p_parent->m_direction;
+    m_x = p_parent->m_x;
+    m_y = p_parent->m_y;
+    m_rotation_mode = p_parent->m_rotation_mode;
+    mp_transforms = p_parent->mp_transforms;
+    m_in_transforms = false;
+    m_transform_slot = 0;
+    mp_grid = p_parent->mp_grid;
+    m_in_grid = false;
+    mp_grid_cells[0] = mp_grid_cells[1] = mp_grid_cells[2] = mp_grid_cells[3] = 0;
+    m_grid_query_stamp = 0;
+    mp_damage = p_parent->mp_damage;
+    m_damage_pending = false;
+    m_drawn = false;
+    m_drawn_bounds = empty_box();
+    for (int i = 0; i < static_cast<int>(graphical_effect::max); ++i)
+    {
+        mp_effects[i] = p_parent->mp_effects[i];
+    }
+    m_pen = p_parent->m_pen;
+}
+
+sprite::~sprite() // freeing all costumes that the sprite uses once no clone shares them anymore
+{
+    remove_from_layers(); // the area it was last drawn in still has to be redrawn
+    if (--mp_costume_set->references > 0)
+    {
+        return;
+    }
+    for (costume* p_costume: mp_costume_set->costumes)
     {
         delete p_costume;
     }
+    delete mp_costume_set;
 }
 
+// the costume is shared with every clone of this sprite
 bool sprite::add_costume(costume* p_costume)
 {
     std::wstring costume_name = p_costume->get_costume_name();
 
-    if (m_costume_map.find(costume_name) != m_costume_map.end()) // enforcing costume name uniqueness
+    if (mp_costume_set->costume_map.find(costume_name) != mp_costume_set->costume_map.end()) // enforcing costume name uniqueness
     {
         return false;
     }
-    m_costumes.push_back(p_costume);
-    m_costume_map[costume_name] = m_costumes.size();
+    mp_costume_set->costumes.push_back(p_costume);
+    mp_costume_set->costume_map[costume_name] = mp_costume_set->costumes.size();
     return true;
 }
 
@@ -67,11 +129,12 @@ void sprite::set_effect(graphical_effect effect, double value)
     {
         return;
     }
-    if (value < 0.0 || value == NAN)
+    if (std::isnan(value))
     {
         value = 0.0;
     }
     mp_effects[index] = value;
+    damage();
 }
 
 void sprite::clear_effects()
@@ -81,6 +144,28 @@ void sprite::clear_effects()
     {
         mp_effects[i] = 0.0;
     }
+    damage();
+}
+
+// the effect values are clamped and scaled here rather than in set_effect so scripts reading them back get what they set, like in Scratch
+bool sprite::get_effects(sprite_effects& effects)
+{
+    costume* p_costume = get_current_costume();
+    double color = mp_effects[static_cast<int>(graphical_effect::color)] / 200.0;
+    double mosaic = std::round((fabs(mp_effects[static_cast<int>(graphical_effect::mosaic)]) + 10.0) / 10.0);
+
+    effects.color = (float)(color - std::floor(color));
+    effects.fisheye = (float)std::max(0.0, (mp_effects[static_cast<int>(graphical_effect::fisheye)] + 100.0) / 100.0);
+    effects.whirl = (float)(-mp_effects[static_cast<int>(graphical_effect::whirl)] * DEG2RAD);
+    effects.pixelate = (float)(fabs(mp_effects[static_cast<int>(graphical_effect::pixelate)]) / 10.0);
+    effects.mosaic = (float)std::min(std::max(mosaic, 1.0), 512.0);
+    effects.brightness = (float)(std::min(std::max(mp_effects[static_cast<int>(graphical_effect::brightness)], -100.0), 100.0) / 100.0);
+    effects.ghost = (float)(1.0 - std::min(std::max(mp_effects[static_cast<int>(graphical_effect::ghost)], 0.0), 100.0) / 100.0);
+    effects.costume_width = p_costume != nullptr ? (float)p_costume->get_width() : 0.0f;
+    effects.costume_height = p_costume != nullptr ? (float)p_costume->get_height() : 0.0f;
+    effects.coordinates = effects.fisheye != 1.0f || effects.whirl != 0.0f || effects.pixelate > 0.0f || effects.mosaic != 1.0f;
+    effects.colors = effects.color != 0.0f || effects.brightness != 0.0f;
+    return effects.coordinates || effects.colors || effects.ghost < 1.0f;
 }
 
 double sprite::get_x()
@@ -115,6 +200,7 @@ void sprite::set_x(double value)
         value = std::min(STAGE_MIN_X_FLOAT, min_x);
     }
     m_x = value;
+    update_bounds();
 }
 
 double sprite::get_y()
@@ -149,6 +235,7 @@ void sprite::set_y(double value)
         value = std::min(STAGE_MIN_Y_FLOAT, min_y);
     }
     m_y = value;
+    update_bounds();
 }
 
 double sprite::get_direction()
@@ -160,6 +247,7 @@ void sprite::set_direction(double value)
 {
     value = fmod(value + SPRITE_ROTATION_RANGE_FLOAT / 2.0, SPRITE_ROTATION_RANGE_FLOAT) - SPRITE_ROTATION_RANGE_FLOAT / 2.0;
     m_direction = std::max(SPRITE_ROTATION_MIN_FLOAT, std::min(SPRITE_ROTATION_MAX_FLOAT, value));
+    update_bounds();
 }
 
 double sprite::get_size()
@@ -195,6 +283,7 @@ void sprite::set_size(double value)
         d_clamp_min = std::min(SPRITE_DEFAULT_SIZE, SPRITE_SIZE_DIMENSION_MINIMUM / d_smaller_dimension * 100.0);
     }
     m_size = std::min(d_clamp_max, std::max(d_clamp_min, value));
+    update_bounds();
 }
 
 rotation_mode sprite::get_rotation_mode()
@@ -209,6 +298,7 @@ void sprite::set_rotation_mode(rotation_mode value)
         return;
     }
     m_rotation_mode = value;
+    update_bounds();
 }
 
 unsigned int sprite::get_costume_number()
@@ -218,20 +308,34 @@ unsigned int sprite::get_costume_number()
 
 void sprite::set_costume_number(unsigned int value)
 {
-    if (value < 1 || value > m_costumes.size())
+    if (value < 1 || value > mp_costume_set->costumes.size())
     {
         return;
     }
     m_costume_number = value;
+    update_bounds();
 }
 
 void sprite::set_costume_by_name(std::wstring name)
 {
-    if (m_costume_map.find(name) == m_costume_map.end())
+    std::unordered_map<std::wstring, unsigned int>::iterator found = mp_costume_set->costume_map.find(name);
+
+    if (found == mp_costume_set->costume_map.end())
     {
         return;
     }
-    m_costume_number = m_costume_map[name];
+    m_costume_number = found->second;
+    update_bounds();
+}
+
+unsigned int sprite::get_costume_count()
+{
+    return mp_costume_set->costumes.size();
+}
+
+bool sprite::has_costume(const std::wstring& name)
+{
+    return mp_costume_set->costume_map.find(name) != mp_costume_set->costume_map.end();
 }
 
 costume* sprite::get_current_costume()
@@ -240,128 +344,193 @@ costume* sprite::get_current_costume()
     {
         return nullptr;
     }
-    return m_costumes[m_costume_number - 1];
+    return mp_costume_set->costumes[m_costume_number - 1];
+}
+
+const std::wstring& sprite::get_name()
+{
+    return mp_costume_set->name;
 }
 
-std::wstring sprite::get_name()
+bool sprite::is_clone()
 {
-    return m_name;
+    return m_is_clone;
 }
 
-void sprite::raise_layer() // moves the sprite up one layer
+bool sprite::is_hidden()
 {
-    sprite* p_two_above = nullptr;
-    sprite* p_old_above = mp_above;
-    
-    if (mp_above == nullptr)
+    return m_hidden;
+}
+
+void sprite::set_hidden(bool value)
+{
+    if (m_hidden == value)
     {
         return;
     }
-    if (mpp_bottom_layer_addy == nullptr || mpp_top_layer_addy == nullptr) // should never happen but if it does good not to crash the program
+    m_hidden = value;
+    damage();
+}
+
+// keeping the engine's broad phase grid and the stage damage in step with anything that changes the sprite's bounds
+// sprites in an engine only hand their new values to the transform store, it moves them in the grid when it is next updated
+void sprite::update_bounds()
+{
+    if (mp_transforms != nullptr)
     {
-        return;
+        mp_transforms->mark(this);
     }
-
-    p_two_above = mp_above->mp_above;
-    p_old_above->mp_below = mp_below;
-    p_old_above->mp_above = this;
-    mp_above = p_two_above;
-    mp_below = p_old_above;
-    
-    if (mp_above == nullptr) // writing the top layer pointer if the sprite on the top has changed
+    else if (mp_grid != nullptr)
     {
-        *mpp_top_layer_addy = this;
+        mp_grid->update(this);
     }
-    else if (p_old_above->mp_below == nullptr) // updating the bottom layer pointer if sprite is no longer on bottom
+    damage();
+}
+
+// anything that changes how the sprite looks, the renderer redraws where it was and where it is now
+void sprite::damage()
+{
+    if (mp_damage != nullptr)
     {
-        *mpp_bottom_layer_addy = p_old_above;
+        mp_damage->add_sprite(this);
     }
 }
 
-void sprite::lower_layer() // moves the sprite down one layer
+// lays the current costume out the way render_job draws its quad: the costume rectangle is scaled by the size, pinned at the rotation
+// center and rotated about it (or mirrored in left-right mode). render plane coordinates are stage coordinates shifted to start at 0
+// sprites in an engine read their layout from its transform store instead, see transform_store::layout
+bool sprite::get_transform(sprite_transform& transform)
 {
-    sprite* p_two_below = nullptr;
-    sprite* p_old_below = mp_below;
+    costume* p_costume = get_current_costume();
+    double scale = m_size / 100.0;
+    double rotation = 0.0;
+    double corner_x = 0.0;
+    double corner_y = 0.0;
+    Rectangle source_rect = {};
 
-    if (mp_below == nullptr)
+    if (m_in_transforms)
     {
-        return;
+        return mp_transforms->get(this, transform);
     }
-    if (mpp_bottom_layer_addy == nullptr || mpp_top_layer_addy == nullptr) // should never happen but if it does good not to crash the program
+    if (p_costume == nullptr)
     {
-        return;
+        return false;
     }
-
-    p_two_below = mp_below->mp_below;
-    p_old_below->mp_above = mp_above;
-    p_old_below->mp_below = this;
-    mp_above = p_old_below;
-    mp_below = p_two_below;
-
-    if (mp_below == nullptr) // sprite has reached bottom layer
+    source_rect = p_costume->get_source_rect();
+    transform.x = scratch_util::stage_to_screen_x_coordinate(m_x);
+    transform.y = scratch_util::stage_to_screen_y_coordinate(m_y);
+    transform.width = p_costume->get_width() * scale;
+    transform.height = p_costume->get_height() * scale;
+    transform.origin_x = p_costume->get_rotation_center_x() * scale;
+    transform.origin_y = transform.height - p_costume->get_rotation_center_y() * scale;
+    if (transform.width <= 0.0 || transform.height <= 0.0)
     {
-        *mpp_bottom_layer_addy = this;
+        return false;
+    }
+
+    transform.flip_x = false;
+    switch (m_rotation_mode)
+    {
+        case rotation_mode::all_around:
+            rotation = (m_direction - 90.0) * MATH_PI / 180.0;
+            break;
+        case rotation_mode::left_right:
+            transform.flip_x = m_direction < 0.0;
+            break;
+        default: // default to rotation_mode::none
+            break;
+    }
+    transform.cos_rotation = cos(rotation);
+    transform.sin_rotation = sin(rotation);
+    transform.u_scale = source_rect.width / transform.width;
+    transform.v_scale = source_rect.height / transform.height;
+
+    transform.min_x = transform.min_y = INFINITY;
+    transform.max_x = transform.max_y = -INFINITY;
+    for (int corner = 0; corner < 4; ++corner)
+    {
+        double local_x = ((corner & 1) ? transform.width : 0.0) - transform.origin_x;
+        double local_y = ((corner & 2) ? transform.height : 0.0) - transform.origin_y;
+        corner_x = transform.x + local_x * transform.cos_rotation - local_y * transform.sin_rotation;
+        corner_y = transform.y + local_x * transform.sin_rotation + local_y * transform.cos_rotation;
+        transform.min_x = std::min(transform.min_x, corner_x);
+        transform.max_x = std::max(transform.max_x, corner_x);
+        transform.min_y = std::min(transform.min_y, corner_y);
+        transform.max_y = std::max(transform.max_y, corner_y);
     }
-    else if (p_old_below->mp_above == nullptr) // this sprite is no longer in the top layer
+    return true;
+}
+
+unsigned int sprite::get_layer()
+{
+    if (mp_layers == nullptr)
     {
-        *mpp_top_layer_addy = p_old_below;
+        return 0;
     }
+    return mp_layers->get_index(this) + 1;
 }
 
-void sprite::goto_top_layer()
+void sprite::change_layer(int offset)
 {
-    bool is_bottom_layer = false;
-    sprite* p_old_top = nullptr;
+    long long index = 0;
 
-    if (mpp_bottom_layer_addy == nullptr || mpp_top_layer_addy == nullptr) // should never happen but if it does good not to crash the program
+    if (mp_layers == nullptr || offset == 0)
     {
         return;
     }
-    if (*mpp_top_layer_addy == *mpp_bottom_layer_addy) // only one sprite do nothing
+    index = std::max((long long)mp_layers->get_index(this) + offset, 0ll);
+    mp_layers->move(this, (unsigned int)std::min(index, (long long)mp_layers->get_count()));
+    damage();
+}
+
+void sprite::goto_top_layer()
+{
+    if (mp_layers == nullptr)
     {
         return;
     }
+    mp_layers->move(this, mp_layers->get_count());
+    damage();
+}
 
-    p_old_top = *mpp_top_layer_addy;
-    if (p_old_top == nullptr)
+void sprite::goto_bottom_layer()
+{
+    if (mp_layers == nullptr)
     {
         return;
     }
-    if (*mpp_bottom_layer_addy == this) // updating the bottom in case this sprite was the old bottom
+    mp_layers->move(this, 0);
+    damage();
+}
+
+// puts the sprite into p_above's layers right below it, this is where Scratch places new clones
+void sprite::insert_below(sprite* p_above)
+{
+    if (p_above->mp_layers == nullptr)
     {
-        *mpp_bottom_layer_addy = mp_above;
+        return;
     }
-    mp_above->mp_below = mp_below;
-    mp_below = p_old_top;
-    p_old_top->mp_above = this;
-    *mpp_top_layer_addy = this;
+    p_above->mp_layers->insert(this, p_above->mp_layers->get_index(p_above));
+    update_bounds();
 }
 
-void sprite::goto_bottom_layer()
+// takes the sprite out of its layers, the grid and the stage's damage. every sprite goes through here when it is deleted, clones also when they are pooled
+void sprite::remove_from_layers()
 {
-    bool is_top_layer = false;
-    sprite* p_old_bottom = nullptr;
-
-    if (mpp_bottom_layer_addy == nullptr || mpp_top_layer_addy == nullptr) // should never happen but if it does good not to crash the program
+    if (mp_layers != nullptr)
     {
-        return;
+        mp_layers->remove(this);
     }
-    if (*mpp_top_layer_addy == *mpp_bottom_layer_addy) // only one sprite do nothing
+    if (mp_transforms != nullptr)
     {
-        return;
+        mp_transforms->remove(this);
     }
-
-    p_old_bottom = *mpp_bottom_layer_addy;
-    if (p_old_bottom == nullptr)
+    if (mp_grid != nullptr)
     {
-        return;
+        mp_grid->remove(this);
     }
-    if (*mpp_top_layer_addy == this) // refreshing top layer in case this sprite was the old top layer
+    if (mp_damage != nullptr)
     {
-        *mpp_top_layer_addy = mp_below;
+        mp_damage->remove_sprite(this);
     }
-    mp_below->mp_above = mp_above;
-    mp_above = p_old_bottom;
-    p_old_bottom->mp_below = this;
-    *mpp_bottom_layer_addy = this;
-}
\ No newline at end of file
+}
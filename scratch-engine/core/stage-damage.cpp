@@ -0,0 +1,139 @@
+/*
+File: stage-damage.cpp
+Description: Implements the tracking of which part of the stage has to be redrawn so idle projects don't redraw anything
+*/
+
+#include "scratch-render.hpp"
+#include "scratch-config.hpp"
+#include <algorithm>
+#include <cmath>
+
+using namespace scratch;
+
+stage_box scratch::empty_box()
+{
+    return stage_box{INFINITY, INFINITY, -INFINITY, -INFINITY};
+}
+
+void scratch::grow_box(stage_box& box, const stage_box& other)
+{
+    box.min_x = std::min(box.min_x, other.min_x);
+    box.min_y = std::min(box.min_y, other.min_y);
+    box.max_x = std::max(box.max_x, other.max_x);
+    box.max_y = std::max(box.max_y, other.max_y);
+}
+
+stage_damage::stage_damage()
+{
+    m_sprites_changed = false;
+    m_frames = 0;
+    m_skipped_frames = 0;
+    m_partial_frames = 0;
+    m_redrawn_pixels = 0;
+    invalidate();
+}
+
+void stage_damage::add(const stage_box& box)
+{
+    grow_box(m_box, box);
+}
+
+void stage_damage::invalidate()
+{
+    m_box = stage_box{0.0, 0.0, STAGE_SIZE_X_FLOAT, STAGE_SIZE_Y_FLOAT};
+}
+
+// the renderers cover whole pixels from floor(min) to ceil(max), the padding takes care of bilinear filtering reaching one pixel further
+bool stage_damage::collect(const std::vector<sprite*>& sprites, pen_layer* p_pen_layer, Rectangle& area)
+{
+    sprite_transform transform = {};
+    int min_x = 0;
+    int min_y = 0;
+    int max_x = 0;
+    int max_y = 0;
+
+    if (m_sprites_changed)
+    {
+        for (sprite* p_sprite : sprites)
+        {
+            if (!p_sprite->m_damage_pending)
+            {
+                continue;
+            }
+            p_sprite->m_damage_pending = false;
+            p_sprite->m_drawn = !p_sprite->m_hidden && p_sprite->get_transform(transform);
+            if (p_sprite->m_drawn)
+            {
+                p_sprite->m_drawn_bounds = stage_box{transform.min_x, transform.min_y, transform.max_x, transform.max_y};
+                grow_box(m_box, p_sprite->m_drawn_bounds);
+            }
+        }
+        m_sprites_changed = false;
+    }
+    if (p_pen_layer != nullptr)
+    {
+        grow_box(m_box, p_pen_layer->get_damage());
+    }
+
+    ++m_frames;
+    if (m_box.min_x > m_box.max_x || m_box.min_y > m_box.max_y)
+    {
+        ++m_skipped_frames;
+        return false;
+    }
+    min_x = (int)std::min(std::max(floor(m_box.min_x) - STAGE_DAMAGE_PADDING, 0.0), STAGE_SIZE_X_FLOAT); // clamped as doubles, sprites can be far off the stage
+    min_y = (int)std::min(std::max(floor(m_box.min_y) - STAGE_DAMAGE_PADDING, 0.0), STAGE_SIZE_Y_FLOAT);
+    max_x = (int)std::max(std::min(ceil(m_box.max_x) + STAGE_DAMAGE_PADDING, STAGE_SIZE_X_FLOAT - 1.0), -1.0);
+    max_y = (int)std::max(std::min(ceil(m_box.max_y) + STAGE_DAMAGE_PADDING, STAGE_SIZE_Y_FLOAT - 1.0), -1.0);
+    m_box = empty_box();
+    if (min_x > max_x || min_y > max_y) // damage that lies entirely off the stage
+    {
+        ++m_skipped_frames;
+        return false;
+    }
+
+    area = Rectangle{(float)min_x, (float)min_y, (float)(max_x - min_x + 1), (float)(max_y - min_y + 1)};
+    if (area.width < STAGE_SIZE_X || area.height < STAGE_SIZE_Y)
+    {
+        ++m_partial_frames;
+    }
+    m_redrawn_pixels += (unsigned long long)(area.width * area.height);
+    return true;
+}
+
+stage_damage_stats stage_damage::get_stats()
+{
+    stage_damage_stats stats = {};
+
+    stats.frames = m_frames;
+    stats.skipped_frames = m_skipped_frames;
+    stats.partial_frames = m_partial_frames;
+    stats.redrawn_pixels = m_redrawn_pixels;
+    return stats;
+}
+
+// the first change in a frame adds where the sprite was last drawn, where it ends up is worked out in collect
+void stage_damage::add_sprite(sprite* p_sprite)
+{
+    if (p_sprite->m_damage_pending)
+    {
+        return;
+    }
+    if (p_sprite->m_drawn)
+    {
+        grow_box(m_box, p_sprite->m_drawn_bounds);
+    }
+    p_sprite->m_damage_pending = true;
+    m_sprites_changed = true;
+}
+
+// sprites leaving the layer list are never visited by collect again, so they only leave their old bounds behind
+void stage_damage::remove_sprite(sprite* p_sprite)
+{
+    if (p_sprite->m_drawn)
+    {
+        grow_box(m_box, p_sprite->m_drawn_bounds);
+    }
+    p_sprite->m_drawn = false;
+    p_sprite->m_damage_pending = false;
+}
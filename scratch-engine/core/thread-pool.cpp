@@ -0,0 +1,88 @@
+/*
+File: thread-pool.cpp
+Description: Implements the thread pool used to run several engine instances at once
+*/
+
+#include "scratch-util.hpp"
+#include <algorithm>
+
+using namespace scratch_util;
+
+thread_pool::thread_pool(unsigned int thread_count)
+{
+    m_running_tasks = 0;
+    m_stopping = false;
+    if (thread_count == 0)
+    {
+        thread_count = std::max(1u, std::thread::hardware_concurrency()); // hardware_concurrency may report 0 when it can't tell
+    }
+    for (unsigned int i = 0; i < thread_count; ++i)
+    {
+        m_threads.emplace_back(&thread_pool::work, this);
+    }
+}
+
+thread_pool::~thread_pool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_task_ready.notify_all();
+    for (std::thread& thread : m_threads)
+    {
+        thread.join();
+    }
+}
+
+void thread_pool::submit(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_tasks.push_back(std::move(task));
+    }
+    m_task_ready.notify_one();
+}
+
+void thread_pool::wait()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    m_tasks_done.wait(lock, [this] { return m_tasks.empty() && m_running_tasks == 0; });
+}
+
+unsigned int thread_pool::get_thread_count()
+{
+    return m_threads.size();
+}
+
+void thread_pool::work()
+{
+    std::function<void()> task;
+
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_task_ready.wait(lock, [this] { return m_stopping || !m_tasks.empty(); });
+            if (m_tasks.empty()) // only reachable when stopping, the queue is drained first
+            {
+                return;
+            }
+            task = std::move(m_tasks.front());
+            m_tasks.pop_front();
+            ++m_running_tasks;
+        }
+
+        task(); // outside the lock so workers actually run in parallel
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            --m_running_tasks;
+            if (m_tasks.empty() && m_running_tasks == 0)
+            {
+                m_tasks_done.notify_all();
+            }
+        }
+    }
+}
@@ -0,0 +1,284 @@
+/*
+File: transform-store.cpp
+Description: Implements the per field arrays CScratch lays out its sprites' costume quads from
+*/
+
+#include "scratch-render.hpp"
+#include "scratch-util.hpp"
+#include "scratch-config.hpp"
+#include <algorithm>
+#include <cmath>
+
+using namespace scratch;
+
+namespace
+{
+    // where a corner at local_x, local_y from the rotation center ends up, see sprite::get_transform
+    double corner_x(double x, double local_x, double local_y, double cos_rotation, double sin_rotation)
+    {
+        return x + local_x * cos_rotation - local_y * sin_rotation;
+    }
+
+    double corner_y(double y, double local_x, double local_y, double cos_rotation, double sin_rotation)
+    {
+        return y + local_x * sin_rotation + local_y * cos_rotation;
+    }
+}
+
+transform_store::transform_store(sprite_grid* p_grid)
+{
+    mp_grid = p_grid;
+}
+
+transform_store::~transform_store()
+{
+    for (sprite* p_sprite : m_sprites)
+    {
+        if (p_sprite != nullptr)
+        {
+            p_sprite->mp_transforms = nullptr;
+            p_sprite->m_in_transforms = false;
+        }
+    }
+}
+
+// every array grows together so a slot indexes all of them
+void transform_store::mark(sprite* p_sprite)
+{
+    costume* p_costume = p_sprite->get_current_costume();
+    Rectangle source_rect = {};
+    double rotation = 0.0;
+    unsigned int slot = 0;
+    bool new_slot = false;
+
+    if (!p_sprite->m_in_transforms)
+    {
+        new_slot = true;
+        if (!m_free_slots.empty())
+        {
+            slot = m_free_slots.back();
+            m_free_slots.pop_back();
+        }
+        else
+        {
+            slot = m_sprites.size();
+            m_sprites.push_back(nullptr);
+            m_listed.push_back(0);
+            m_stale.push_back(0);
+            for (std::vector<double>* p_field : {&m_x, &m_y, &m_scale, &m_rotation, &m_cos_rotation, &m_sin_rotation, &m_costume_width,
+                &m_costume_height, &m_center_x, &m_center_y, &m_source_width, &m_source_height, &m_width, &m_height, &m_origin_x,
+                &m_origin_y, &m_u_scale, &m_v_scale, &m_min_x, &m_min_y, &m_max_x, &m_max_y})
+            {
+                p_field->push_back(0.0);
+            }
+            m_flip_x.push_back(0);
+        }
+        m_sprites[slot] = p_sprite;
+        p_sprite->m_transform_slot = slot;
+        p_sprite->m_in_transforms = true;
+    }
+    slot = p_sprite->m_transform_slot;
+
+    switch (p_sprite->m_rotation_mode)
+    {
+        case rotation_mode::all_around:
+            rotation = (p_sprite->m_direction - 90.0) * MATH_PI / 180.0;
+            break;
+        default:
+            break;
+    }
+    if (new_slot || rotation != m_rotation[slot])
+    {
+        m_rotation[slot] = rotation;
+        m_cos_rotation[slot] = cos(rotation);
+        m_sin_rotation[slot] = sin(rotation);
+    }
+    m_x[slot] = scratch_util::stage_to_screen_x_coordinate(p_sprite->m_x);
+    m_y[slot] = scratch_util::stage_to_screen_y_coordinate(p_sprite->m_y);
+    m_scale[slot] = p_sprite->m_size / 100.0;
+    m_flip_x[slot] = p_sprite->m_rotation_mode == rotation_mode::left_right && p_sprite->m_direction < 0.0;
+    if (p_costume != nullptr)
+    {
+        source_rect = p_costume->get_source_rect();
+        m_costume_width[slot] = p_costume->get_width();
+        m_costume_height[slot] = p_costume->get_height();
+        m_center_x[slot] = p_costume->get_rotation_center_x();
+        m_center_y[slot] = p_costume->get_rotation_center_y();
+    }
+    else
+    {
+        m_costume_width[slot] = m_costume_height[slot] = 0.0;
+        m_center_x[slot] = m_center_y[slot] = 0.0;
+    }
+    m_source_width[slot] = source_rect.width;
+    m_source_height[slot] = source_rect.height;
+
+    m_stale[slot] = 1;
+    if (!m_listed[slot])
+    {
+        m_listed[slot] = 1;
+        m_pending.push_back(slot);
+    }
+}
+
+// the slot stays in m_pending if it is listed, update skips it while it is free
+void transform_store::remove(sprite* p_sprite)
+{
+    if (p_sprite == nullptr || p_sprite->mp_transforms != this || !p_sprite->m_in_transforms)
+    {
+        return;
+    }
+    m_sprites[p_sprite->m_transform_slot] = nullptr;
+    m_free_slots.push_back(p_sprite->m_transform_slot);
+    p_sprite->m_in_transforms = false;
+}
+
+// scattered changes are laid out slot by slot, once a large enough share of the slots changed one pass over every slot is cheaper
+void transform_store::update()
+{
+    if (m_pending.empty())
+    {
+        return;
+    }
+    if (m_pending.size() * TRANSFORM_STORE_BATCH_DIVISOR >= m_sprites.size())
+    {
+        layout(0, m_sprites.size());
+        std::fill(m_stale.begin(), m_stale.end(), 0);
+    }
+    else
+    {
+        for (unsigned int slot : m_pending)
+        {
+            if (m_stale[slot])
+            {
+                layout(slot, slot + 1);
+                m_stale[slot] = 0;
+            }
+        }
+    }
+
+    // the grid reads the layouts back through sprite::get_transform, which is why they go first
+    for (unsigned int slot : m_pending)
+    {
+        m_listed[slot] = 0;
+        if (m_sprites[slot] != nullptr && mp_grid != nullptr)
+        {
+            mp_grid->update(m_sprites[slot]);
+        }
+    }
+    m_pending.clear();
+}
+
+bool transform_store::get(sprite* p_sprite, sprite_transform& transform)
+{
+    unsigned int slot = p_sprite->m_transform_slot;
+
+    if (m_stale[slot])
+    {
+        layout(slot, slot + 1);
+        m_stale[slot] = 0;
+    }
+    if (!(m_width[slot] > 0.0) || !(m_height[slot] > 0.0))
+    {
+        return false;
+    }
+    transform.x = m_x[slot];
+    transform.y = m_y[slot];
+    transform.origin_x = m_origin_x[slot];
+    transform.origin_y = m_origin_y[slot];
+    transform.width = m_width[slot];
+    transform.height = m_height[slot];
+    transform.cos_rotation = m_cos_rotation[slot];
+    transform.sin_rotation = m_sin_rotation[slot];
+    transform.u_scale = m_u_scale[slot];
+    transform.v_scale = m_v_scale[slot];
+    transform.flip_x = m_flip_x[slot] != 0;
+    transform.min_x = m_min_x[slot];
+    transform.min_y = m_min_y[slot];
+    transform.max_x = m_max_x[slot];
+    transform.max_y = m_max_y[slot];
+    return true;
+}
+
+// the same math as sprite::get_transform in the same order so both give identical results. each loop writes one array and has no
+// branches so the compiler can vectorize it without giving up on checking every array against every other. slots without a costume
+// come out with a zero size and get() rejects them
+void transform_store::layout(unsigned int first, unsigned int last)
+{
+    const double* p_x = m_x.data();
+    const double* p_y = m_y.data();
+    const double* p_scale = m_scale.data();
+    const double* p_cos = m_cos_rotation.data();
+    const double* p_sin = m_sin_rotation.data();
+    const double* p_costume_width = m_costume_width.data();
+    const double* p_costume_height = m_costume_height.data();
+    const double* p_center_x = m_center_x.data();
+    const double* p_center_y = m_center_y.data();
+    const double* p_source_width = m_source_width.data();
+    const double* p_source_height = m_source_height.data();
+    double* p_width = m_width.data();
+    double* p_height = m_height.data();
+    double* p_origin_x = m_origin_x.data();
+    double* p_origin_y = m_origin_y.data();
+    double* p_u_scale = m_u_scale.data();
+    double* p_v_scale = m_v_scale.data();
+    double* p_min_x = m_min_x.data();
+    double* p_min_y = m_min_y.data();
+    double* p_max_x = m_max_x.data();
+    double* p_max_y = m_max_y.data();
+
+    for (unsigned int i = first; i < last; ++i)
+    {
+        p_width[i] = p_costume_width[i] * p_scale[i];
+    }
+    for (unsigned int i = first; i < last; ++i)
+    {
+        p_height[i] = p_costume_height[i] * p_scale[i];
+    }
+    for (unsigned int i = first; i < last; ++i)
+    {
+        p_origin_x[i] = p_center_x[i] * p_scale[i];
+    }
+    for (unsigned int i = first; i < last; ++i)
+    {
+        p_origin_y[i] = p_height[i] - p_center_y[i] * p_scale[i];
+    }
+    for (unsigned int i = first; i < last; ++i)
+    {
+        p_u_scale[i] = p_source_width[i] / p_width[i];
+    }
+    for (unsigned int i = first; i < last; ++i)
+    {
+        p_v_scale[i] = p_source_height[i] / p_height[i];
+    }
+
+    // corners in the order get_transform visits them: bottom left, bottom right, top left, top right
+    for (unsigned int i = first; i < last; ++i)
+    {
+        p_min_x[i] = std::min(std::min(std::min(corner_x(p_x[i], 0.0 - p_origin_x[i], 0.0 - p_origin_y[i], p_cos[i], p_sin[i]),
+            corner_x(p_x[i], p_width[i] - p_origin_x[i], 0.0 - p_origin_y[i], p_cos[i], p_sin[i])),
+            corner_x(p_x[i], 0.0 - p_origin_x[i], p_height[i] - p_origin_y[i], p_cos[i], p_sin[i])),
+            corner_x(p_x[i], p_width[i] - p_origin_x[i], p_height[i] - p_origin_y[i], p_cos[i], p_sin[i]));
+    }
+    for (unsigned int i = first; i < last; ++i)
+    {
+        p_max_x[i] = std::max(std::max(std::max(corner_x(p_x[i], 0.0 - p_origin_x[i], 0.0 - p_origin_y[i], p_cos[i], p_sin[i]),
+            corner_x(p_x[i], p_width[i] - p_origin_x[i], 0.0 - p_origin_y[i], p_cos[i], p_sin[i])),
+            corner_x(p_x[i], 0.0 - p_origin_x[i], p_height[i] - p_origin_y[i], p_cos[i], p_sin[i])),
+            corner_x(p_x[i], p_width[i] - p_origin_x[i], p_height[i] - p_origin_y[i], p_cos[i], p_sin[i]));
+    }
+    for (unsigned int i = first; i < last; ++i)
+    {
+        p_min_y[i] = std::min(std::min(std::min(corner_y(p_y[i], 0.0 - p_origin_x[i], 0.0 - p_origin_y[i], p_cos[i], p_sin[i]),
+            corner_y(p_y[i], p_width[i] - p_origin_x[i], 0.0 - p_origin_y[i], p_cos[i], p_sin[i])),
+            corner_y(p_y[i], 0.0 - p_origin_x[i], p_height[i] - p_origin_y[i], p_cos[i], p_sin[i])),
+            corner_y(p_y[i], p_width[i] - p_origin_x[i], p_height[i] - p_origin_y[i], p_cos[i], p_sin[i]));
+    }
+    for (unsigned int i = first; i < last; ++i)
+    {
+        p_max_y[i] = std::max(std::max(std::max(corner_y(p_y[i], 0.0 - p_origin_x[i], 0.0 - p_origin_y[i], p_cos[i], p_sin[i]),
+            corner_y(p_y[i], p_width[i] - p_origin_x[i], 0.0 - p_origin_y[i], p_cos[i], p_sin[i])),
+            corner_y(p_y[i], 0.0 - p_origin_x[i], p_height[i] - p_origin_y[i], p_cos[i], p_sin[i])),
+            corner_y(p_y[i], p_width[i] - p_origin_x[i], p_height[i] - p_origin_y[i], p_cos[i], p_sin[i]));
+    }
+}
@@ -0,0 +1,694 @@
+/*
+File: vm-compiler.cpp
+Description: Implements the compiler that turns CScratch script trees into flat bytecode
+*/
+
+#include "scratch-vm.hpp"
+#include <algorithm>
+
+using namespace scratch;
+
+namespace
+{
+    // blocks that compile to "push every input, then one instruction"
+    // input names starting with '#' are numeric, literal text in them is converted to a number at compile time
+    struct simple_block
+    {
+        const char* p_opcode;
+        vm_opcode instruction;
+        bool reporter;
+        const char* p_inputs[2];
+    };
+
+    const simple_block g_simple_blocks[] =
+    {
+        {"motion_movesteps", vm_opcode::move_steps, false, {"#STEPS", nullptr}},
+        {"motion_turnright", vm_opcode::turn_right, false, {"#DEGREES", nullptr}},
+        {"motion_turnleft", vm_opcode::turn_left, false, {"#DEGREES", nullptr}},
+        {"motion_gotoxy", vm_opcode::goto_xy, false, {"#X", "#Y"}},
+        {"motion_changexby", vm_opcode::change_x, false, {"#DX", nullptr}},
+        {"motion_setx", vm_opcode::set_x, false, {"#X", nullptr}},
+        {"motion_changeyby", vm_opcode::change_y, false, {"#DY", nullptr}},
+        {"motion_sety", vm_opcode::set_y, false, {"#Y", nullptr}},
+        {"motion_pointindirection", vm_opcode::point_direction, false, {"#DIRECTION", nullptr}},
+        {"motion_xposition", vm_opcode::get_x, true, {nullptr, nullptr}},
+        {"motion_yposition", vm_opcode::get_y, true, {nullptr, nullptr}},
+        {"motion_direction", vm_opcode::get_direction, true, {nullptr, nullptr}},
+        {"looks_setsizeto", vm_opcode::set_size, false, {"#SIZE", nullptr}},
+        {"looks_changesizeby", vm_opcode::change_size, false, {"#CHANGE", nullptr}},
+        {"looks_size", vm_opcode::get_size, true, {nullptr, nullptr}},
+        {"looks_show", vm_opcode::show, false, {nullptr, nullptr}},
+        {"looks_hide", vm_opcode::hide, false, {nullptr, nullptr}},
+        {"looks_switchcostumeto", vm_opcode::switch_costume, false, {"COSTUME", nullptr}},
+        {"looks_nextcostume", vm_opcode::next_costume, false, {nullptr, nullptr}},
+        {"looks_cleargraphiceffects", vm_opcode::clear_effects, false, {nullptr, nullptr}},
+        {"pen_clear", vm_opcode::pen_clear, false, {nullptr, nullptr}},
+        {"pen_stamp", vm_opcode::pen_stamp, false, {nullptr, nullptr}},
+        {"pen_penDown", vm_opcode::pen_down, false, {nullptr, nullptr}},
+        {"pen_penUp", vm_opcode::pen_up, false, {nullptr, nullptr}},
+        {"pen_setPenColorToColor", vm_opcode::set_pen_color, false, {"COLOR", nullptr}},
+        {"pen_setPenColorParamTo", vm_opcode::set_pen_param, false, {"COLOR_PARAM", "#VALUE"}},
+        {"pen_changePenColorParamBy", vm_opcode::change_pen_param, false, {"COLOR_PARAM", "#VALUE"}},
+        {"pen_setPenSizeTo", vm_opcode::set_pen_size, false, {"#SIZE", nullptr}},
+        {"pen_changePenSizeBy", vm_opcode::change_pen_size, false, {"#SIZE", nullptr}},
+        {"event_broadcast", vm_opcode::broadcast, false, {"BROADCAST_INPUT", nullptr}},
+        {"control_create_clone_of", vm_opcode::create_clone, false, {"CLONE_OPTION", nullptr}},
+        {"control_delete_this_clone", vm_opcode::delete_clone, false, {nullptr, nullptr}},
+        {"sensing_timer", vm_opcode::get_timer, true, {nullptr, nullptr}},
+        {"sensing_resettimer", vm_opcode::reset_timer, false, {nullptr, nullptr}},
+        {"sensing_keypressed", vm_opcode::key_pressed, true, {"KEY_OPTION", nullptr}},
+        {"sensing_mousex", vm_opcode::get_mouse_x, true, {nullptr, nullptr}},
+        {"sensing_mousey", vm_opcode::get_mouse_y, true, {nullptr, nullptr}},
+        {"sensing_mousedown", vm_opcode::get_mouse_down, true, {nullptr, nullptr}},
+        {"sensing_touchingobject", vm_opcode::touching_object, true, {"TOUCHINGOBJECTMENU", nullptr}},
+        {"operator_add", vm_opcode::add, true, {"#NUM1", "#NUM2"}},
+        {"operator_subtract", vm_opcode::subtract, true, {"#NUM1", "#NUM2"}},
+        {"operator_multiply", vm_opcode::multiply, true, {"#NUM1", "#NUM2"}},
+        {"operator_divide", vm_opcode::divide, true, {"#NUM1", "#NUM2"}},
+        {"operator_mod", vm_opcode::mod, true, {"#NUM1", "#NUM2"}},
+        {"operator_round", vm_opcode::round, true, {"#NUM", nullptr}},
+        {"operator_random", vm_opcode::random, true, {"FROM", "TO"}}, // not numeric, "1" and "1.0" pick different kinds of random numbers
+        {"operator_lt", vm_opcode::less_than, true, {"OPERAND1", "OPERAND2"}},
+        {"operator_gt", vm_opcode::greater_than, true, {"OPERAND1", "OPERAND2"}},
+        {"operator_equals", vm_opcode::equals, true, {"OPERAND1", "OPERAND2"}},
+        {"operator_and", vm_opcode::logic_and, true, {"OPERAND1", "OPERAND2"}},
+        {"operator_or", vm_opcode::logic_or, true, {"OPERAND1", "OPERAND2"}},
+        {"operator_not", vm_opcode::logic_not, true, {"OPERAND", nullptr}},
+        {"operator_join", vm_opcode::join, true, {"STRING1", "STRING2"}},
+        {"operator_letter_of", vm_opcode::letter_of, true, {"#LETTER", "STRING"}},
+        {"operator_length", vm_opcode::length_of, true, {"STRING", nullptr}},
+        {"operator_contains", vm_opcode::contains, true, {"STRING1", "STRING2"}},
+    };
+
+    std::unordered_map<std::string, const simple_block*> build_simple_block_lookup()
+    {
+        std::unordered_map<std::string, const simple_block*> lookup;
+
+        for (const simple_block& block : g_simple_blocks)
+        {
+            lookup[block.p_opcode] = &block;
+        }
+        return lookup;
+    }
+
+    const simple_block* find_simple_block(const std::string& opcode)
+    {
+        static const std::unordered_map<std::string, const simple_block*> lookup = build_simple_block_lookup(); // static initialization is thread safe, engines may compile on several threads at once
+        std::unordered_map<std::string, const simple_block*>::const_iterator found = lookup.find(opcode);
+
+        return found == lookup.end() ? nullptr : found->second;
+    }
+
+    int effect_from_name(const std::wstring& name)
+    {
+        static const wchar_t* const p_effect_names[] = {L"color", L"fisheye", L"whirl", L"pixelate", L"mosaic", L"brightness", L"ghost"};
+
+        for (int i = 0; i < static_cast<int>(graphical_effect::max); ++i)
+        {
+            if (string_equals_ignore_case(name, p_effect_names[i]))
+            {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    int math_op_from_name(const std::wstring& name)
+    {
+        static const wchar_t* const p_math_names[] = {L"abs", L"floor", L"ceiling", L"sqrt", L"sin", L"cos", L"tan", L"asin", L"acos", L"atan", L"ln", L"log", L"e ^", L"10 ^"};
+
+        for (int i = 0; i < (int)(sizeof(p_math_names) / sizeof(p_math_names[0])); ++i)
+        {
+            if (name == p_math_names[i])
+            {
+                return i;
+            }
+        }
+        return -1;
+    }
+}
+
+vm_compiler::vm_compiler(vm_target* p_target)
+{
+    mp_target = p_target;
+    mp_program = p_target->mp_program;
+    mp_argument_names = nullptr;
+}
+
+// compiles a script starting at its hat block (or a procedure definition) into the target's program
+// returns false if the hat is not one the VM knows how to start
+bool vm_compiler::add_script(script_node* p_hat)
+{
+    vm_script_entry script = {};
+    const std::string* p_opcode = nullptr;
+
+    if (p_hat == nullptr)
+    {
+        return false;
+    }
+    p_opcode = &p_hat->m_opcode;
+    if (*p_opcode == "procedures_definition")
+    {
+        compile_procedure(p_hat);
+        return true;
+    }
+
+    if (*p_opcode == "event_whenflagclicked")
+    {
+        script.hat = vm_hat::green_flag;
+    }
+    else if (*p_opcode == "event_whenkeypressed")
+    {
+        script.hat = vm_hat::key_pressed;
+        script.hat_parameter = get_field_text(p_hat, "KEY_OPTION");
+    }
+    else if (*p_opcode == "event_whenbroadcastreceived")
+    {
+        script.hat = vm_hat::broadcast_received;
+        script.hat_parameter = get_field_text(p_hat, "BROADCAST_OPTION");
+    }
+    else if (*p_opcode == "control_start_as_clone")
+    {
+        script.hat = vm_hat::clone_start;
+    }
+    else if (*p_opcode == "event_whenthisspriteclicked" || *p_opcode == "event_whenstageclicked")
+    {
+        script.hat = vm_hat::sprite_clicked;
+    }
+    else
+    {
+        compile_unsupported(p_hat);
+        return false;
+    }
+
+    script.entry = mp_program->m_code.size();
+    compile_stack(p_hat->mp_next);
+    emit(vm_opcode::end);
+    mp_program->m_scripts.push_back(script);
+    return true;
+}
+
+// links procedure calls to their definitions, call this after every script of the target has been added
+// calls to procedures that were never defined do nothing (like in Scratch), returns false if there were any
+bool vm_compiler::finish()
+{
+    bool all_resolved = true;
+
+    for (pending_call& call : m_pending_calls)
+    {
+        vm_instruction& instruction = mp_program->m_code[call.instruction];
+        bool resolved = false;
+
+        for (unsigned int i = 0; i < mp_program->m_procedures.size(); ++i)
+        {
+            if (mp_program->m_procedures[i].proccode == call.proccode)
+            {
+                instruction.operand = i;
+                resolved = true;
+                break;
+            }
+        }
+        if (!resolved) // throwing away the arguments that were pushed for it instead
+        {
+            instruction.opcode = vm_opcode::pop;
+            all_resolved = false;
+        }
+    }
+    m_pending_calls.clear();
+    return all_resolved;
+}
+
+void vm_compiler::emit(vm_opcode opcode, int operand)
+{
+    vm_instruction instruction = {opcode, operand};
+    mp_program->m_code.push_back(instruction);
+}
+
+// constants are deduplicated so that the pool stays small
+unsigned int vm_compiler::add_constant(const scratch_state& value)
+{
+    std::wstring key;
+    std::unordered_map<std::wstring, unsigned int>::iterator found;
+
+    switch (value.get_type())
+    {
+        case state_type::number:
+            key = L"n" + value.to_string();
+            break;
+        case state_type::boolean:
+            key = value.to_boolean() ? L"b1" : L"b0";
+            break;
+        default:
+            key = L"s" + value.to_string();
+            break;
+    }
+    found = m_constant_lookup.find(key);
+    if (found != m_constant_lookup.end())
+    {
+        return found->second;
+    }
+    mp_program->m_constants.push_back(value);
+    m_constant_lookup[key] = mp_program->m_constants.size() - 1;
+    return mp_program->m_constants.size() - 1;
+}
+
+void vm_compiler::compile_stack(script_node* p_block)
+{
+    for (; p_block != nullptr; p_block = p_block->mp_next)
+    {
+        compile_block(p_block);
+    }
+}
+
+void vm_compiler::compile_block(script_node* p_block)
+{
+    const std::string& opcode = p_block->m_opcode;
+    const simple_block* p_simple = find_simple_block(opcode);
+    unsigned int loop_start = 0;
+    unsigned int exit_jump = 0;
+    unsigned int else_jump = 0;
+    bool is_global = false;
+    int slot = 0;
+    int operand = 0;
+
+    if (p_simple != nullptr)
+    {
+        compile_reporter(p_block); // same code path, reporters used as statements just get their result thrown away
+        if (p_simple->reporter)
+        {
+            emit(vm_opcode::pop, 1);
+        }
+        return;
+    }
+
+    // control
+    if (opcode == "control_repeat")
+    {
+        compile_number_input(p_block, "TIMES");
+        emit(vm_opcode::repeat_init);
+        loop_start = mp_program->m_code.size();
+        emit(vm_opcode::repeat_next);
+        compile_stack(p_block->get_input("SUBSTACK"));
+        emit(vm_opcode::yield_loop);
+        emit(vm_opcode::jump, loop_start);
+        mp_program->m_code[loop_start].operand = mp_program->m_code.size();
+    }
+    else if (opcode == "control_forever")
+    {
+        loop_start = mp_program->m_code.size();
+        compile_stack(p_block->get_input("SUBSTACK"));
+        emit(vm_opcode::yield_loop);
+        emit(vm_opcode::jump, loop_start);
+    }
+    else if (opcode == "control_if")
+    {
+        compile_input(p_block, "CONDITION");
+        exit_jump = mp_program->m_code.size();
+        emit(vm_opcode::jump_if_false);
+        compile_stack(p_block->get_input("SUBSTACK"));
+        mp_program->m_code[exit_jump].operand = mp_program->m_code.size();
+    }
+    else if (opcode == "control_if_else")
+    {
+        compile_input(p_block, "CONDITION");
+        else_jump = mp_program->m_code.size();
+        emit(vm_opcode::jump_if_false);
+        compile_stack(p_block->get_input("SUBSTACK"));
+        exit_jump = mp_program->m_code.size();
+        emit(vm_opcode::jump);
+        mp_program->m_code[else_jump].operand = mp_program->m_code.size();
+        compile_stack(p_block->get_input("SUBSTACK2"));
+        mp_program->m_code[exit_jump].operand = mp_program->m_code.size();
+    }
+    else if (opcode == "control_repeat_until" || opcode == "control_while")
+    {
+        loop_start = mp_program->m_code.size();
+        compile_input(p_block, "CONDITION");
+        exit_jump = mp_program->m_code.size();
+        emit(opcode == "control_while" ? vm_opcode::jump_if_false : vm_opcode::jump_if_true);
+        compile_stack(p_block->get_input("SUBSTACK"));
+        emit(vm_opcode::yield_loop);
+        emit(vm_opcode::jump, loop_start);
+        mp_program->m_code[exit_jump].operand = mp_program->m_code.size();
+    }
+    else if (opcode == "control_wait")
+    {
+        compile_number_input(p_block, "DURATION");
+        emit(vm_opcode::wait_start);
+        emit(vm_opcode::wait_check);
+    }
+    else if (opcode == "control_wait_until")
+    {
+        loop_start = mp_program->m_code.size();
+        compile_input(p_block, "CONDITION");
+        exit_jump = mp_program->m_code.size();
+        emit(vm_opcode::jump_if_true);
+        emit(vm_opcode::yield);
+        emit(vm_opcode::jump, loop_start);
+        mp_program->m_code[exit_jump].operand = mp_program->m_code.size();
+    }
+    else if (opcode == "control_stop")
+    {
+        std::wstring option = get_field_text(p_block, "STOP_OPTION");
+        if (option == L"all")
+        {
+            emit(vm_opcode::stop_all);
+        }
+        else if (option == L"this script")
+        {
+            emit(vm_opcode::halt);
+        }
+        else
+        {
+            emit(vm_opcode::stop_others);
+        }
+    }
+    else if (opcode == "event_broadcastandwait")
+    {
+        compile_input(p_block, "BROADCAST_INPUT");
+        emit(vm_opcode::broadcast, 1);
+    }
+    else if (opcode == "procedures_call")
+    {
+        pending_call call = {};
+        for (std::wstring& argument_id : p_block->m_mutation.argument_ids)
+        {
+            compile_input(p_block, std::string(argument_id.begin(), argument_id.end()));
+        }
+        call.instruction = mp_program->m_code.size();
+        call.proccode = p_block->m_mutation.proccode;
+        m_pending_calls.push_back(call);
+        emit(vm_opcode::call, p_block->m_mutation.argument_ids.size()); // operand holds the argument count until finish() links the call
+    }
+
+    // variables and lists
+    else if (opcode == "data_setvariableto" || opcode == "data_changevariableby")
+    {
+        bool is_set = opcode == "data_setvariableto";
+        slot = resolve_variable(p_block, is_global);
+        if (is_set)
+        {
+            compile_input(p_block, "VALUE");
+            emit(is_global ? vm_opcode::store_global : vm_opcode::store_local, slot);
+        }
+        else
+        {
+            compile_number_input(p_block, "VALUE");
+            emit(is_global ? vm_opcode::change_global : vm_opcode::change_local, slot);
+        }
+    }
+    else if (opcode == "data_addtolist")
+    {
+        compile_input(p_block, "ITEM");
+        emit(vm_opcode::list_add, resolve_list(p_block));
+    }
+    else if (opcode == "data_deleteoflist")
+    {
+        compile_input(p_block, "INDEX");
+        emit(vm_opcode::list_delete, resolve_list(p_block));
+    }
+    else if (opcode == "data_deletealloflist")
+    {
+        emit(vm_opcode::list_delete_all, resolve_list(p_block));
+    }
+    else if (opcode == "data_insertatlist")
+    {
+        compile_input(p_block, "ITEM");
+        compile_input(p_block, "INDEX");
+        emit(vm_opcode::list_insert, resolve_list(p_block));
+    }
+    else if (opcode == "data_replaceitemoflist")
+    {
+        compile_input(p_block, "INDEX");
+        compile_input(p_block, "ITEM");
+        emit(vm_opcode::list_replace, resolve_list(p_block));
+    }
+    else if (opcode == "data_showvariable" || opcode == "data_hidevariable" || opcode == "data_showlist" || opcode == "data_hidelist")
+    {
+        // monitors are not drawn by CScratch
+    }
+
+    // looks and motion with menu fields
+    else if (opcode == "looks_gotofrontback")
+    {
+        emit(get_field_text(p_block, "FRONT_BACK") == L"back" ? vm_opcode::goto_back : vm_opcode::goto_front);
+    }
+    else if (opcode == "looks_goforwardbackwardlayers")
+    {
+        compile_number_input(p_block, "NUM");
+        emit(vm_opcode::go_forward_layers, get_field_text(p_block, "FORWARD_BACKWARD") == L"backward" ? -1 : 1);
+    }
+    else if (opcode == "looks_seteffectto" || opcode == "looks_changeeffectby")
+    {
+        compile_number_input(p_block, opcode == "looks_seteffectto" ? "VALUE" : "CHANGE");
+        operand = effect_from_name(get_field_text(p_block, "EFFECT"));
+        if (operand < 0)
+        {
+            emit(vm_opcode::pop, 1);
+        }
+        else
+        {
+            emit(opcode == "looks_seteffectto" ? vm_opcode::set_effect : vm_opcode::change_effect, operand);
+        }
+    }
+    else if (opcode == "motion_setrotationstyle")
+    {
+        std::wstring style = get_field_text(p_block, "STYLE");
+        operand = static_cast<int>(rotation_mode::all_around);
+        if (style == L"left-right")
+        {
+            operand = static_cast<int>(rotation_mode::left_right);
+        }
+        else if (style == L"don't rotate")
+        {
+            operand = static_cast<int>(rotation_mode::none);
+        }
+        emit(vm_opcode::set_rotation_mode, operand);
+    }
+    else
+    {
+        compile_unsupported(p_block);
+    }
+}
+
+// compiles a block that leaves exactly one value on the stack
+void vm_compiler::compile_reporter(script_node* p_node)
+{
+    const std::string& opcode = p_node->m_opcode;
+    const simple_block* p_simple = find_simple_block(opcode);
+    bool is_global = false;
+    int slot = 0;
+    int operand = 0;
+
+    if (opcode == "literal")
+    {
+        emit(vm_opcode::push_constant, add_constant(p_node->m_literal));
+        return;
+    }
+    if (p_simple != nullptr)
+    {
+        for (const char* p_input : p_simple->p_inputs)
+        {
+            if (p_input == nullptr)
+            {
+                break;
+            }
+            if (p_input[0] == '#')
+            {
+                compile_number_input(p_node, p_input + 1);
+            }
+            else
+            {
+                compile_input(p_node, p_input);
+            }
+        }
+        emit(p_simple->instruction);
+        return;
+    }
+
+    if (opcode == "data_variable")
+    {
+        slot = resolve_variable(p_node, is_global);
+        emit(is_global ? vm_opcode::load_global : vm_opcode::load_local, slot);
+    }
+    else if (opcode == "data_itemoflist")
+    {
+        compile_input(p_node, "INDEX");
+        emit(vm_opcode::list_item, resolve_list(p_node));
+    }
+    else if (opcode == "data_itemnumoflist")
+    {
+        compile_input(p_node, "ITEM");
+        emit(vm_opcode::list_item_number, resolve_list(p_node));
+    }
+    else if (opcode == "data_lengthoflist")
+    {
+        emit(vm_opcode::list_length, resolve_list(p_node));
+    }
+    else if (opcode == "data_listcontainsitem")
+    {
+        compile_input(p_node, "ITEM");
+        emit(vm_opcode::list_contains, resolve_list(p_node));
+    }
+    else if (opcode == "data_listcontents")
+    {
+        emit(vm_opcode::list_contents, resolve_list(p_node));
+    }
+    else if (opcode == "operator_mathop")
+    {
+        compile_number_input(p_node, "NUM");
+        operand = math_op_from_name(get_field_text(p_node, "OPERATOR"));
+        if (operand >= 0)
+        {
+            emit(vm_opcode::math, operand);
+        }
+    }
+    else if (opcode == "looks_costumenumbername")
+    {
+        emit(get_field_text(p_node, "NUMBER_NAME") == L"name" ? vm_opcode::get_costume_name : vm_opcode::get_costume_number);
+    }
+    else if (opcode == "argument_reporter_string_number" || opcode == "argument_reporter_boolean")
+    {
+        std::wstring name = get_field_text(p_node, "VALUE");
+        operand = -1;
+        if (mp_argument_names != nullptr)
+        {
+            std::vector<std::wstring>::iterator found = std::find(mp_argument_names->begin(), mp_argument_names->end(), name);
+            if (found != mp_argument_names->end())
+            {
+                operand = found - mp_argument_names->begin();
+            }
+        }
+        if (operand < 0) // used outside of its definition
+        {
+            emit(vm_opcode::push_constant, add_constant(opcode == "argument_reporter_boolean" ? scratch_state(false) : scratch_state(0.0)));
+        }
+        else
+        {
+            emit(vm_opcode::load_argument, operand);
+        }
+    }
+    else if (p_node->m_inputs.empty() && p_node->m_fields.size() == 1) // menus (costume names, key names, broadcast names) just report their field
+    {
+        emit(vm_opcode::push_constant, add_constant(scratch_state(p_node->m_fields[0].second)));
+    }
+    else
+    {
+        compile_unsupported(p_node);
+        emit(vm_opcode::push_constant, add_constant(scratch_state(L"")));
+    }
+}
+
+// a missing input reports the empty string, which also reads as 0 and false
+void vm_compiler::compile_input(script_node* p_block, const std::string& name)
+{
+    script_node* p_input = p_block->get_input(name);
+
+    if (p_input == nullptr)
+    {
+        emit(vm_opcode::push_constant, add_constant(scratch_state(L"")));
+        return;
+    }
+    compile_reporter(p_input);
+}
+
+// same as compile_input but literal text is turned into a number here instead of on every execution
+void vm_compiler::compile_number_input(script_node* p_block, const std::string& name)
+{
+    script_node* p_input = p_block->get_input(name);
+
+    if (p_input == nullptr)
+    {
+        emit(vm_opcode::push_constant, add_constant(scratch_state(0.0)));
+        return;
+    }
+    if (p_input->m_opcode == "literal")
+    {
+        emit(vm_opcode::push_constant, add_constant(scratch_state(p_input->m_literal.to_number())));
+        return;
+    }
+    compile_reporter(p_input);
+}
+
+void vm_compiler::compile_procedure(script_node* p_definition)
+{
+    script_node* p_prototype = p_definition->get_input("custom_block");
+    vm_procedure procedure = {};
+
+    if (p_prototype == nullptr)
+    {
+        return;
+    }
+    for (vm_procedure& existing : mp_program->m_procedures) // Scratch only ever runs the first definition of a procedure
+    {
+        if (existing.proccode == p_prototype->m_mutation.proccode)
+        {
+            return;
+        }
+    }
+
+    procedure.proccode = p_prototype->m_mutation.proccode;
+    procedure.argument_count = p_prototype->m_mutation.argument_names.size();
+    procedure.warp = p_prototype->m_mutation.warp;
+    procedure.entry = mp_program->m_code.size();
+    mp_program->m_procedures.push_back(procedure);
+
+    mp_argument_names = &p_prototype->m_mutation.argument_names;
+    compile_stack(p_definition->mp_next);
+    emit(vm_opcode::return_procedure);
+    mp_argument_names = nullptr;
+}
+
+void vm_compiler::compile_unsupported(script_node* p_block)
+{
+    std::vector<std::string>& unsupported = mp_program->m_unsupported_opcodes;
+
+    if (std::find(unsupported.begin(), unsupported.end(), p_block->m_opcode) == unsupported.end())
+    {
+        unsupported.push_back(p_block->m_opcode);
+    }
+}
+
+// finds the VARIABLE field's slot in the sprite first and then on the stage, unknown variables get created on the sprite like Scratch does
+int vm_compiler::resolve_variable(script_node* p_block, bool& is_global)
+{
+    std::wstring name = get_field_text(p_block, "VARIABLE");
+    int slot = mp_target->find_variable(name);
+
+    is_global = false;
+    if (slot >= 0)
+    {
+        return slot;
+    }
+    slot = mp_target->mp_stage->find_variable(name);
+    if (slot >= 0)
+    {
+        is_global = mp_target->mp_stage != mp_target;
+        return slot;
+    }
+    return mp_target->declare_variable(name, scratch_state(0.0));
+}
+
+// list operands are the sprite's slot, or ~slot for a list on the stage
+int vm_compiler::resolve_list(script_node* p_block)
+{
+    std::wstring name = get_field_text(p_block, "LIST");
+    int slot = mp_target->find_list(name);
+
+    if (slot >= 0)
+    {
+        return slot;
+    }
+    slot = mp_target->mp_stage->find_list(name);
+    if (slot >= 0)
+    {
+        return mp_target->mp_stage != mp_target ? ~slot : slot;
+    }
+    return mp_target->declare_list(name);
+}
+
+std::wstring vm_compiler::get_field_text(script_node* p_block, const std::string& name)
+{
+    const std::wstring* p_field = p_block->get_field(name);
+    return p_field == nullptr ? std::wstring() : *p_field;
+}
@@ -0,0 +1,131 @@
+/*
+File: vm-native.cpp
+Description: Implements the checks that decide whether natively compiled programs still match the project they are bound to
+*/
+
+#include "scratch-vm.hpp"
+#include "scratch-render.hpp"
+#include "scratch-util.hpp"
+#include <cstring>
+
+using namespace scratch;
+
+namespace
+{
+    // fixed width little endian so the fingerprint doesn't depend on how wide wchar_t is
+    void append_number(std::vector<unsigned char>& bytes, unsigned long long value, unsigned int size)
+    {
+        for (unsigned int i = 0; i < size; ++i)
+        {
+            bytes.push_back((unsigned char)(value >> (i * 8)));
+        }
+    }
+
+    void append_text(std::vector<unsigned char>& bytes, const std::wstring& text)
+    {
+        append_number(bytes, text.size(), 4);
+        for (wchar_t character : text)
+        {
+            append_number(bytes, (unsigned long long)character, 4);
+        }
+    }
+}
+
+unsigned long long scratch::vm_fingerprint(vm_target* p_target)
+{
+    vm_program* p_program = p_target->mp_program;
+    std::vector<unsigned char> bytes;
+    unsigned long long bits = 0;
+    double number = 0.0;
+
+    append_number(bytes, p_target->m_variables.size(), 4);
+    append_number(bytes, p_target->m_lists.size(), 4);
+    append_number(bytes, p_program->m_code.size(), 4);
+    for (const vm_instruction& instruction : p_program->m_code)
+    {
+        append_number(bytes, static_cast<unsigned long long>(instruction.opcode), 2);
+        append_number(bytes, (unsigned int)instruction.operand, 4);
+    }
+    append_number(bytes, p_program->m_constants.size(), 4);
+    for (const scratch_state& constant : p_program->m_constants)
+    {
+        append_number(bytes, static_cast<unsigned long long>(constant.get_type()), 1);
+        if (constant.is_number())
+        {
+            number = constant.get_number();
+            memcpy(&bits, &number, sizeof(bits));
+            append_number(bytes, bits, 8);
+        }
+        else
+        {
+            append_text(bytes, constant.to_string());
+        }
+    }
+    append_number(bytes, p_program->m_scripts.size(), 4);
+    for (const vm_script_entry& script : p_program->m_scripts)
+    {
+        append_number(bytes, static_cast<unsigned long long>(script.hat), 1);
+        append_text(bytes, script.hat_parameter);
+        append_number(bytes, script.entry, 4);
+    }
+    append_number(bytes, p_program->m_procedures.size(), 4);
+    for (const vm_procedure& procedure : p_program->m_procedures)
+    {
+        append_text(bytes, procedure.proccode);
+        append_number(bytes, procedure.entry, 4);
+        append_number(bytes, procedure.argument_count, 4);
+        append_number(bytes, procedure.warp ? 1 : 0, 1);
+    }
+    return scratch_util::fnv1a_64(bytes.data(), bytes.size());
+}
+
+// matched by sprite name since that is all that stays the same between loading the project for the transpiler and loading it to run
+bool scratch::vm_bind_native(const std::vector<vm_target*>& targets, const vm_native_program* p_programs, unsigned int count)
+{
+    std::vector<const vm_native_program*> matches;
+
+    for (vm_target* p_target : targets)
+    {
+        const vm_native_program* p_match = nullptr;
+
+        if (p_target->is_clone())
+        {
+            continue;
+        }
+        for (unsigned int i = 0; i < count && p_match == nullptr; ++i)
+        {
+            if (p_target->mp_sprite == nullptr ? p_programs[i].p_target_name == nullptr
+                : p_programs[i].p_target_name != nullptr && p_target->mp_sprite->get_name() == p_programs[i].p_target_name)
+            {
+                p_match = &p_programs[i];
+            }
+        }
+        if (p_match == nullptr || p_match->fingerprint != vm_fingerprint(p_target))
+        {
+            return false;
+        }
+        for (unsigned int i = 0; i < p_match->number_variable_count; ++i)
+        {
+            unsigned int slot = p_match->p_number_variables[i];
+
+            if (slot >= p_target->m_variables.size() || !p_target->m_variables[slot].is_number())
+            {
+                return false;
+            }
+        }
+        matches.push_back(p_match);
+    }
+    if (matches.size() != count)
+    {
+        return false;
+    }
+
+    for (unsigned int i = 0, match = 0; i < targets.size(); ++i)
+    {
+        if (!targets[i]->is_clone())
+        {
+            targets[i]->mp_program->m_native_step = matches[match++]->step;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,372 @@
+/*
+File: vm-ops.cpp
+Description: Implements the Scratch block logic shared by the bytecode interpreter and natively compiled scripts
+*/
+
+#include "scratch-vm-ops.hpp"
+#include "scratch-input.hpp"
+#include "scratch-util.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cwctype>
+
+using namespace scratch;
+
+// turns a Scratch list index ("last", "random", a number) into 1..length, or list_index_invalid / list_index_all
+int vm_ops::resolve_list_index(const scratch_state& index, int length, bool accept_all, vm_context& context)
+{
+    double number = 0.0;
+
+    if (index.is_string())
+    {
+        if (accept_all && index.string_equals(L"all"))
+        {
+            return list_index_all;
+        }
+        if (index.string_equals(L"last"))
+        {
+            return length > 0 ? length : list_index_invalid;
+        }
+        if (index.string_equals(L"random") || index.string_equals(L"any"))
+        {
+            return length > 0 ? 1 + (int)(next_random(context) * length) : list_index_invalid;
+        }
+    }
+    number = floor(index.to_number());
+    if (number < 1.0 || number > length)
+    {
+        return list_index_invalid;
+    }
+    return (int)number;
+}
+
+// a sprite with its pen down leaves a line behind wherever it moves, old_x and old_y are where it was before the move
+void vm_ops::move_pen(vm_context& context, sprite* p_sprite, double old_x, double old_y)
+{
+    if (p_sprite->m_pen.down && context.p_pen_layer != nullptr)
+    {
+        context.p_pen_layer->draw_line(old_x, old_y, p_sprite->get_x(), p_sprite->get_y(), p_sprite->m_pen);
+        context.redraw_requested = true;
+    }
+}
+
+// colors come from color pickers, as "#rrggbb" text or as numbers packing ARGB where an alpha of 0 means opaque, like Scratch's casts
+Color vm_ops::to_color(const scratch_state& value)
+{
+    std::wstring text;
+    unsigned long long packed = 0;
+
+    if (value.is_string())
+    {
+        text = value.to_string();
+    }
+    if (!text.empty() && text[0] == L'#')
+    {
+        if (text.size() == 4) // #rgb
+        {
+            text = std::wstring(L"#") + text[1] + text[1] + text[2] + text[2] + text[3] + text[3];
+        }
+        packed = wcstoull(text.c_str() + 1, nullptr, 16) & 0xFFFFFF;
+    }
+    else
+    {
+        packed = (unsigned long long)(long long)value.to_number() & 0xFFFFFFFF;
+    }
+    return Color{(unsigned char)(packed >> 16), (unsigned char)(packed >> 8), (unsigned char)packed, packed >> 24 == 0 ? (unsigned char)255 : (unsigned char)(packed >> 24)};
+}
+
+void vm_ops::set_pen_color(pen_state& pen, Color color)
+{
+    double red = color.r / 255.0;
+    double green = color.g / 255.0;
+    double blue = color.b / 255.0;
+    double value = std::max(red, std::max(green, blue));
+    double chroma = value - std::min(red, std::min(green, blue));
+    double hue = 0.0;
+
+    if (chroma > 0.0)
+    {
+        hue = value == red ? (green - blue) / chroma : value == green ? (blue - red) / chroma + 2.0 : (red - green) / chroma + 4.0;
+        hue = hue < 0.0 ? hue + 6.0 : hue;
+    }
+    pen.color = hue / 6.0 * 100.0;
+    pen.saturation = value > 0.0 ? chroma / value * 100.0 : 0.0;
+    pen.brightness = value * 100.0;
+    pen.transparency = 100.0 * (1.0 - color.a / 255.0);
+    pen.rgba = resolve_pen_color(pen);
+}
+
+// the hue wraps over 0 to 100 inclusive like Scratch's wrapClamp, the rest clamp
+void vm_ops::set_pen_param(pen_state& pen, const scratch_state& param, double value, bool change)
+{
+    double* p_param = nullptr;
+
+    if (param.string_equals(L"color"))
+    {
+        pen.color = change ? pen.color + value : value;
+        pen.color -= floor(pen.color / 101.0) * 101.0;
+    }
+    else
+    {
+        if (param.string_equals(L"saturation"))
+        {
+            p_param = &pen.saturation;
+        }
+        else if (param.string_equals(L"brightness"))
+        {
+            p_param = &pen.brightness;
+        }
+        else if (param.string_equals(L"transparency"))
+        {
+            p_param = &pen.transparency;
+        }
+        if (p_param == nullptr)
+        {
+            return;
+        }
+        *p_param = std::min(std::max(change ? *p_param + value : value, 0.0), 100.0);
+    }
+    pen.rgba = resolve_pen_color(pen);
+}
+
+int vm_ops::find_list_item(const scratch_list& list, const scratch_state& item)
+{
+    return list.find(item);
+}
+
+bool vm_ops::contains_ignore_case(const std::wstring& text, const std::wstring& part)
+{
+    std::wstring lower_text = text;
+    std::wstring lower_part = part;
+
+    for (wchar_t& character : lower_text)
+    {
+        character = towlower(character);
+    }
+    for (wchar_t& character : lower_part)
+    {
+        character = towlower(character);
+    }
+    return lower_text.find(lower_part) != std::wstring::npos;
+}
+
+double vm_ops::apply_math_op(vm_math_op op, double value)
+{
+    double result = 0.0;
+
+    switch (op)
+    {
+        case vm_math_op::abs: return fabs(value);
+        case vm_math_op::floor: return floor(value);
+        case vm_math_op::ceiling: return ceil(value);
+        case vm_math_op::sqrt: return sqrt(value);
+        case vm_math_op::sin: result = sin(value * MATH_PI / 180.0); break; // Scratch rounds trig results to 10 places so sin(180) is 0
+        case vm_math_op::cos: result = cos(value * MATH_PI / 180.0); break;
+        case vm_math_op::tan:
+            value = fmod(value, 360.0);
+            if (value == -270.0 || value == 90.0)
+            {
+                return INFINITY;
+            }
+            if (value == -90.0 || value == 270.0)
+            {
+                return -INFINITY;
+            }
+            result = tan(value * MATH_PI / 180.0);
+            break;
+        case vm_math_op::asin: return asin(value) * 180.0 / MATH_PI;
+        case vm_math_op::acos: return acos(value) * 180.0 / MATH_PI;
+        case vm_math_op::atan: return atan(value) * 180.0 / MATH_PI;
+        case vm_math_op::ln: return log(value);
+        case vm_math_op::log: return log10(value);
+        case vm_math_op::exp: return exp(value);
+        case vm_math_op::pow10: return pow(10.0, value);
+        default: return 0.0;
+    }
+    return round(result * 1e10) / 1e10;
+}
+
+// Scratch's switch costume: costume names win, then numbers (wrapping around), then the next/previous costume keywords
+void vm_ops::switch_costume(sprite* p_sprite, const scratch_state& value)
+{
+    int costume_count = p_sprite->get_costume_count();
+    double number = 0.0;
+    std::wstring name;
+
+    if (costume_count == 0)
+    {
+        return;
+    }
+    if (value.is_string())
+    {
+        name = value.to_string();
+        if (p_sprite->has_costume(name))
+        {
+            p_sprite->set_costume_by_name(name);
+            return;
+        }
+        if (name == L"next costume" || name == L"previous costume")
+        {
+            number = p_sprite->get_costume_number() + (name == L"next costume" ? 1 : -1);
+        }
+        else if (value.is_whitespace() || std::isnan(string_to_number(name)))
+        {
+            return;
+        }
+        else
+        {
+            number = string_to_number(name);
+        }
+    }
+    else
+    {
+        number = value.to_number();
+    }
+    if (std::isinf(number) || std::isnan(number))
+    {
+        return;
+    }
+    number = round(number) - 1.0;
+    number -= floor(number / costume_count) * costume_count;
+    p_sprite->set_costume_number((unsigned int)number + 1);
+}
+
+void vm_ops::list_delete(scratch_list& list, const scratch_state& index, vm_context& context)
+{
+    int position = resolve_list_index(index, list.size(), true, context);
+
+    if (position == list_index_all)
+    {
+        list.clear();
+    }
+    else if (position != list_index_invalid)
+    {
+        list.erase(position - 1);
+    }
+}
+
+void vm_ops::list_insert(scratch_list& list, const scratch_state& index, const scratch_state& item, vm_context& context)
+{
+    int position = resolve_list_index(index, list.size() + 1, false, context);
+
+    if (position != list_index_invalid && list.size() < LIST_ITEM_LIMIT)
+    {
+        list.insert(position - 1, item);
+    }
+}
+
+void vm_ops::list_replace(scratch_list& list, const scratch_state& index, const scratch_state& item, vm_context& context)
+{
+    int position = resolve_list_index(index, list.size(), false, context);
+
+    if (position != list_index_invalid)
+    {
+        list.set(position - 1, item);
+    }
+}
+
+scratch_state vm_ops::list_item(const scratch_list& list, const scratch_state& index, vm_context& context)
+{
+    int position = resolve_list_index(index, list.size(), false, context);
+
+    return position == list_index_invalid ? scratch_state(L"") : list.get(position - 1);
+}
+
+// single characters are joined without spaces like Scratch does
+scratch_state vm_ops::list_contents(const scratch_list& list)
+{
+    std::wstring text;
+    bool all_single_characters = true;
+
+    for (size_t i = 0; i < list.size() && all_single_characters; ++i)
+    {
+        all_single_characters = list.get(i).to_string().size() == 1;
+    }
+    for (size_t i = 0; i < list.size(); ++i)
+    {
+        if (i > 0 && !all_single_characters)
+        {
+            text += L' ';
+        }
+        text += list.get(i).to_string();
+    }
+    return scratch_state(text);
+}
+
+// "1" and "1.0" pick different kinds of random numbers, so the inputs are only cast here
+double vm_ops::pick_random(const scratch_state& from, const scratch_state& to, vm_context& context)
+{
+    double low = from.to_number();
+    double high = to.to_number();
+    bool decimal = (from.is_string() && from.to_string().find(L'.') != std::wstring::npos)
+        || (to.is_string() && to.to_string().find(L'.') != std::wstring::npos)
+        || low != floor(low) || high != floor(high);
+
+    if (low > high)
+    {
+        std::swap(low, high);
+    }
+    if (decimal)
+    {
+        return low + next_random(context) * (high - low);
+    }
+    return low + floor(next_random(context) * (high - low + 1.0));
+}
+
+scratch_state vm_ops::letter_of(double index, const std::wstring& text)
+{
+    index = floor(index) - 1.0;
+    if (index < 0.0 || index >= text.size())
+    {
+        return scratch_state(L"");
+    }
+    return scratch_state(std::wstring(1, text[(size_t)index]));
+}
+
+bool vm_ops::key_pressed(const scratch_state& key, vm_context& context)
+{
+    int keycode = scratch_util::key_name_to_keycode(key.to_string()); // -1 for "any"
+
+    return context.p_input != nullptr && context.p_input->is_key_down(keycode);
+}
+
+// name is "_mouse_", "_edge_" or a sprite name, which clones share with their parent
+bool vm_ops::touching_object(sprite* p_sprite, const std::wstring& name, vm_context& context)
+{
+    sprite_transform transform = {};
+
+    if (p_sprite == nullptr)
+    {
+        return false;
+    }
+    if (name == L"_mouse_")
+    {
+        return context.p_input != nullptr && p_sprite->touches_point(context.p_input->get_mouse_x(), context.p_input->get_mouse_y());
+    }
+    if (name == L"_edge_")
+    {
+        return p_sprite->touches_edge();
+    }
+    if (context.p_sprite_grid != nullptr && p_sprite->get_transform(transform))
+    {
+        for (sprite* p_other : context.p_sprite_grid->query_box(transform.min_x, transform.min_y, transform.max_x, transform.max_y))
+        {
+            if (p_other != p_sprite && p_other->get_name() == name && p_sprite->touches_sprite(p_other))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+    if (context.p_layers != nullptr)
+    {
+        for (sprite* p_other : context.p_layers->get_draw_order())
+        {
+            if (p_other != p_sprite && p_other->get_name() == name && p_sprite->touches_sprite(p_other))
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
@@ -0,0 +1,99 @@
+/*
+File: vm-target.cpp
+Description: Implements the per sprite variable and list storage used by the CScratch VM
+*/
+
+#include "scratch-vm.hpp"
+
+using namespace scratch;
+
+// p_stage is the target holding global variables, pass nullptr when creating the stage itself
+vm_target::vm_target(sprite* p_sprite, vm_target* p_stage)
+{
+    mp_sprite = p_sprite;
+    mp_stage = p_stage == nullptr ? this : p_stage;
+    mp_original = nullptr;
+    mp_program = new vm_program();
+}
+
+vm_target::~vm_target()
+{
+    if (mp_original == nullptr)
+    {
+        delete mp_program;
+    }
+}
+
+// turns this target into a clone of p_parent running on p_sprite. the scheduler recycles clone targets through here,
+// assigning into the existing vectors reuses their storage so a recycled target usually allocates nothing
+void vm_target::make_clone_of(vm_target* p_parent, sprite* p_sprite)
+{
+    if (mp_original == nullptr)
+    {
+        delete mp_program;
+    }
+    mp_sprite = p_sprite;
+    mp_stage = p_parent->mp_stage;
+    mp_original = p_parent->mp_original == nullptr ? p_parent : p_parent->mp_original;
+    mp_program = p_parent->mp_program;
+    m_variables.assign(p_parent->m_variables.begin(), p_parent->m_variables.end());
+    m_lists.assign(p_parent->m_lists.begin(), p_parent->m_lists.end());
+}
+
+bool vm_target::is_clone()
+{
+    return mp_original != nullptr;
+}
+
+// returns the slot of the variable, redeclaring an existing variable just overwrites its value
+unsigned int vm_target::declare_variable(const std::wstring& name, scratch_state value)
+{
+    std::unordered_map<std::wstring, unsigned int>::iterator slot = m_variable_slots.find(name);
+
+    if (slot != m_variable_slots.end())
+    {
+        m_variables[slot->second] = value;
+        return slot->second;
+    }
+    m_variables.push_back(value);
+    m_variable_slots[name] = m_variables.size() - 1;
+    return m_variables.size() - 1;
+}
+
+unsigned int vm_target::declare_list(const std::wstring& name)
+{
+    std::unordered_map<std::wstring, unsigned int>::iterator slot = m_list_slots.find(name);
+
+    if (slot != m_list_slots.end())
+    {
+        return slot->second;
+    }
+    m_lists.emplace_back();
+    m_list_slots[name] = m_lists.size() - 1;
+    return m_lists.size() - 1;
+}
+
+// returns -1 if this target has no variable with that name, clones use the slots of the target they were made from
+int vm_target::find_variable(const std::wstring& name)
+{
+    std::unordered_map<std::wstring, unsigned int>::iterator slot;
+
+    if (mp_original != nullptr)
+    {
+        return mp_original->find_variable(name);
+    }
+    slot = m_variable_slots.find(name);
+    return slot == m_variable_slots.end() ? -1 : (int)slot->second;
+}
+
+int vm_target::find_list(const std::wstring& name)
+{
+    std::unordered_map<std::wstring, unsigned int>::iterator slot;
+
+    if (mp_original != nullptr)
+    {
+        return mp_original->find_list(name);
+    }
+    slot = m_list_slots.find(name);
+    return slot == m_list_slots.end() ? -1 : (int)slot->second;
+}
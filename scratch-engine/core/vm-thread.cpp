@@ -0,0 +1,671 @@
+/*
+File: vm-thread.cpp
+Description: Implements the bytecode interpreter that runs CScratch scripts
+*/
+
+#include "scratch-vm-ops.hpp"
+#include "scratch-input.hpp"
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cmath>
+
+using namespace scratch;
+using namespace scratch::vm_ops;
+
+vm_thread::vm_thread(vm_target* p_target, unsigned int entry)
+{
+    m_state.stack.reserve(VM_STACK_RESERVE);
+    reset(p_target, entry);
+}
+
+void vm_thread::reset(vm_target* p_target, unsigned int entry)
+{
+    m_state.p_target = p_target;
+    m_state.entry = entry;
+    m_state.pc = entry;
+    m_state.done = false;
+    m_state.waiting = false;
+    m_state.wait_until = 0.0;
+    m_state.warp_loops = 0;
+    m_state.stack.clear();
+    m_state.frames.clear();
+}
+
+// runs the thread until it yields or ends
+// returns ok when it yielded, signal_job_terminate once it has finished, signal_scheduler_terminate_others for "stop other scripts in sprite"
+// (the thread can carry on running after that), signal_create_clone for "create clone of" (likewise), signal_delete_clone for "delete this clone",
+// signal_vm_halt for "stop all" and error for broken bytecode
+job_status vm_thread::step(vm_context& context)
+{
+    vm_program* p_program = m_state.p_target->mp_program;
+    const vm_instruction* p_code = p_program->m_code.data();
+    const scratch_state* p_constants = p_program->m_constants.data();
+    unsigned int code_size = p_program->m_code.size();
+    std::vector<scratch_state>& stack = m_state.stack;
+    std::vector<scratch_state>& locals = m_state.p_target->m_variables;
+    std::vector<scratch_state>& globals = m_state.p_target->mp_stage->m_variables;
+    sprite* p_sprite = m_state.p_target->mp_sprite;
+    unsigned int pc = m_state.pc;
+    double number = 0.0;
+
+    if (m_state.done)
+    {
+        return job_status::signal_job_terminate;
+    }
+    m_state.waiting = false;
+    if (p_program->m_native_step != nullptr) // compiled ahead of time, see vm_transpiler
+    {
+        return p_program->m_native_step(m_state, context);
+    }
+
+    while (pc < code_size)
+    {
+        const vm_instruction instruction = p_code[pc++];
+
+        switch (instruction.opcode)
+        {
+            // stack and variables
+            case vm_opcode::push_constant:
+                stack.push_back(p_constants[instruction.operand]);
+                break;
+            case vm_opcode::pop:
+                stack.resize(stack.size() - instruction.operand);
+                break;
+            case vm_opcode::load_local:
+                stack.push_back(locals[instruction.operand]);
+                break;
+            case vm_opcode::load_global:
+                stack.push_back(globals[instruction.operand]);
+                break;
+            case vm_opcode::store_local:
+                locals[instruction.operand] = std::move(stack.back());
+                stack.pop_back();
+                break;
+            case vm_opcode::store_global:
+                globals[instruction.operand] = std::move(stack.back());
+                stack.pop_back();
+                break;
+            case vm_opcode::change_local:
+                locals[instruction.operand] = scratch_state(locals[instruction.operand].to_number() + stack.back().to_number());
+                stack.pop_back();
+                break;
+            case vm_opcode::change_global:
+                globals[instruction.operand] = scratch_state(globals[instruction.operand].to_number() + stack.back().to_number());
+                stack.pop_back();
+                break;
+            case vm_opcode::load_argument:
+            {
+                scratch_state argument = stack[m_state.frames.back().argument_base + instruction.operand]; // copying first, push_back may reallocate
+                stack.push_back(std::move(argument));
+                break;
+            }
+
+            // operators, binary ones leave their result where the left operand was
+            case vm_opcode::add:
+                number = stack.back().to_number();
+                stack.pop_back();
+                stack.back() = scratch_state(stack.back().to_number() + number);
+                break;
+            case vm_opcode::subtract:
+                number = stack.back().to_number();
+                stack.pop_back();
+                stack.back() = scratch_state(stack.back().to_number() - number);
+                break;
+            case vm_opcode::multiply:
+                number = stack.back().to_number();
+                stack.pop_back();
+                stack.back() = scratch_state(stack.back().to_number() * number);
+                break;
+            case vm_opcode::divide:
+                number = stack.back().to_number();
+                stack.pop_back();
+                stack.back() = scratch_state(stack.back().to_number() / number);
+                break;
+            case vm_opcode::mod:
+                number = stack.back().to_number();
+                stack.pop_back();
+                stack.back() = scratch_state(mod(stack.back().to_number(), number));
+                break;
+            case vm_opcode::round:
+                stack.back() = scratch_state(floor(stack.back().to_number() + 0.5));
+                break;
+            case vm_opcode::math:
+                stack.back() = scratch_state(apply_math_op(static_cast<vm_math_op>(instruction.operand), stack.back().to_number()));
+                break;
+            case vm_opcode::random:
+                number = pick_random(stack[stack.size() - 2], stack.back(), context);
+                stack.pop_back();
+                stack.back() = scratch_state(number);
+                break;
+            case vm_opcode::equals:
+            {
+                bool result = stack[stack.size() - 2].equals(stack.back());
+                stack.pop_back();
+                stack.back() = scratch_state(result);
+                break;
+            }
+            case vm_opcode::less_than:
+            {
+                bool result = stack[stack.size() - 2].compare(stack.back()) < 0;
+                stack.pop_back();
+                stack.back() = scratch_state(result);
+                break;
+            }
+            case vm_opcode::greater_than:
+            {
+                bool result = stack[stack.size() - 2].compare(stack.back()) > 0;
+                stack.pop_back();
+                stack.back() = scratch_state(result);
+                break;
+            }
+            case vm_opcode::logic_and:
+            {
+                bool result = stack.back().to_boolean();
+                stack.pop_back();
+                stack.back() = scratch_state(stack.back().to_boolean() && result);
+                break;
+            }
+            case vm_opcode::logic_or:
+            {
+                bool result = stack.back().to_boolean();
+                stack.pop_back();
+                stack.back() = scratch_state(stack.back().to_boolean() || result);
+                break;
+            }
+            case vm_opcode::logic_not:
+                stack.back() = scratch_state(!stack.back().to_boolean());
+                break;
+            case vm_opcode::join:
+            {
+                std::wstring text = stack[stack.size() - 2].to_string();
+                text += stack.back().to_string();
+                stack.pop_back();
+                stack.back() = scratch_state(text);
+                break;
+            }
+            case vm_opcode::letter_of:
+            {
+                std::wstring text = stack.back().to_string();
+                stack.pop_back();
+                stack.back() = letter_of(stack.back().to_number(), text);
+                break;
+            }
+            case vm_opcode::length_of:
+                stack.back() = scratch_state((double)stack.back().to_string().size());
+                break;
+            case vm_opcode::contains:
+            {
+                bool result = contains_ignore_case(stack[stack.size() - 2].to_string(), stack.back().to_string());
+                stack.pop_back();
+                stack.back() = scratch_state(result);
+                break;
+            }
+
+            // control flow
+            case vm_opcode::jump:
+                pc = instruction.operand;
+                break;
+            case vm_opcode::jump_if_false:
+                if (!stack.back().to_boolean())
+                {
+                    pc = instruction.operand;
+                }
+                stack.pop_back();
+                break;
+            case vm_opcode::jump_if_true:
+                if (stack.back().to_boolean())
+                {
+                    pc = instruction.operand;
+                }
+                stack.pop_back();
+                break;
+            case vm_opcode::repeat_init:
+                stack.back() = scratch_state(floor(stack.back().to_number() + 0.5));
+                break;
+            case vm_opcode::repeat_next:
+                if (!(stack.back().get_number() >= 1.0)) // repeat_init left a number, NaN ends the loop too
+                {
+                    stack.pop_back();
+                    pc = instruction.operand;
+                }
+                else
+                {
+                    stack.back() = scratch_state(stack.back().get_number() - 1.0);
+                }
+                break;
+            case vm_opcode::yield:
+                m_state.pc = pc;
+                return job_status::ok;
+            case vm_opcode::yield_loop:
+                if (!is_warp() || ((++m_state.warp_loops & (VM_WARP_CHECK_INTERVAL - 1)) == 0 && std::chrono::steady_clock::now() >= context.warp_deadline))
+                {
+                    m_state.pc = pc;
+                    return job_status::ok;
+                }
+                break;
+            case vm_opcode::wait_start:
+                m_state.wait_until = context.current_time + stack.back().to_number();
+                m_state.waiting = context.current_time < m_state.wait_until;
+                stack.pop_back();
+                m_state.pc = pc;
+                return job_status::ok;
+            case vm_opcode::wait_check:
+                if (context.current_time < m_state.wait_until)
+                {
+                    m_state.waiting = true;
+                    m_state.pc = pc - 1;
+                    return job_status::ok;
+                }
+                break;
+            case vm_opcode::call:
+            {
+                const vm_procedure& procedure = p_program->m_procedures[instruction.operand];
+                vm_call_frame frame = {};
+                bool recursive = false;
+
+                frame.return_pc = pc;
+                frame.argument_base = stack.size() - procedure.argument_count;
+                frame.warp = procedure.warp || is_warp();
+                frame.procedure = instruction.operand;
+                for (const vm_call_frame& caller : m_state.frames)
+                {
+                    recursive = recursive || caller.procedure == frame.procedure;
+                }
+                m_state.frames.push_back(frame);
+                pc = procedure.entry;
+                if (recursive && !frame.warp) // like Scratch, recursion without warp gives other scripts a turn
+                {
+                    m_state.pc = pc;
+                    return job_status::ok;
+                }
+                break;
+            }
+            case vm_opcode::halt:
+                if (m_state.frames.empty())
+                {
+                    m_state.done = true;
+                    m_state.stack.clear();
+                    return job_status::signal_job_terminate;
+                }
+                // stop this script inside a procedure only leaves the procedure
+                // fall through
+            case vm_opcode::return_procedure:
+                stack.resize(m_state.frames.back().argument_base);
+                pc = m_state.frames.back().return_pc;
+                m_state.frames.pop_back();
+                break;
+            case vm_opcode::stop_all:
+                m_state.done = true;
+                m_state.stack.clear();
+                return job_status::signal_vm_halt;
+            case vm_opcode::stop_others:
+                m_state.pc = pc;
+                return job_status::signal_scheduler_terminate_others;
+            case vm_opcode::create_clone:
+                context.clone_option = stack.back();
+                stack.pop_back();
+                m_state.pc = pc;
+                return job_status::signal_create_clone;
+            case vm_opcode::delete_clone:
+                if (!m_state.p_target->is_clone()) // does nothing in the original sprite
+                {
+                    break;
+                }
+                m_state.done = true;
+                m_state.stack.clear();
+                m_state.pc = pc;
+                return job_status::signal_delete_clone;
+            case vm_opcode::broadcast: // operand: 1 for broadcast and wait
+                if (context.p_broadcasts != nullptr)
+                {
+                    context.p_broadcasts->push_back({stack.back().to_string(), instruction.operand != 0});
+                }
+                stack.pop_back();
+                if (instruction.operand != 0 && context.p_broadcasts != nullptr) // yielding so the runner can start the receivers and park this thread
+                {
+                    m_state.pc = pc;
+                    return job_status::ok;
+                }
+                break;
+
+            // lists
+            case vm_opcode::list_add:
+            {
+                scratch_list& list = get_list(m_state.p_target, instruction.operand);
+                if (list.size() < LIST_ITEM_LIMIT)
+                {
+                    list.push_back(std::move(stack.back()));
+                }
+                stack.pop_back();
+                break;
+            }
+            case vm_opcode::list_delete:
+                list_delete(get_list(m_state.p_target, instruction.operand), stack.back(), context);
+                stack.pop_back();
+                break;
+            case vm_opcode::list_delete_all:
+                get_list(m_state.p_target, instruction.operand).clear();
+                break;
+            case vm_opcode::list_insert:
+                list_insert(get_list(m_state.p_target, instruction.operand), stack.back(), std::move(stack[stack.size() - 2]), context);
+                stack.resize(stack.size() - 2);
+                break;
+            case vm_opcode::list_replace:
+                list_replace(get_list(m_state.p_target, instruction.operand), stack[stack.size() - 2], std::move(stack.back()), context);
+                stack.resize(stack.size() - 2);
+                break;
+            case vm_opcode::list_item:
+                stack.back() = list_item(get_list(m_state.p_target, instruction.operand), stack.back(), context);
+                break;
+            case vm_opcode::list_item_number:
+                stack.back() = scratch_state((double)find_list_item(get_list(m_state.p_target, instruction.operand), stack.back()));
+                break;
+            case vm_opcode::list_length:
+                stack.push_back(scratch_state((double)get_list(m_state.p_target, instruction.operand).size()));
+                break;
+            case vm_opcode::list_contains:
+                stack.back() = scratch_state(find_list_item(get_list(m_state.p_target, instruction.operand), stack.back()) != 0);
+                break;
+            case vm_opcode::list_contents:
+                stack.push_back(list_contents(get_list(m_state.p_target, instruction.operand)));
+                break;
+
+            // sprite, the stage has no sprite so these only keep the stack balanced there
+            case vm_opcode::move_steps:
+                number = stack.back().to_number();
+                stack.pop_back();
+                if (p_sprite != nullptr)
+                {
+                    request_redraw(context, p_sprite);
+                    double radians = (90.0 - p_sprite->get_direction()) * MATH_PI / 180.0;
+                    double old_x = p_sprite->get_x();
+                    double old_y = p_sprite->get_y();
+                    p_sprite->set_x(old_x + number * cos(radians));
+                    p_sprite->set_y(old_y + number * sin(radians));
+                    move_pen(context, p_sprite, old_x, old_y);
+                }
+                break;
+            case vm_opcode::turn_right:
+            case vm_opcode::turn_left:
+                number = stack.back().to_number();
+                stack.pop_back();
+                if (p_sprite != nullptr)
+                {
+                    request_redraw(context, p_sprite);
+                    p_sprite->set_direction(p_sprite->get_direction() + (instruction.opcode == vm_opcode::turn_right ? number : -number));
+                }
+                break;
+            case vm_opcode::goto_xy:
+                number = stack.back().to_number();
+                stack.pop_back();
+                if (p_sprite != nullptr)
+                {
+                    request_redraw(context, p_sprite);
+                    double old_x = p_sprite->get_x();
+                    double old_y = p_sprite->get_y();
+                    p_sprite->set_x(stack.back().to_number());
+                    p_sprite->set_y(number);
+                    move_pen(context, p_sprite, old_x, old_y);
+                }
+                stack.pop_back();
+                break;
+            case vm_opcode::set_x:
+            case vm_opcode::change_x:
+                number = stack.back().to_number();
+                stack.pop_back();
+                if (p_sprite != nullptr)
+                {
+                    request_redraw(context, p_sprite);
+                    double old_x = p_sprite->get_x();
+                    p_sprite->set_x(instruction.opcode == vm_opcode::change_x ? old_x + number : number);
+                    move_pen(context, p_sprite, old_x, p_sprite->get_y());
+                }
+                break;
+            case vm_opcode::set_y:
+            case vm_opcode::change_y:
+                number = stack.back().to_number();
+                stack.pop_back();
+                if (p_sprite != nullptr)
+                {
+                    request_redraw(context, p_sprite);
+                    double old_y = p_sprite->get_y();
+                    p_sprite->set_y(instruction.opcode == vm_opcode::change_y ? old_y + number : number);
+                    move_pen(context, p_sprite, p_sprite->get_x(), old_y);
+                }
+                break;
+            case vm_opcode::point_direction:
+                number = stack.back().to_number();
+                stack.pop_back();
+                if (p_sprite != nullptr)
+                {
+                    request_redraw(context, p_sprite);
+                    p_sprite->set_direction(number);
+                }
+                break;
+            case vm_opcode::set_rotation_mode:
+                if (p_sprite != nullptr)
+                {
+                    request_redraw(context, p_sprite);
+                    p_sprite->set_rotation_mode(static_cast<rotation_mode>(instruction.operand));
+                }
+                break;
+            case vm_opcode::get_x:
+                stack.push_back(scratch_state(p_sprite != nullptr ? p_sprite->get_x() : 0.0));
+                break;
+            case vm_opcode::get_y:
+                stack.push_back(scratch_state(p_sprite != nullptr ? p_sprite->get_y() : 0.0));
+                break;
+            case vm_opcode::get_direction:
+                stack.push_back(scratch_state(p_sprite != nullptr ? p_sprite->get_direction() : 90.0));
+                break;
+            case vm_opcode::set_size:
+            case vm_opcode::change_size:
+                number = stack.back().to_number();
+                stack.pop_back();
+                if (p_sprite != nullptr)
+                {
+                    request_redraw(context, p_sprite);
+                    p_sprite->set_size(instruction.opcode == vm_opcode::change_size ? p_sprite->get_size() + number : number);
+                }
+                break;
+            case vm_opcode::get_size:
+                stack.push_back(scratch_state(p_sprite != nullptr ? round(p_sprite->get_size()) : 100.0));
+                break;
+            case vm_opcode::show:
+            case vm_opcode::hide:
+                if (p_sprite != nullptr)
+                {
+                    context.redraw_requested = true;
+                    p_sprite->set_hidden(instruction.opcode == vm_opcode::hide);
+                }
+                break;
+            case vm_opcode::switch_costume:
+                if (p_sprite != nullptr)
+                {
+                    request_redraw(context, p_sprite);
+                    switch_costume(p_sprite, stack.back());
+                }
+                stack.pop_back();
+                break;
+            case vm_opcode::next_costume:
+                if (p_sprite != nullptr)
+                {
+                    request_redraw(context, p_sprite);
+                    switch_costume(p_sprite, scratch_state((double)p_sprite->get_costume_number() + 1.0));
+                }
+                break;
+            case vm_opcode::get_costume_number:
+                stack.push_back(scratch_state(p_sprite != nullptr ? (double)p_sprite->get_costume_number() : 1.0));
+                break;
+            case vm_opcode::get_costume_name:
+                if (p_sprite != nullptr && p_sprite->get_current_costume() != nullptr)
+                {
+                    stack.push_back(scratch_state(p_sprite->get_current_costume()->get_costume_name()));
+                }
+                else
+                {
+                    stack.push_back(scratch_state(L""));
+                }
+                break;
+            case vm_opcode::goto_front:
+                if (p_sprite != nullptr)
+                {
+                    request_redraw(context, p_sprite);
+                    p_sprite->goto_top_layer();
+                }
+                break;
+            case vm_opcode::goto_back:
+                if (p_sprite != nullptr)
+                {
+                    request_redraw(context, p_sprite);
+                    p_sprite->goto_bottom_layer();
+                }
+                break;
+            case vm_opcode::go_forward_layers:
+                number = floor(stack.back().to_number()) * instruction.operand;
+                stack.pop_back();
+                if (p_sprite != nullptr && !std::isnan(number))
+                {
+                    request_redraw(context, p_sprite);
+                    p_sprite->change_layer((int)std::min(std::max(number, (double)INT_MIN), (double)INT_MAX)); // the layers clamp it further
+                }
+                break;
+            case vm_opcode::set_effect:
+            case vm_opcode::change_effect:
+                number = stack.back().to_number();
+                stack.pop_back();
+                if (p_sprite != nullptr)
+                {
+                    request_redraw(context, p_sprite);
+                    graphical_effect effect = static_cast<graphical_effect>(instruction.operand);
+                    p_sprite->set_effect(effect, instruction.opcode == vm_opcode::change_effect ? p_sprite->get_effect(effect) + number : number);
+                }
+                break;
+            case vm_opcode::clear_effects:
+                if (p_sprite != nullptr)
+                {
+                    request_redraw(context, p_sprite);
+                    p_sprite->clear_effects();
+                }
+                break;
+
+            // pen, lines and stamps are queued on the pen layer and drawn with the next frame
+            case vm_opcode::pen_clear:
+                if (context.p_pen_layer != nullptr)
+                {
+                    context.p_pen_layer->clear();
+                    context.redraw_requested = true;
+                }
+                break;
+            case vm_opcode::pen_stamp:
+                if (p_sprite != nullptr && context.p_pen_layer != nullptr)
+                {
+                    context.p_pen_layer->stamp(p_sprite);
+                    context.redraw_requested = true;
+                }
+                break;
+            case vm_opcode::pen_down: // putting the pen down leaves a dot even if the sprite never moves
+                if (p_sprite != nullptr)
+                {
+                    p_sprite->m_pen.down = true;
+                    move_pen(context, p_sprite, p_sprite->get_x(), p_sprite->get_y());
+                }
+                break;
+            case vm_opcode::pen_up:
+                if (p_sprite != nullptr)
+                {
+                    p_sprite->m_pen.down = false;
+                }
+                break;
+            case vm_opcode::set_pen_color:
+                if (p_sprite != nullptr)
+                {
+                    set_pen_color(p_sprite->m_pen, to_color(stack.back()));
+                }
+                stack.pop_back();
+                break;
+            case vm_opcode::set_pen_param:
+            case vm_opcode::change_pen_param:
+                number = stack.back().to_number();
+                stack.pop_back();
+                if (p_sprite != nullptr)
+                {
+                    set_pen_param(p_sprite->m_pen, stack.back(), number, instruction.opcode == vm_opcode::change_pen_param);
+                }
+                stack.pop_back();
+                break;
+            case vm_opcode::set_pen_size:
+            case vm_opcode::change_pen_size:
+                number = stack.back().to_number();
+                stack.pop_back();
+                if (p_sprite != nullptr)
+                {
+                    p_sprite->m_pen.size = std::min(std::max(instruction.opcode == vm_opcode::change_pen_size ? p_sprite->m_pen.size + number : number, 1.0), PEN_MAX_SIZE);
+                }
+                break;
+
+            // sensing
+            case vm_opcode::get_timer:
+                stack.push_back(scratch_state(context.current_time - context.timer_start));
+                break;
+            case vm_opcode::reset_timer:
+                context.timer_start = context.current_time;
+                break;
+            case vm_opcode::key_pressed:
+                stack.back() = scratch_state(key_pressed(stack.back(), context));
+                break;
+            case vm_opcode::get_mouse_x:
+                stack.push_back(scratch_state(context.p_input != nullptr ? context.p_input->get_mouse_x() : 0.0));
+                break;
+            case vm_opcode::get_mouse_y:
+                stack.push_back(scratch_state(context.p_input != nullptr ? context.p_input->get_mouse_y() : 0.0));
+                break;
+            case vm_opcode::get_mouse_down:
+                stack.push_back(scratch_state(context.p_input != nullptr && context.p_input->is_mouse_down()));
+                break;
+            case vm_opcode::touching_object:
+                stack.back() = scratch_state(touching_object(p_sprite, stack.back().to_string(), context));
+                break;
+
+            case vm_opcode::end:
+                m_state.done = true;
+                m_state.stack.clear();
+                m_state.pc = pc;
+                return job_status::signal_job_terminate;
+            default:
+                m_state.done = true;
+                return job_status::error;
+        }
+    }
+
+    // ran off the end of the program, only possible with hand written bytecode
+    m_state.done = true;
+    return job_status::error;
+}
+
+bool vm_thread::is_done()
+{
+    return m_state.done;
+}
+
+// true while inside a procedure marked "run without screen refresh"
+bool vm_thread::is_warp()
+{
+    return !m_state.frames.empty() && m_state.frames.back().warp;
+}
+
+bool vm_thread::is_waiting()
+{
+    return m_state.waiting;
+}
+
+unsigned int vm_thread::get_entry()
+{
+    return m_state.entry;
+}
+
+vm_target* vm_thread::get_target()
+{
+    return m_state.p_target;
+}
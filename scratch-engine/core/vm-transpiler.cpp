@@ -0,0 +1,1172 @@
+/*
+File: vm-transpiler.cpp
+Description: Implements the ahead of time compiler that turns CScratch bytecode into C++
+*/
+
+#include "scratch-vm.hpp"
+#include "scratch-render.hpp"
+#include "scratch-util.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+using namespace scratch;
+
+namespace
+{
+    // the shortest text that reads back as exactly the same double
+    std::string number_literal(double value)
+    {
+        char buffer[64] = {};
+
+        if (std::isnan(value))
+        {
+            return "NAN";
+        }
+        if (std::isinf(value))
+        {
+            return value > 0.0 ? "INFINITY" : "-INFINITY";
+        }
+        if (value == floor(value) && fabs(value) < 1e15) // whole numbers read better without an exponent
+        {
+            snprintf(buffer, sizeof(buffer), "%.1f", value);
+            return buffer;
+        }
+        for (int precision = 1; precision <= 17; ++precision)
+        {
+            snprintf(buffer, sizeof(buffer), "%.*g", precision, value);
+            if (strtod(buffer, nullptr) == value)
+            {
+                break;
+            }
+        }
+        std::string text = buffer;
+        if (text.find_first_of(".en") == std::string::npos) // keeps it a double
+        {
+            text += ".0";
+        }
+        return text;
+    }
+
+    // anything outside printable ASCII is written as a hex escape in a literal of its own, "\x41" "B" can't run into the next character
+    std::string wide_literal(const std::wstring& text)
+    {
+        std::string literal = "L\"";
+        char buffer[16] = {};
+
+        for (wchar_t character : text)
+        {
+            if (character == L'"' || character == L'\\')
+            {
+                literal += '\\';
+                literal += (char)character;
+            }
+            else if (character >= 0x20 && character < 0x7F)
+            {
+                literal += (char)character;
+            }
+            else
+            {
+                snprintf(buffer, sizeof(buffer), "\\x%x\" L\"", (unsigned int)character);
+                literal += buffer;
+            }
+        }
+        return literal + "\"";
+    }
+
+    std::string comment_text(const std::wstring& text) // sprite names in comments, anything that isn't plain ASCII becomes '?'
+    {
+        std::string comment;
+
+        for (wchar_t character : text)
+        {
+            comment += character >= 0x20 && character < 0x7F ? (char)character : '?';
+        }
+        return comment;
+    }
+
+    std::string to_text(unsigned long long value)
+    {
+        return std::to_string(value);
+    }
+
+    std::string label(unsigned int pc)
+    {
+        return "pc_" + to_text(pc);
+    }
+
+    bool uses(const std::string& code, const std::string& name) // name appears as a whole identifier
+    {
+        size_t position = code.find(name);
+
+        while (position != std::string::npos)
+        {
+            bool starts = position == 0 || !(isalnum((unsigned char)code[position - 1]) || code[position - 1] == '_');
+            size_t end = position + name.size();
+            bool ends = end >= code.size() || !(isalnum((unsigned char)code[end]) || code[end] == '_');
+
+            if (starts && ends)
+            {
+                return true;
+            }
+            position = code.find(name, position + 1);
+        }
+        return false;
+    }
+
+    const char* const g_math_functions[] = {"fabs", "floor", "ceil", "sqrt"}; // the math ops that need nothing but the C function
+}
+
+vm_transpiler::vm_transpiler(const std::vector<vm_target*>& targets)
+{
+    m_stage_index = -1;
+    m_analyzing = false;
+    m_changed = false;
+    mp_target = nullptr;
+    mp_program = nullptr;
+    m_temporaries = 0;
+    for (vm_target* p_target : targets)
+    {
+        if (p_target->is_clone())
+        {
+            continue;
+        }
+        if (p_target->mp_stage == p_target)
+        {
+            m_stage_index = m_targets.size();
+        }
+        m_targets.push_back(p_target);
+    }
+    analyze();
+}
+
+// a variable starts out as a number if it holds one right now, then every store anywhere in the project that might not be a number
+// rules it out. loads of ruled out variables aren't numbers anymore either, so this repeats until nothing changes
+void vm_transpiler::analyze()
+{
+    m_number_variables.clear();
+    for (vm_target* p_target : m_targets)
+    {
+        std::vector<unsigned char> numbers;
+
+        for (const scratch_state& value : p_target->m_variables)
+        {
+            numbers.push_back(value.is_number() ? 1 : 0);
+        }
+        m_number_variables.push_back(numbers);
+    }
+
+    m_analyzing = true;
+    do
+    {
+        m_changed = false;
+        for (unsigned int i = 0; i < m_targets.size(); ++i)
+        {
+            write_program(i);
+        }
+    } while (m_changed);
+    m_analyzing = false;
+}
+
+unsigned int vm_transpiler::get_number_variable_count()
+{
+    unsigned int count = 0;
+
+    for (const std::vector<unsigned char>& numbers : m_number_variables)
+    {
+        count += std::count(numbers.begin(), numbers.end(), 1);
+    }
+    return count;
+}
+
+std::string vm_transpiler::transpile(const std::string& bind_function)
+{
+    std::string source;
+    std::string table;
+
+    source += "// generated by scratch-aot, changes are lost when the project is transpiled again\n";
+    source += "#include \"scratch-engine.hpp\"\n";
+    source += "#include \"scratch-vm-ops.hpp\"\n";
+    source += "#include \"scratch-input.hpp\"\n";
+    source += "#include <algorithm>\n#include <chrono>\n#include <climits>\n#include <cmath>\n\n";
+    source += "using namespace scratch;\nusing namespace scratch::vm_ops;\n\nnamespace\n{\n";
+    for (unsigned int i = 0; i < m_targets.size(); ++i)
+    {
+        vm_target* p_target = m_targets[i];
+        std::string numbers;
+        unsigned int number_count = 0;
+
+        source += write_program(i);
+        for (unsigned int slot = 0; slot < m_number_variables[i].size(); ++slot)
+        {
+            if (m_number_variables[i][slot] != 0)
+            {
+                numbers += (number_count++ > 0 ? ", " : "") + to_text(slot);
+            }
+        }
+        if (number_count > 0)
+        {
+            source += "\n    const unsigned int g_numbers_" + to_text(i) + "[] = {" + numbers + "};\n";
+        }
+        source += "\n";
+        table += "        {" + (p_target->mp_sprite == nullptr ? std::string("nullptr") : wide_literal(p_target->mp_sprite->get_name())) + ", "
+            + to_text(vm_fingerprint(p_target)) + "ULL, step_" + to_text(i) + ", "
+            + (number_count > 0 ? "g_numbers_" + to_text(i) : std::string("nullptr")) + ", " + to_text(number_count) + "},\n";
+    }
+    source += "    const vm_native_program g_programs[] =\n    {\n" + table + "    };\n}\n\n";
+    source += "bool " + bind_function + "(scratch_engine* p_engine)\n{\n";
+    source += "    return vm_bind_native(p_engine->get_scheduler()->get_targets(), g_programs, " + to_text(m_targets.size()) + ");\n}\n";
+    return source;
+}
+
+// one function per program, a switch on the thread's pc jumps to the block to continue from
+std::string vm_transpiler::write_program(unsigned int index)
+{
+    std::vector<std::pair<unsigned int, int>> entries; // instruction and procedure, -1 for scripts
+    std::string body;
+    std::string function;
+    unsigned int code_size = 0;
+
+    mp_target = m_targets[index];
+    mp_program = mp_target->mp_program;
+    code_size = mp_program->m_code.size();
+    m_leaders.assign(code_size + 1, 0);
+    m_procedures.assign(code_size, -1);
+    m_cache.clear();
+    m_code.clear();
+    m_temporaries = 0;
+
+    for (const vm_script_entry& script : mp_program->m_scripts)
+    {
+        entries.push_back({script.entry, -1});
+    }
+    for (unsigned int i = 0; i < mp_program->m_procedures.size(); ++i)
+    {
+        entries.push_back({mp_program->m_procedures[i].entry, (int)i});
+    }
+    std::sort(entries.begin(), entries.end());
+    for (unsigned int i = 0; i < entries.size(); ++i)
+    {
+        unsigned int end = i + 1 < entries.size() ? entries[i + 1].first : code_size;
+
+        for (unsigned int pc = entries[i].first; pc < end && pc < code_size; ++pc)
+        {
+            m_procedures[pc] = entries[i].second;
+        }
+        m_leaders[std::min(entries[i].first, code_size)] = 1;
+    }
+    m_leaders[0] = 1;
+    for (unsigned int pc = 0; pc < code_size; ++pc)
+    {
+        const vm_instruction& instruction = mp_program->m_code[pc];
+
+        switch (instruction.opcode)
+        {
+            case vm_opcode::jump:
+            case vm_opcode::jump_if_false:
+            case vm_opcode::jump_if_true:
+            case vm_opcode::repeat_next:
+                if (instruction.operand >= 0 && (unsigned int)instruction.operand <= code_size)
+                {
+                    m_leaders[instruction.operand] = 1;
+                }
+                m_leaders[pc + 1] = 1;
+                break;
+            case vm_opcode::wait_check: // waits resume on the check itself
+                m_leaders[pc] = 1;
+                m_leaders[pc + 1] = 1;
+                break;
+            case vm_opcode::yield:
+            case vm_opcode::yield_loop:
+            case vm_opcode::wait_start:
+            case vm_opcode::call:
+            case vm_opcode::halt:
+            case vm_opcode::return_procedure:
+            case vm_opcode::stop_all:
+            case vm_opcode::stop_others:
+            case vm_opcode::broadcast:
+            case vm_opcode::create_clone:
+            case vm_opcode::delete_clone:
+            case vm_opcode::end:
+                m_leaders[pc + 1] = 1;
+                break;
+            default:
+                break;
+        }
+    }
+
+    for (unsigned int pc = 0; pc < code_size; ++pc)
+    {
+        if (m_leaders[pc] != 0)
+        {
+            flush();
+            if (pc > 0)
+            {
+                m_code += "    }\n";
+            }
+            m_code += label(pc) + ":\n    {\n";
+        }
+        write_instruction(pc);
+    }
+    flush();
+    if (code_size > 0)
+    {
+        m_code += "    }\n";
+    }
+    if (m_analyzing)
+    {
+        return std::string();
+    }
+
+    // only declaring what the blocks use keeps the generated code free of warnings
+    body = m_code;
+    function += "    // " + (mp_target->mp_sprite == nullptr ? std::string("the stage") : comment_text(mp_target->mp_sprite->get_name())) + "\n";
+    function += "    job_status step_" + to_text(index) + "(vm_thread_state& thread, vm_context& context)\n    {\n";
+    if (uses(body, "p_constants"))
+    {
+        function += "        const scratch_state* p_constants = thread.p_target->mp_program->m_constants.data();\n";
+    }
+    if (uses(body, "stack"))
+    {
+        function += "        std::vector<scratch_state>& stack = thread.stack;\n";
+    }
+    if (uses(body, "locals"))
+    {
+        function += "        std::vector<scratch_state>& locals = thread.p_target->m_variables;\n";
+    }
+    if (uses(body, "globals"))
+    {
+        function += "        std::vector<scratch_state>& globals = thread.p_target->mp_stage->m_variables;\n";
+    }
+    if (uses(body, "p_sprite"))
+    {
+        function += "        sprite* p_sprite = thread.p_target->mp_sprite;\n";
+    }
+    if (function.compare(function.size() - 2, 2, "{\n") != 0)
+    {
+        function += "\n";
+    }
+    if (uses(body, "resume"))
+    {
+        function += "    resume:\n";
+    }
+    function += "        switch (thread.pc)\n        {\n";
+    for (unsigned int pc = 0; pc < code_size; ++pc)
+    {
+        if (m_leaders[pc] != 0)
+        {
+            function += "            case " + to_text(pc) + ": goto " + label(pc) + ";\n";
+        }
+    }
+    function += "            default:\n                thread.done = true; // a pc the program doesn't have\n                return job_status::error;\n        }\n\n";
+
+    // the blocks are written one level in so they sit inside the function
+    for (size_t start = 0; start < body.size();)
+    {
+        size_t end = body.find('\n', start);
+        std::string line = body.substr(start, end - start);
+
+        function += (line.empty() ? "" : "    ") + line + "\n";
+        start = end + 1;
+    }
+    function += "        thread.done = true; // ran off the end of the program\n        return job_status::error;\n    }\n";
+    return function;
+}
+
+void vm_transpiler::write_line(const std::string& line)
+{
+    m_code += "        " + line + "\n";
+}
+
+unsigned char* vm_transpiler::find_number_variable(bool global, int slot)
+{
+    int owner = global ? m_stage_index : std::find(m_targets.begin(), m_targets.end(), mp_target) - m_targets.begin();
+
+    if (owner < 0 || slot < 0 || (unsigned int)slot >= m_number_variables[owner].size())
+    {
+        return nullptr;
+    }
+    return &m_number_variables[owner][slot];
+}
+
+void vm_transpiler::push(vm_value_kind kind, const std::string& expression)
+{
+    std::string name = "t" + to_text(m_temporaries++);
+
+    switch (kind)
+    {
+        case vm_value_kind::number:
+            write_line("const double " + name + " = " + expression + ";");
+            break;
+        case vm_value_kind::boolean:
+            write_line("const bool " + name + " = " + expression + ";");
+            break;
+        default:
+            write_line("scratch_state " + name + " = " + expression + ";");
+            break;
+    }
+    m_cache.push_back(stack_entry{kind, name, false, scratch_state()});
+}
+
+void vm_transpiler::push_constant(unsigned int index)
+{
+    const scratch_state& value = mp_program->m_constants[index];
+
+    if (value.is_number())
+    {
+        m_cache.push_back(stack_entry{vm_value_kind::number, number_literal(value.get_number()), true, value});
+    }
+    else if (value.get_type() == state_type::boolean)
+    {
+        m_cache.push_back(stack_entry{vm_value_kind::boolean, value.to_boolean() ? "true" : "false", true, value});
+    }
+    else
+    {
+        m_cache.push_back(stack_entry{vm_value_kind::value, "p_constants[" + to_text(index) + "]", true, value});
+    }
+}
+
+// values below what the cache holds were put on the thread's stack at the start of the block, by a yield or by a call
+vm_transpiler::stack_entry vm_transpiler::pop()
+{
+    stack_entry entry = {};
+
+    if (m_cache.empty())
+    {
+        push(vm_value_kind::value, "std::move(stack.back())");
+        write_line("stack.pop_back();");
+    }
+    entry = m_cache.back();
+    m_cache.pop_back();
+    return entry;
+}
+
+void vm_transpiler::flush()
+{
+    for (const stack_entry& entry : m_cache)
+    {
+        write_line("stack.push_back(" + as_value(entry) + ");");
+    }
+    m_cache.clear();
+}
+
+std::string vm_transpiler::as_number(const stack_entry& entry)
+{
+    if (entry.constant)
+    {
+        return number_literal(entry.literal.to_number());
+    }
+    switch (entry.kind)
+    {
+        case vm_value_kind::number: return entry.expression;
+        case vm_value_kind::boolean: return "(" + entry.expression + " ? 1.0 : 0.0)";
+        default: return entry.expression + ".to_number()";
+    }
+}
+
+std::string vm_transpiler::as_boolean(const stack_entry& entry)
+{
+    if (entry.constant)
+    {
+        return entry.literal.to_boolean() ? "true" : "false";
+    }
+    switch (entry.kind)
+    {
+        case vm_value_kind::number: return "to_boolean(" + entry.expression + ")";
+        case vm_value_kind::boolean: return entry.expression;
+        default: return entry.expression + ".to_boolean()";
+    }
+}
+
+std::string vm_transpiler::as_value(const stack_entry& entry)
+{
+    if (entry.constant && entry.kind == vm_value_kind::value)
+    {
+        return "scratch_state(" + entry.expression + ")";
+    }
+    switch (entry.kind)
+    {
+        case vm_value_kind::number:
+        case vm_value_kind::boolean:
+            return "scratch_state(" + entry.expression + ")";
+        default:
+            return "std::move(" + entry.expression + ")";
+    }
+}
+
+std::string vm_transpiler::as_string(const stack_entry& entry)
+{
+    if (entry.constant)
+    {
+        return "std::wstring(" + wide_literal(entry.literal.to_string()) + ")";
+    }
+    switch (entry.kind)
+    {
+        case vm_value_kind::number: return "number_to_string(" + entry.expression + ")";
+        case vm_value_kind::boolean: return "std::wstring(" + entry.expression + " ? L\"true\" : L\"false\")";
+        default: return entry.expression + ".to_string()";
+    }
+}
+
+std::string vm_transpiler::resume(unsigned int pc, const std::string& status)
+{
+    return "thread.pc = " + to_text(pc) + "; return job_status::" + status + ";";
+}
+
+// mirrors vm_thread::step case by case, with the sprite checks decided here since a program always runs on a sprite or always on the stage
+void vm_transpiler::write_instruction(unsigned int pc)
+{
+    const vm_instruction instruction = mp_program->m_code[pc];
+    const int operand = instruction.operand;
+    const bool is_sprite = mp_target->mp_sprite != nullptr;
+    const int procedure = m_procedures[pc];
+    const unsigned int next = pc + 1;
+    stack_entry a = {};
+    stack_entry b = {};
+    unsigned char* p_number = nullptr;
+    std::string list = "get_list(thread.p_target, " + to_text(operand) + ")";
+    std::string text;
+
+    switch (instruction.opcode)
+    {
+        // stack and variables
+        case vm_opcode::push_constant:
+            push_constant(operand);
+            break;
+        case vm_opcode::pop:
+            for (int i = 0; i < operand; ++i)
+            {
+                if (m_cache.empty())
+                {
+                    write_line("stack.pop_back();");
+                }
+                else
+                {
+                    m_cache.pop_back();
+                }
+            }
+            break;
+        case vm_opcode::load_local:
+        case vm_opcode::load_global:
+            p_number = find_number_variable(instruction.opcode == vm_opcode::load_global, operand);
+            text = (instruction.opcode == vm_opcode::load_global ? "globals[" : "locals[") + to_text(operand) + "]";
+            if (p_number != nullptr && *p_number != 0)
+            {
+                push(vm_value_kind::number, text + ".get_number()");
+            }
+            else
+            {
+                push(vm_value_kind::value, text);
+            }
+            break;
+        case vm_opcode::store_local:
+        case vm_opcode::store_global:
+            a = pop();
+            p_number = find_number_variable(instruction.opcode == vm_opcode::store_global, operand);
+            if (p_number != nullptr && *p_number != 0 && a.kind != vm_value_kind::number)
+            {
+                *p_number = 0;
+                m_changed = true;
+            }
+            write_line((instruction.opcode == vm_opcode::store_global ? "globals[" : "locals[") + to_text(operand) + "] = " + as_value(a) + ";");
+            break;
+        case vm_opcode::change_local:
+        case vm_opcode::change_global:
+            a = pop();
+            p_number = find_number_variable(instruction.opcode == vm_opcode::change_global, operand);
+            text = (instruction.opcode == vm_opcode::change_global ? "globals[" : "locals[") + to_text(operand) + "]";
+            write_line(text + " = scratch_state(" + text + (p_number != nullptr && *p_number != 0 ? ".get_number()" : ".to_number()") + " + " + as_number(a) + ");");
+            break;
+        case vm_opcode::load_argument:
+            push(vm_value_kind::value, "stack[thread.frames.back().argument_base + " + to_text(operand) + "]");
+            break;
+
+        // operators
+        case vm_opcode::add:
+        case vm_opcode::subtract:
+        case vm_opcode::multiply:
+        case vm_opcode::divide:
+            b = pop();
+            a = pop();
+            text = instruction.opcode == vm_opcode::add ? " + " : instruction.opcode == vm_opcode::subtract ? " - " : instruction.opcode == vm_opcode::multiply ? " * " : " / ";
+            push(vm_value_kind::number, as_number(a) + text + as_number(b));
+            break;
+        case vm_opcode::mod:
+            b = pop();
+            a = pop();
+            push(vm_value_kind::number, "mod(" + as_number(a) + ", " + as_number(b) + ")");
+            break;
+        case vm_opcode::round:
+            a = pop();
+            push(vm_value_kind::number, "floor(" + as_number(a) + " + 0.5)");
+            break;
+        case vm_opcode::math:
+            a = pop();
+            if (operand >= 0 && operand < (int)(sizeof(g_math_functions) / sizeof(g_math_functions[0])))
+            {
+                push(vm_value_kind::number, std::string(g_math_functions[operand]) + "(" + as_number(a) + ")");
+            }
+            else
+            {
+                push(vm_value_kind::number, "apply_math_op(static_cast<vm_math_op>(" + to_text(operand) + "), " + as_number(a) + ")");
+            }
+            break;
+        case vm_opcode::random:
+            b = pop();
+            a = pop();
+            if (a.constant && b.constant) // the usual case, whether it picks whole numbers is known up front
+            {
+                double low = a.literal.to_number();
+                double high = b.literal.to_number();
+                bool decimal = (a.literal.is_string() && a.literal.to_string().find(L'.') != std::wstring::npos)
+                    || (b.literal.is_string() && b.literal.to_string().find(L'.') != std::wstring::npos)
+                    || low != floor(low) || high != floor(high);
+
+                if (low > high)
+                {
+                    std::swap(low, high);
+                }
+                if (decimal)
+                {
+                    push(vm_value_kind::number, number_literal(low) + " + next_random(context) * " + number_literal(high - low));
+                }
+                else
+                {
+                    push(vm_value_kind::number, number_literal(low) + " + floor(next_random(context) * " + number_literal(high - low + 1.0) + ")");
+                }
+            }
+            else
+            {
+                push(vm_value_kind::number, "pick_random(" + as_value(a) + ", " + as_value(b) + ", context)");
+            }
+            break;
+        case vm_opcode::equals:
+        case vm_opcode::less_than:
+        case vm_opcode::greater_than:
+            b = pop();
+            a = pop();
+            text = instruction.opcode == vm_opcode::equals ? " == 0" : instruction.opcode == vm_opcode::less_than ? " < 0" : " > 0";
+            if (a.kind == vm_value_kind::number && b.kind == vm_value_kind::number)
+            {
+                push(vm_value_kind::boolean, "compare_numbers(" + as_number(a) + ", " + as_number(b) + ")" + text);
+            }
+            else if (instruction.opcode == vm_opcode::equals)
+            {
+                push(vm_value_kind::boolean, as_value(a) + ".equals(" + as_value(b) + ")");
+            }
+            else
+            {
+                push(vm_value_kind::boolean, as_value(a) + ".compare(" + as_value(b) + ")" + text);
+            }
+            break;
+        case vm_opcode::logic_and:
+        case vm_opcode::logic_or:
+            b = pop();
+            a = pop();
+            push(vm_value_kind::boolean, as_boolean(a) + (instruction.opcode == vm_opcode::logic_and ? " && " : " || ") + as_boolean(b));
+            break;
+        case vm_opcode::logic_not:
+            a = pop();
+            push(vm_value_kind::boolean, "!" + as_boolean(a));
+            break;
+        case vm_opcode::join:
+            b = pop();
+            a = pop();
+            push(vm_value_kind::value, "scratch_state(" + as_string(a) + " + " + as_string(b) + ")");
+            break;
+        case vm_opcode::letter_of:
+            b = pop();
+            a = pop();
+            push(vm_value_kind::value, "letter_of(" + as_number(a) + ", " + as_string(b) + ")");
+            break;
+        case vm_opcode::length_of:
+            a = pop();
+            push(vm_value_kind::number, "(double)" + as_string(a) + ".size()");
+            break;
+        case vm_opcode::contains:
+            b = pop();
+            a = pop();
+            push(vm_value_kind::boolean, "contains_ignore_case(" + as_string(a) + ", " + as_string(b) + ")");
+            break;
+
+        // control flow, the thread's stack is brought up to date before anything that leaves the block
+        case vm_opcode::jump:
+            flush();
+            write_line("goto " + label(operand) + ";");
+            break;
+        case vm_opcode::jump_if_false:
+        case vm_opcode::jump_if_true:
+            a = pop();
+            flush();
+            write_line("if (" + std::string(instruction.opcode == vm_opcode::jump_if_false ? "!" : "") + "(" + as_boolean(a) + "))");
+            write_line("{");
+            write_line("    goto " + label(operand) + ";");
+            write_line("}");
+            break;
+        case vm_opcode::repeat_init:
+            a = pop();
+            push(vm_value_kind::number, "floor(" + as_number(a) + " + 0.5)");
+            break;
+        case vm_opcode::repeat_next:
+            flush();
+            write_line("if (!(stack.back().get_number() >= 1.0))");
+            write_line("{");
+            write_line("    stack.pop_back();");
+            write_line("    goto " + label(operand) + ";");
+            write_line("}");
+            write_line("stack.back() = scratch_state(stack.back().get_number() - 1.0);");
+            break;
+        case vm_opcode::yield:
+            flush();
+            write_line(resume(next, "ok"));
+            break;
+        case vm_opcode::yield_loop:
+            flush();
+            if (procedure < 0) // top level scripts are never warped
+            {
+                write_line(resume(next, "ok"));
+            }
+            else
+            {
+                text = "((++thread.warp_loops & (VM_WARP_CHECK_INTERVAL - 1)) == 0 && std::chrono::steady_clock::now() >= context.warp_deadline)";
+                write_line("if (" + (mp_program->m_procedures[procedure].warp ? text : "!thread.frames.back().warp || " + text) + ")");
+                write_line("{");
+                write_line("    " + resume(next, "ok"));
+                write_line("}");
+            }
+            break;
+        case vm_opcode::wait_start:
+            a = pop();
+            flush();
+            write_line("thread.wait_until = context.current_time + " + as_number(a) + ";");
+            write_line("thread.waiting = context.current_time < thread.wait_until;");
+            write_line(resume(next, "ok"));
+            break;
+        case vm_opcode::wait_check:
+            flush();
+            write_line("if (context.current_time < thread.wait_until)");
+            write_line("{");
+            write_line("    thread.waiting = true;");
+            write_line("    " + resume(pc, "ok"));
+            write_line("}");
+            break;
+        case vm_opcode::call:
+        {
+            const vm_procedure& called = mp_program->m_procedures[operand];
+            std::string warp = called.warp ? "true" : procedure < 0 ? "false" : "thread.frames.back().warp";
+
+            flush();
+            write_line("thread.frames.push_back(vm_call_frame{" + to_text(next) + ", (unsigned int)stack.size() - " + to_text(called.argument_count) + ", "
+                + to_text(operand) + ", " + warp + "});");
+            if (procedure >= 0 && !called.warp) // like Scratch, recursion without warp gives other scripts a turn
+            {
+                write_line("if (!thread.frames.back().warp && std::any_of(thread.frames.begin(), thread.frames.end() - 1, [](const vm_call_frame& caller) { return caller.procedure == "
+                    + to_text(operand) + "; }))");
+                write_line("{");
+                write_line("    " + resume(called.entry, "ok"));
+                write_line("}");
+            }
+            write_line("goto " + label(called.entry) + ";");
+            break;
+        }
+        case vm_opcode::halt:
+            m_cache.clear();
+            if (procedure < 0)
+            {
+                write_line("thread.done = true;");
+                write_line("stack.clear();");
+                write_line("return job_status::signal_job_terminate;");
+                break;
+            }
+            // stop this script inside a procedure only leaves the procedure
+            // fall through
+        case vm_opcode::return_procedure:
+            m_cache.clear();
+            write_line("stack.resize(thread.frames.back().argument_base);");
+            write_line("thread.pc = thread.frames.back().return_pc;");
+            write_line("thread.frames.pop_back();");
+            write_line("goto resume;");
+            break;
+        case vm_opcode::stop_all:
+            m_cache.clear();
+            write_line("thread.done = true;");
+            write_line("stack.clear();");
+            write_line("return job_status::signal_vm_halt;");
+            break;
+        case vm_opcode::stop_others:
+            flush();
+            write_line(resume(next, "signal_scheduler_terminate_others"));
+            break;
+        case vm_opcode::create_clone:
+            a = pop();
+            flush();
+            write_line("context.clone_option = " + as_value(a) + ";");
+            write_line(resume(next, "signal_create_clone"));
+            break;
+        case vm_opcode::delete_clone:
+            if (!is_sprite)
+            {
+                break;
+            }
+            flush();
+            write_line("if (thread.p_target->is_clone()) // does nothing in the original sprite");
+            write_line("{");
+            write_line("    thread.done = true;");
+            write_line("    stack.clear();");
+            write_line("    " + resume(next, "signal_delete_clone"));
+            write_line("}");
+            break;
+        case vm_opcode::broadcast:
+            a = pop();
+            flush();
+            write_line("if (context.p_broadcasts != nullptr)");
+            write_line("{");
+            write_line("    context.p_broadcasts->push_back({" + as_string(a) + ", " + (operand != 0 ? "true" : "false") + "});");
+            if (operand != 0) // yielding so the runner can start the receivers and park this thread
+            {
+                write_line("    " + resume(next, "ok"));
+            }
+            write_line("}");
+            break;
+
+        // lists
+        case vm_opcode::list_add:
+            a = pop();
+            write_line("if (" + list + ".size() < LIST_ITEM_LIMIT)");
+            write_line("{");
+            write_line("    " + list + ".push_back(" + as_value(a) + ");");
+            write_line("}");
+            break;
+        case vm_opcode::list_delete:
+            a = pop();
+            write_line("list_delete(" + list + ", " + as_value(a) + ", context);");
+            break;
+        case vm_opcode::list_delete_all:
+            write_line(list + ".clear();");
+            break;
+        case vm_opcode::list_insert:
+            b = pop();
+            a = pop();
+            write_line("list_insert(" + list + ", " + as_value(b) + ", " + as_value(a) + ", context);");
+            break;
+        case vm_opcode::list_replace:
+            b = pop();
+            a = pop();
+            write_line("list_replace(" + list + ", " + as_value(a) + ", " + as_value(b) + ", context);");
+            break;
+        case vm_opcode::list_item:
+            a = pop();
+            push(vm_value_kind::value, "list_item(" + list + ", " + as_value(a) + ", context)");
+            break;
+        case vm_opcode::list_item_number:
+            a = pop();
+            push(vm_value_kind::number, "(double)find_list_item(" + list + ", " + as_value(a) + ")");
+            break;
+        case vm_opcode::list_length:
+            push(vm_value_kind::number, "(double)" + list + ".size()");
+            break;
+        case vm_opcode::list_contains:
+            a = pop();
+            push(vm_value_kind::boolean, "find_list_item(" + list + ", " + as_value(a) + ") != 0");
+            break;
+        case vm_opcode::list_contents:
+            push(vm_value_kind::value, "list_contents(" + list + ")");
+            break;
+
+        // sprite, on the stage these only keep the stack balanced
+        case vm_opcode::move_steps:
+            a = pop();
+            if (is_sprite)
+            {
+                write_line("{");
+                write_line("    const double steps = " + as_number(a) + ";");
+                write_line("    const double radians = (90.0 - p_sprite->get_direction()) * MATH_PI / 180.0;");
+                write_line("    const double old_x = p_sprite->get_x();");
+                write_line("    const double old_y = p_sprite->get_y();");
+                write_line("    request_redraw(context, p_sprite);");
+                write_line("    p_sprite->set_x(old_x + steps * cos(radians));");
+                write_line("    p_sprite->set_y(old_y + steps * sin(radians));");
+                write_line("    move_pen(context, p_sprite, old_x, old_y);");
+                write_line("}");
+            }
+            break;
+        case vm_opcode::turn_right:
+        case vm_opcode::turn_left:
+            a = pop();
+            if (is_sprite)
+            {
+                write_line("request_redraw(context, p_sprite);");
+                write_line("p_sprite->set_direction(p_sprite->get_direction() " + std::string(instruction.opcode == vm_opcode::turn_right ? "+ " : "- ") + as_number(a) + ");");
+            }
+            break;
+        case vm_opcode::goto_xy:
+            b = pop();
+            a = pop();
+            if (is_sprite)
+            {
+                write_line("{");
+                write_line("    const double old_x = p_sprite->get_x();");
+                write_line("    const double old_y = p_sprite->get_y();");
+                write_line("    request_redraw(context, p_sprite);");
+                write_line("    p_sprite->set_x(" + as_number(a) + ");");
+                write_line("    p_sprite->set_y(" + as_number(b) + ");");
+                write_line("    move_pen(context, p_sprite, old_x, old_y);");
+                write_line("}");
+            }
+            break;
+        case vm_opcode::set_x:
+        case vm_opcode::change_x:
+        case vm_opcode::set_y:
+        case vm_opcode::change_y:
+            a = pop();
+            if (is_sprite)
+            {
+                bool is_x = instruction.opcode == vm_opcode::set_x || instruction.opcode == vm_opcode::change_x;
+                bool change = instruction.opcode == vm_opcode::change_x || instruction.opcode == vm_opcode::change_y;
+                std::string axis = is_x ? "x" : "y";
+
+                write_line("{");
+                write_line("    const double old_" + axis + " = p_sprite->get_" + axis + "();");
+                write_line("    request_redraw(context, p_sprite);");
+                write_line("    p_sprite->set_" + axis + "(" + (change ? "old_" + axis + " + " : std::string()) + as_number(a) + ");");
+                write_line(std::string("    move_pen(context, p_sprite, ") + (is_x ? "old_x, p_sprite->get_y()" : "p_sprite->get_x(), old_y") + ");");
+                write_line("}");
+            }
+            break;
+        case vm_opcode::point_direction:
+            a = pop();
+            if (is_sprite)
+            {
+                write_line("request_redraw(context, p_sprite);");
+                write_line("p_sprite->set_direction(" + as_number(a) + ");");
+            }
+            break;
+        case vm_opcode::set_rotation_mode:
+            if (is_sprite)
+            {
+                write_line("request_redraw(context, p_sprite);");
+                write_line("p_sprite->set_rotation_mode(static_cast<rotation_mode>(" + to_text(operand) + "));");
+            }
+            break;
+        case vm_opcode::get_x:
+            push(vm_value_kind::number, is_sprite ? "p_sprite->get_x()" : "0.0");
+            break;
+        case vm_opcode::get_y:
+            push(vm_value_kind::number, is_sprite ? "p_sprite->get_y()" : "0.0");
+            break;
+        case vm_opcode::get_direction:
+            push(vm_value_kind::number, is_sprite ? "p_sprite->get_direction()" : "90.0");
+            break;
+        case vm_opcode::set_size:
+        case vm_opcode::change_size:
+            a = pop();
+            if (is_sprite)
+            {
+                write_line("request_redraw(context, p_sprite);");
+                write_line("p_sprite->set_size(" + std::string(instruction.opcode == vm_opcode::change_size ? "p_sprite->get_size() + " : "") + as_number(a) + ");");
+            }
+            break;
+        case vm_opcode::get_size:
+            push(vm_value_kind::number, is_sprite ? "round(p_sprite->get_size())" : "100.0");
+            break;
+        case vm_opcode::show:
+        case vm_opcode::hide:
+            if (is_sprite)
+            {
+                write_line("context.redraw_requested = true;");
+                write_line(std::string("p_sprite->set_hidden(") + (instruction.opcode == vm_opcode::hide ? "true" : "false") + ");");
+            }
+            break;
+        case vm_opcode::switch_costume:
+            a = pop();
+            if (!is_sprite)
+            {
+                break;
+            }
+            write_line("request_redraw(context, p_sprite);");
+            if (a.constant && a.literal.is_string() && mp_target->mp_sprite->has_costume(a.literal.to_string())) // names win over numbers, so a name the sprite has is always a name
+            {
+                text = wide_literal(a.literal.to_string());
+                write_line("if (p_sprite->has_costume(" + text + "))");
+                write_line("{");
+                write_line("    p_sprite->set_costume_by_name(" + text + ");");
+                write_line("}");
+                write_line("else");
+                write_line("{");
+                write_line("    switch_costume(p_sprite, " + a.expression + ");");
+                write_line("}");
+            }
+            else
+            {
+                write_line("switch_costume(p_sprite, " + as_value(a) + ");");
+            }
+            break;
+        case vm_opcode::next_costume:
+            if (is_sprite)
+            {
+                write_line("request_redraw(context, p_sprite);");
+                write_line("switch_costume(p_sprite, scratch_state((double)p_sprite->get_costume_number() + 1.0));");
+            }
+            break;
+        case vm_opcode::get_costume_number:
+            push(vm_value_kind::number, is_sprite ? "(double)p_sprite->get_costume_number()" : "1.0");
+            break;
+        case vm_opcode::get_costume_name:
+            push(vm_value_kind::value, is_sprite ? "p_sprite->get_current_costume() != nullptr ? scratch_state(p_sprite->get_current_costume()->get_costume_name()) : scratch_state(L\"\")"
+                : "scratch_state(L\"\")");
+            break;
+        case vm_opcode::goto_front:
+        case vm_opcode::goto_back:
+            if (is_sprite)
+            {
+                write_line("request_redraw(context, p_sprite);");
+                write_line(instruction.opcode == vm_opcode::goto_front ? "p_sprite->goto_top_layer();" : "p_sprite->goto_bottom_layer();");
+            }
+            break;
+        case vm_opcode::go_forward_layers:
+            a = pop();
+            if (is_sprite)
+            {
+                write_line("{");
+                write_line("    const double layers = floor(" + as_number(a) + ") * " + number_literal(operand) + ";");
+                write_line("    if (!std::isnan(layers))");
+                write_line("    {");
+                write_line("        request_redraw(context, p_sprite);");
+                write_line("        p_sprite->change_layer((int)std::min(std::max(layers, (double)INT_MIN), (double)INT_MAX));");
+                write_line("    }");
+                write_line("}");
+            }
+            break;
+        case vm_opcode::set_effect:
+        case vm_opcode::change_effect:
+            a = pop();
+            if (is_sprite)
+            {
+                text = "static_cast<graphical_effect>(" + to_text(operand) + ")";
+                write_line("request_redraw(context, p_sprite);");
+                write_line("p_sprite->set_effect(" + text + ", " + (instruction.opcode == vm_opcode::change_effect ? "p_sprite->get_effect(" + text + ") + " : std::string())
+                    + as_number(a) + ");");
+            }
+            break;
+        case vm_opcode::clear_effects:
+            if (is_sprite)
+            {
+                write_line("request_redraw(context, p_sprite);");
+                write_line("p_sprite->clear_effects();");
+            }
+            break;
+
+        // pen
+        case vm_opcode::pen_clear:
+            write_line("if (context.p_pen_layer != nullptr)");
+            write_line("{");
+            write_line("    context.p_pen_layer->clear();");
+            write_line("    context.redraw_requested = true;");
+            write_line("}");
+            break;
+        case vm_opcode::pen_stamp:
+            if (is_sprite)
+            {
+                write_line("if (context.p_pen_layer != nullptr)");
+                write_line("{");
+                write_line("    context.p_pen_layer->stamp(p_sprite);");
+                write_line("    context.redraw_requested = true;");
+                write_line("}");
+            }
+            break;
+        case vm_opcode::pen_down:
+            if (is_sprite)
+            {
+                write_line("p_sprite->m_pen.down = true;");
+                write_line("move_pen(context, p_sprite, p_sprite->get_x(), p_sprite->get_y());");
+            }
+            break;
+        case vm_opcode::pen_up:
+            if (is_sprite)
+            {
+                write_line("p_sprite->m_pen.down = false;");
+            }
+            break;
+        case vm_opcode::set_pen_color:
+            a = pop();
+            if (is_sprite)
+            {
+                write_line("set_pen_color(p_sprite->m_pen, to_color(" + as_value(a) + "));");
+            }
+            break;
+        case vm_opcode::set_pen_param:
+        case vm_opcode::change_pen_param:
+            b = pop();
+            a = pop();
+            if (is_sprite)
+            {
+                write_line("set_pen_param(p_sprite->m_pen, " + as_value(a) + ", " + as_number(b) + ", " + (instruction.opcode == vm_opcode::change_pen_param ? "true" : "false") + ");");
+            }
+            break;
+        case vm_opcode::set_pen_size:
+        case vm_opcode::change_pen_size:
+            a = pop();
+            if (is_sprite)
+            {
+                write_line("p_sprite->m_pen.size = std::min(std::max(" + std::string(instruction.opcode == vm_opcode::change_pen_size ? "p_sprite->m_pen.size + " : "") + as_number(a)
+                    + ", 1.0), PEN_MAX_SIZE);");
+            }
+            break;
+
+        // sensing
+        case vm_opcode::get_timer:
+            push(vm_value_kind::number, "context.current_time - context.timer_start");
+            break;
+        case vm_opcode::reset_timer:
+            write_line("context.timer_start = context.current_time;");
+            break;
+        case vm_opcode::key_pressed:
+            a = pop();
+            if (a.constant)
+            {
+                push(vm_value_kind::boolean, "context.p_input != nullptr && context.p_input->is_key_down(" + std::to_string(scratch_util::key_name_to_keycode(a.literal.to_string())) + ")");
+            }
+            else
+            {
+                push(vm_value_kind::boolean, "key_pressed(" + as_value(a) + ", context)");
+            }
+            break;
+        case vm_opcode::get_mouse_x:
+            push(vm_value_kind::number, "context.p_input != nullptr ? context.p_input->get_mouse_x() : 0.0");
+            break;
+        case vm_opcode::get_mouse_y:
+            push(vm_value_kind::number, "context.p_input != nullptr ? context.p_input->get_mouse_y() : 0.0");
+            break;
+        case vm_opcode::get_mouse_down:
+            push(vm_value_kind::boolean, "context.p_input != nullptr && context.p_input->is_mouse_down()");
+            break;
+        case vm_opcode::touching_object:
+            a = pop();
+            if (!is_sprite)
+            {
+                push(vm_value_kind::boolean, "false");
+            }
+            else if (a.constant && a.literal.string_equals(L"_edge_"))
+            {
+                push(vm_value_kind::boolean, "p_sprite->touches_edge()");
+            }
+            else
+            {
+                push(vm_value_kind::boolean, "touching_object(p_sprite, " + as_string(a) + ", context)");
+            }
+            break;
+
+        case vm_opcode::end:
+            m_cache.clear();
+            write_line("thread.done = true;");
+            write_line("stack.clear();");
+            write_line(resume(next, "signal_job_terminate"));
+            break;
+        default:
+            m_cache.clear();
+            write_line("thread.done = true;");
+            write_line("return job_status::error;");
+            break;
+    }
+}
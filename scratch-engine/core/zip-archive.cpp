@@ -0,0 +1,176 @@
+/*
+File: zip-archive.cpp
+Description: Implements the read only zip archive reader CScratch opens project files with
+*/
+
+#include "scratch-loader.hpp"
+#include <cstring>
+
+using namespace scratch;
+
+namespace
+{
+    const unsigned int ZIP_LOCAL_HEADER_SIGNATURE = 0x04034b50;
+    const unsigned int ZIP_CENTRAL_HEADER_SIGNATURE = 0x02014b50;
+    const unsigned int ZIP_END_SIGNATURE = 0x06054b50;
+    const size_t ZIP_LOCAL_HEADER_SIZE = 30;
+    const size_t ZIP_CENTRAL_HEADER_SIZE = 46;
+    const size_t ZIP_END_SIZE = 22;
+    const size_t ZIP_MAX_COMMENT = 0xFFFF;
+
+    // zip fields are little endian and unaligned
+    unsigned int read_u16(const unsigned char* p_data)
+    {
+        return p_data[0] | (p_data[1] << 8);
+    }
+
+    unsigned int read_u32(const unsigned char* p_data)
+    {
+        return p_data[0] | (p_data[1] << 8) | (p_data[2] << 16) | ((unsigned int)p_data[3] << 24);
+    }
+}
+
+zip_archive::zip_archive()
+{
+    mp_data = nullptr;
+    m_size = 0;
+}
+
+// finds the end of central directory record at the back of the archive and lists every entry from the central directory
+bool zip_archive::open(const unsigned char* p_data, size_t size)
+{
+    size_t end_record = 0;
+    size_t directory = 0;
+    size_t directory_end = 0;
+    unsigned int entry_count = 0;
+    bool found = false;
+
+    mp_data = p_data;
+    m_size = size;
+    m_entries.clear();
+    m_entry_lookup.clear();
+    if (p_data == nullptr || size < ZIP_END_SIZE)
+    {
+        return false;
+    }
+
+    for (size_t i = size - ZIP_END_SIZE + 1; i-- > 0 && size - i <= ZIP_END_SIZE + ZIP_MAX_COMMENT;) // the record is followed by a comment of up to 64k
+    {
+        if (read_u32(p_data + i) == ZIP_END_SIGNATURE)
+        {
+            end_record = i;
+            found = true;
+            break;
+        }
+    }
+    if (!found)
+    {
+        return false;
+    }
+    entry_count = read_u16(p_data + end_record + 10);
+    directory = read_u32(p_data + end_record + 16);
+    directory_end = directory + read_u32(p_data + end_record + 12);
+    if (directory_end > end_record || directory > directory_end) // zip64 archives land here too, projects never get that big
+    {
+        return false;
+    }
+
+    m_entries.reserve(entry_count);
+    m_entry_lookup.reserve(entry_count);
+    for (size_t position = directory; m_entries.size() < entry_count;)
+    {
+        const unsigned char* p_header = p_data + position;
+        zip_entry entry = {};
+        size_t name_length = 0;
+
+        if (position + ZIP_CENTRAL_HEADER_SIZE > directory_end || read_u32(p_header) != ZIP_CENTRAL_HEADER_SIGNATURE)
+        {
+            return false;
+        }
+        name_length = read_u16(p_header + 28);
+        if (position + ZIP_CENTRAL_HEADER_SIZE + name_length > directory_end)
+        {
+            return false;
+        }
+        entry.method = read_u16(p_header + 10);
+        entry.compressed_size = read_u32(p_header + 20);
+        entry.size = read_u32(p_header + 24);
+        entry.local_header_offset = read_u32(p_header + 42);
+        entry.name.assign((const char*)p_header + ZIP_CENTRAL_HEADER_SIZE, name_length);
+        m_entry_lookup.emplace(entry.name, (unsigned int)m_entries.size()); // the first of two entries with the same name wins
+        m_entries.push_back(entry);
+        position += ZIP_CENTRAL_HEADER_SIZE + name_length + read_u16(p_header + 30) + read_u16(p_header + 32);
+    }
+    return true;
+}
+
+int zip_archive::find(const std::string& name)
+{
+    std::unordered_map<std::string, unsigned int>::iterator found = m_entry_lookup.find(name);
+
+    return found == m_entry_lookup.end() ? -1 : (int)found->second;
+}
+
+unsigned int zip_archive::get_entry_count()
+{
+    return m_entries.size();
+}
+
+const zip_entry& zip_archive::get_entry(unsigned int index)
+{
+    return m_entries[index];
+}
+
+// the local header's name and extra field lengths can differ from the central directory's so the data offset is worked out here
+bool zip_archive::read(unsigned int index, std::vector<unsigned char>& buffer, const unsigned char*& p_data, size_t& size) const
+{
+    const zip_entry& entry = m_entries[index];
+    const unsigned char* p_header = mp_data + entry.local_header_offset;
+    const unsigned char* p_compressed = nullptr;
+    unsigned char* p_inflated = nullptr;
+    size_t data_offset = 0;
+    int inflated_size = 0;
+
+    p_data = nullptr;
+    size = 0;
+    if (entry.local_header_offset + ZIP_LOCAL_HEADER_SIZE > m_size || read_u32(p_header) != ZIP_LOCAL_HEADER_SIGNATURE)
+    {
+        return false;
+    }
+    data_offset = entry.local_header_offset + ZIP_LOCAL_HEADER_SIZE + read_u16(p_header + 26) + read_u16(p_header + 28);
+    if (data_offset > m_size || entry.compressed_size > m_size - data_offset)
+    {
+        return false;
+    }
+    p_compressed = mp_data + data_offset;
+
+    if (entry.method == 0)
+    {
+        if (entry.compressed_size != entry.size)
+        {
+            return false;
+        }
+        p_data = p_compressed;
+        size = entry.size;
+        return true;
+    }
+    if (entry.method != 8 || entry.compressed_size > 0x7FFFFFFF)
+    {
+        return false;
+    }
+
+    p_inflated = DecompressData(p_compressed, (int)entry.compressed_size, &inflated_size); // raw deflate, which is what zip stores
+    if (p_inflated == nullptr || (size_t)inflated_size != entry.size)
+    {
+        if (p_inflated != nullptr)
+        {
+            MemFree(p_inflated);
+        }
+        return false;
+    }
+    buffer.assign(p_inflated, p_inflated + inflated_size);
+    MemFree(p_inflated);
+    p_data = buffer.data();
+    size = buffer.size();
+    return true;
+}
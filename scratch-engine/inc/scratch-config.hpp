@@ -5,10 +5,17 @@ Description: Contains all defines for global constants in CScratch
 
 #pragma once
 
-#define CORE_ENGINE_JOB_COUNT 2
+#define CORE_ENGINE_JOB_COUNT 4
 
 #define TARGET_FRAMERATE 60
+#define SIMULATION_DEFAULT_TICK_RATE 30.0 // logic ticks per second, Scratch runs projects at 30
+#define SIMULATION_MAX_CATCHUP_TICKS 8 // most ticks a single frame runs to catch up, anything beyond is dropped so a stall can't snowball
+#define WINDOW_DEFAULT_WIDTH 1280
+#define WINDOW_DEFAULT_HEIGHT 720
 #define SCRATCHK_MAX_KEYCODE 337 // KEY_KP_EQUAL + 1
+#define INPUT_TRACE_MAGIC "CSIT" // first bytes of an input trace file
+#define INPUT_TRACE_VERSION 2
+#define INPUT_TRACE_EXACT_POSITION 0x80 // set on the type byte of a mouse event stored as two doubles instead of a whole unit move
 
 #define STAGE_MIN_X (-240)
 #define STAGE_MAX_X 240
@@ -16,6 +23,7 @@ Description: Contains all defines for global constants in CScratch
 #define STAGE_MAX_Y 180
 #define STAGE_SIZE_X (STAGE_MAX_X - STAGE_MIN_X)
 #define STAGE_SIZE_Y (STAGE_MAX_Y - STAGE_MIN_Y)
+#define STAGE_PIXEL_COUNT (STAGE_SIZE_X * STAGE_SIZE_Y)
 #define STAGE_MIN_X_FLOAT (-240.0)
 #define STAGE_MAX_X_FLOAT 240.0
 #define STAGE_MIN_Y_FLOAT (-180.0)
@@ -33,6 +41,42 @@ Description: Contains all defines for global constants in CScratch
 #define SPRITE_DEFAULT_SIZE 100.0
 #define SPRITE_MAX_SIZE_X_FLOAT 720.0
 #define SPRITE_MAX_SIZE_Y_FLOAT 540.0
+#define SPRITE_POOL_SLAB_SIZE 64 // clone sprites allocated per slab
+#define SPRITE_DEFAULT_CLONE_LIMIT 300 // same as Scratch, the scheduler can be configured to allow more
+#define SPRITE_GRID_DEFAULT_CELL_SIZE 32.0 // render plane units per side of a broad phase cell
+#define TRANSFORM_STORE_BATCH_DIVISOR 4 // the transform store lays out every slot in one pass once at least 1 in this many changed
+
+#define ATLAS_PAGE_SIZE 2048
+#define ATLAS_MAX_ENTRY_SIZE 1024 // costumes bigger than this in either dimension get a texture of their own
+#define ATLAS_PADDING 1
+#define ASSET_DEFAULT_TEXTURE_BUDGET (256ull * 1024 * 1024) // bytes of standalone costume textures kept on the GPU before the least recently drawn are evicted
+#define COSTUME_MAX_LEVELS 8 // downsampled copies a costume can have, each half the size of the one before
+#define COSTUME_LEVEL_MIN_SIZE 8 // no level is made whose longer side would be shorter than this
+#define EFFECT_BATCH_SLOTS 32 // sprites with distinct effects one batch can hold, each takes 3 vec4 uniforms of the effect shader
+#define ASSET_DEFAULT_UPLOAD_BUDGET (16ull * 1024 * 1024) // bytes of costume pixels uploaded per frame, anything past that waits for the next frame
+#define PEN_DEFAULT_SIZE 1.0
+#define PEN_MAX_SIZE 1200.0
+#define PEN_DEFAULT_COLOR 66.66 // blue
+#define PEN_CAP_TEXTURE_SIZE 64 // disc the GPU pen draws line ends with
+#define STAGE_DAMAGE_PADDING 1.0 // pixels added around the damaged area so filtered edges get redrawn too
+
+#define VM_STACK_RESERVE 64
+#define VM_WARP_CHECK_INTERVAL 1024 // must be a power of two
+#define SCHEDULER_WORK_FRACTION 0.75 // share of a frame the scheduler may spend running scripts, same as Scratch
+#define SCHEDULER_WARP_TIME_LIMIT 0.5 // seconds a warped script may run before it is forced to yield
+#define LIST_ITEM_LIMIT 200000
+#define LIST_CHUNK_SIZE 512 // items per list chunk, a full chunk is split in two
+#define STRING_INTERN_SHARD_COUNT 64 // intern table shards, each with its own lock, must be a power of two
+#define STRING_NUMBER_UNPARSED 0xFFFFFFFFFFFFFFFFULL // a NaN no parse produces, marks a string whose number isn't cached yet
+
+#define JSON_MAX_DEPTH 256 // deeper documents are rejected instead of overflowing the parser's stack
+#define SB3_MAX_BLOCK_DEPTH 1024 // projects nesting blocks deeper than this are rejected, converting a script recurses once per level
+#define SB3_PLACEHOLDER_COLOR {128, 128, 128, 255} // costumes whose image can't be decoded are drawn as a flat box of this color
+
+#define TRACE_BUFFER_EVENT_COUNT 65536 // per thread, must be a power of two
+
+#define MATH_PI 3.14159265358979323846
 
 #define COLOR_BLACK {0, 0, 0, 255}
-#define COLOR_WHITE {255, 255, 255, 255}
\ No newline at end of file
+#define COLOR_WHITE {255, 255, 255, 255}
+#define COLOR_BLANK {0, 0, 0, 0}
\ No newline at end of file
@@ -6,40 +6,76 @@ Description: Main include file for use of the CScratch engine for external progr
 #pragma once
 
 #include <raylib.h>
+#include <chrono>
 #include "scratch-enums.hpp"
 #include "scratch-jobs.hpp"
 #include "scratch-config.hpp"
 #include "scratch-render.hpp"
+#include "scratch-loader.hpp"
 
 namespace scratch
 {
     class scratch_engine
     {
         public:
-            scratch_engine(const char* window_title);
+            scratch_engine(const char* window_title, scratch::engine_mode mode = scratch::engine_mode::windowed);
             ~scratch_engine();
 
             scratch::engine_status get_status();
+            scratch::engine_mode get_mode();
+            const Color* get_stage_framebuffer();
+            scratch::render_stats get_render_stats();
+            scratch::costume_atlas* get_costume_atlas();
+            scratch::asset_cache* get_asset_cache();
+            scratch::sprite_grid* get_sprite_grid();
+            scratch::layer_list* get_layers();
+            scratch::pen_layer* get_pen_layer();
+            scratch::stage_damage* get_stage_damage();
+            scratch::scheduler_job* get_scheduler();
             scratch::engine_status next_tick();
+            scratch::engine_status run_ticks(unsigned long long tick_count);
+            void set_tick_rate(double ticks_per_second);
+            void set_turbo(bool turbo);
+            bool is_turbo();
+            unsigned long long get_tick_count();
             void add_sprite(scratch::sprite* p_sprite, scratch::sprite* p_above);
+            scratch::sprite* pick_sprite(double x, double y); // stage coordinates
+            void click(double x, double y); // stage coordinates
+            scratch::input_tracker* get_input();
+            void set_input_source(scratch::input_source* p_source); // becomes property of the engine, lets headless runs be fed input
+            bool start_recording(); // false while replaying
+            bool save_recording(const char* p_path);
+            bool start_replay(const char* p_path); // false if the file isn't a trace or the engine is recording
+            bool is_replaying();
         private:
             scratch::engine_status m_status = scratch::engine_status::error;
+            scratch::engine_mode m_mode;
             scratch::engine_job* mp_core_jobs[CORE_ENGINE_JOB_COUNT];
+            bool run_job(scratch::core_jobs job); // false once the engine should stop
+            void dispatch_input();
+
+            // simulation timing
+            double m_tick_rate;
+            bool m_turbo;
+            double m_tick_accumulator; // real time not yet turned into ticks
+            std::chrono::steady_clock::time_point m_last_frame_time;
+            unsigned long long m_tick_count;
 
             // input related stuff
-            scratch::input_state mp_key_pressed[SCRATCHK_MAX_KEYCODE];
-            struct
-            {
-                double x;
-                double y;
-                bool mouse_down;
-            } m_mouse_data;
+            scratch::input_tracker m_input;
+            scratch::record_job* mp_record_job; // nullptr unless recording
+            scratch::replay_input_job* mp_replay_job; // nullptr unless replaying
 
             // renderer related stuff
-            struct
-            {
-                scratch::sprite* p_top_sprite;
-                scratch::sprite* p_bottom_sprite;
-            } m_sprite_list;
+            scratch::layer_list* mp_layers;
+            Color* mp_stage_framebuffer; // only allocated in headless mode
+            scratch::costume_atlas* mp_costume_atlas;
+            scratch::asset_cache* mp_asset_cache;
+            scratch::sprite_grid* mp_sprite_grid;
+            scratch::transform_store* mp_transforms; // where every added sprite's costume quad is laid out, see sprite::update_bounds
+            scratch::pen_layer* mp_pen_layer;
+            scratch::stage_damage* mp_stage_damage;
+            scratch::render_stats m_render_stats;
+
     };
 }
\ No newline at end of file
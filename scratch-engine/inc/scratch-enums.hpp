@@ -11,6 +11,11 @@ namespace scratch
         error = 1,
         exited = 2
     };
+    enum class engine_mode
+    {
+        windowed = 0,
+        headless = 1 // no window or GPU context, the stage is drawn by the software rasterizer
+    };
     enum class state_type
     {
         number = 0,
@@ -26,17 +31,40 @@ namespace scratch
         signal_job_terminate = 3, // signal for jobs to tell scheduler to stop running the job in the future
         signal_scheduler_terminate_others = 4, // need this to emulate stop other scripts in sprite
         signal_vm_halt = 5, // need this to simulate red stop button and stop all scripts
+        signal_create_clone = 6, // create clone block ran, the thread carries on once the scheduler has made the clone
+        signal_delete_clone = 7, // delete this clone block ran in a clone, the scheduler stops all of the clone's scripts and frees it
+    };
+    enum class load_status
+    {
+        ok = 0,
+        file_error = 1, // missing or unreadable file
+        archive_error = 2, // not a zip archive, or project.json is missing or damaged
+        json_error = 3, // project.json is not valid JSON
+        project_error = 4 // valid JSON that doesn't describe a Scratch 3 project
+    };
+    enum class json_type : unsigned char
+    {
+        null_value = 0,
+        boolean = 1,
+        number = 2,
+        string = 3,
+        array = 4,
+        object = 5
     };
     enum class core_jobs
     {
         input = 0,
-        render = 1
+        scheduler = 1,
+        render = 2,
+        record = 3 // does nothing unless the engine is recording
     };
-    enum class input_state : unsigned char
+    enum class input_event_type
     {
-        fresh_pressed = 2,
-        pressed = 1,
-        unpressed = 0
+        key_down = 0, // also sent for key repeats
+        key_up = 1,
+        mouse_move = 2,
+        mouse_down = 3,
+        mouse_up = 4
     };
     enum class rotation_mode
     {
@@ -55,4 +83,151 @@ namespace scratch
         ghost = 6,
         max = 7
     };
+    enum class vm_hat // events that start a script
+    {
+        green_flag = 0,
+        key_pressed = 1,
+        broadcast_received = 2,
+        clone_start = 3,
+        sprite_clicked = 4
+    };
+    enum class vm_opcode : unsigned short
+    {
+        // stack and variables
+        push_constant = 0, // operand: constant pool index
+        pop,
+        load_local, // operand: variable slot of the running sprite
+        load_global, // operand: variable slot of the stage
+        store_local,
+        store_global,
+        change_local,
+        change_global,
+        load_argument, // operand: argument index of the running procedure
+
+        // operators
+        add,
+        subtract,
+        multiply,
+        divide,
+        mod,
+        round,
+        math, // operand: vm_math_op
+        random,
+        equals,
+        less_than,
+        greater_than,
+        logic_and,
+        logic_or,
+        logic_not,
+        join,
+        letter_of,
+        length_of,
+        contains,
+
+        // control flow, jump operands are absolute instruction indices
+        jump,
+        jump_if_false,
+        jump_if_true,
+        repeat_init, // turns the value on top of the stack into a loop counter
+        repeat_next, // operand: loop exit, pops the counter and exits once it runs out
+        yield, // always gives up the rest of the tick
+        yield_loop, // end of a loop iteration, yields unless running without screen refresh
+        wait_start, // pops a duration in seconds and yields
+        wait_check, // yields until the duration from wait_start is over
+        call, // operand: procedure index
+        return_procedure,
+        halt, // stop this script
+        stop_all,
+        stop_others,
+        broadcast,
+        create_clone, // pops "_myself_" or the name of the sprite to clone
+        delete_clone,
+
+        // lists, operand: list slot of the running sprite, or ~slot for a stage list
+        list_add,
+        list_delete,
+        list_delete_all,
+        list_insert,
+        list_replace,
+        list_item,
+        list_item_number,
+        list_length,
+        list_contains,
+        list_contents,
+
+        // sprite
+        move_steps,
+        turn_right,
+        turn_left,
+        goto_xy,
+        set_x,
+        change_x,
+        set_y,
+        change_y,
+        point_direction,
+        set_rotation_mode, // operand: rotation_mode
+        get_x,
+        get_y,
+        get_direction,
+        set_size,
+        change_size,
+        get_size,
+        show,
+        hide,
+        switch_costume,
+        next_costume,
+        get_costume_number,
+        get_costume_name,
+        goto_front,
+        goto_back,
+        go_forward_layers,
+        set_effect, // operand: graphical_effect
+        change_effect, // operand: graphical_effect
+        clear_effects,
+
+        // pen
+        pen_clear,
+        pen_stamp,
+        pen_down,
+        pen_up,
+        set_pen_color, // pops a color
+        set_pen_param, // pops "color", "saturation", "brightness" or "transparency" and a number
+        change_pen_param,
+        set_pen_size,
+        change_pen_size,
+
+        // sensing
+        get_timer,
+        reset_timer,
+        key_pressed, // pops a key name
+        get_mouse_x,
+        get_mouse_y,
+        get_mouse_down,
+        touching_object, // pops "_mouse_", "_edge_" or a sprite name
+
+        end // end of a top level script
+    };
+    enum class vm_value_kind // what vm_transpiler knows about a value at compile time
+    {
+        number = 0, // held as a double
+        boolean = 1, // held as a bool
+        value = 2 // anything, held as a scratch_state
+    };
+    enum class vm_math_op
+    {
+        abs = 0,
+        floor = 1,
+        ceiling = 2,
+        sqrt = 3,
+        sin = 4,
+        cos = 5,
+        tan = 6,
+        asin = 7,
+        acos = 8,
+        atan = 9,
+        ln = 10,
+        log = 11,
+        exp = 12,
+        pow10 = 13
+    };
 }
\ No newline at end of file
@@ -0,0 +1,106 @@
+/*
+File: scratch-input.hpp
+Description: Contains the keyboard and mouse state CScratch's scripts see and the sources it is fed from
+*/
+
+#pragma once
+
+#include <raylib.h>
+#include <cstddef>
+#include <vector>
+#include "scratch-enums.hpp"
+#include "scratch-config.hpp"
+
+namespace scratch
+{
+    struct input_event
+    {
+        scratch::input_event_type type;
+        int key; // raylib keycode, only used by key events
+        double x; // stage coordinates, only used by mouse events
+        double y;
+    };
+
+    class input_tracker // what is held down right now plus the presses and clicks that haven't started their hat scripts yet
+    {
+        public:
+            input_tracker();
+            void apply(const scratch::input_event& event);
+            bool is_key_down(int keycode); // a negative keycode asks whether any key is down
+            double get_mouse_x(); // stage coordinates
+            double get_mouse_y();
+            bool is_mouse_down();
+            const std::vector<scratch::input_event>& get_pending(); // key downs (repeats included) and mouse downs in the order they came in
+            void clear_pending();
+        private:
+            unsigned long long mp_keys_down[(SCRATCHK_MAX_KEYCODE + 63) / 64]; // one bit per keycode
+            unsigned int m_keys_down_count;
+            double m_mouse_x;
+            double m_mouse_y;
+            bool m_mouse_down;
+            std::vector<scratch::input_event> m_pending;
+    };
+
+    // a recorded session: the seed pick random started from, then for every frame the input events and how many scheduler passes
+    // each of its logic ticks ran, see input-trace.cpp for the encoding
+    class input_trace
+    {
+        public:
+            input_trace();
+            void clear(unsigned long long seed);
+            void add_frame(const std::vector<scratch::input_event>& events, const std::vector<unsigned int>& tick_passes);
+            bool save(const char* p_path);
+            bool load(const char* p_path); // false if the file is missing, not a trace or from another version
+            void rewind();
+            bool next_frame(std::vector<scratch::input_event>& events, std::vector<unsigned int>& tick_passes); // false at the end
+            unsigned long long get_seed();
+            unsigned long long get_frame_count();
+            size_t get_size(); // bytes of frame data
+        private:
+            void write_varint(unsigned long long value);
+            bool read_varint(unsigned long long& value);
+
+            std::vector<unsigned char> m_data; // the frames, the header is only written by save
+            size_t m_read_offset;
+            unsigned long long m_seed;
+            unsigned long long m_frame_count;
+            double m_write_mouse_x; // mouse events store how far the mouse moved since the previous one
+            double m_write_mouse_y;
+            double m_read_mouse_x;
+            double m_read_mouse_y;
+    };
+
+    class input_source // where input_job gets its events from, this one never has any which is all a headless engine needs
+    {
+        public:
+            virtual ~input_source() {};
+            virtual void collect(std::vector<scratch::input_event>& /*events*/) // appends whatever happened since the last call
+            {
+            };
+            virtual bool should_close()
+            {
+                return false;
+            };
+    };
+
+    class window_input_source : public input_source // turns raylib's per frame key queue and mouse state into events
+    {
+        public:
+            window_input_source();
+            void collect(std::vector<scratch::input_event>& events) override;
+            bool should_close() override;
+        private:
+            std::vector<int> m_held_keys; // only these are asked about repeats and releases instead of every keycode
+            double m_mouse_x;
+            double m_mouse_y;
+    };
+
+    class queued_input_source : public input_source // stand-in for a window, events pushed in are handed out on the next frame
+    {
+        public:
+            void push(const scratch::input_event& event);
+            void collect(std::vector<scratch::input_event>& events) override;
+        private:
+            std::vector<scratch::input_event> m_queue;
+    };
+}
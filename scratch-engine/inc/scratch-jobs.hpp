@@ -6,39 +6,206 @@ Description: Contains all jobs that CScratch may run
 #pragma once
 
 #include <raylib.h>
+#include <chrono>
+#include <vector>
 #include "scratch-enums.hpp"
 #include "scratch-render.hpp"
+#include "scratch-vm.hpp"
+#include "scratch-input.hpp"
 
 namespace scratch
 {
     class engine_job // abstract god interface class for all jobs the engine will run
     {
         public:
+            virtual ~engine_job() {};
             virtual scratch::job_status run()
             {
                 return scratch::job_status::ok;
             };
+            virtual const char* get_name() // used to label the job in traces
+            {
+                return "engine_job";
+            };
+    };
+
+    class input_job : public engine_job // job for feeding the events of an input source into the tracker scripts read
+    {
+        public:
+            input_job(scratch::input_source* p_source, scratch::input_tracker* p_input); // the source becomes property of the job
+            ~input_job();
+            scratch::job_status run() override;
+            void set_source(scratch::input_source* p_source);
+            const std::vector<scratch::input_event>& get_events(); // what the last run applied
+            unsigned long long get_run_count();
+            const char* get_name() override;
+        private:
+            scratch::input_source* mp_source;
+            scratch::input_tracker* mp_input;
+            std::vector<scratch::input_event> m_events; // reused every frame
+            unsigned long long m_run_count;
+    };
+
+    class replay_input_job : public engine_job // stands in for input_job while the engine replays a recorded session, see scratch_engine::start_replay
+    {
+        public:
+            replay_input_job(scratch::input_tracker* p_input);
+            scratch::input_trace& get_trace();
+            scratch::job_status run() override; // signals the engine to stop once the trace runs out
+            const std::vector<unsigned int>& get_tick_passes(); // the frame's ticks and how many passes each of them ran
+            const char* get_name() override;
+        private:
+            scratch::input_tracker* mp_input;
+            scratch::input_trace m_trace;
+            std::vector<scratch::input_event> m_events;
+            std::vector<unsigned int> m_tick_passes;
+    };
+
+    class record_job : public engine_job // writes down every frame's input and ticks so the session can be replayed, see scratch_engine::start_recording
+    {
+        public:
+            record_job(scratch::input_job* p_input_job, unsigned long long seed);
+            scratch::input_trace& get_trace();
+            std::vector<unsigned int>* get_pass_log(); // the scheduler adds every tick's passes here
+            scratch::job_status run() override;
+            const char* get_name() override;
+        private:
+            scratch::input_job* mp_input_job;
+            unsigned long long m_recorded_runs; // input_job runs already recorded, run_ticks frames have no input of their own
+            scratch::input_trace m_trace;
+            std::vector<unsigned int> m_pass_log;
     };
 
-    class input_job : public engine_job // job for collecting all input sent to the SDL window
+    class scheduler_job : public engine_job // job for running Scratch scripts, steps every thread round robin until they have all yielded or the frame's work budget is used up
     {
         public:
-            input_job(scratch::input_state* p_key_pressed);
+            scheduler_job(scratch::input_tracker* p_input, scratch::layer_list* p_layers, scratch::sprite_grid* p_sprite_grid, scratch::pen_layer* p_pen_layer);
+            ~scheduler_job();
             scratch::job_status run() override;
+            const char* get_name() override;
+            void add_target(scratch::vm_target* p_target); // the target becomes property of the scheduler
+            scratch::vm_target* find_target(scratch::sprite* p_sprite); // nullptr finds the stage
+            const std::vector<scratch::vm_target*>& get_targets(); // in the order their scripts start, clones included
+            unsigned int start_hats(scratch::vm_hat hat, const std::wstring& parameter, scratch::vm_target* p_only_target = nullptr);
+            void start_key_hats(int keycode);
+            void green_flag();
+            void stop_all();
+            void set_tick_rate(double ticks_per_second);
+            void set_turbo(bool turbo);
+            void set_clone_limit(unsigned int clone_limit); // 0 removes the limit
+            void set_random_seed(unsigned long long seed);
+            void set_pass_log(std::vector<unsigned int>* p_pass_log); // each tick adds how many passes it ran, nullptr stops logging
+            void set_pass_limit(unsigned int passes); // the next ticks run exactly this many passes instead of using up the time budget, 0 goes back
+            unsigned int get_thread_count();
+            unsigned int get_clone_count();
         private:
-            scratch::input_state* mp_key_pressed;
+            struct scheduled_thread
+            {
+                scratch::vm_thread* p_thread; // nullptr once stopped, removed at the end of the pass
+                unsigned int wait_group; // broadcast and wait that started this thread, 0 for none
+                unsigned int waiting_for; // broadcast and wait group this thread is parked on, 0 for none
+                unsigned int generation; // changes whenever a script is (re)started in this slot, thread objects are recycled so the pointer alone can't tell
+            };
+
+            bool start_script(scratch::vm_target* p_target, unsigned int entry, bool restart, unsigned int wait_group);
+            scratch::vm_thread* new_thread(scratch::vm_target* p_target, unsigned int entry);
+            scratch::job_status step_thread(unsigned int index);
+            void stop_thread(unsigned int index);
+            bool is_group_running(unsigned int wait_group);
+            bool create_clone(scratch::vm_target* p_parent, const scratch::scratch_state& option);
+            void delete_clone(scratch::vm_target* p_clone);
+            void delete_all_clones();
+
+            std::vector<scratch::vm_target*> m_targets;
+            std::vector<scheduled_thread> m_threads;
+            std::vector<scratch::vm_thread*> m_free_threads; // stopped threads waiting to be reused so starting a script doesn't allocate
+            std::vector<scratch::vm_broadcast> m_broadcasts;
+            scratch::vm_context m_context;
+            double m_tick_time; // seconds of simulation time each run() advances
+            double m_time_base; // simulation time when the tick rate last changed
+            unsigned long long m_ticks_since_base; // simulation time is m_time_base + m_ticks_since_base * m_tick_time, multiplying instead of summing so waits end on the exact tick
+            bool m_turbo; // keep running passes after a redraw request, like Scratch's turbo mode
+            unsigned int m_last_wait_group;
+            unsigned int m_last_generation;
+
+            // clones
+            scratch::sprite_pool* mp_clone_pool;
+            std::vector<scratch::vm_target*> m_free_clone_targets; // deleted clones' targets kept around for their already grown storage
+            unsigned int m_clone_count;
+            unsigned int m_clone_limit;
+            std::vector<unsigned int>* mp_pass_log;
+            unsigned int m_pass_limit;
     };
 
     class render_job : public engine_job // job for drawing pixels onto the screen
     {
         public:
-            render_job(scratch::sprite** pp_sprite_list);
+            render_job(scratch::layer_list* p_layers, scratch::pen_layer* p_pen_layer, scratch::stage_damage* p_damage, scratch::render_stats* p_stats);
             ~render_job();
             scratch::job_status run() override;
+            const char* get_name() override;
         private:
             void draw_sprite(scratch::sprite* p_sprite);
+            bool draw_costume(scratch::costume* p_costume, const scratch::sprite_transform& transform, bool has_effects, const scratch::sprite_effects& effects, unsigned int& effect_slot, bool forced);
+            Vector2 get_corner(const scratch::sprite_transform& transform, double x, double y);
+            unsigned int add_effect_slot(const scratch::sprite_effects& effects, float left_u, float top_v, float right_u, float bottom_v);
+            void flush_batch();
+            void flush_pen();
+            void end_stamps();
+            void draw_pen_lines(const std::vector<scratch::pen_line>& lines, size_t first, size_t last);
+            void draw_pen_cap(float x, float y, float radius);
             void present_stage();
-            scratch::sprite** mpp_sprite_list;
-            RenderTexture2D m_stage_texture;
+            scratch::layer_list* mp_layers;
+            scratch::pen_layer* mp_pen_layer;
+            scratch::stage_damage* mp_damage;
+            scratch::render_stats* mp_stats;
+            RenderTexture2D m_stage_texture; // kept from frame to frame, only the damaged part is drawn again
+            Rectangle m_area; // the damaged part, whole pixels
+            unsigned int m_batch_texture_id; // texture of the quads currently being accumulated, 0 when no batch is open
+
+            // pen
+            RenderTexture2D m_pen_texture; // persistent, premultiplied alpha
+            Texture2D m_pen_cap_texture;
+            bool m_pen_used; // false until something is drawn and again after a clear, the stage skips compositing an empty layer
+
+            // every effect is applied by one shader. each sprite with effects gets a slot of uniforms and passes its slot number in the
+            // red channel of its vertex color, so sprites with different effects still share a batch until the slots run out
+            Shader m_effect_shader; // id 0 when it failed to compile, sprites are then drawn with ghost only
+            int m_effect_slots_location;
+            float mp_effect_slots[EFFECT_BATCH_SLOTS * 12]; // slot 0 is reserved for sprites without effects
+            unsigned int m_effect_slot_count;
+    };
+
+    class software_render_job : public engine_job // job for drawing the stage into an in-memory framebuffer on the CPU, used when there is no window or GPU
+    {
+        public:
+            software_render_job(scratch::layer_list* p_layers, scratch::pen_layer* p_pen_layer, scratch::stage_damage* p_damage, Color* p_framebuffer, scratch::render_stats* p_stats);
+            ~software_render_job();
+            scratch::job_status run() override;
+            const char* get_name() override;
+        private:
+            void draw_sprite(scratch::sprite* p_sprite);
+            void draw_costume(Color* p_target, bool pen_target, scratch::costume* p_costume, const scratch::sprite_transform& transform, bool has_effects, const scratch::sprite_effects& effects);
+            void draw_span(Color* p_destination, bool pen_target, const Image& image, const scratch::sprite_effects& effects, unsigned int count); // one row of a sprite with effects, its coordinates already in mp_span_u and mp_span_v
+            void flush_pen();
+            void draw_pen_line(const scratch::pen_line& line);
+            scratch::layer_list* mp_layers;
+            scratch::pen_layer* mp_pen_layer;
+            scratch::stage_damage* mp_damage;
+            scratch::render_stats* mp_stats;
+            Color* mp_framebuffer; // STAGE_PIXEL_COUNT pixels, top row of the stage first. kept from frame to frame, only the damaged part is drawn again
+            int m_clip_min_x; // the damaged part as inclusive pixel ranges of the render plane, only drawing into mp_framebuffer is clipped to it
+            int m_clip_min_y;
+            int m_clip_max_x;
+            int m_clip_max_y;
+            Color* mp_pen_framebuffer; // same layout with premultiplied alpha, nullptr until the pen first draws something
+
+            // one row of costume coordinates and colors, laid out as separate arrays so the effect passes vectorize
+            float mp_span_u[STAGE_SIZE_X];
+            float mp_span_v[STAGE_SIZE_X];
+            float mp_span_red[STAGE_SIZE_X];
+            float mp_span_green[STAGE_SIZE_X];
+            float mp_span_blue[STAGE_SIZE_X];
+            float mp_span_alpha[STAGE_SIZE_X];
     };
 }
\ No newline at end of file
@@ -0,0 +1,166 @@
+/*
+File: scratch-loader.hpp
+Description: Contains the classes CScratch reads Scratch 3 project files (.sb3) with
+*/
+
+#pragma once
+
+#include <raylib.h>
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "scratch-enums.hpp"
+#include "scratch-config.hpp"
+#include "scratch-render.hpp"
+#include "scratch-vm.hpp"
+
+namespace scratch
+{
+    class scratch_engine;
+
+    struct zip_entry
+    {
+        std::string name;
+        unsigned int method; // 0 stored, 8 deflated
+        size_t compressed_size;
+        size_t size;
+        size_t local_header_offset;
+    };
+
+    class zip_archive // read only view of a zip archive sitting in memory, only the central directory is read up front
+    {
+        public:
+            zip_archive();
+            bool open(const unsigned char* p_data, size_t size); // the data must outlive the archive
+            int find(const std::string& name); // entry index, -1 if there is no such entry
+            unsigned int get_entry_count();
+            const scratch::zip_entry& get_entry(unsigned int index);
+            // stored entries point straight into the archive, deflated ones are inflated into buffer. safe to call from several threads at once
+            bool read(unsigned int index, std::vector<unsigned char>& buffer, const unsigned char*& p_data, size_t& size) const;
+        private:
+            const unsigned char* mp_data;
+            size_t m_size;
+            std::vector<scratch::zip_entry> m_entries;
+            std::unordered_map<std::string, unsigned int> m_entry_lookup;
+    };
+
+    struct json_value // one entry of a parsed document. containers are followed by their children, objects alternate key and value entries
+    {
+        scratch::json_type type;
+        bool escaped; // string with escape sequences, its raw text can't be used as is
+        bool truth; // value of a boolean
+        unsigned int offset; // where the string contents or number text start in the source
+        unsigned int length; // bytes of string contents or number text, entries for containers
+        unsigned int end; // index one past the last entry of this value, the next sibling starts there
+    };
+
+    // JSON parsed into a flat array of entries that point back into the source text instead of a tree of nodes,
+    // so parsing is a single pass with one growing allocation and strings are only decoded when asked for
+    class json_document
+    {
+        public:
+            json_document();
+            bool parse(const char* p_text, size_t length); // the text must outlive the document
+            unsigned int get_count();
+            const scratch::json_value& get(unsigned int index); // the root is entry 0
+            int find(unsigned int object, const char* p_key); // entry of the member's value, -1 if it is missing or object isn't an object
+            bool equals(unsigned int index, const char* p_text); // string comparison without decoding
+            bool equals(unsigned int index, unsigned int other);
+            std::string get_string(unsigned int index); // UTF-8, numbers come back as their source text
+            std::wstring get_wstring(unsigned int index);
+            double get_number(unsigned int index, double fallback = 0.0); // numbers and numeric strings
+            bool get_boolean(unsigned int index); // true and "true"
+            scratch::scratch_state get_state(unsigned int index);
+            unsigned long long hash(unsigned int index); // fnv1a of a string's decoded UTF-8
+        private:
+            bool parse_value(unsigned int depth);
+            bool parse_string();
+            bool parse_literal(const char* p_word, scratch::json_type type, bool truth);
+            bool parse_number();
+            void skip_whitespace();
+            void push(scratch::json_type type, size_t offset, size_t length);
+
+            const char* mp_text;
+            size_t m_length;
+            size_t m_position;
+            std::vector<scratch::json_value> m_values;
+    };
+
+    struct sb3_load_stats
+    {
+        unsigned int targets; // sprites plus the stage
+        unsigned int costumes;
+        unsigned int images; // costume files decoded, costumes sharing a file share one decode
+        unsigned int placeholder_images; // costume files that couldn't be decoded, vector costumes without a raylib built with SVG support end up here
+        unsigned int scripts;
+        unsigned int decode_threads;
+        double parse_seconds; // mapping the file, unzipping and parsing project.json
+        double decode_seconds; // wall time of the image decodes, they overlap with building the targets
+        double total_seconds;
+    };
+
+    // loads a Scratch 3 project into an engine: sprites with their costumes and layers, variables, lists and compiled scripts
+    // the archive is memory mapped and project.json is parsed in place. costume images are decoded on a thread pool while the
+    // calling thread compiles scripts, textures are left to be uploaded by the engine when the costumes are first drawn
+    class sb3_loader
+    {
+        public:
+            sb3_loader(scratch::scratch_engine* p_engine);
+            scratch::load_status load(const char* p_path, unsigned int decode_threads = 0); // 0 uses one thread per hardware thread, 1 decodes on the calling thread
+            scratch::vm_target* get_stage(); // nullptr until a project has been loaded
+            scratch::sb3_load_stats get_stats();
+        private:
+            struct image_job // one costume file, decoded once no matter how many costumes use it
+            {
+                unsigned int entry;
+                std::string file_type; // ".png", ".svg", ...
+                Image image;
+                bool placeholder;
+                bool used; // the first costume takes the image, the rest get copies
+            };
+            struct costume_record
+            {
+                std::wstring name;
+                int job; // -1 when the costume's file isn't in the archive
+                double resolution;
+                double rotation_center_x;
+                double rotation_center_y;
+            };
+            struct target_record
+            {
+                unsigned int value; // the target's object in the document
+                scratch::sprite* p_sprite; // nullptr for the stage
+                scratch::vm_target* p_target;
+                std::vector<costume_record> costumes;
+                double layer_order;
+            };
+
+            int find_project_entry(); // project.json, also when the whole project was zipped inside a folder
+            void collect_costumes(target_record& record, std::vector<image_job>& jobs, std::unordered_map<std::string, unsigned int>& job_lookup);
+            void decode_image(image_job& job);
+            void build_target(target_record& record);
+            void declare_data(target_record& record);
+            void compile_scripts(target_record& record, unsigned int blocks);
+            void apply_sprite_state(target_record& record, std::vector<image_job>& jobs);
+            int find_block(unsigned int id);
+            scratch::script_node* convert_stack(unsigned int id);
+            scratch::script_node* convert_block(unsigned int block);
+            scratch::script_node* convert_input(unsigned int input);
+            scratch::script_node* convert_input_value(unsigned int value);
+            scratch::script_node* convert_primitive(unsigned int primitive);
+            void convert_mutation(unsigned int mutation, scratch::script_mutation& result);
+
+            scratch::scratch_engine* mp_engine;
+            scratch::zip_archive m_archive;
+            scratch::json_document m_document;
+            scratch::vm_target* mp_stage;
+            std::string m_prefix; // folder holding project.json inside the archive, usually empty
+            std::vector<std::pair<unsigned long long, unsigned int>> m_block_lookup; // id hash and key entry of the current target's blocks, sorted
+            std::vector<unsigned char> m_converted; // per document entry, blocks are converted at most once so damaged files can't loop forever
+            unsigned int m_depth; // stacks being converted inside each other
+            bool m_too_deep; // a script nested deeper than SB3_MAX_BLOCK_DEPTH, the project is rejected
+            scratch::sb3_load_stats m_stats;
+    };
+}
@@ -15,21 +15,410 @@ Description: Defines all the classes and structures necessary for CScratch rende
 namespace scratch
 {
     class scratch_engine;
+    class sprite;
+    class sprite_pool;
+    class costume;
+    class pen_layer;
+    class transform_store;
+    struct render_stats // per frame counters filled in by the render jobs
+    {
+        unsigned int sprites_drawn;
+        unsigned int draw_calls;
+        unsigned int texture_switches;
+        unsigned int effect_sprites; // sprites drawn with an effect other than ghost
+        unsigned int pen_lines; // drawn into the pen layer this frame
+        unsigned int pen_stamps;
+        unsigned int redrawn_pixels; // part of the stage drawn again, 0 when the last frame was reused as is
+    };
+    struct stage_box // axis aligned area of the render plane, empty while min_x is greater than max_x
+    {
+        double min_x;
+        double min_y;
+        double max_x;
+        double max_y;
+    };
+    scratch::stage_box empty_box();
+    void grow_box(scratch::stage_box& box, const scratch::stage_box& other);
+    struct sprite_transform // where a sprite's current costume lands on the render plane, shared by the renderers and collision queries so they always agree
+    {
+        double x; // rotation center on the render plane
+        double y;
+        double origin_x; // rotation center inside the scaled costume rectangle
+        double origin_y;
+        double width; // scaled costume rectangle
+        double height;
+        double cos_rotation;
+        double sin_rotation;
+        double u_scale; // costume image pixels per render plane unit
+        double v_scale;
+        bool flip_x;
+        double min_x; // axis aligned bounds of the rotated rectangle
+        double min_y;
+        double max_x;
+        double max_y;
+    };
+    struct sprite_effects // a sprite's graphical effects converted the way Scratch converts them for its shader, shared by both renderers so they agree
+    {
+        float color; // hue shift in turns, 0 to 1
+        float fisheye; // exponent on the distance from the center, 1 is no effect
+        float whirl; // rotation at the center in radians
+        float pixelate; // block size in costume pixels, 0 is no effect
+        float mosaic; // copies along each axis, 1 is no effect
+        float brightness; // -1 to 1
+        float ghost; // alpha multiplier, 1 is no effect
+        float costume_width; // pixelate blocks are measured in costume pixels
+        float costume_height;
+        bool coordinates; // fisheye, whirl, pixelate or mosaic is on
+        bool colors; // color or brightness is on
+    };
+    // the CPU side of the effect shader, working on spans so the loops vectorize. coordinates are costume space (0 to 1, unflipped)
+    // and come out of range where the costume should be transparent, colors are 0 to 1 and not premultiplied
+    void apply_effect_coordinates(const scratch::sprite_effects& effects, float* p_u, float* p_v, unsigned int count);
+    void apply_effect_colors(const scratch::sprite_effects& effects, float* p_red, float* p_green, float* p_blue, float* p_alpha, unsigned int count);
+    struct pen_state // per sprite, copied to clones. the color parameters use the same 0 to 100 ranges as the pen blocks
+    {
+        bool down;
+        double size;
+        double color; // hue, wraps around
+        double saturation;
+        double brightness;
+        double transparency;
+        Color rgba; // the four parameters above resolved, whoever changes them updates this
+    };
+    Color resolve_pen_color(const scratch::pen_state& pen); // HSV plus transparency to RGBA, the way Scratch's pen does it
+    struct pen_line // render plane coordinates
+    {
+        float x0;
+        float y0;
+        float x1;
+        float y1;
+        float size;
+        Color color;
+    };
+    struct pen_stamp // a sprite's look at the moment it was stamped, drawn after the first line_index lines
+    {
+        scratch::costume* p_costume;
+        scratch::sprite_transform transform;
+        scratch::sprite_effects effects;
+        bool has_effects;
+        unsigned int line_index;
+    };
+    // pen lines and stamps issued by scripts, queued in order until the renderer draws the whole lot into its persistent pen layer
+    // in one batch. the queue only grows during a frame and is emptied by the renderer, so issuing a line is just a push_back
+    class pen_layer
+    {
+        public:
+            pen_layer();
+            void draw_line(double x0, double y0, double x1, double y1, const scratch::pen_state& pen); // stage coordinates
+            void stamp(scratch::sprite* p_sprite);
+            void clear(); // also drops everything still queued
+            bool has_pending(); // anything for the renderer to do
+            bool is_clear_pending(); // the layer has to be wiped before the queue is drawn
+            const std::vector<scratch::pen_line>& get_lines();
+            const std::vector<scratch::pen_stamp>& get_stamps();
+            const scratch::stage_box& get_damage(); // render plane area the queue changes, a clear covers everything drawn since the last one
+            void finish_frame(); // called by the renderer once the queue is drawn
+        private:
+            std::vector<scratch::pen_line> m_lines;
+            std::vector<scratch::pen_stamp> m_stamps;
+            bool m_clear_pending;
+            scratch::stage_box m_damage;
+            scratch::stage_box m_ink; // everything on the layer since the last clear
+    };
+    struct stage_damage_stats
+    {
+        unsigned long long frames;
+        unsigned long long skipped_frames; // nothing visible changed, the previous frame was shown again
+        unsigned long long partial_frames; // only the damaged rectangle was redrawn
+        unsigned long long redrawn_pixels;
+    };
+    // the part of the stage that changed since the last frame. sprites report their old bounds the first time they change in a frame,
+    // their new bounds are only worked out when the frame is drawn so a sprite moved many times per frame costs one transform
+    // the damage is a single rectangle, sprites changing at opposite ends of the stage simply redraw what lies between them
+    class stage_damage
+    {
+        public:
+            stage_damage(); // starts out covering the whole stage since nothing has been drawn yet
+            void add(const scratch::stage_box& box); // render plane coordinates
+            void invalidate(); // the whole stage
+            // adds the new bounds of changed sprites and the pen's damage, then hands back the whole pixels to redraw and starts the next frame
+            // false when nothing changed and the previous frame can be shown again
+            bool collect(const std::vector<scratch::sprite*>& sprites, scratch::pen_layer* p_pen_layer, Rectangle& area);
+            scratch::stage_damage_stats get_stats();
+        private:
+            void add_sprite(scratch::sprite* p_sprite); // see sprite::damage
+            void remove_sprite(scratch::sprite* p_sprite);
+
+            scratch::stage_box m_box;
+            bool m_sprites_changed; // some sprite has new bounds to collect
+            unsigned long long m_frames;
+            unsigned long long m_skipped_frames;
+            unsigned long long m_partial_frames;
+            unsigned long long m_redrawn_pixels;
+
+        friend class scratch::sprite;
+    };
+    // the sprites in layer order, kept as an implicit treap: a balanced tree ordered by position rather than by key, where each node knows
+    // the size of its subtree. moving a sprite by any number of layers and finding a sprite's layer both take O(log n), and the nodes sit
+    // in one array instead of being spread over the heap. the renderers walk get_draw_order(), a plain array rebuilt only after a change
+    class layer_list
+    {
+        public:
+            layer_list();
+            ~layer_list(); // sprites still in the list are only detached, not deleted
+            void insert(scratch::sprite* p_sprite, unsigned int index); // index 0 is the bottom, anything past the top puts it on top
+            void remove(scratch::sprite* p_sprite);
+            void move(scratch::sprite* p_sprite, unsigned int index); // same clamping as insert
+            unsigned int get_index(scratch::sprite* p_sprite); // 0 is the bottom
+            scratch::sprite* get_sprite(unsigned int index); // nullptr past the top
+            unsigned int get_count();
+            const std::vector<scratch::sprite*>& get_draw_order(); // bottom to top
+        private:
+            struct layer_node
+            {
+                scratch::sprite* p_sprite;
+                unsigned int left; // node indices, 0 is no node
+                unsigned int right;
+                unsigned int parent;
+                unsigned int size; // nodes in the subtree, what positions are worked out from
+                unsigned int priority; // random, keeps the tree balanced. parents never have a lower priority than their children
+            };
+
+            unsigned int new_node(scratch::sprite* p_sprite);
+            void update(unsigned int node);
+            void split(unsigned int node, unsigned int count, unsigned int& left, unsigned int& right); // the first count nodes go left
+            unsigned int merge(unsigned int left, unsigned int right);
+            unsigned int detach(unsigned int index); // takes the node at index out of the tree and hands it back
+            void attach(unsigned int node, unsigned int index);
+
+            std::vector<layer_node> m_nodes; // node 0 is the empty tree, its size stays 0
+            std::vector<unsigned int> m_free_nodes; // left behind by removed sprites, clones come and go a lot
+            unsigned int m_root;
+            unsigned int m_random; // xorshift state for the priorities
+            std::vector<scratch::sprite*> m_draw_order;
+            bool m_draw_order_valid;
+    };
+    struct sprite_grid_stats // occupancy counters for tuning the cell size
+    {
+        unsigned int columns;
+        unsigned int rows;
+        double cell_size;
+        unsigned int sprite_count; // sprites with a costume to place
+        unsigned int cell_entries; // a sprite spanning several cells counts once per cell
+        unsigned int occupied_cells;
+        unsigned int max_cell_occupancy;
+        double mean_cell_occupancy; // over occupied cells only
+        unsigned long long updates; // position, size, direction and costume changes seen
+        unsigned long long relinks; // updates that moved the sprite to a different set of cells
+        unsigned long long queries;
+        unsigned long long candidates; // sprites handed back by all queries, divide by queries for the average visited
+    };
+    struct costume_set // what a sprite shares with all of its clones, freed along with the last of them
+    {
+        std::wstring name;
+        std::vector<scratch::costume*> costumes;
+        std::unordered_map<std::wstring, unsigned int> costume_map; // costume name to costume number
+        unsigned int references; // the sprite and its live clones, only touched by the thread running the engine
+    };
+    class sprite_grid // uniform grid over the render plane that sprites register their bounds in so queries only visit nearby sprites
+    {
+        public:
+            sprite_grid(double cell_size = SPRITE_GRID_DEFAULT_CELL_SIZE);
+            void update(scratch::sprite* p_sprite); // called by the sprite whenever its bounds may have changed
+            void remove(scratch::sprite* p_sprite);
+            void set_cell_size(double cell_size); // relinks every sprite already in the grid
+            void set_transform_store(scratch::transform_store* p_transforms); // queries bring its pending sprites into the grid first
+            // queries return every sprite whose bounds share a cell with the area, each sprite once. the list stays valid until the next query
+            const std::vector<scratch::sprite*>& query_point(double x, double y); // stage coordinates
+            const std::vector<scratch::sprite*>& query_box(double min_x, double min_y, double max_x, double max_y); // render plane coordinates
+            const std::vector<scratch::sprite*>& query_radius(double x, double y, double radius); // stage coordinates
+            scratch::sprite_grid_stats get_stats();
+        private:
+            int column_of(double x);
+            int row_of(double y);
+            void link(scratch::sprite* p_sprite);
+            void unlink(scratch::sprite* p_sprite);
+
+            scratch::transform_store* mp_transforms;
+            double m_cell_size;
+            int m_columns;
+            int m_rows;
+            std::vector<std::vector<scratch::sprite*>> m_cells; // row major, the outer ring of cells also holds whatever hangs off the stage
+            std::vector<scratch::sprite*> m_results;
+            unsigned int m_query_stamp; // sprites remember the last query that returned them so spanning sprites are only returned once
+            unsigned long long m_updates;
+            unsigned long long m_relinks;
+            unsigned long long m_queries;
+            unsigned long long m_candidates;
+    };
+    // the part of every engine sprite's state that decides where it is drawn, kept as one array per field indexed by the sprite's slot.
+    // setters only copy the new values in and flag the slot, update() then lays out every flagged sprite in passes over whole arrays
+    // (one pass over all slots once enough of them changed) and relinks them in the grid, so a sprite moved many times in a tick is laid
+    // out once. the sprite keeps its own copy of the values for its getters and for when it isn't in an engine
+    class transform_store
+    {
+        public:
+            transform_store(scratch::sprite_grid* p_grid);
+            ~transform_store(); // sprites still in the store are only detached
+            void mark(scratch::sprite* p_sprite); // see sprite::update_bounds, gives the sprite a slot if it has none
+            void remove(scratch::sprite* p_sprite);
+            void update(); // called by the engine before drawing and by grid queries
+            bool get(scratch::sprite* p_sprite, scratch::sprite_transform& transform); // lays out just this sprite if it is out of date
+        private:
+            void layout(unsigned int first, unsigned int last); // the slots from first up to but not including last
+
+            scratch::sprite_grid* mp_grid;
+            std::vector<scratch::sprite*> m_sprites; // nullptr for free slots
+            std::vector<unsigned int> m_free_slots;
+            std::vector<unsigned int> m_pending; // slots marked since the last update, each listed once
+            std::vector<unsigned char> m_listed; // slot is in m_pending
+            std::vector<unsigned char> m_stale; // slot's layout is out of date
+            // copied in by mark
+            std::vector<double> m_x; // render plane
+            std::vector<double> m_y;
+            std::vector<double> m_scale;
+            std::vector<double> m_rotation; // radians, cos and sin are only recomputed when it changes
+            std::vector<double> m_cos_rotation;
+            std::vector<double> m_sin_rotation;
+            std::vector<unsigned char> m_flip_x;
+            std::vector<double> m_costume_width; // 0 without a costume
+            std::vector<double> m_costume_height;
+            std::vector<double> m_center_x;
+            std::vector<double> m_center_y;
+            std::vector<double> m_source_width;
+            std::vector<double> m_source_height;
+            // worked out by layout, see sprite_transform
+            std::vector<double> m_width;
+            std::vector<double> m_height;
+            std::vector<double> m_origin_x;
+            std::vector<double> m_origin_y;
+            std::vector<double> m_u_scale;
+            std::vector<double> m_v_scale;
+            std::vector<double> m_min_x;
+            std::vector<double> m_min_y;
+            std::vector<double> m_max_x;
+            std::vector<double> m_max_y;
+    };
+    class costume_atlas // packs costume images into shared texture pages so that sprites with different costumes can be drawn without switching textures
+    {
+        public:
+            costume_atlas();
+            ~costume_atlas();
+            bool pack(Image image, Texture2D& page_texture, Rectangle& source_rect);
+            unsigned int get_page_count();
+        private:
+            struct atlas_page
+            {
+                Texture2D texture;
+                int shelf_x; // where the next image goes on the current shelf
+                int shelf_y;
+                int shelf_height;
+            };
+            std::vector<atlas_page> m_pages;
+    };
+    struct costume_level // a downsampled copy of a costume image on the GPU, level n is 2^n times smaller than the image
+    {
+        Texture2D texture; // id 0 until the costume is drawn small enough to use the level
+        Rectangle source_rect;
+        bool owns_texture;
+    };
+    class costume_asset // one image's pixels, collision mask and texture, shared by every costume showing that image
+    {
+        public:
+            costume_asset(Image image); // image becomes owned by the asset
+            ~costume_asset();
+            bool upload(scratch::costume_atlas* p_atlas); // false if there is no GPU to upload to
+            bool upload_level(unsigned int level, scratch::costume_atlas* p_atlas); // level 1 and up, the pixels are rebuilt from m_image every time so only the texture is kept
+            unsigned int get_level_count(); // downsampled levels the image can have, not counting the image itself
+            void unload_texture(); // also unloads the levels. atlas entries stay where they are, only textures of their own are freed
+            size_t get_texture_bytes(); // GPU memory held by textures of its own (levels included), atlas entries count as 0
+
+            unsigned long long m_hash; // content hash the cache files the asset under, 0 when not cached
+            Image m_image; // R8G8B8A8
+            std::vector<unsigned long long> m_mask; // one bit per pixel, set where the pixel is not fully transparent. rows are padded to whole words
+            int m_mask_words_per_row;
+            Texture2D m_texture; // id 0 until the asset is first drawn
+            Rectangle m_source_rect; // where the image lives inside m_texture
+            bool m_owns_texture; // false when m_texture is an atlas page shared with other assets
+            std::vector<scratch::costume_level> m_levels; // m_levels[n - 1] is level n, grown as the costume gets drawn smaller
+            unsigned int m_references; // costumes using the asset
+            unsigned long long m_last_drawn_frame; // for evicting the least recently drawn textures first
+        private:
+            void build_mask();
+    };
+    struct asset_cache_stats
+    {
+        unsigned int assets;
+        unsigned int resident_textures; // assets with a texture of their own currently on the GPU
+        unsigned long long hits; // images that turned out to be duplicates of a cached one
+        unsigned long long misses;
+        unsigned long long uploads;
+        unsigned long long level_uploads; // downsampled levels, also counted in uploads
+        unsigned long long evictions;
+        unsigned long long deferred_uploads; // draws skipped because the frame's upload budget was used up
+        size_t resident_bytes; // GPU memory held by textures of their own, atlas pages are not included
+        size_t budget_bytes;
+    };
+    class asset_cache // hands out costume assets keyed by the hash of their pixels so duplicated art is decoded, masked and uploaded once
+    {
+        public:
+            asset_cache(scratch::costume_atlas* p_atlas); // p_atlas may be nullptr, it must outlive the cache
+            ~asset_cache();
+            scratch::costume_asset* acquire(Image image); // image becomes owned by the cache, duplicates are freed right away
+            void release(scratch::costume_asset* p_asset);
+            // uploads on first use, call only from the thread owning the GPU context. forced uploads ignore the frame's upload budget
+            Texture2D get_texture(scratch::costume_asset* p_asset, bool forced = false);
+            Texture2D get_texture(scratch::costume_asset* p_asset, unsigned int level, Rectangle& source_rect, bool forced = false); // a downsampled level, level 0 is the image itself
+            void begin_frame();
+            void set_texture_budget(size_t budget_bytes);
+            void set_upload_budget(size_t bytes_per_frame); // costume pixels uploaded per frame, spreads the uploads of a freshly loaded project over several frames
+            scratch::asset_cache_stats get_stats();
+        private:
+            void evict(size_t needed_bytes);
+            void pick_oldest(scratch::costume_asset* p_asset, scratch::costume_asset*& p_oldest); // eviction candidate
+            bool reserve_upload(size_t image_bytes, bool forced); // false once the frame's upload budget is used up
+
+            scratch::costume_atlas* mp_atlas;
+            std::unordered_map<unsigned long long, scratch::costume_asset*> m_assets;
+            std::vector<scratch::costume_asset*> m_collided; // assets whose hash is taken by a different image, evicted and counted with the rest
+            unsigned long long m_frame;
+            size_t m_budget_bytes;
+            size_t m_upload_budget_bytes;
+            size_t m_frame_upload_bytes;
+            size_t m_resident_bytes;
+            unsigned long long m_hits;
+            unsigned long long m_misses;
+            unsigned long long m_uploads;
+            unsigned long long m_level_uploads;
+            unsigned long long m_evictions;
+            unsigned long long m_deferred_uploads;
+    };
     class costume
     {
         public:
             costume(std::wstring costume_name, Texture2D texture, double rotation_center_x, double rotation_center_y, double width, double height);
+            costume(std::wstring costume_name, Image image, double rotation_center_x, double rotation_center_y, double width, double height, scratch::asset_cache* p_cache = nullptr);
             ~costume();
             std::wstring get_costume_name();
-            Texture2D get_texture();
+            Texture2D get_texture(bool forced = false); // costumes made from an image are uploaded the first time this is called, see asset_cache::get_texture
+            Texture2D get_texture(double scale, Rectangle& source_rect, bool forced = false); // the smallest level that still has a texel per pixel at scale render plane pixels per costume unit
+            Rectangle get_source_rect();
+            bool has_image();
+            Image get_image();
             double get_rotation_center_x();
             double get_rotation_center_y();
             double get_width();
             double get_height();
+            bool has_mask();
+            const unsigned long long* get_mask_row(int y); // one bit per image pixel, set where the pixel is not fully transparent
+            int get_mask_width();
+            int get_mask_height();
 
         private:
             std::wstring m_costume_name;
-            Texture2D m_texture;
+            Texture2D m_texture; // only used by costumes made from a texture
+            scratch::costume_asset* mp_asset; // pixels of costumes made from an image, nullptr otherwise
+            scratch::asset_cache* mp_cache; // where mp_asset came from, nullptr if the costume owns it
             double m_rotation_center_x;
             double m_rotation_center_y;
             double m_width; // need native scratch width and height values since images will be loaded at the largest resolution available to ensure image quality
@@ -44,6 +433,7 @@ namespace scratch
             double get_effect(scratch::graphical_effect effect);
             void set_effect(scratch::graphical_effect effect, double value);
             void clear_effects();
+            bool get_effects(scratch::sprite_effects& effects); // false when every effect is off
             double get_x();
             void set_x(double value);
             double get_y();
@@ -57,17 +447,30 @@ namespace scratch
             unsigned int get_costume_number();
             void set_costume_number(unsigned int value);
             void set_costume_by_name(std::wstring p_name);
+            unsigned int get_costume_count();
+            bool has_costume(const std::wstring& name);
             scratch::costume* get_current_costume();
-            std::wstring get_name();
-            void raise_layer();
-            void lower_layer();
+            const std::wstring& get_name();
+            bool is_clone();
+            bool is_hidden();
+            void set_hidden(bool value);
+            bool get_transform(scratch::sprite_transform& transform); // false when there is nothing to draw
+            bool touches_point(double x, double y); // stage coordinates
+            bool touches_sprite(scratch::sprite* p_other);
+            bool touches_edge();
+            unsigned int get_layer(); // 1 is the bottom sprite like in Scratch, where the stage is layer 0. 0 when the sprite isn't in any layers
+            void change_layer(int offset); // positive goes forward, stops at the top or bottom
             void goto_top_layer();
             void goto_bottom_layer();
+            void insert_below(scratch::sprite* p_above);
+            void remove_from_layers();
 
-            scratch::sprite* mp_above; // sprite on the layer above
-            scratch::sprite* mp_below; // sprite on the layer below
-            bool m_hidden;
+            scratch::pen_state m_pen;
         private:
+            sprite(scratch::sprite* p_parent); // clone constructor, see sprite_pool
+            void update_bounds();
+            void damage();
+
             unsigned int m_costume_number; // needs to be private for safety (don't want users setting costume numbers to weird values)
             double m_size; // needs to be private due to clamping
             double mp_effects[static_cast<int>(scratch::graphical_effect::max)]; // needs to be private for pointer safety
@@ -75,13 +478,48 @@ namespace scratch
             double m_x; // needs to be private since position can be clamped
             double m_y; // ditto
             bool m_is_clone; // read only
-            std::wstring m_name; // read only
+            bool m_hidden; // private so the renderer hears about it
             scratch::rotation_mode m_rotation_mode; // private so that people don't set it to weird statically casted int values
-            std::vector<scratch::costume*> m_costumes;
-            std::unordered_map<std::wstring, unsigned int> m_costume_map;
-            scratch::sprite** mpp_bottom_layer_addy;
-            scratch::sprite** mpp_top_layer_addy;
+            scratch::costume_set* mp_costume_set; // shared with clones, holds the name too so clones don't need their own copy
+            scratch::layer_list* mp_layers; // set when the sprite is put into the engine's layers, nullptr otherwise
+            unsigned int m_layer_node; // the sprite's node in mp_layers
+            scratch::transform_store* mp_transforms; // set by the engine when the sprite is added
+            bool m_in_transforms;
+            unsigned int m_transform_slot;
+            scratch::sprite_grid* mp_grid; // set by the engine when the sprite is added
+            bool m_in_grid;
+            int mp_grid_cells[4]; // first column, first row, last column, last row the sprite is linked into
+            unsigned int m_grid_query_stamp;
+            scratch::stage_damage* mp_damage; // set by the engine when the sprite is added
+            bool m_damage_pending; // changed since the last frame, its old bounds are already in mp_damage
+            bool m_drawn; // m_drawn_bounds hold where the last frame showed the sprite
+            scratch::stage_box m_drawn_bounds;
 
         friend class scratch::scratch_engine;
+        friend class scratch::sprite_grid;
+        friend class scratch::sprite_pool;
+        friend class scratch::stage_damage;
+        friend class scratch::layer_list;
+        friend class scratch::transform_store;
+    };
+    class sprite_pool // hands out clone sprites from fixed size slabs so that once warmed up creating and deleting clones never touches the heap
+    {
+        public:
+            sprite_pool();
+            ~sprite_pool(); // only frees the slabs, every clone has to be released first
+            scratch::sprite* acquire(scratch::sprite* p_parent);
+            void release(scratch::sprite* p_clone); // also takes the clone out of its layer list and the grid
+            unsigned int get_live_count();
+            unsigned int get_capacity();
+        private:
+            union slot // free slots double as the links of the free list
+            {
+                slot* p_next_free;
+                alignas(scratch::sprite) unsigned char p_storage[sizeof(scratch::sprite)];
+            };
+
+            std::vector<slot*> m_slabs; // SPRITE_POOL_SLAB_SIZE slots each
+            slot* mp_free;
+            unsigned int m_live_count;
     };
 }
\ No newline at end of file
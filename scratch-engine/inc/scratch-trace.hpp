@@ -0,0 +1,57 @@
+/*
+File: scratch-trace.hpp
+Description: Compile time gated tracing of hot paths in CScratch, exported as Chrome trace event JSON
+*/
+
+#pragma once
+
+#include "scratch-config.hpp"
+#include <atomic>
+
+// tracing only exists when CSCRATCH_TRACING is defined (cmake -DCSCRATCH_ENABLE_TRACING=ON)
+// otherwise SCRATCH_TRACE_SCOPE expands to nothing and its argument is never evaluated
+#ifdef CSCRATCH_TRACING
+#define SCRATCH_TRACE_CONCAT_INNER(a, b) a##b
+#define SCRATCH_TRACE_CONCAT(a, b) SCRATCH_TRACE_CONCAT_INNER(a, b)
+#define SCRATCH_TRACE_SCOPE(name) scratch::trace_scope SCRATCH_TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#else
+#define SCRATCH_TRACE_SCOPE(name)
+#endif
+
+namespace scratch
+{
+    struct trace_event
+    {
+        const char* p_name; // must point at a string that outlives the trace (string literals)
+        unsigned long long start_ns;
+        unsigned long long duration_ns;
+    };
+
+    class trace_buffer // fixed size ring buffer of events, written only by the thread that owns it
+    {
+        public:
+            trace_buffer(unsigned int thread_id);
+            void record(const char* p_name, unsigned long long start_ns, unsigned long long duration_ns);
+            unsigned int get_thread_id();
+            unsigned long long get_event_count(); // total events ever written, the buffer only holds the last TRACE_BUFFER_EVENT_COUNT
+            trace_event get_event(unsigned long long index);
+        private:
+            trace_event mp_events[TRACE_BUFFER_EVENT_COUNT];
+            std::atomic<unsigned long long> m_head; // next slot to write, only ever grows
+            unsigned int m_thread_id;
+    };
+
+    class trace_scope // records the time between its construction and destruction into the calling thread's trace buffer
+    {
+        public:
+            trace_scope(const char* p_name);
+            ~trace_scope();
+        private:
+            const char* mp_name;
+            unsigned long long m_start_ns;
+    };
+
+    unsigned long long trace_now_ns();
+    trace_buffer* trace_get_thread_buffer();
+    bool trace_export_chrome_json(const char* p_path);
+}
@@ -5,9 +5,57 @@ Description: Contains utility functions not strictly related to the scratch engi
 
 #pragma once
 
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
 namespace scratch_util
 {
     int round(double value);
+    unsigned long long fnv1a_64(const void* p_data, size_t size);
+    int key_name_to_keycode(const std::wstring& name);
     double stage_to_screen_x_coordinate(double scratch_x);
     double stage_to_screen_y_coordinate(double scratch_y);
+    void clip_span(double start, double step, double limit, double& t_min, double& t_max);
+
+    class thread_pool // fixed set of worker threads taking tasks off a shared queue in the order they were submitted
+    {
+        public:
+            thread_pool(unsigned int thread_count); // 0 uses one thread per hardware thread
+            ~thread_pool(); // runs whatever is still queued, then joins the workers
+            void submit(std::function<void()> task);
+            void wait(); // blocks until every submitted task has finished
+            unsigned int get_thread_count();
+        private:
+            void work();
+
+            std::vector<std::thread> m_threads;
+            std::deque<std::function<void()>> m_tasks;
+            std::mutex m_mutex;
+            std::condition_variable m_task_ready;
+            std::condition_variable m_tasks_done;
+            unsigned int m_running_tasks;
+            bool m_stopping;
+    };
+
+    class mapped_file // read only view of a whole file, memory mapped where possible so only the parts that are touched get paged in
+    {
+        public:
+            mapped_file();
+            ~mapped_file();
+            bool open(const char* p_path); // falls back to reading the file into memory if it can't be mapped
+            void close();
+            const unsigned char* get_data();
+            size_t get_size();
+        private:
+            const unsigned char* mp_data;
+            size_t m_size;
+            bool m_mapped; // false when mp_data is a heap copy
+            void* mp_mapping; // mapping handle on windows, unused elsewhere
+    };
 }
\ No newline at end of file
@@ -0,0 +1,88 @@
+/*
+File: scratch-vm-ops.hpp
+Description: The logic behind Scratch blocks that is shared by the bytecode interpreter and natively compiled scripts so both behave the same
+*/
+
+#pragma once
+
+#include "scratch-vm.hpp"
+#include "scratch-render.hpp"
+#include <cmath>
+#include <string>
+
+namespace scratch
+{
+    namespace vm_ops
+    {
+        const int list_index_invalid = 0;
+        const int list_index_all = -1;
+
+        inline double next_random(scratch::vm_context& context) // xorshift64*, returns [0, 1)
+        {
+            unsigned long long state = context.random_state;
+            state ^= state >> 12;
+            state ^= state << 25;
+            state ^= state >> 27;
+            context.random_state = state;
+            return ((state * 2685821657736338717ULL) >> 11) * (1.0 / 9007199254740992.0);
+        }
+
+        // Scratch only lets the scheduler run another pass over its threads in the same frame when nothing visible changed
+        inline void request_redraw(scratch::vm_context& context, scratch::sprite* p_sprite)
+        {
+            context.redraw_requested = context.redraw_requested || !p_sprite->is_hidden();
+        }
+
+        // list operands are the sprite's slot, or ~slot for a list on the stage
+        inline scratch::scratch_list& get_list(scratch::vm_target* p_target, int operand)
+        {
+            return operand >= 0 ? p_target->m_lists[operand] : p_target->mp_stage->m_lists[~operand];
+        }
+
+        inline bool to_boolean(double value) // same as scratch_state::to_boolean for a number
+        {
+            return value != 0.0 && !std::isnan(value);
+        }
+
+        inline int compare_numbers(double left, double right) // same as scratch_state::compare for two numbers
+        {
+            if (!std::isnan(left) && !std::isnan(right))
+            {
+                return left < right ? -1 : (left > right ? 1 : 0);
+            }
+            return scratch::scratch_state(left).compare(scratch::scratch_state(right));
+        }
+
+        inline double mod(double dividend, double divisor) // the result takes the sign of the divisor
+        {
+            dividend = fmod(dividend, divisor);
+            if (dividend != 0.0 && (dividend < 0.0) != (divisor < 0.0))
+            {
+                dividend += divisor;
+            }
+            return dividend;
+        }
+
+        // turns a Scratch list index ("last", "random", a number) into 1..length, or list_index_invalid / list_index_all
+        int resolve_list_index(const scratch::scratch_state& index, int length, bool accept_all, scratch::vm_context& context);
+        int find_list_item(const scratch::scratch_list& list, const scratch::scratch_state& item);
+        void list_delete(scratch::scratch_list& list, const scratch::scratch_state& index, scratch::vm_context& context);
+        void list_insert(scratch::scratch_list& list, const scratch::scratch_state& index, const scratch::scratch_state& item, scratch::vm_context& context);
+        void list_replace(scratch::scratch_list& list, const scratch::scratch_state& index, const scratch::scratch_state& item, scratch::vm_context& context);
+        scratch::scratch_state list_item(const scratch::scratch_list& list, const scratch::scratch_state& index, scratch::vm_context& context);
+        scratch::scratch_state list_contents(const scratch::scratch_list& list);
+
+        double pick_random(const scratch::scratch_state& from, const scratch::scratch_state& to, scratch::vm_context& context);
+        double apply_math_op(scratch::vm_math_op op, double value);
+        scratch::scratch_state letter_of(double index, const std::wstring& text);
+        bool contains_ignore_case(const std::wstring& text, const std::wstring& part);
+
+        void move_pen(scratch::vm_context& context, scratch::sprite* p_sprite, double old_x, double old_y);
+        void switch_costume(scratch::sprite* p_sprite, const scratch::scratch_state& value);
+        Color to_color(const scratch::scratch_state& value);
+        void set_pen_color(scratch::pen_state& pen, Color color);
+        void set_pen_param(scratch::pen_state& pen, const scratch::scratch_state& param, double value, bool change);
+        bool key_pressed(const scratch::scratch_state& key, scratch::vm_context& context);
+        bool touching_object(scratch::sprite* p_sprite, const std::wstring& name, scratch::vm_context& context);
+    }
+}
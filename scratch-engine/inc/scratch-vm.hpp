@@ -1,32 +1,475 @@
 /*
-File: scratch-jobs.hpp
+File: scratch-vm.hpp
 Description: Contains all structs and classes related to the CScratch VM
 */
 
 #pragma once
 
 #include "scratch-enums.hpp"
+#include "scratch-config.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
 #include <string>
 #include <vector>
+#include <unordered_map>
 
 namespace scratch
 {
-    struct scratch_state
+    class sprite;
+    class sprite_grid;
+    class pen_layer;
+    class layer_list;
+    class input_tracker;
+    class vm_target;
+    struct vm_context;
+
+    // text too long to fit inside a scratch_state. equal texts are interned to one scratch_string shared by every value holding it,
+    // so two long strings are the same text exactly when they point at the same scratch_string
+    struct scratch_string
+    {
+        std::atomic<unsigned int> references;
+        std::wstring text;
+        unsigned long long hash; // of the exact text, finds the string in the intern table
+        unsigned long long folded_hash; // of the lower cased text, strings Scratch compares as equal text share it
+        std::atomic<unsigned long long> number_bits; // the text parsed as a number, NaN when it isn't one, STRING_NUMBER_UNPARSED until needed
+    };
+
+    // a Scratch value in 16 bytes, cheap to copy so variables, list items and the VM stack can hold it directly
+    // the first word is NaN-boxed: doubles are stored as is (NaNs are canonicalized) and the negative quiet NaN space
+    // carries a type tag plus a 48 bit payload for booleans, colors and strings. strings of up to 6 UTF-16 code units
+    // are stored inline across the payload and the second word, longer ones point at a refcounted, interned scratch_string
+    class scratch_state
+    {
+        public:
+            scratch_state();
+            scratch_state(double value);
+            scratch_state(bool value);
+            scratch_state(const std::wstring& value);
+            scratch_state(const wchar_t* p_value);
+            scratch_state(const scratch_state& other);
+            scratch_state(scratch_state&& other) noexcept;
+            ~scratch_state();
+            scratch_state& operator=(const scratch_state& other);
+            scratch_state& operator=(scratch_state&& other) noexcept;
+            static scratch_state make_color(unsigned char r, unsigned char g, unsigned char b);
+
+            scratch::state_type get_type() const;
+            bool is_number() const;
+            bool is_string() const;
+            double get_number() const; // the raw double, only meaningful when is_number()
+            bool string_equals(const wchar_t* p_text) const; // exact match against a string value, false for other types
+
+            // conversions follow Scratch's casting rules (invalid numbers become 0, "false"/"0"/"" are false, etc)
+            double to_number() const;
+            bool to_boolean() const;
+            std::wstring to_string() const;
+            bool is_whitespace() const;
+            int compare(const scratch_state& other) const; // Scratch's < = > ordering: numeric if both sides are numbers, case insensitive text otherwise
+            bool equals(const scratch_state& other) const;
+        private:
+            static const unsigned long long BOX_BOOLEAN = 0xFFF9000000000000ULL;
+            static const unsigned long long BOX_COLOR = 0xFFFA000000000000ULL;
+            static const unsigned long long BOX_SHORT_STRING = 0xFFFB000000000000ULL;
+            static const unsigned long long BOX_LONG_STRING = 0xFFFC000000000000ULL;
+            static const unsigned long long BOX_TAG_MASK = 0xFFFF000000000000ULL;
+            static const unsigned long long BOX_PAYLOAD_MASK = 0x0000FFFFFFFFFFFFULL;
+            static const unsigned int INLINE_LENGTH = 6;
+
+            void assign_string(const wchar_t* p_text, size_t length);
+            void release();
+            scratch::scratch_string* get_long_string() const;
+            double get_long_number() const; // the cached parse of a long string, NaN for text that isn't a number (including whitespace)
+            double get_compare_number() const; // what compare sees, NaN for anything that compares as text
+            size_t get_short_string(wchar_t* p_buffer) const; // decodes an inline string, p_buffer needs INLINE_LENGTH entries
+
+            unsigned long long m_bits; // NaN-boxed double or tag + payload
+            unsigned long long m_inline; // first 4 code units of an inline string, 0 otherwise
+    };
+    static_assert(sizeof(scratch_state) <= 16, "scratch_state must stay within two words");
+
+    inline scratch_state::scratch_state()
+    {
+        m_bits = 0; // +0.0
+        m_inline = 0;
+    }
+
+    inline scratch_state::scratch_state(double value)
+    {
+        if (value != value) // every NaN becomes the positive quiet NaN so no payload can alias a boxed tag
+        {
+            m_bits = 0x7FF8000000000000ULL;
+        }
+        else
+        {
+            memcpy(&m_bits, &value, sizeof(m_bits));
+        }
+        m_inline = 0;
+    }
+
+    inline scratch_state::scratch_state(bool value)
+    {
+        m_bits = BOX_BOOLEAN | (value ? 1 : 0);
+        m_inline = 0;
+    }
+
+    inline scratch_state::scratch_state(const scratch_state& other)
+    {
+        m_bits = other.m_bits;
+        m_inline = other.m_inline;
+        if ((m_bits & BOX_TAG_MASK) == BOX_LONG_STRING)
+        {
+            get_long_string()->references.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    inline scratch_state::scratch_state(scratch_state&& other) noexcept
+    {
+        m_bits = other.m_bits;
+        m_inline = other.m_inline;
+        other.m_bits = 0;
+        other.m_inline = 0;
+    }
+
+    inline scratch_state::~scratch_state()
+    {
+        if ((m_bits & BOX_TAG_MASK) == BOX_LONG_STRING)
+        {
+            release();
+        }
+    }
+
+    inline scratch_state& scratch_state::operator=(const scratch_state& other)
+    {
+        unsigned long long bits = other.m_bits; // read before releasing, other may be *this
+        unsigned long long inline_units = other.m_inline;
+
+        if ((bits & BOX_TAG_MASK) == BOX_LONG_STRING) // taking the reference first makes self assignment safe
+        {
+            other.get_long_string()->references.fetch_add(1, std::memory_order_relaxed);
+        }
+        if ((m_bits & BOX_TAG_MASK) == BOX_LONG_STRING)
+        {
+            release();
+        }
+        m_bits = bits;
+        m_inline = inline_units;
+        return *this;
+    }
+
+    inline scratch_state& scratch_state::operator=(scratch_state&& other) noexcept
     {
-        union
+        if (this != &other)
         {
-            std::wstring string_data;
-            std::vector<scratch::scratch_state> list_data;
-            double number_data;
-            bool boolean_data;
-            struct
+            if ((m_bits & BOX_TAG_MASK) == BOX_LONG_STRING)
+            {
+                release();
+            }
+            m_bits = other.m_bits;
+            m_inline = other.m_inline;
+            other.m_bits = 0;
+            other.m_inline = 0;
+        }
+        return *this;
+    }
+
+    inline bool scratch_state::is_number() const
+    {
+        return m_bits < BOX_BOOLEAN; // every double sorts below the first boxed tag once NaNs are canonicalized
+    }
+
+    inline bool scratch_state::is_string() const
+    {
+        return (m_bits & BOX_TAG_MASK) == BOX_SHORT_STRING || (m_bits & BOX_TAG_MASK) == BOX_LONG_STRING;
+    }
+
+    inline double scratch_state::get_number() const
+    {
+        double value = 0.0;
+
+        memcpy(&value, &m_bits, sizeof(value));
+        return value;
+    }
+
+    inline scratch_string* scratch_state::get_long_string() const
+    {
+        return reinterpret_cast<scratch::scratch_string*>(static_cast<uintptr_t>(m_bits & BOX_PAYLOAD_MASK));
+    }
+
+    // a Scratch list, stored in chunks of up to LIST_CHUNK_SIZE items so inserting or deleting near the front only moves one chunk.
+    // while every item is a number the chunks hold plain doubles, the first item that isn't turns them into scratch_states
+    // until the list is emptied again. indexes are 0 based here, the list blocks' 1 based indexes are resolved in vm_ops
+    class scratch_list
+    {
+        public:
+            scratch_list();
+            size_t size() const;
+            bool empty() const;
+            bool is_numeric() const; // true while the items are stored as doubles
+            scratch::scratch_state get(size_t index) const;
+            void set(size_t index, const scratch::scratch_state& item);
+            void push_back(const scratch::scratch_state& item);
+            void insert(size_t index, const scratch::scratch_state& item); // index can be size() to append
+            void erase(size_t index);
+            void clear();
+            int find(const scratch::scratch_state& item) const; // 1 based position of the first item that equals item, 0 if there is none
+        private:
+            void locate(size_t index, size_t& chunk, size_t& offset) const;
+            size_t get_chunk_size(size_t chunk) const;
+            void make_generic();
+            void split_chunk(size_t chunk);
+            void remove_chunk(size_t chunk);
+
+            std::vector<std::vector<double>> m_number_chunks; // used while numeric
+            std::vector<std::vector<scratch::scratch_state>> m_value_chunks; // used otherwise
+            std::vector<size_t> m_chunk_starts; // index of each chunk's first item
+            size_t m_size;
+            bool m_numeric;
+            mutable size_t m_last_chunk; // loops walk lists in order, so the chunk found last time is checked first
+    };
+
+    double string_to_number(const std::wstring& text); // NaN when text is not a number
+    std::wstring number_to_string(double value); // formats like JavaScript's Number.toString
+    bool string_equals_ignore_case(const std::wstring& a, const std::wstring& b);
+
+    struct script_mutation // extra data attached to procedure blocks
+    {
+        std::wstring proccode; // eg "jump %s times"
+        std::vector<std::wstring> argument_ids;
+        std::vector<std::wstring> argument_names;
+        bool warp; // run without screen refresh
+    };
+
+    // a block in a script, mirrors a block in project.json
+    // inputs and the next block are owned by the node. substacks are inputs named SUBSTACK and SUBSTACK2
+    // constants are nodes with the opcode "literal"
+    class script_node
+    {
+        public:
+            script_node(std::string opcode);
+            ~script_node();
+            static script_node* make_literal(scratch::scratch_state value);
+            void add_input(std::string name, scratch::script_node* p_node);
+            void add_field(std::string name, std::wstring value);
+            scratch::script_node* get_input(const std::string& name);
+            const std::wstring* get_field(const std::string& name);
+
+            std::string m_opcode;
+            scratch::scratch_state m_literal;
+            std::vector<std::pair<std::string, scratch::script_node*>> m_inputs;
+            std::vector<std::pair<std::string, std::wstring>> m_fields;
+            scratch::script_mutation m_mutation;
+            scratch::script_node* mp_next;
+    };
+
+    struct vm_instruction
+    {
+        scratch::vm_opcode opcode;
+        int operand;
+    };
+
+    struct vm_script_entry
+    {
+        scratch::vm_hat hat;
+        std::wstring hat_parameter; // key name or broadcast name
+        unsigned int entry; // index of the first instruction
+    };
+
+    struct vm_procedure
+    {
+        std::wstring proccode;
+        unsigned int entry;
+        unsigned int argument_count;
+        bool warp;
+    };
+
+    struct vm_call_frame
+    {
+        unsigned int return_pc;
+        unsigned int argument_base; // stack index of the first argument
+        int procedure;
+        bool warp;
+    };
+
+    struct vm_thread_state // everything a thread resumes from, shared by the interpreter and natively compiled scripts
+    {
+        scratch::vm_target* p_target;
+        unsigned int entry;
+        unsigned int pc;
+        bool done;
+        bool waiting;
+        double wait_until;
+        unsigned int warp_loops; // loop iterations run in warp mode, the clock is only checked every VM_WARP_CHECK_INTERVAL of them
+        std::vector<scratch::scratch_state> stack;
+        std::vector<scratch::vm_call_frame> frames;
+    };
+
+    // a program's bytecode translated to C++ ahead of time (see vm_transpiler), runs a thread exactly like vm_thread::step would
+    typedef scratch::job_status (*vm_native_step)(scratch::vm_thread_state& thread, scratch::vm_context& context);
+
+    class vm_program // flat bytecode for every script of one sprite
+    {
+        public:
+            std::vector<scratch::vm_instruction> m_code;
+            std::vector<scratch::scratch_state> m_constants;
+            std::vector<scratch::vm_script_entry> m_scripts;
+            std::vector<scratch::vm_procedure> m_procedures;
+            std::vector<std::string> m_unsupported_opcodes; // blocks that were compiled as no-ops
+            scratch::vm_native_step m_native_step = nullptr; // runs instead of the interpreter when set, see vm_bind_native
+    };
+
+    class vm_target // a sprite (or the stage) as seen by scripts: its variables, lists and bytecode
+    {
+        public:
+            vm_target(scratch::sprite* p_sprite, scratch::vm_target* p_stage);
+            ~vm_target();
+            unsigned int declare_variable(const std::wstring& name, scratch::scratch_state value);
+            unsigned int declare_list(const std::wstring& name);
+            int find_variable(const std::wstring& name);
+            int find_list(const std::wstring& name);
+            void make_clone_of(scratch::vm_target* p_parent, scratch::sprite* p_sprite); // copies the parent's variables and lists, shares its program
+            bool is_clone();
+
+            scratch::sprite* mp_sprite; // nullptr for the stage
+            scratch::vm_target* mp_stage; // where global variables live, points to itself for the stage
+            scratch::vm_target* mp_original; // target the clone was made from (a clone of a clone points at the first one), nullptr if not a clone
+            scratch::vm_program* mp_program; // owned unless this is a clone
+            std::vector<scratch::scratch_state> m_variables;
+            std::vector<scratch::scratch_list> m_lists;
+        private:
+            std::unordered_map<std::wstring, unsigned int> m_variable_slots;
+            std::unordered_map<std::wstring, unsigned int> m_list_slots;
+    };
+
+    struct vm_broadcast // a broadcast sent by a script, the receivers are started once the sending thread yields
+    {
+        std::wstring name;
+        bool wait; // broadcast and wait, the sender stays parked until every script it started has finished
+    };
+
+    struct vm_context // everything outside of a thread that a running script can see, kept up to date by whoever runs the threads
+    {
+        double current_time; // seconds
+        double timer_start;
+        scratch::input_tracker* p_input; // keyboard and mouse, may be nullptr
+        scratch::layer_list* p_layers; // every sprite, for touching queries, may be nullptr
+        scratch::sprite_grid* p_sprite_grid; // broad phase for touching queries, the layer list is walked instead when nullptr
+        scratch::pen_layer* p_pen_layer; // where pen blocks draw, they do nothing when nullptr
+        std::vector<scratch::vm_broadcast>* p_broadcasts; // broadcasts sent since the runner last looked, may be nullptr
+        scratch::scratch_state clone_option; // what the last create clone block asked for, read by the runner on signal_create_clone
+        unsigned long long random_state; // xorshift state for pick random, must not be 0
+        std::chrono::steady_clock::time_point warp_deadline; // warped loops yield anyway once this passes so a runaway script can't freeze the engine
+        bool redraw_requested; // set whenever a script changes something visible on the stage
+    };
+
+    class vm_compiler // turns script trees into a target's bytecode. variable and list names are resolved to slots at compile time
+    {
+        public:
+            vm_compiler(scratch::vm_target* p_target);
+            bool add_script(scratch::script_node* p_hat);
+            bool finish();
+        private:
+            struct pending_call
             {
-                unsigned char r;
-                unsigned char g;
-                unsigned char b;
-                unsigned char reserved;
-            } color_data;
-        };
-        scratch::state_type type;
+                unsigned int instruction;
+                std::wstring proccode;
+            };
+
+            void emit(scratch::vm_opcode opcode, int operand = 0);
+            unsigned int add_constant(const scratch::scratch_state& value);
+            void compile_stack(scratch::script_node* p_block);
+            void compile_block(scratch::script_node* p_block);
+            void compile_reporter(scratch::script_node* p_node);
+            void compile_input(scratch::script_node* p_block, const std::string& name);
+            void compile_number_input(scratch::script_node* p_block, const std::string& name);
+            void compile_procedure(scratch::script_node* p_definition);
+            void compile_unsupported(scratch::script_node* p_block);
+            int resolve_variable(scratch::script_node* p_block, bool& is_global);
+            int resolve_list(scratch::script_node* p_block);
+            std::wstring get_field_text(scratch::script_node* p_block, const std::string& name);
+
+            scratch::vm_target* mp_target;
+            scratch::vm_program* mp_program;
+            std::vector<std::wstring>* mp_argument_names; // arguments of the procedure being compiled
+            std::vector<pending_call> m_pending_calls;
+            std::unordered_map<std::wstring, unsigned int> m_constant_lookup;
+    };
+
+    struct vm_native_program // one target's natively compiled program, listed by the code vm_transpiler writes
+    {
+        const wchar_t* p_target_name; // nullptr for the stage
+        unsigned long long fingerprint; // vm_fingerprint of the target it was compiled from
+        scratch::vm_native_step step;
+        const unsigned int* p_number_variables; // variable slots the code reads as plain doubles, they have to hold numbers when binding
+        unsigned int number_variable_count;
+    };
+
+    unsigned long long vm_fingerprint(scratch::vm_target* p_target); // covers the bytecode, constants, procedures and variable and list slots
+    // hands natively compiled programs to the targets they were compiled from, all of them or none. false (and nothing bound) if any
+    // target's program differs from the one that was compiled, the project then keeps running on the interpreter
+    bool vm_bind_native(const std::vector<scratch::vm_target*>& targets, const scratch::vm_native_program* p_programs, unsigned int count);
+
+    // turns every target's bytecode into C++ ahead of time. the code mirrors the interpreter instruction by instruction, but values between
+    // instructions live in typed locals instead of on the thread's stack and every yield becomes a return plus a case in a switch that resumes
+    // from the same pc, so threads still take turns exactly like Scratch's. variables that only ever hold numbers are read as plain doubles
+    class vm_transpiler
+    {
+        public:
+            vm_transpiler(const std::vector<scratch::vm_target*>& targets); // clones are skipped
+            std::string transpile(const std::string& bind_function); // a whole translation unit, bool bind_function(scratch_engine*) binds it
+            unsigned int get_number_variable_count(); // variables found to only ever hold numbers
+        private:
+            struct stack_entry // a value the generated code keeps in a local (or a literal) instead of on the thread's stack
+            {
+                scratch::vm_value_kind kind;
+                std::string expression;
+                bool constant;
+                scratch::scratch_state literal; // the value when constant
+            };
+
+            void analyze();
+            std::string write_program(unsigned int index);
+            void write_instruction(unsigned int pc);
+            void write_line(const std::string& line);
+            unsigned char* find_number_variable(bool global, int slot); // nullptr for slots that don't exist
+            void push(scratch::vm_value_kind kind, const std::string& expression);
+            void push_constant(unsigned int index);
+            stack_entry pop();
+            void flush(); // moves the locals onto the thread's stack, done wherever the interpreter's stack has to be exact
+            std::string as_number(const stack_entry& entry);
+            std::string as_boolean(const stack_entry& entry);
+            std::string as_value(const stack_entry& entry); // an rvalue
+            std::string as_string(const stack_entry& entry);
+            std::string resume(unsigned int pc, const std::string& status); // saves where to continue and returns from the function
+
+            std::vector<scratch::vm_target*> m_targets;
+            int m_stage_index;
+            std::vector<std::vector<unsigned char>> m_number_variables; // per target and slot
+            bool m_analyzing;
+            bool m_changed; // the analysis found another variable that can hold something other than a number
+            // the program being written
+            scratch::vm_target* mp_target;
+            scratch::vm_program* mp_program;
+            std::vector<unsigned char> m_leaders; // instructions that start a block: jump targets, entry points and resume points
+            std::vector<int> m_procedures; // the procedure each instruction belongs to, -1 for top level scripts
+            std::vector<scratch::vm_transpiler::stack_entry> m_cache; // the top of the stack, what isn't here is on the thread's stack
+            std::string m_code;
+            unsigned int m_temporaries;
+    };
+
+    class vm_thread // one running script
+    {
+        public:
+            vm_thread(scratch::vm_target* p_target, unsigned int entry);
+            void reset(scratch::vm_target* p_target, unsigned int entry); // starts the thread over on another script, keeping its stack storage
+            scratch::job_status step(scratch::vm_context& context);
+            bool is_done();
+            bool is_warp();
+            bool is_waiting(); // yielded inside a wait block that has not elapsed yet
+            unsigned int get_entry();
+            scratch::vm_target* get_target();
+        private:
+            scratch::vm_thread_state m_state;
     };
 }
\ No newline at end of file
@@ -0,0 +1,85 @@
+/*
+File: input-test.cpp
+Description: Feeds events through a queued_input_source into an input_tracker and checks the state scripts would see
+*/
+
+#include "scratch-input.hpp"
+#include <cstdio>
+
+using namespace scratch;
+
+namespace
+{
+    unsigned int g_fails = 0;
+
+    void check(bool condition, const char* p_what)
+    {
+        if (!condition)
+        {
+            printf("input-test: %s failed\n", p_what);
+            ++g_fails;
+        }
+    }
+
+    // what input_job does every frame: collect from the source, then apply everything in order
+    void run_frame(input_source& source, input_tracker& tracker)
+    {
+        std::vector<input_event> events;
+
+        source.collect(events);
+        for (const input_event& event : events)
+        {
+            tracker.apply(event);
+        }
+    }
+}
+
+int main()
+{
+    queued_input_source source;
+    input_source empty_source;
+    input_tracker tracker;
+    std::vector<input_event> events;
+
+    empty_source.collect(events);
+    check(events.empty(), "the default source has no events");
+
+    // nothing reaches the tracker until the frame collects it
+    source.push(input_event{input_event_type::key_down, KEY_SPACE, 0.0, 0.0});
+    source.push(input_event{input_event_type::key_down, KEY_A, 0.0, 0.0});
+    check(!tracker.is_key_down(KEY_SPACE), "events wait for the next frame");
+    run_frame(source, tracker);
+    check(tracker.is_key_down(KEY_SPACE) && tracker.is_key_down(KEY_A) && tracker.is_key_down(-1), "key downs are held");
+    check(tracker.get_pending().size() == 2 && tracker.get_pending()[0].key == KEY_SPACE && tracker.get_pending()[1].key == KEY_A, "presses are pending in order");
+    tracker.clear_pending();
+    run_frame(source, tracker);
+    check(tracker.get_pending().empty() && tracker.is_key_down(KEY_SPACE), "the queue is emptied by collecting it");
+
+    // repeats start hats again but count as one held key
+    source.push(input_event{input_event_type::key_down, KEY_A, 0.0, 0.0});
+    source.push(input_event{input_event_type::key_up, KEY_SPACE, 0.0, 0.0});
+    source.push(input_event{input_event_type::key_up, KEY_SPACE, 0.0, 0.0});
+    run_frame(source, tracker);
+    check(tracker.get_pending().size() == 1 && !tracker.is_key_down(KEY_SPACE) && tracker.is_key_down(-1), "repeats and releases");
+    tracker.clear_pending();
+    source.push(input_event{input_event_type::key_up, KEY_A, 0.0, 0.0});
+    source.push(input_event{input_event_type::key_down, SCRATCHK_MAX_KEYCODE, 0.0, 0.0});
+    source.push(input_event{input_event_type::key_down, -5, 0.0, 0.0});
+    run_frame(source, tracker);
+    check(!tracker.is_key_down(-1) && tracker.get_pending().empty(), "keycodes out of range are ignored");
+
+    // the mouse keeps the position of the last event, only downs are pending
+    source.push(input_event{input_event_type::mouse_move, 0, 12.5, -30.25});
+    run_frame(source, tracker);
+    check(tracker.get_mouse_x() == 12.5 && tracker.get_mouse_y() == -30.25 && !tracker.is_mouse_down(), "mouse moves");
+    source.push(input_event{input_event_type::mouse_down, 0, 3.0, 4.0});
+    run_frame(source, tracker);
+    check(tracker.is_mouse_down() && tracker.get_mouse_x() == 3.0 && tracker.get_pending().size() == 1, "mouse downs");
+    tracker.clear_pending();
+    source.push(input_event{input_event_type::mouse_up, 0, -240.0, 180.0});
+    run_frame(source, tracker);
+    check(!tracker.is_mouse_down() && tracker.get_mouse_x() == -240.0 && tracker.get_mouse_y() == 180.0 && tracker.get_pending().empty(), "mouse ups");
+
+    printf("input-test: %u failures\n", g_fails);
+    return g_fails == 0 ? 0 : 1;
+}
@@ -0,0 +1,107 @@
+/*
+File: intern-test.cpp
+Description: Has several threads intern, copy, release and parse the same long strings at once, build it with
+             -fsanitize=thread to have the refcounts and the lazy number cache checked for races too
+*/
+
+#include "scratch-vm.hpp"
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace scratch;
+
+namespace
+{
+    const unsigned int THREAD_COUNT = 8;
+    const unsigned int STEP_COUNT = 100000;
+
+    // equals is a shortcut for compare() == 0, both must agree for every pair whatever the representation
+    unsigned int check_equals(const std::vector<scratch_state>& values)
+    {
+        unsigned int fails = 0;
+
+        for (const scratch_state& a : values)
+        {
+            for (const scratch_state& b : values)
+            {
+                fails += a.equals(b) != (a.compare(b) == 0) ? 1 : 0;
+            }
+        }
+        return fails;
+    }
+
+    // every thread builds the same few texts independently, so the strings are interned, shared, released down to nothing
+    // and interned again while other threads hold them. the shared values are parsed for the first time by all threads at once
+    void hammer(unsigned int seed, const std::vector<scratch_state>* p_shared, std::atomic<unsigned int>* p_fails)
+    {
+        unsigned long long random = 1234567 + seed;
+        unsigned int fails = 0;
+
+        for (unsigned int step = 0; step < STEP_COUNT; ++step)
+        {
+            random ^= random << 13;
+            random ^= random >> 7;
+            random ^= random << 17;
+
+            std::wstring text = L"shared text value #" + std::to_wstring(random % 16);
+            scratch_state a(text);
+            scratch_state b = a;
+            scratch_state c(text);
+            scratch_state number(std::to_wstring(random % 7) + L".0000000000");
+            const scratch_state& shared = (*p_shared)[random % p_shared->size()];
+
+            fails += c.equals(a) && b.compare(c) == 0 && c.to_number() == 0.0 ? 0 : 1;
+            fails += number.to_number() == (double)(random % 7) ? 0 : 1;
+            fails += shared.to_number() == (double)(&shared - p_shared->data()) ? 0 : 1;
+            b = number; // drops a reference while the other threads may be taking one
+        }
+        *p_fails += fails;
+    }
+}
+
+int main()
+{
+    const wchar_t* p_samples[] = {L"hello world", L"HELLO WORLD", L"Hello World", L"1.0000000", L"1.00000000000", L"   1e3   ", L"1000.0000",
+        L"        ", L"         ", L"Infinity000", L"  Infinity ", L"-Infinity  ", L"0x1000000", L"4096.000000", L"abcdefgh", L"ABCDEFGH",
+        L"ÉCOLE MAT", L"école mat", L"12345678", L"1", L"", L"true", L"0", L"abc"};
+    std::vector<scratch_state> values;
+    std::vector<scratch_state> shared;
+    std::vector<std::thread> threads;
+    std::atomic<unsigned int> thread_fails(0);
+    unsigned int fails = 0;
+
+    for (const wchar_t* p_sample : p_samples)
+    {
+        values.push_back(scratch_state(p_sample));
+    }
+    values.push_back(scratch_state(1.0));
+    values.push_back(scratch_state(1000.0));
+    values.push_back(scratch_state(INFINITY));
+    values.push_back(scratch_state(NAN));
+    values.push_back(scratch_state(true));
+    fails += check_equals(values);
+    fails += scratch_state(std::wstring(L"interned text value")).equals(scratch_state(std::wstring(L"interned text") + L" value")) ? 0 : 1;
+    fails += scratch_state(L"   1e3   ").to_number() == 1000.0 ? 0 : 1;
+    fails += scratch_state(L"        ").to_number() == 0.0 ? 0 : 1;
+
+    for (unsigned int i = 0; i < 16; ++i)
+    {
+        shared.push_back(scratch_state(std::to_wstring(i) + L".000000000000")); // long enough to be interned, not parsed yet
+    }
+    for (unsigned int i = 0; i < THREAD_COUNT; ++i)
+    {
+        threads.emplace_back(hammer, i, &shared, &thread_fails);
+    }
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+    fails += thread_fails.load();
+
+    printf("intern-test: %u failures\n", fails);
+    return fails == 0 ? 0 : 1;
+}
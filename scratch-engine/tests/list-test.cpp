@@ -0,0 +1,180 @@
+/*
+File: list-test.cpp
+Description: Runs random edits against scratch_list and a plain vector side by side and checks they always agree
+*/
+
+#include "scratch-vm.hpp"
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace scratch;
+
+namespace
+{
+    unsigned long long g_random = 88172645463325252ULL; // fixed seed, a failure always reproduces
+
+    unsigned long long next_random()
+    {
+        g_random ^= g_random << 13;
+        g_random ^= g_random >> 7;
+        g_random ^= g_random << 17;
+        return g_random;
+    }
+
+    scratch_state make_item(unsigned int string_odds) // 1 in string_odds items is text, 0 keeps the list numeric
+    {
+        if (string_odds != 0 && next_random() % string_odds == 0)
+        {
+            return scratch_state(L"s" + std::to_wstring(next_random() % 10));
+        }
+        return scratch_state((double)(next_random() % 100));
+    }
+
+    int find_reference(const std::vector<scratch_state>& reference, const scratch_state& item)
+    {
+        for (size_t i = 0; i < reference.size(); ++i)
+        {
+            if (reference[i].equals(item))
+            {
+                return i + 1;
+            }
+        }
+        return 0;
+    }
+
+    bool matches(const scratch_list& list, const std::vector<scratch_state>& reference)
+    {
+        if (list.size() != reference.size())
+        {
+            return false;
+        }
+        for (size_t i = 0; i < reference.size(); ++i)
+        {
+            if (list.get(i).get_type() != reference[i].get_type() || list.get(i).to_string() != reference[i].to_string())
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool is_all_numbers(const std::vector<scratch_state>& reference)
+    {
+        for (const scratch_state& item : reference)
+        {
+            if (!item.is_number())
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // one round of random inserts, appends, erases, sets and finds, long enough to split and merge plenty of chunks
+    unsigned int run_round(unsigned int string_odds)
+    {
+        scratch_list list;
+        std::vector<scratch_state> reference;
+        unsigned int fails = 0;
+
+        for (unsigned int step = 0; step < 20000; ++step)
+        {
+            unsigned int operation = next_random() % 100;
+            scratch_state item = make_item(string_odds);
+            size_t index = 0;
+
+            if (operation < 40 || reference.empty())
+            {
+                index = next_random() % (reference.size() + 1);
+                list.insert(index, item);
+                reference.insert(reference.begin() + index, item);
+            }
+            else if (operation < 50)
+            {
+                list.push_back(item);
+                reference.push_back(item);
+            }
+            else if (operation < 85)
+            {
+                index = next_random() % reference.size();
+                list.erase(index);
+                reference.erase(reference.begin() + index);
+            }
+            else if (operation < 95)
+            {
+                index = next_random() % reference.size();
+                list.set(index, item);
+                reference[index] = item;
+            }
+            else if (operation < 99)
+            {
+                fails += list.find(item) != find_reference(reference, item) ? 1 : 0;
+            }
+            else if (next_random() % 20 == 0)
+            {
+                list.clear();
+                reference.clear();
+            }
+
+            // a list only stays numeric while every item is a number, and an emptied list starts over as numeric
+            if (list.size() != reference.size() || (list.is_numeric() && !is_all_numbers(reference)) || (reference.empty() && !list.is_numeric()))
+            {
+                return fails + 1;
+            }
+            if (step % 997 == 0 && !matches(list, reference))
+            {
+                return fails + 1;
+            }
+        }
+        fails += matches(list, reference) ? 0 : 1;
+        return fails;
+    }
+
+    // fills a numeric list over several chunks, turns it generic with one string, then erases it down to nothing from alternating ends
+    unsigned int run_transitions()
+    {
+        scratch_list list;
+        std::vector<scratch_state> reference;
+        unsigned int fails = 0;
+
+        for (unsigned int i = 0; i < LIST_CHUNK_SIZE * 3; ++i)
+        {
+            list.push_back(scratch_state((double)i));
+            reference.push_back(scratch_state((double)i));
+        }
+        fails += list.is_numeric() && matches(list, reference) ? 0 : 1;
+        fails += list.find(scratch_state(L"1000")) == 1001 ? 0 : 1; // numeric lists still compare like Scratch
+        list.set(LIST_CHUNK_SIZE + 1, scratch_state(L"text"));
+        reference[LIST_CHUNK_SIZE + 1] = scratch_state(L"text");
+        fails += !list.is_numeric() && matches(list, reference) ? 0 : 1;
+        fails += list.find(scratch_state(L"TEXT")) == LIST_CHUNK_SIZE + 2 ? 0 : 1;
+        for (size_t i = 0; !reference.empty(); ++i)
+        {
+            size_t index = i % 2 == 0 ? 0 : reference.size() - 1;
+            list.erase(index);
+            reference.erase(reference.begin() + index);
+            if (!matches(list, reference))
+            {
+                return fails + 1;
+            }
+        }
+        fails += list.empty() && list.is_numeric() ? 0 : 1;
+        list.insert(0, scratch_state(5.0));
+        fails += list.is_numeric() && list.size() == 1 && list.get(0).get_number() == 5.0 ? 0 : 1;
+        return fails;
+    }
+}
+
+int main()
+{
+    unsigned int fails = 0;
+
+    for (unsigned int round = 0; round < 40; ++round)
+    {
+        fails += run_round(round % 3 == 0 ? 0 : 50);
+    }
+    fails += run_transitions();
+    printf("list-test: %u failures\n", fails);
+    return fails == 0 ? 0 : 1;
+}
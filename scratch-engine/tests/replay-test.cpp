@@ -0,0 +1,145 @@
+/*
+File: replay-test.cpp
+Description: Records a headless session fed with fractional mouse positions and random key presses, saves and loads the trace,
+             replays it on a fresh engine and checks every variable ends up the same
+*/
+
+#include "scratch-engine.hpp"
+#include "script-builder.hpp"
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace scratch;
+using namespace scratch_tools;
+
+namespace
+{
+    const char* TRACE_PATH = "replay-test.trace";
+    const unsigned int FRAME_COUNT = 300;
+
+    script_node* make_change(const wchar_t* p_variable, script_node* p_value)
+    {
+        script_node* p_node = make_block("data_changevariableby", "VALUE", p_value);
+
+        p_node->add_field("VARIABLE", p_variable);
+        return p_node;
+    }
+
+    // a sprite that sums up where the mouse was every tick and what pick random gave, so a position or a seed that
+    // doesn't come back exactly shows up in the totals
+    scratch_engine* make_engine(vm_target*& p_target)
+    {
+        scratch_engine* p_engine = new scratch_engine("replay-test", engine_mode::headless);
+        vm_target* p_stage = new vm_target(nullptr, nullptr);
+        sprite* p_sprite = new sprite(L"Sprite");
+        script_node* p_key_hat = new script_node("event_whenkeypressed");
+        script_node* p_click_hat = new script_node("event_whenthisspriteclicked");
+        script_node* p_flag_hat = new script_node("event_whenflagclicked");
+        script_node* p_forever = new script_node("control_forever");
+        script_node* p_sum_x = make_change(L"mouse x sum", make_block("sensing_mousex"));
+        script_node* p_sum_y = make_change(L"mouse y sum", make_block("sensing_mousey"));
+        script_node* p_move = make_block("motion_changexby", "DX", make_random(-5, 5));
+        bool compiled = true;
+
+        p_engine->get_scheduler()->add_target(p_stage);
+        p_sprite->add_costume(new costume(L"costume1", GenImageColor(40, 40, COLOR_BLACK), 20, 20, 40, 40));
+        p_sprite->set_costume_number(1);
+        p_engine->add_sprite(p_sprite, nullptr);
+        p_target = new vm_target(p_sprite, p_stage);
+        p_engine->get_scheduler()->add_target(p_target);
+
+        p_key_hat->add_field("KEY_OPTION", L"any");
+        p_key_hat->mp_next = make_change(L"keys", make_random(1, 100));
+        p_click_hat->mp_next = make_change(L"clicks", make_number(1));
+        p_sum_x->mp_next = p_sum_y;
+        p_sum_y->mp_next = p_move;
+        p_forever->add_input("SUBSTACK", p_sum_x);
+        p_flag_hat->mp_next = p_forever;
+        {
+            vm_compiler compiler(p_target);
+            compiled = compiler.add_script(p_key_hat) && compiler.add_script(p_click_hat) && compiler.add_script(p_flag_hat) && compiler.finish();
+        }
+        delete p_key_hat;
+        delete p_click_hat;
+        delete p_flag_hat;
+        if (!compiled)
+        {
+            delete p_engine;
+            return nullptr;
+        }
+        return p_engine;
+    }
+}
+
+int main()
+{
+    vm_target* p_target = nullptr;
+    scratch_engine* p_engine = make_engine(p_target);
+    queued_input_source* p_source = new queued_input_source();
+    std::vector<scratch_state> recorded;
+    unsigned long long recorded_ticks = 0;
+    unsigned long long random = 11;
+    unsigned int fails = 0;
+
+    if (p_engine == nullptr)
+    {
+        printf("replay-test: the scripts didn't compile\n");
+        return 1;
+    }
+    p_engine->set_input_source(p_source);
+    fails += p_engine->start_recording() ? 0 : 1;
+    p_engine->get_scheduler()->green_flag();
+    for (unsigned int frame = 0; frame < FRAME_COUNT; ++frame)
+    {
+        random ^= random << 13;
+        random ^= random >> 7;
+        random ^= random << 17;
+        switch (random % 8)
+        {
+            case 0:
+                p_source->push(input_event{input_event_type::key_down, KEY_A + (int)(random / 8 % 5), 0.0, 0.0});
+                break;
+            case 1:
+                p_source->push(input_event{input_event_type::key_up, KEY_A + (int)(random / 8 % 5), 0.0, 0.0});
+                break;
+            case 2: // positions a window would never report
+                p_source->push(input_event{input_event_type::mouse_move, 0, (double)(random / 8 % 4800) / 10.0 - 240.0, (double)(random / 8 % 3600) / 7.0 - 180.0});
+                break;
+            case 3:
+                p_source->push(input_event{input_event_type::mouse_move, 0, (double)(random / 8 % 480) - 240.0, (double)(random / 8 % 360) - 180.0});
+                break;
+            case 4:
+                p_source->push(input_event{input_event_type::mouse_down, 0, p_target->mp_sprite->get_x() + 0.25, p_target->mp_sprite->get_y()});
+                p_source->push(input_event{input_event_type::mouse_up, 0, p_target->mp_sprite->get_x() + 0.25, p_target->mp_sprite->get_y()});
+                break;
+        }
+        p_engine->next_tick();
+    }
+    fails += p_engine->save_recording(TRACE_PATH) ? 0 : 1;
+    recorded = p_target->m_variables;
+    recorded_ticks = p_engine->get_tick_count();
+    delete p_engine;
+
+    p_engine = make_engine(p_target);
+    fails += p_engine->start_replay(TRACE_PATH) ? 0 : 1;
+    p_engine->get_scheduler()->green_flag();
+    while (p_engine->next_tick() == engine_status::ok)
+    {
+    }
+    fails += p_engine->get_tick_count() == recorded_ticks ? 0 : 1;
+    fails += p_target->m_variables.size() == recorded.size() ? 0 : 1;
+    for (size_t i = 0; i < recorded.size() && i < p_target->m_variables.size(); ++i)
+    {
+        if (p_target->m_variables[i].to_string() != recorded[i].to_string())
+        {
+            printf("replay-test: variable %zu is %ls after the replay, %ls when recorded\n", i, p_target->m_variables[i].to_string().c_str(), recorded[i].to_string().c_str());
+            ++fails;
+        }
+    }
+    delete p_engine;
+    remove(TRACE_PATH);
+
+    printf("replay-test: %u failures\n", fails);
+    return fails == 0 ? 0 : 1;
+}
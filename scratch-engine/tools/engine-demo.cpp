@@ -0,0 +1,104 @@
+/*
+File: engine-demo.cpp
+Description: Small demo program that spins a sprite, also used to measure headless throughput
+*/
+
+#include "scratch-engine.hpp"
+#include "scratch-util.hpp"
+#include "scratch-trace.hpp"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+using namespace scratch;
+
+int main(int argc, char** argv)
+{
+    engine_mode mode = engine_mode::windowed;
+    long headless_ticks = 600;
+    scratch_engine* engine = nullptr;
+    sprite* test_sprite = nullptr;
+    costume* p_costume = nullptr;
+    Image costume_image = {};
+    double direction = 90.0;
+    std::chrono::steady_clock::time_point start_time;
+    double elapsed_seconds = 0.0;
+    long ticks = 0;
+    const char* p_trace_path = nullptr;
+
+    // usage: scratch-engine [--headless [tick count]] [--trace output.json]
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--headless") == 0)
+        {
+            mode = engine_mode::headless;
+            if (i + 1 < argc && isdigit((unsigned char)argv[i + 1][0]))
+            {
+                headless_ticks = std::max(1L, atol(argv[++i]));
+            }
+        }
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+        {
+            p_trace_path = argv[++i];
+        }
+    }
+
+    engine = new scratch_engine("CScratch", mode);
+    test_sprite = new sprite(L"Sprite1");
+    if (engine == nullptr || test_sprite == nullptr)
+    {
+        std::cout << "failed to initialize engine award" << std::endl;
+        return 1;
+    }
+    
+    costume_image = LoadImage("../assets/breadboard.png");
+    std::cout << "loaded assets award" << std::endl;
+    p_costume = new costume(L"Costume1", costume_image, costume_image.width / 2.0, costume_image.height / 2.0, costume_image.width, costume_image.height, engine->get_asset_cache());
+    if (p_costume == nullptr)
+    {
+        std::cout << "failed to initialize costume award" << std::endl;
+        return 1;
+    }
+
+    test_sprite->add_costume(p_costume);
+    test_sprite->set_costume_number(1);
+    test_sprite->set_rotation_mode(rotation_mode::all_around);
+    test_sprite->set_size(10.0);
+    test_sprite->set_direction(90.0);
+    test_sprite->set_x(0.0);
+    test_sprite->set_y(0.0);
+    engine->add_sprite(test_sprite, nullptr);
+    std::cout << "initialized engine award" << std::endl;
+
+    start_time = std::chrono::steady_clock::now();
+    while (engine->next_tick() == engine_status::ok)
+    {
+        direction += 10.0;
+        test_sprite->set_direction(direction);
+        ++ticks;
+        if (mode == engine_mode::headless && ticks >= headless_ticks)
+        {
+            break;
+        }
+    }
+
+    if (mode == engine_mode::headless) // throughput plus a checksum of the final frame so runs can be compared against each other
+    {
+        elapsed_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+        std::cout << "ticks: " << ticks << std::endl;
+        std::cout << "ticks per second: " << ticks / std::max(elapsed_seconds, 1e-9) << std::endl;
+        std::cout << "frame checksum: " << std::hex << scratch_util::fnv1a_64(engine->get_stage_framebuffer(), STAGE_PIXEL_COUNT * sizeof(Color)) << std::dec << std::endl;
+    }
+
+    if (p_trace_path != nullptr && !trace_export_chrome_json(p_trace_path))
+    {
+        std::cout << "failed to write trace (was the engine built with CSCRATCH_ENABLE_TRACING?)" << std::endl;
+    }
+
+    delete engine;
+
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,119 @@
+/*
+File: scratch-aot.cpp
+Description: Transpiles the scripts of a .sb3 project into a C++ file that is compiled and linked against the engine
+*/
+
+#include "scratch-engine.hpp"
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+using namespace scratch;
+
+namespace
+{
+    // the generated program loads the project for its assets and variables, then swaps the bytecode for the native scripts
+    std::string make_main(const std::string& project_path)
+    {
+        std::string escaped;
+
+        for (char character : project_path)
+        {
+            if (character == '"' || character == '\\')
+            {
+                escaped += '\\';
+            }
+            escaped += character;
+        }
+        return "\n#ifndef SCRATCH_AOT_NO_MAIN\n"
+            "#include <cstdio>\n#include <cstdlib>\n#include <cstring>\n\n"
+            "// usage: program [project.sb3] [--headless ticks]\n"
+            "int main(int argc, char** argv)\n"
+            "{\n"
+            "    const char* p_project_path = \"" + escaped + "\";\n"
+            "    unsigned long long ticks = 0;\n"
+            "    bool headless = false;\n"
+            "    scratch_engine* p_engine = nullptr;\n"
+            "    engine_status status = engine_status::ok;\n"
+            "\n"
+            "    for (int i = 1; i < argc; ++i)\n"
+            "    {\n"
+            "        if (strcmp(argv[i], \"--headless\") == 0)\n"
+            "        {\n"
+            "            headless = true;\n"
+            "            ticks = i + 1 < argc ? strtoull(argv[++i], nullptr, 10) : 0;\n"
+            "        }\n"
+            "        else\n"
+            "        {\n"
+            "            p_project_path = argv[i];\n"
+            "        }\n"
+            "    }\n"
+            "\n"
+            "    p_engine = new scratch_engine(\"CScratch\", headless ? engine_mode::headless : engine_mode::windowed);\n"
+            "    if (p_engine->get_status() != engine_status::ok || sb3_loader(p_engine).load(p_project_path) != load_status::ok)\n"
+            "    {\n"
+            "        printf(\"could not load %s\\n\", p_project_path);\n"
+            "        delete p_engine;\n"
+            "        return 1;\n"
+            "    }\n"
+            "    if (!bind_native_scripts(p_engine))\n"
+            "    {\n"
+            "        printf(\"%s changed since it was transpiled, running it interpreted\\n\", p_project_path);\n"
+            "    }\n"
+            "\n"
+            "    p_engine->get_scheduler()->green_flag();\n"
+            "    if (headless)\n"
+            "    {\n"
+            "        status = p_engine->run_ticks(ticks);\n"
+            "    }\n"
+            "    while (!headless && status == engine_status::ok)\n"
+            "    {\n"
+            "        status = p_engine->next_tick();\n"
+            "    }\n"
+            "    delete p_engine;\n"
+            "    return status == engine_status::error ? 1 : 0;\n"
+            "}\n"
+            "#endif\n";
+    }
+}
+
+int main(int argc, char** argv)
+{
+    scratch_engine* p_engine = nullptr;
+    std::string source;
+    FILE* p_file = nullptr;
+    bool ok = false;
+
+    // usage: scratch-aot project.sb3 output.cpp
+    if (argc != 3)
+    {
+        printf("usage: scratch-aot project.sb3 output.cpp\n");
+        return 1;
+    }
+
+    p_engine = new scratch_engine("CScratch", engine_mode::headless);
+    if (p_engine->get_status() != engine_status::ok || sb3_loader(p_engine).load(argv[1], 1) != load_status::ok)
+    {
+        printf("could not load %s\n", argv[1]);
+        delete p_engine;
+        return 1;
+    }
+
+    vm_transpiler transpiler(p_engine->get_scheduler()->get_targets());
+    source = transpiler.transpile("bind_native_scripts") + make_main(argv[1]);
+    printf("%u variables only ever hold numbers\n", transpiler.get_number_variable_count());
+    delete p_engine;
+
+    p_file = fopen(argv[2], "wb");
+    if (p_file != nullptr)
+    {
+        ok = fwrite(source.data(), 1, source.size(), p_file) == source.size();
+        ok = fclose(p_file) == 0 && ok;
+    }
+    if (!ok)
+    {
+        printf("could not write %s\n", argv[2]);
+        return 1;
+    }
+    return 0;
+}
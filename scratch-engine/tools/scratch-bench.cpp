@@ -0,0 +1,421 @@
+/*
+File: scratch-bench.cpp
+Description: Runs fixed benchmark scenarios against the engine library and reports the timings as JSON so runs can be compared across versions
+*/
+
+#include "scratch-engine.hpp"
+#include "scratch-util.hpp"
+#include "script-builder.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace scratch;
+
+namespace
+{
+    struct bench_options
+    {
+        unsigned int samples; // timed samples per scenario, the first untimed one only warms up
+        const char* p_filter; // only scenarios with this in their name
+        const char* p_label; // copied into the output, e.g. the version or commit that was measured
+        const char* p_output_path; // stdout when nullptr
+    };
+
+    struct bench_state // what the running scenario set up, run_scenario deletes the engine afterwards
+    {
+        scratch_engine* p_engine;
+        std::vector<sprite*> sprites; // owned by the engine
+        std::vector<std::wstring> names;
+        unsigned int random;
+        double value;
+    };
+
+    // setup returns false if the scenario can't run here, each call to run is one sample of ops_per_sample operations
+    struct bench_scenario
+    {
+        const char* p_name;
+        unsigned int ops_per_sample;
+        bool (*setup)(bench_state& state);
+        void (*run)(bench_state& state);
+    };
+
+    struct bench_result
+    {
+        const char* p_name;
+        unsigned int ops_per_sample;
+        unsigned int samples;
+        double median_ns; // per operation
+        double p99_ns;
+        double min_ns;
+        double ops_per_second; // from the median
+    };
+
+    // the same sequence on every run and machine, rand() differs between C libraries
+    unsigned int next_random(unsigned int& state)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    double random_range(unsigned int& state, double low, double high)
+    {
+        return low + (high - low) * (next_random(state) & 0xFFFFFF) / (double)0xFFFFFF;
+    }
+
+    sprite* make_sprite(scratch_engine* p_engine, unsigned int index, unsigned int costumes)
+    {
+        sprite* p_sprite = new sprite(L"Sprite" + std::to_wstring(index + 1));
+        unsigned char shade = (unsigned char)((index * 53) & 0xFF);
+
+        for (unsigned int i = 0; i < costumes; ++i)
+        {
+            Image image = GenImageColor(24 + i % 4 * 8, 24, Color{shade, (unsigned char)(i * 29), 128, 255});
+            p_sprite->add_costume(new costume(L"costume" + std::to_wstring(i + 1), image, 12.0, 12.0, 24.0 + i % 4 * 8, 24.0, p_engine->get_asset_cache()));
+        }
+        p_sprite->set_costume_number(1);
+        p_engine->add_sprite(p_sprite, nullptr);
+        return p_sprite;
+    }
+
+    // engine with sprites spread over the stage, nothing else. sprites are freed by the engine
+    scratch_engine* make_engine(unsigned int sprite_count, std::vector<sprite*>& sprites)
+    {
+        scratch_engine* p_engine = new scratch_engine("CScratch", engine_mode::headless);
+        unsigned int random = 0x2545f491;
+
+        if (p_engine->get_status() != engine_status::ok)
+        {
+            delete p_engine;
+            return nullptr;
+        }
+        sprites.clear();
+        for (unsigned int i = 0; i < sprite_count; ++i)
+        {
+            sprite* p_sprite = make_sprite(p_engine, i, 1);
+
+            p_sprite->set_x(random_range(random, -240.0, 240.0));
+            p_sprite->set_y(random_range(random, -180.0, 180.0));
+            p_sprite->set_direction(random_range(random, -180.0, 180.0));
+            sprites.push_back(p_sprite);
+        }
+        p_engine->next_tick(); // the first frame draws everything, later ones only what changed
+        return p_engine;
+    }
+
+    bool setup_single_sprite(bench_state& state)
+    {
+        state.p_engine = make_engine(1, state.sprites);
+        state.value = 0.0;
+        return state.p_engine != nullptr;
+    }
+
+    // values alternate between on stage and far off it so the fencing and size clamping both have work to do
+    void run_set_x_y_size(bench_state& state)
+    {
+        sprite* p_sprite = state.sprites[0];
+
+        for (unsigned int i = 0; i < 10000; ++i)
+        {
+            state.value = state.value > 1000.0 ? -1000.0 : state.value + 7.5;
+            p_sprite->set_x(state.value);
+            p_sprite->set_y(-state.value);
+            p_sprite->set_size(std::fabs(state.value) * 4.0);
+        }
+    }
+
+    bool setup_layer_reorder(bench_state& state)
+    {
+        state.p_engine = make_engine(10000, state.sprites);
+        state.random = 0x9e3779b9;
+        return state.p_engine != nullptr;
+    }
+
+    void run_layer_reorder(bench_state& state)
+    {
+        for (unsigned int i = 0; i < 10000; ++i)
+        {
+            sprite* p_sprite = state.sprites[next_random(state.random) % state.sprites.size()];
+
+            switch (next_random(state.random) % 4)
+            {
+                case 0:
+                    p_sprite->goto_top_layer();
+                    break;
+                case 1:
+                    p_sprite->goto_bottom_layer();
+                    break;
+                default:
+                    p_sprite->change_layer((int)(next_random(state.random) % 201) - 100);
+                    break;
+            }
+        }
+    }
+
+    bool setup_costume_switch(bench_state& state)
+    {
+        state.p_engine = make_engine(0, state.sprites);
+        if (state.p_engine == nullptr)
+        {
+            return false;
+        }
+        state.sprites.push_back(make_sprite(state.p_engine, 0, 64));
+        for (unsigned int i = 0; i < 64; ++i)
+        {
+            state.names.push_back(L"costume" + std::to_wstring(i * 17 % 64 + 1));
+        }
+        return true;
+    }
+
+    void run_costume_switch(bench_state& state)
+    {
+        sprite* p_sprite = state.sprites[0];
+
+        for (unsigned int i = 0; i < 10000; ++i)
+        {
+            p_sprite->set_costume_by_name(state.names[i % state.names.size()]);
+        }
+    }
+
+    bool setup_render_1k(bench_state& state)
+    {
+        state.p_engine = make_engine(1000, state.sprites);
+        return state.p_engine != nullptr;
+    }
+
+    bool setup_render_10k(bench_state& state)
+    {
+        state.p_engine = make_engine(10000, state.sprites);
+        return state.p_engine != nullptr;
+    }
+
+    // a full stage redraw every frame, the damage tracking would otherwise skip the static sprites
+    void run_render(bench_state& state)
+    {
+        state.p_engine->get_stage_damage()->invalidate();
+        state.p_engine->next_tick();
+    }
+
+    bool setup_wanderers(bench_state& state)
+    {
+        scheduler_job* p_scheduler = nullptr;
+        vm_target* p_stage = nullptr;
+        bool ok = false;
+
+        state.p_engine = make_engine(200, state.sprites);
+        if (state.p_engine == nullptr)
+        {
+            return false;
+        }
+        p_scheduler = state.p_engine->get_scheduler();
+        p_scheduler->set_random_seed(1);
+        p_stage = new vm_target(nullptr, nullptr);
+        p_stage->mp_stage = p_stage;
+        p_scheduler->add_target(p_stage);
+        ok = vm_compiler(p_stage).finish();
+        for (sprite* p_sprite : state.sprites)
+        {
+            vm_target* p_target = new vm_target(p_sprite, p_stage);
+
+            p_scheduler->add_target(p_target);
+            ok = ok && scratch_tools::build_wanderer_scripts(p_target, false);
+        }
+        p_scheduler->green_flag();
+        return ok;
+    }
+
+    void run_next_tick(bench_state& state)
+    {
+        state.p_engine->next_tick();
+    }
+
+    const bench_scenario g_scenarios[] =
+    {
+        {"sprite_set_x_y_size", 30000, setup_single_sprite, run_set_x_y_size},
+        {"layer_reorder_10k", 10000, setup_layer_reorder, run_layer_reorder},
+        {"costume_switch_by_name", 10000, setup_costume_switch, run_costume_switch},
+        {"render_1k_sprites", 1, setup_render_1k, run_render},
+        {"render_10k_sprites", 1, setup_render_10k, run_render},
+        {"next_tick_200_wanderers", 1, setup_wanderers, run_next_tick},
+    };
+
+    bool is_value_option(const char* p_option) // every option but --help is followed by its value
+    {
+        const char* p_options[] = {"--samples", "--filter", "--label", "--output"};
+
+        for (const char* p_known : p_options)
+        {
+            if (strcmp(p_option, p_known) == 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    double percentile(const std::vector<double>& sorted, double fraction) // nearest rank
+    {
+        size_t rank = (size_t)std::ceil(fraction * sorted.size());
+
+        return sorted[std::min(std::max(rank, (size_t)1), sorted.size()) - 1];
+    }
+
+    bool run_scenario(const bench_scenario& scenario, unsigned int samples, bench_result& result)
+    {
+        bench_state state = {};
+        std::vector<double> timings;
+        bool ok = scenario.setup(state);
+
+        if (ok)
+        {
+            scenario.run(state); // warming up caches and growing buffers, not timed
+        }
+        for (unsigned int i = 0; i < samples && ok; ++i)
+        {
+            std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+
+            scenario.run(state);
+            timings.push_back(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start_time).count() / scenario.ops_per_sample);
+        }
+        delete state.p_engine;
+        if (!ok)
+        {
+            return false;
+        }
+
+        std::sort(timings.begin(), timings.end());
+        result.p_name = scenario.p_name;
+        result.ops_per_sample = scenario.ops_per_sample;
+        result.samples = samples;
+        result.median_ns = timings.size() % 2 != 0 ? timings[timings.size() / 2] : (timings[timings.size() / 2 - 1] + timings[timings.size() / 2]) / 2.0;
+        result.p99_ns = percentile(timings, 0.99);
+        result.min_ns = timings.front();
+        result.ops_per_second = 1e9 / std::max(result.median_ns, 1e-9);
+        return true;
+    }
+
+    // fixed key order and precision so the output diffs cleanly between runs
+    void write_json(FILE* p_file, const bench_options& options, const std::vector<bench_result>& results)
+    {
+        fprintf(p_file, "{\n");
+        fprintf(p_file, "  \"benchmark\": \"cscratch-bench\",\n");
+        fprintf(p_file, "  \"format\": 1,\n");
+        fprintf(p_file, "  \"label\": \"");
+        for (const char* p_char = options.p_label; *p_char != '\0'; ++p_char)
+        {
+            if (*p_char == '"' || *p_char == '\\')
+            {
+                fputc('\\', p_file);
+            }
+            if ((unsigned char)*p_char >= 0x20)
+            {
+                fputc(*p_char, p_file);
+            }
+        }
+        fprintf(p_file, "\",\n");
+        fprintf(p_file, "  \"samples\": %u,\n", options.samples);
+        fprintf(p_file, "  \"results\": [\n");
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            const bench_result& result = results[i];
+
+            fprintf(p_file, "    {\"name\": \"%s\", \"ops_per_sample\": %u, \"median_ns\": %.1f, \"p99_ns\": %.1f, \"min_ns\": %.1f, \"ops_per_sec\": %.1f}%s\n",
+                result.p_name, result.ops_per_sample, result.median_ns, result.p99_ns, result.min_ns, result.ops_per_second, i + 1 < results.size() ? "," : "");
+        }
+        fprintf(p_file, "  ]\n");
+        fprintf(p_file, "}\n");
+    }
+}
+
+int main(int argc, char** argv)
+{
+    bench_options options = {};
+    std::vector<bench_result> results;
+    FILE* p_file = stdout;
+    bool ok = true;
+
+    options.samples = 101; // enough that the nearest rank p99 isn't just the slowest sample
+    options.p_filter = nullptr;
+    options.p_label = "";
+    options.p_output_path = nullptr;
+
+    // usage: scratch-bench [--samples n] [--filter name] [--label text] [--output results.json]
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* p_option = argv[i];
+
+        if (strcmp(p_option, "--help") == 0 || strcmp(p_option, "-h") == 0)
+        {
+            printf("usage: scratch-bench [--samples n] [--filter name] [--label text] [--output results.json]\n");
+            return 0;
+        }
+        if (!is_value_option(p_option))
+        {
+            fprintf(stderr, "unknown option %s\n", p_option);
+            return 1;
+        }
+        if (++i >= argc)
+        {
+            fprintf(stderr, "missing value for %s\n", p_option);
+            return 1;
+        }
+        if (strcmp(p_option, "--samples") == 0)
+        {
+            options.samples = std::max(1, atoi(argv[i]));
+        }
+        else if (strcmp(p_option, "--filter") == 0)
+        {
+            options.p_filter = argv[i];
+        }
+        else if (strcmp(p_option, "--label") == 0)
+        {
+            options.p_label = argv[i];
+        }
+        else
+        {
+            options.p_output_path = argv[i];
+        }
+    }
+
+    SetTraceLogLevel(LOG_WARNING); // raylib's info lines would end up in the JSON on stdout
+    for (const bench_scenario& scenario : g_scenarios)
+    {
+        bench_result result = {};
+
+        if (options.p_filter != nullptr && strstr(scenario.p_name, options.p_filter) == nullptr)
+        {
+            continue;
+        }
+        fprintf(stderr, "running %s\n", scenario.p_name); // progress goes to stderr so stdout stays valid JSON
+        if (!run_scenario(scenario, options.samples, result))
+        {
+            fprintf(stderr, "failed to set up %s\n", scenario.p_name);
+            ok = false;
+            continue;
+        }
+        results.push_back(result);
+    }
+
+    if (options.p_output_path != nullptr)
+    {
+        p_file = fopen(options.p_output_path, "w");
+        if (p_file == nullptr)
+        {
+            fprintf(stderr, "failed to open %s\n", options.p_output_path);
+            return 1;
+        }
+    }
+    write_json(p_file, options, results);
+    if (p_file != stdout)
+    {
+        fclose(p_file);
+    }
+    return ok ? 0 : 1;
+}
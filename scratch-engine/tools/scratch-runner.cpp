@@ -0,0 +1,224 @@
+/*
+File: scratch-runner.cpp
+Description: Batch runner that simulates many headless engine instances across a thread pool and reports aggregate throughput
+*/
+
+#include "scratch-engine.hpp"
+#include "scratch-util.hpp"
+#include "scratch-trace.hpp"
+#include "script-builder.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace scratch;
+
+namespace
+{
+    struct runner_options
+    {
+        unsigned int instances;
+        unsigned long long ticks;
+        unsigned int threads; // 0 for one per hardware thread
+        unsigned int sprites; // per instance
+        double cell_size; // broad phase grid cell size
+        const char* p_project_path; // .sb3 every instance runs instead of the built in wanderers
+        const char* p_trace_path;
+    };
+
+    struct instance_result // written only by the worker that ran the instance, so no locking is needed
+    {
+        bool ok;
+        unsigned long long ticks;
+        double seconds;
+        sprite_grid_stats grid;
+        sb3_load_stats load;
+    };
+
+    bool is_value_option(const char* p_option) // every option but --help is followed by its value
+    {
+        const char* p_options[] = {"--instances", "--ticks", "--threads", "--sprites", "--cell-size", "--project", "--trace"};
+
+        for (const char* p_known : p_options)
+        {
+            if (strcmp(p_option, p_known) == 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // everything an instance touches is created and destroyed inside this call
+    void run_instance(const runner_options& options, unsigned int index, instance_result& result)
+    {
+        SCRATCH_TRACE_SCOPE("run_instance");
+        std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+        scratch_engine* p_engine = new scratch_engine("CScratch", engine_mode::headless);
+        vm_target* p_stage = nullptr;
+        scheduler_job* p_scheduler = p_engine->get_scheduler();
+        bool ok = p_engine->get_status() == engine_status::ok;
+
+        p_engine->get_sprite_grid()->set_cell_size(options.cell_size);
+        if (options.p_project_path != nullptr && ok)
+        {
+            sb3_loader loader(p_engine);
+            ok = loader.load(options.p_project_path, 1) == load_status::ok; // instances already run in parallel, so each one decodes on its own thread
+            result.load = loader.get_stats();
+        }
+        else if (ok)
+        {
+            p_stage = new vm_target(nullptr, nullptr);
+            p_stage->mp_stage = p_stage;
+            p_scheduler->add_target(p_stage);
+            ok = vm_compiler(p_stage).finish();
+        }
+
+        for (unsigned int i = 0; i < options.sprites && ok && p_stage != nullptr; ++i)
+        {
+            sprite* p_sprite = new sprite(L"Sprite" + std::to_wstring(i + 1));
+            unsigned char shade = (unsigned char)((index * 37 + i * 53) & 0xFF);
+            Image image = GenImageColor(24, 24, Color{shade, (unsigned char)(255 - shade), 128, 255});
+            costume* p_costume = new costume(L"costume1", image, 12.0, 12.0, 24.0, 24.0, p_engine->get_asset_cache());
+            vm_target* p_target = nullptr;
+
+            p_sprite->add_costume(p_costume);
+            p_sprite->set_costume_number(1);
+            p_engine->add_sprite(p_sprite, nullptr);
+            p_target = new vm_target(p_sprite, p_stage);
+            p_scheduler->add_target(p_target);
+            ok = scratch_tools::build_wanderer_scripts(p_target, true);
+        }
+
+        if (ok)
+        {
+            p_scheduler->green_flag();
+            p_engine->run_ticks(options.ticks);
+            ok = p_engine->next_tick() == engine_status::ok; // presenting the final state once, like a real run would
+        }
+
+        result.ok = ok;
+        result.ticks = p_engine->get_tick_count();
+        result.grid = p_engine->get_sprite_grid()->get_stats();
+        delete p_engine;
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    }
+}
+
+int main(int argc, char** argv)
+{
+    runner_options options = {};
+    std::vector<instance_result> results;
+    scratch_util::thread_pool* p_pool = nullptr;
+    std::chrono::steady_clock::time_point start_time;
+    double elapsed_seconds = 0.0;
+    double instance_seconds = 0.0;
+    unsigned long long total_ticks = 0;
+    unsigned int failures = 0;
+
+    options.instances = 64;
+    options.ticks = 1800; // one minute of project time at 30 ticks per second
+    options.threads = 0;
+    options.sprites = 8;
+    options.cell_size = SPRITE_GRID_DEFAULT_CELL_SIZE;
+    options.p_project_path = nullptr;
+    options.p_trace_path = nullptr;
+
+    // usage: scratch-runner [--instances n] [--ticks n] [--threads n] [--sprites n] [--cell-size n] [--project file.sb3] [--trace output.json]
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* p_option = argv[i];
+
+        if (strcmp(p_option, "--help") == 0 || strcmp(p_option, "-h") == 0)
+        {
+            printf("usage: scratch-runner [--instances n] [--ticks n] [--threads n] [--sprites n] [--cell-size n] [--project file.sb3] [--trace output.json]\n");
+            return 0;
+        }
+        if (!is_value_option(p_option))
+        {
+            printf("unknown option %s\n", p_option);
+            return 1;
+        }
+        if (++i >= argc)
+        {
+            printf("missing value for %s\n", p_option);
+            return 1;
+        }
+        if (strcmp(p_option, "--instances") == 0)
+        {
+            options.instances = std::max(1, atoi(argv[i]));
+        }
+        else if (strcmp(p_option, "--ticks") == 0)
+        {
+            options.ticks = strtoull(argv[i], nullptr, 10);
+        }
+        else if (strcmp(p_option, "--threads") == 0)
+        {
+            options.threads = std::max(0, atoi(argv[i]));
+        }
+        else if (strcmp(p_option, "--sprites") == 0)
+        {
+            options.sprites = std::max(0, atoi(argv[i]));
+        }
+        else if (strcmp(p_option, "--cell-size") == 0)
+        {
+            options.cell_size = atof(argv[i]);
+        }
+        else if (strcmp(p_option, "--project") == 0)
+        {
+            options.p_project_path = argv[i];
+        }
+        else
+        {
+            options.p_trace_path = argv[i];
+        }
+    }
+
+    results.resize(options.instances);
+    p_pool = new scratch_util::thread_pool(options.threads);
+    start_time = std::chrono::steady_clock::now();
+    for (unsigned int i = 0; i < options.instances; ++i)
+    {
+        p_pool->submit([&options, &results, i] { run_instance(options, i, results[i]); });
+    }
+    p_pool->wait();
+    elapsed_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+    for (instance_result& result : results)
+    {
+        total_ticks += result.ticks;
+        instance_seconds += result.seconds;
+        failures += result.ok ? 0 : 1;
+    }
+    printf("instances: %u (%u failed)\n", options.instances, failures);
+    printf("threads: %u\n", p_pool->get_thread_count());
+    printf("ticks: %llu\n", total_ticks);
+    printf("wall time: %.3f s\n", elapsed_seconds);
+    printf("mean instance time: %.3f s\n", instance_seconds / options.instances);
+    printf("aggregate ticks per second: %.1f\n", total_ticks / std::max(elapsed_seconds, 1e-9));
+    if (!results.empty()) // the first instance stands in for the rest since they all run the same project
+    {
+        sprite_grid_stats& grid = results[0].grid;
+        sb3_load_stats& load = results[0].load;
+
+        if (options.p_project_path != nullptr)
+        {
+            printf("project: %u targets, %u costumes from %u images (%u placeholders), %u scripts\n", load.targets, load.costumes, load.images, load.placeholder_images, load.scripts);
+            printf("project load: %.3f s (parse %.3f s, decode %.3f s)\n", load.total_seconds, load.parse_seconds, load.decode_seconds);
+        }
+        printf("grid: %ux%u cells of %.1f, %u occupied, %.2f sprites per occupied cell (max %u), %.2f cells per sprite\n", grid.columns, grid.rows, grid.cell_size,
+            grid.occupied_cells, grid.mean_cell_occupancy, grid.max_cell_occupancy, grid.sprite_count > 0 ? (double)grid.cell_entries / grid.sprite_count : 0.0);
+        printf("grid: %llu updates, %llu relinks\n", grid.updates, grid.relinks);
+    }
+    delete p_pool;
+
+    if (options.p_trace_path != nullptr && !trace_export_chrome_json(options.p_trace_path))
+    {
+        printf("failed to write trace (was the engine built with CSCRATCH_ENABLE_TRACING?)\n");
+    }
+    return failures == 0 ? 0 : 1;
+}
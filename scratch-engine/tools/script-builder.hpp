@@ -0,0 +1,68 @@
+/*
+File: script-builder.hpp
+Description: Helpers the tools and tests build small scripts with when there is no .sb3 to load
+*/
+
+#pragma once
+
+#include "scratch-vm.hpp"
+
+namespace scratch_tools
+{
+    inline scratch::script_node* make_number(double value)
+    {
+        return scratch::script_node::make_literal(scratch::scratch_state(value));
+    }
+
+    inline scratch::script_node* make_block(const char* p_opcode, const char* p_input_a = nullptr, scratch::script_node* p_value_a = nullptr, const char* p_input_b = nullptr,
+        scratch::script_node* p_value_b = nullptr)
+    {
+        scratch::script_node* p_block = new scratch::script_node(p_opcode);
+
+        if (p_input_a != nullptr)
+        {
+            p_block->add_input(p_input_a, p_value_a);
+        }
+        if (p_input_b != nullptr)
+        {
+            p_block->add_input(p_input_b, p_value_b);
+        }
+        return p_block;
+    }
+
+    inline scratch::script_node* make_random(double from, double to)
+    {
+        return make_block("operator_random", "FROM", make_number(from), "TO", make_number(to));
+    }
+
+    // when flag clicked, forever turn a random amount and move, the fencing keeps the sprite on the stage. scattered sprites
+    // first go to a random spot and count their steps in the variable steps
+    inline bool build_wanderer_scripts(scratch::vm_target* p_target, bool scattered)
+    {
+        scratch::vm_compiler compiler(p_target);
+        scratch::script_node* p_hat = new scratch::script_node("event_whenflagclicked");
+        scratch::script_node* p_forever = new scratch::script_node("control_forever");
+        scratch::script_node* p_turn = make_block("motion_turnright", "DEGREES", make_random(-15.0, 15.0));
+        scratch::script_node* p_move = make_block("motion_movesteps", "STEPS", make_number(4.0));
+        scratch::script_node* p_goto = nullptr;
+        scratch::script_node* p_count = nullptr;
+        bool compiled = false;
+
+        p_turn->mp_next = p_move;
+        p_forever->add_input("SUBSTACK", p_turn);
+        p_hat->mp_next = p_forever;
+        if (scattered)
+        {
+            p_goto = make_block("motion_gotoxy", "X", make_random(-200.0, 200.0), "Y", make_random(-150.0, 150.0));
+            p_count = make_block("data_changevariableby", "VALUE", make_number(1.0));
+            p_count->add_field("VARIABLE", L"steps");
+            p_move->mp_next = p_count;
+            p_goto->mp_next = p_forever;
+            p_hat->mp_next = p_goto;
+        }
+
+        compiled = compiler.add_script(p_hat) && compiler.finish();
+        delete p_hat; // the compiler keeps nothing but the bytecode
+        return compiled;
+    }
+}